@@ -0,0 +1,471 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Measures the generated TL codec over a corpus of decrypted server payloads:
+// skip_type_any, fetch_ds_type_any and free_ds_type_any throughput, the heap
+// allocations per payload and the peak RSS of the process.
+//
+// A corpus directory holds one payload per file, named <type>.bin or
+// <type>-<label>.bin, e.g. messages.messages-gzip.bin. A payload may be a
+// gzip_packed object, in which case it is inflated once before decoding.
+// Without --corpus a synthetic corpus is used; --write dumps it so that it
+// can be replaced file by file with recorded traffic.
+
+#include "auto/auto.h"
+#include "auto/auto_fetch_ds.h"
+#include "auto/auto_free_ds.h"
+#include "auto/auto_skip.h"
+#include "auto/auto_types.h"
+#include "auto/constants.h"
+#include "ds_arena.h"
+#include "inflate_arena.h"
+#include "mtproto_common.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+#include <zlib.h>
+
+using namespace tgl::impl;
+
+namespace {
+
+struct corpus_entry {
+    std::string name;
+    paramed_type type;
+    std::vector<int32_t> payload;
+};
+
+struct corpus_type {
+    const char* name;
+    paramed_type type;
+};
+
+const corpus_type corpus_types[] = {
+    { "contacts.contacts", TYPE_TO_PARAM(contacts_contacts) },
+    { "messages.dialogs", TYPE_TO_PARAM(messages_dialogs) },
+    { "messages.messages", TYPE_TO_PARAM(messages_messages) },
+    { "updates.difference", TYPE_TO_PARAM(updates_difference) },
+    { "upload.file", TYPE_TO_PARAM(upload_file) },
+};
+
+std::vector<int32_t> to_payload(const mtprotocol_serializer& s)
+{
+    return std::vector<int32_t>(s.i32_data(), s.i32_data() + s.i32_size());
+}
+
+void out_message(mtprotocol_serializer& s, int i)
+{
+    bool with_entities = i % 4 == 0;
+    s.out_i32(CODE_message);
+    s.out_i32((1 << 8) | (with_entities ? 1 << 7 : 0));
+    s.out_i32(100000 + i);
+    s.out_i32(1000 + i % 50);
+    s.out_i32(CODE_peer_user);
+    s.out_i32(2000);
+    s.out_i32(1480000000 + i);
+    s.out_std_string("message text number " + std::to_string(i) + ", long enough to look like a real chat line");
+    if (with_entities) {
+        s.out_i32(CODE_vector);
+        s.out_i32(2);
+        for (int j = 0; j < 2; ++j) {
+            s.out_i32(CODE_message_entity_bold);
+            s.out_i32(j * 8);
+            s.out_i32(4);
+        }
+    }
+}
+
+void out_messages(mtprotocol_serializer& s, int count)
+{
+    s.out_i32(CODE_vector);
+    s.out_i32(count);
+    for (int i = 0; i < count; ++i) {
+        out_message(s, i);
+    }
+}
+
+void out_users(mtprotocol_serializer& s, int count)
+{
+    s.out_i32(CODE_vector);
+    s.out_i32(count);
+    for (int i = 0; i < count; ++i) {
+        s.out_i32(CODE_user);
+        s.out_i32((1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 6));
+        s.out_i32(1000 + i);
+        s.out_i64(0x1234567890LL + i);
+        s.out_std_string("First" + std::to_string(i));
+        s.out_std_string("Last" + std::to_string(i));
+        s.out_std_string("user" + std::to_string(i));
+        s.out_i32(CODE_user_status_online);
+        s.out_i32(1480000000 + i);
+    }
+}
+
+void out_chats(mtprotocol_serializer& s, int count)
+{
+    s.out_i32(CODE_vector);
+    s.out_i32(count);
+    for (int i = 0; i < count; ++i) {
+        s.out_i32(CODE_chat);
+        s.out_i32(0);
+        s.out_i32(3000 + i);
+        s.out_std_string("Group chat " + std::to_string(i));
+        s.out_i32(CODE_chat_photo_empty);
+        s.out_i32(10 + i);
+        s.out_i32(1470000000 + i);
+        s.out_i32(1);
+    }
+}
+
+std::vector<int32_t> build_messages_messages(int messages, int chats, int users)
+{
+    mtprotocol_serializer s;
+    s.out_i32(CODE_messages_messages);
+    out_messages(s, messages);
+    out_chats(s, chats);
+    out_users(s, users);
+    return to_payload(s);
+}
+
+std::vector<int32_t> build_messages_dialogs(int dialogs)
+{
+    mtprotocol_serializer s;
+    s.out_i32(CODE_messages_dialogs);
+    s.out_i32(CODE_vector);
+    s.out_i32(dialogs);
+    for (int i = 0; i < dialogs; ++i) {
+        s.out_i32(CODE_dialog);
+        if (i % 3) {
+            s.out_i32(CODE_peer_user);
+            s.out_i32(1000 + i);
+        } else {
+            s.out_i32(CODE_peer_chat);
+            s.out_i32(3000 + i);
+        }
+        s.out_i32(100000 + i);
+        s.out_i32(100000 + i - 1);
+        s.out_i32(i % 5);
+        s.out_i32(CODE_peer_notify_settings);
+        s.out_i32(0);
+        s.out_std_string("default");
+        s.out_i32(CODE_bool_true);
+        s.out_i32(0);
+    }
+    out_messages(s, dialogs);
+    out_chats(s, dialogs / 3 + 1);
+    out_users(s, dialogs);
+    return to_payload(s);
+}
+
+std::vector<int32_t> build_updates_difference(int messages, int updates, int users)
+{
+    mtprotocol_serializer s;
+    s.out_i32(CODE_updates_difference);
+    out_messages(s, messages);
+    s.out_i32(CODE_vector);
+    s.out_i32(0);
+    s.out_i32(CODE_vector);
+    s.out_i32(updates);
+    for (int i = 0; i < updates; ++i) {
+        if (i % 2) {
+            s.out_i32(CODE_update_user_status);
+            s.out_i32(1000 + i % users);
+            s.out_i32(CODE_user_status_online);
+            s.out_i32(1480000000 + i);
+        } else {
+            s.out_i32(CODE_update_read_history_inbox);
+            s.out_i32(CODE_peer_user);
+            s.out_i32(1000 + i % users);
+            s.out_i32(100000 + i);
+            s.out_i32(5000 + i);
+            s.out_i32(1);
+        }
+    }
+    out_chats(s, 5);
+    out_users(s, users);
+    s.out_i32(CODE_updates_state);
+    s.out_i32(5000 + updates);
+    s.out_i32(0);
+    s.out_i32(1480000000);
+    s.out_i32(1);
+    s.out_i32(0);
+    return to_payload(s);
+}
+
+std::vector<int32_t> build_contacts_contacts(int contacts)
+{
+    mtprotocol_serializer s;
+    s.out_i32(CODE_contacts_contacts);
+    s.out_i32(CODE_vector);
+    s.out_i32(contacts);
+    for (int i = 0; i < contacts; ++i) {
+        s.out_i32(CODE_contact);
+        s.out_i32(1000 + i);
+        s.out_i32(CODE_bool_true);
+    }
+    out_users(s, contacts);
+    return to_payload(s);
+}
+
+std::vector<int32_t> build_upload_file(size_t size)
+{
+    std::string bytes(size, '\0');
+    for (size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<char>(i * 2654435761u >> 24);
+    }
+    mtprotocol_serializer s;
+    s.out_i32(CODE_upload_file);
+    s.out_i32(CODE_storage_file_jpeg);
+    s.out_i32(1480000000);
+    s.out_std_string(bytes);
+    return to_payload(s);
+}
+
+std::vector<int32_t> gzip_pack(const std::vector<int32_t>& payload)
+{
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "deflateInit2 failed\n");
+        exit(1);
+    }
+    std::string packed(deflateBound(&z, payload.size() * 4), '\0');
+    z.next_in = reinterpret_cast<Bytef*>(const_cast<int32_t*>(payload.data()));
+    z.avail_in = payload.size() * 4;
+    z.next_out = reinterpret_cast<Bytef*>(&packed[0]);
+    z.avail_out = packed.size();
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "deflate failed\n");
+        exit(1);
+    }
+    packed.resize(z.total_out);
+    deflateEnd(&z);
+
+    mtprotocol_serializer s;
+    s.out_i32(CODE_gzip_packed);
+    s.out_std_string(packed);
+    return to_payload(s);
+}
+
+std::vector<corpus_entry> synthetic_corpus()
+{
+    std::vector<corpus_entry> corpus;
+    corpus.push_back({ "contacts.contacts", TYPE_TO_PARAM(contacts_contacts), build_contacts_contacts(500) });
+    corpus.push_back({ "messages.dialogs", TYPE_TO_PARAM(messages_dialogs), build_messages_dialogs(100) });
+    corpus.push_back({ "messages.messages", TYPE_TO_PARAM(messages_messages), build_messages_messages(100, 5, 50) });
+    corpus.push_back({ "messages.messages-gzip", TYPE_TO_PARAM(messages_messages),
+            gzip_pack(build_messages_messages(100, 5, 50)) });
+    corpus.push_back({ "updates.difference", TYPE_TO_PARAM(updates_difference), build_updates_difference(200, 100, 50) });
+    corpus.push_back({ "updates.difference-gzip", TYPE_TO_PARAM(updates_difference),
+            gzip_pack(build_updates_difference(200, 100, 50)) });
+    corpus.push_back({ "upload.file", TYPE_TO_PARAM(upload_file), build_upload_file(128 * 1024) });
+    return corpus;
+}
+
+bool load_corpus(const std::string& dir, std::vector<corpus_entry>& corpus)
+{
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        fprintf(stderr, "can not open %s\n", dir.c_str());
+        return false;
+    }
+    while (struct dirent* e = readdir(d)) {
+        std::string file = e->d_name;
+        if (file.size() < 4 || file.compare(file.size() - 4, 4, ".bin")) {
+            continue;
+        }
+        std::string name = file.substr(0, file.size() - 4);
+        std::string type_name = name.substr(0, name.find('-'));
+        const corpus_type* type = nullptr;
+        for (const auto& t : corpus_types) {
+            if (type_name == t.name) {
+                type = &t;
+            }
+        }
+        if (!type) {
+            fprintf(stderr, "skipping %s: unknown type %s\n", file.c_str(), type_name.c_str());
+            continue;
+        }
+        std::ifstream f(dir + "/" + file, std::ios::binary | std::ios::ate);
+        std::streamsize size = f.tellg();
+        if (size <= 0 || size % 4) {
+            fprintf(stderr, "skipping %s: bad size %ld\n", file.c_str(), static_cast<long>(size));
+            continue;
+        }
+        corpus_entry entry = { name, type->type, std::vector<int32_t>(size / 4) };
+        f.seekg(0);
+        f.read(reinterpret_cast<char*>(entry.payload.data()), size);
+        corpus.push_back(std::move(entry));
+    }
+    closedir(d);
+    return true;
+}
+
+bool write_corpus(const std::string& dir, const std::vector<corpus_entry>& corpus)
+{
+    for (const auto& entry : corpus) {
+        std::ofstream f(dir + "/" + entry.name + ".bin", std::ios::binary | std::ios::trunc);
+        f.write(reinterpret_cast<const char*>(entry.payload.data()), entry.payload.size() * 4);
+        if (!f) {
+            fprintf(stderr, "can not write %s/%s.bin\n", dir.c_str(), entry.name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Decoded structures are freed in batches so that the clock is read once per
+// batch rather than once per payload.
+constexpr int BATCH_SIZE = 32;
+
+void run(const corpus_entry& entry, int iterations, inflate_arena& inflater)
+{
+    const int32_t* data = entry.payload.data();
+    tgl_in_buffer in = { data, data + entry.payload.size() };
+
+    inflate_arena::lease packed_buffer(inflater);
+    double inflate_ns = 0;
+    if (entry.payload.size() > 1 && entry.payload[0] == CODE_gzip_packed) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            inflate_arena::lease lease(inflater);
+            tgl_in_buffer packed = { data + 1, in.end };
+            int l = prefetch_strlen(&packed);
+            tgl_in_buffer inflated;
+            if (l < 0 || !lease.inflate(fetch_str(&packed, l), l, &inflated)) {
+                fprintf(stderr, "%s: inflate failed\n", entry.name.c_str());
+                exit(1);
+            }
+        }
+        inflate_ns = elapsed_ns(start) / iterations;
+
+        tgl_in_buffer packed = { data + 1, in.end };
+        int l = prefetch_strlen(&packed);
+        packed_buffer.inflate(fetch_str(&packed, l), l, &in);
+    }
+    size_t bytes = 4 * (in.end - in.ptr);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        tgl_in_buffer skip_in = in;
+        if (skip_type_any(&skip_in, &entry.type) < 0 || skip_in.ptr != skip_in.end) {
+            fprintf(stderr, "%s: skip failed\n", entry.name.c_str());
+            exit(1);
+        }
+    }
+    double skip_ns = elapsed_ns(start) / iterations;
+
+    double fetch_ns = 0;
+    double free_ns = 0;
+    ds_arena::stats() = ds_alloc_stats();
+    void* results[BATCH_SIZE];
+    for (int done = 0; done < iterations; done += BATCH_SIZE) {
+        int batch = std::min(BATCH_SIZE, iterations - done);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batch; ++i) {
+            tgl_in_buffer fetch_in = in;
+            results[i] = fetch_ds_type_any(&fetch_in, &entry.type);
+            if (!results[i] || fetch_in.ptr != fetch_in.end) {
+                fprintf(stderr, "%s: fetch failed\n", entry.name.c_str());
+                exit(1);
+            }
+        }
+        fetch_ns += elapsed_ns(start);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < batch; ++i) {
+            free_ds_type_any(results[i], &entry.type);
+        }
+        free_ns += elapsed_ns(start);
+    }
+    fetch_ns /= iterations;
+    free_ns /= iterations;
+    double allocations = static_cast<double>(ds_arena::stats().heap_allocations) / iterations;
+
+    double mb = bytes / 1e6;
+    printf("%-24s %8zu %9.0f %9.0f %8.1f %9.0f %8.1f %9.0f %9.1f\n",
+            entry.name.c_str(), bytes, inflate_ns,
+            skip_ns, mb / (skip_ns / 1e9), fetch_ns, mb / (fetch_ns / 1e9), free_ns, allocations);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::string corpus_dir;
+    std::string write_dir;
+    int iterations = 1000;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--corpus") && i + 1 < argc) {
+            corpus_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--write") && i + 1 < argc) {
+            write_dir = argv[++i];
+        } else if (atoi(argv[i]) > 0) {
+            iterations = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "usage: %s [--corpus dir] [--write dir] [iterations]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<corpus_entry> corpus;
+    if (corpus_dir.empty()) {
+        corpus = synthetic_corpus();
+    } else if (!load_corpus(corpus_dir, corpus)) {
+        return 1;
+    }
+    if (corpus.empty()) {
+        fprintf(stderr, "the corpus is empty\n");
+        return 1;
+    }
+    if (!write_dir.empty()) {
+        return write_corpus(write_dir, corpus) ? 0 : 1;
+    }
+
+    long base_rss = peak_rss_kb();
+    inflate_arena inflater;
+    printf("%-24s %8s %9s %9s %8s %9s %8s %9s %9s\n", "payload", "bytes", "inflate",
+            "skip", "MB/s", "fetch", "MB/s", "free", "allocs");
+    for (const auto& entry : corpus) {
+        run(entry, iterations, inflater);
+    }
+    printf("times in ns/payload, allocs in heap allocations/payload\n");
+    printf("peak RSS: %ld kB (%ld kB before decoding)\n", peak_rss_kb(), base_rss);
+    return 0;
+}
@@ -0,0 +1,129 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Decodes a synthetic messages.messages response with the generated fetch_ds
+// code, once with every structure on the heap and once from the ds_arena, and
+// reports the allocations per response and the decode time.
+
+#include "auto/auto.h"
+#include "auto/auto_fetch_ds.h"
+#include "auto/auto_free_ds.h"
+#include "auto/auto_types.h"
+#include "auto/constants.h"
+#include "ds_arena.h"
+#include "mtproto_common.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace tgl::impl;
+
+static void build_response(mtprotocol_serializer& s, int messages, int users)
+{
+    s.out_i32(CODE_messages_messages);
+
+    s.out_i32(CODE_vector);
+    s.out_i32(messages);
+    for (int i = 0; i < messages; ++i) {
+        s.out_i32(CODE_message);
+        s.out_i32(1 << 8);
+        s.out_i32(100000 + i);
+        s.out_i32(1000 + i % users);
+        s.out_i32(CODE_peer_user);
+        s.out_i32(2000);
+        s.out_i32(1480000000 + i);
+        s.out_std_string("message text number " + std::to_string(i));
+    }
+
+    s.out_i32(CODE_vector);
+    s.out_i32(0);
+
+    s.out_i32(CODE_vector);
+    s.out_i32(users);
+    for (int i = 0; i < users; ++i) {
+        s.out_i32(CODE_user);
+        s.out_i32((1 << 0) | (1 << 1) | (1 << 2) | (1 << 3));
+        s.out_i32(1000 + i);
+        s.out_i64(0x1234567890LL + i);
+        s.out_std_string("First" + std::to_string(i));
+        s.out_std_string("Last" + std::to_string(i));
+        s.out_std_string("user" + std::to_string(i));
+    }
+}
+
+static void decode_once(const mtprotocol_serializer& s)
+{
+    paramed_type type = TYPE_TO_PARAM(messages_messages);
+    tgl_in_buffer in = { s.i32_data(), s.i32_data() + s.i32_size() };
+    tl_ds_messages_messages* DS_MM = fetch_ds_type_messages_messages(&in, &type);
+    if (!DS_MM || in.ptr != in.end) {
+        fprintf(stderr, "decode failed\n");
+        exit(1);
+    }
+    free_ds_type_messages_messages(DS_MM, &type);
+}
+
+static void run(const char* name, const mtprotocol_serializer& s, int iterations, bool use_arena)
+{
+    ds_arena::stats() = ds_alloc_stats();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        if (use_arena) {
+            ds_arena::scope ds_scope;
+            ds_arena::fetch_scope fetch;
+            decode_once(s);
+        } else {
+            decode_once(s);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    const ds_alloc_stats& stats = ds_arena::stats();
+    printf("%-6s %10.0f ns/response %8.1f heap allocations/response %8.1f arena allocations/response\n",
+            name, static_cast<double>(elapsed) / iterations,
+            static_cast<double>(stats.heap_allocations) / iterations,
+            static_cast<double>(stats.arena_allocations) / iterations);
+}
+
+int main(int argc, char** argv)
+{
+    int messages = argc > 1 ? atoi(argv[1]) : 100;
+    int users = argc > 2 ? atoi(argv[2]) : 20;
+    int iterations = argc > 3 ? atoi(argv[3]) : 2000;
+    if (messages < 0 || users <= 0 || iterations <= 0) {
+        fprintf(stderr, "usage: %s [messages] [users] [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    mtprotocol_serializer s;
+    build_response(s, messages, users);
+    printf("response: %d messages, %d users, %zu bytes\n", messages, users, s.char_size());
+
+    // Warm up both paths so that the arena blocks are already reserved.
+    run("warmup", s, iterations / 10 + 1, false);
+    run("warmup", s, iterations / 10 + 1, true);
+
+    run("heap", s, iterations, false);
+    run("arena", s, iterations, true);
+    printf("arena reserved: %zu bytes\n", ds_arena::current().reserved());
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Measures the CPU work of a handshake on the client side: factorizing the pq
+// of res_pq, with the previous Pollard rho loop and with bn_factorize, and
+// checking the 2048-bit DH prime, with the full primality tests and with the
+// prime already in the validated set of the user agent.
+
+#include "crypto/crypto_bn.h"
+#include "crypto/crypto_sha.h"
+#include "mtproto_utils.h"
+#include "updater.h"
+#include "user_agent.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace tgl::impl;
+
+namespace {
+
+// The prime the servers send in server_DH_inner_data, with g = 3.
+const char* const DH_PRIME_HEX =
+    "C71CAEB9C6B1C9048E6C522F70F13F73980D40238E3E21C14934D037563D930F"
+    "48198A0AA7C14058229493D22530F4DBFA336F6E0AC925139543AED44CCE7C37"
+    "20FD51F69458705AC68CD4FE6B6B13ABDC9746512969328454F18FAF8C595F64"
+    "2477FE96BB2A941D5BCD1D4AC8CC49880708FA9B378E3C4F3A9060BEE67CF9A4"
+    "A4A695811051907E162753B56B0F6B410DBA74D8A84B2A14B3144E0EF1284754"
+    "FD17ED950D5965B4B9DD46582DB1178D169C6BC465B0D6FF9CA3928FEF5B9AE4"
+    "E418FC15E83EBEA0F87FA9FF5EED70050DED2849F47BF959D956850CE929851F"
+    "0D8115F635B105EE2E4E15D04B2454BF6F4FADF034B10403119CD8E3B92FCC5B";
+
+unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+    return b ? gcd(b, a % b) : a;
+}
+
+// The factorization bn_factorize used before: Pollard rho with Floyd style
+// restarts and a shift-and-add modular multiplication.
+unsigned long long legacy_factorize(unsigned long long what, std::mt19937_64& rng)
+{
+    unsigned long long g = 0;
+    int it = 0;
+    for (int i = 0; i < 3 || it < 1000; i++) {
+        int q = ((rng() & 15) + 17) % what;
+        unsigned long long x = rng() % (what - 1) + 1, y = x;
+        int lim = 1 << (i + 18);
+        for (int j = 1; j < lim; j++) {
+            ++it;
+            unsigned long long a = x, b = x, c = q;
+            while (b) {
+                if (b & 1) {
+                    c += a;
+                    if (c >= what) {
+                        c -= what;
+                    }
+                }
+                a += a;
+                if (a >= what) {
+                    a -= what;
+                }
+                b >>= 1;
+            }
+            x = c;
+            unsigned long long z = x < y ? what + x - y : x - y;
+            g = gcd(z, what);
+            if (g != 1) {
+                break;
+            }
+            if (!(j & (j - 1))) {
+                y = x;
+            }
+        }
+        if (g > 1 && g < what) {
+            break;
+        }
+    }
+    return g;
+}
+
+bool is_prime(unsigned long long n)
+{
+    for (unsigned long long d = 2; d * d <= n; ++d) {
+        if (n % d == 0) {
+            return false;
+        }
+    }
+    return n > 1;
+}
+
+unsigned long long random_prime(std::mt19937_64& rng)
+{
+    while (true) {
+        unsigned long long n = ((1ULL << 30) + rng() % (1ULL << 30)) | 1;
+        if (is_prime(n)) {
+            return n;
+        }
+    }
+}
+
+template<typename Fn>
+double time_us(int iterations, Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn(i);
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [handshakes]\n", argv[0]);
+        return 2;
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<unsigned long long> pqs;
+    for (int i = 0; i < count; ++i) {
+        pqs.push_back(random_prime(rng) * random_prime(rng));
+    }
+
+    unsigned long long check = 0;
+    double legacy_us = time_us(count, [&](int i) {
+        check += legacy_factorize(pqs[i], rng);
+    });
+
+    std::unique_ptr<TGLC_bn, TGLC_bn_deleter> pq(TGLC_bn_new());
+    std::unique_ptr<TGLC_bn, TGLC_bn_deleter> p(TGLC_bn_new());
+    std::unique_ptr<TGLC_bn, TGLC_bn_deleter> q(TGLC_bn_new());
+    double brent_us = time_us(count, [&](int i) {
+        TGLC_bn_set_word(pq.get(), pqs[i]);
+        if (bn_factorize(pq.get(), p.get(), q.get()) < 0
+                || TGLC_bn_get_word(p.get()) * TGLC_bn_get_word(q.get()) != pqs[i]) {
+            fprintf(stderr, "bn_factorize failed for %llu\n", pqs[i]);
+            exit(1);
+        }
+    });
+
+    printf("pq factorization, %d products of two 31-bit primes\n", count);
+    printf("  previous Pollard rho   %10.1f us\n", legacy_us);
+    printf("  Brent, batched gcd     %10.1f us\n", brent_us);
+
+    unsigned char bytes[256];
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        bytes[i] = std::stoi(std::string(DH_PRIME_HEX + 2 * i, 2), nullptr, 16);
+    }
+    std::unique_ptr<TGLC_bn, TGLC_bn_deleter> prime(TGLC_bn_bin2bn(bytes, sizeof(bytes), nullptr));
+    std::unique_ptr<TGLC_bn_ctx, TGLC_bn_ctx_deleter> ctx(TGLC_bn_ctx_new());
+
+    int dh_iterations = std::max(1, count / 20);
+    double full_us = time_us(dh_iterations, [&](int) {
+        if (tglmp_check_DH_params(ctx.get(), prime.get(), 3) < 0) {
+            fprintf(stderr, "the DH prime did not pass the checks\n");
+            exit(1);
+        }
+    });
+
+    auto ua = std::make_shared<user_agent>();
+    std::string fingerprint(32, '\0');
+    TGLC_sha256(bytes, sizeof(bytes), reinterpret_cast<unsigned char*>(&fingerprint[0]));
+    ua->add_validated_dh_prime(fingerprint);
+    double cached_us = time_us(count, [&](int) {
+        if (!ua->check_dh_params(prime.get(), 3)) {
+            fprintf(stderr, "the cached DH prime did not pass the checks\n");
+            exit(1);
+        }
+    });
+
+    printf("DH prime check\n");
+    printf("  primality tests        %10.1f us\n", full_us);
+    printf("  validated before       %10.1f us\n", cached_us);
+    return check == 0;
+}
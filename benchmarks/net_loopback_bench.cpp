@@ -0,0 +1,300 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Sends packets shaped like MTProto frames (a length prefix, a 20 byte header and
+// the payload, written separately and then flushed) to an echo server on the
+// loopback interface and waits for the echo of every window of packets. Compares
+// tgl_connection_epoll with and without TCP_CORK, and tgl_connection_asio when it
+// is built, against a naive blocking client that issues one send() per part.
+
+#include <tgl/impl/tgl_net_epoll.h>
+#if defined(TGL_BENCH_ASIO)
+#include <tgl/impl/tgl_net_asio.h>
+#endif
+#include <tgl/tgl_log.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+class echo_server {
+public:
+    echo_server()
+        : m_listen_fd(socket(AF_INET, SOCK_STREAM, 0))
+        , m_port(0)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), len) < 0
+                || listen(m_listen_fd, 4) < 0
+                || getsockname(m_listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len) < 0) {
+            perror("echo server");
+            exit(1);
+        }
+        m_port = ntohs(addr.sin_port);
+        m_thread = std::thread([this] { serve(); });
+    }
+
+    ~echo_server()
+    {
+        shutdown(m_listen_fd, SHUT_RDWR);
+        close(m_listen_fd);
+        m_thread.join();
+    }
+
+    int port() const { return m_port; }
+
+private:
+    void serve()
+    {
+        while (true) {
+            int fd = accept(m_listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            int flag = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            char buffer[64 * 1024];
+            ssize_t n;
+            while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+                for (ssize_t sent = 0; sent < n; ) {
+                    ssize_t result = write(fd, buffer + sent, n - sent);
+                    if (result <= 0) {
+                        break;
+                    }
+                    sent += result;
+                }
+            }
+            close(fd);
+        }
+    }
+
+    int m_listen_fd;
+    int m_port;
+    std::thread m_thread;
+};
+
+class bench_client : public tgl_mtproto_client {
+public:
+    bench_client()
+        : m_connected(false)
+        , m_received(0)
+    { }
+
+    virtual int32_t id() const override { return 0; }
+    virtual void connection_status_changed(const std::shared_ptr<tgl_connection>& c) override
+    {
+        m_connected = c->status() == tgl_connection_status::connected;
+    }
+    virtual bool try_rpc_execute(const std::shared_ptr<tgl_connection>& c) override
+    {
+        char sink[64 * 1024];
+        while (size_t available = c->available_bytes_for_read()) {
+            m_received += c->read(sink, std::min(available, sizeof(sink)));
+        }
+        return true;
+    }
+    virtual void ping() override { }
+    virtual tgl_online_status online_status() const override { return tgl_online_status::non_wwan_online; }
+    virtual bool ipv6_enabled() const override { return false; }
+    virtual std::shared_ptr<tgl_timer_factory> timer_factory() const override { return nullptr; }
+    virtual void add_online_status_observer(const std::weak_ptr<tgl_online_status_observer>&) override { }
+    virtual void remove_online_status_observer(const std::weak_ptr<tgl_online_status_observer>&) override { }
+    virtual void bytes_sent(size_t) override { }
+    virtual void bytes_received(size_t) override { }
+
+    bool m_connected;
+    size_t m_received;
+};
+
+struct bench_params {
+    int packets;
+    size_t payload_size;
+    int window;
+};
+
+void report(const char* name, const bench_params& params, double seconds, double syscalls)
+{
+    double bytes = static_cast<double>(params.packets) * (4 + 20 + params.payload_size);
+    printf("%-18s %10.0f packets/s %9.1f MB/s %6.2f send syscalls/packet\n",
+            name, params.packets / seconds, bytes / seconds / 1e6, syscalls / params.packets);
+}
+
+// poll() runs the event loop of the connection for up to a second and returns whether anything happened.
+template<typename Connection, typename Poll>
+void run_connection(const char* name, const bench_params& params, const std::shared_ptr<bench_client>& client,
+        const std::shared_ptr<Connection>& connection, Poll poll)
+{
+    connection->open();
+    while (!client->m_connected) {
+        if (!poll()) {
+            fprintf(stderr, "%s: connect timed out\n", name);
+            exit(1);
+        }
+    }
+
+    // The transport marker byte written by open() is echoed too.
+    size_t expected = 1;
+    while (client->m_received < expected) {
+        poll();
+    }
+
+    std::vector<char> payload(params.payload_size, 'x');
+    char prefix[4] = { 0x7f, 0, 0, 0 };
+    char header[20] = { 0 };
+    uint64_t base_writev_calls = connection->writev_calls();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int sent = 0; sent < params.packets; ) {
+        for (int i = 0; i < params.window && sent < params.packets; ++i, ++sent) {
+            connection->write(prefix, sizeof(prefix));
+            connection->write(header, sizeof(header));
+            connection->write(payload.data(), payload.size());
+            connection->flush();
+            expected += sizeof(prefix) + sizeof(header) + payload.size();
+        }
+        while (client->m_received < expected) {
+            if (!poll()) {
+                fprintf(stderr, "%s: echo timed out\n", name);
+                exit(1);
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report(name, params, seconds, connection->writev_calls() - base_writev_calls);
+    connection->close();
+}
+
+std::vector<std::pair<std::string, int>> loopback_options(const echo_server& server)
+{
+    return { { "127.0.0.1", server.port() } };
+}
+
+void run_epoll(const char* name, const echo_server& server, const bench_params& params, bool cork)
+{
+    auto loop = std::make_shared<tgl_epoll_loop>();
+    auto client = std::make_shared<bench_client>();
+    tgl_socket_options options;
+    options.tcp_cork = cork;
+    tgl_connection_factory_epoll factory(loop, options);
+    auto connection = std::static_pointer_cast<tgl_connection_epoll>(
+            factory.create_connection(loopback_options(server), { { "", 0 } }, client));
+    run_connection(name, params, client, connection, [&loop] { return loop->run_once(1000) > 0; });
+}
+
+#if defined(TGL_BENCH_ASIO)
+void run_asio(const char* name, const echo_server& server, const bench_params& params, bool cork)
+{
+    boost::asio::io_context io_context;
+    auto client = std::make_shared<bench_client>();
+    tgl_socket_options options;
+    options.tcp_cork = cork;
+    tgl_connection_factory_asio factory(io_context, options);
+    auto connection = std::static_pointer_cast<tgl_connection_asio>(
+            factory.create_connection(loopback_options(server), { { "", 0 } }, client));
+    run_connection(name, params, client, connection, [&io_context] {
+        return io_context.run_one_for(std::chrono::seconds(1)) > 0;
+    });
+}
+#endif
+
+void run_naive(const echo_server& server, const bench_params& params)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server.port());
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        perror("naive connect");
+        exit(1);
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    std::vector<char> payload(params.payload_size, 'x');
+    char prefix[4] = { 0x7f, 0, 0, 0 };
+    char header[20] = { 0 };
+    std::vector<char> sink(64 * 1024);
+    double syscalls = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int sent = 0; sent < params.packets; ) {
+        size_t expected = 0;
+        for (int i = 0; i < params.window && sent < params.packets; ++i, ++sent) {
+            send(fd, prefix, sizeof(prefix), 0);
+            send(fd, header, sizeof(header), 0);
+            send(fd, payload.data(), payload.size(), 0);
+            syscalls += 3;
+            expected += sizeof(prefix) + sizeof(header) + payload.size();
+        }
+        while (expected) {
+            ssize_t n = read(fd, sink.data(), std::min(expected, sink.size()));
+            if (n <= 0) {
+                perror("naive read");
+                exit(1);
+            }
+            expected -= n;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report("naive send()", params, seconds, syscalls);
+    close(fd);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench_params params;
+    params.packets = argc > 1 ? atoi(argv[1]) : 20000;
+    params.payload_size = argc > 2 ? atoi(argv[2]) : 256;
+    params.window = argc > 3 ? atoi(argv[3]) : 16;
+    if (params.packets <= 0 || params.window <= 0 || params.payload_size % 4) {
+        fprintf(stderr, "usage: %s [packets] [payload size, multiple of 4] [window]\n", argv[0]);
+        return 2;
+    }
+
+    tgl_init_log([](const std::string&, tgl_log_level) { }, tgl_log_level::level_error);
+
+    echo_server server;
+    printf("%d packets of %zu bytes, %d packets per round trip\n", params.packets, params.payload_size, params.window);
+    run_naive(server, params);
+    run_epoll("epoll", server, params, false);
+    run_epoll("epoll + TCP_CORK", server, params, true);
+#if defined(TGL_BENCH_ASIO)
+    run_asio("asio", server, params, false);
+    run_asio("asio + TCP_CORK", server, params, true);
+#endif
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Runs the bookkeeping of an RPC without the network: create a query, write a
+// small request into it, register it as active and with its client, look it up
+// by msg_id when the "answer" arrives, unregister it and drop it. Windows of
+// queries are in flight at once, as under load. Compares std::make_shared
+// queries in a std::map with pooled queries in the active_query_table.
+
+#include "auto/auto.h"
+#include "auto/auto_types.h"
+#include "auto/constants.h"
+#include "mtproto_client.h"
+#include "query/active_query_table.h"
+#include "query/query.h"
+#include "query/query_pool.h"
+#include "updater.h"
+#include "user_agent.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace tgl::impl;
+
+namespace {
+
+class bench_query: public query
+{
+public:
+    explicit bench_query(user_agent& ua)
+        : query(ua, "bench", TYPE_TO_PARAM(bool))
+    { }
+
+    virtual void on_answer(void*) override { }
+    virtual int on_error(int, const std::string&) override { return 0; }
+};
+
+struct map_table {
+    std::map<int64_t, std::shared_ptr<query>> queries;
+    void insert(int64_t id, const std::shared_ptr<query>& q) { queries.emplace(id, q); }
+    std::shared_ptr<query> find(int64_t id) const
+    {
+        auto it = queries.find(id);
+        return it == queries.end() ? nullptr : it->second;
+    }
+    void erase(int64_t id) { queries.erase(id); }
+};
+
+struct pooled_table {
+    active_query_table queries;
+    void insert(int64_t id, const std::shared_ptr<query>& q) { queries.insert(id, q); }
+    std::shared_ptr<query> find(int64_t id) const { return queries.find(id); }
+    void erase(int64_t id) { queries.erase(id); }
+};
+
+template<typename Table, typename Create>
+double run(user_agent& ua, const std::shared_ptr<mtproto_client>& client, int cycles, int window, Create create)
+{
+    Table table;
+    std::vector<std::shared_ptr<query>> in_flight;
+    std::vector<int64_t> msg_ids;
+    in_flight.reserve(window);
+    msg_ids.reserve(window);
+    int64_t msg_id = static_cast<int64_t>(1500000000) << 32;
+    size_t answered = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int done = 0; done < cycles; ) {
+        for (int i = 0; i < window; ++i) {
+            auto q = create(ua);
+            q->out_i32(CODE_messages_send_message);
+            q->out_i32(0);
+            q->out_i64(msg_id);
+            q->out_std_string("hello");
+            msg_id += 4;
+            client->add_connection_status_observer(q);
+            table.insert(msg_id, q);
+            msg_ids.push_back(msg_id);
+            in_flight.push_back(std::move(q));
+        }
+        in_flight.clear();
+        for (int64_t id: msg_ids) {
+            auto q = table.find(id);
+            if (q) {
+                answered++;
+                client->remove_connection_status_observer(q);
+                table.erase(id);
+            }
+        }
+        msg_ids.clear();
+        done += window;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (answered != static_cast<size_t>((cycles + window - 1) / window * window)) {
+        fprintf(stderr, "lost queries\n");
+        exit(1);
+    }
+    return seconds * 1e9 / answered;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    int cycles = argc > 1 ? atoi(argv[1]) : 1000000;
+    int window = argc > 2 ? atoi(argv[2]) : 256;
+    if (cycles <= 0 || window <= 0) {
+        fprintf(stderr, "usage: %s [cycles] [queries in flight]\n", argv[0]);
+        return 2;
+    }
+
+    auto ua = std::make_shared<user_agent>();
+    auto client = std::make_shared<mtproto_client>(*ua, 2);
+
+    printf("%d create->send->answer->destroy cycles, %d queries in flight\n", cycles, window);
+    for (int round = 0; round < 2; ++round) {
+        double heap_ns = run<map_table>(*ua, client, cycles, window, [](user_agent& ua) {
+            return std::make_shared<bench_query>(ua);
+        });
+        double pooled_ns = run<pooled_table>(*ua, client, cycles, window, [](user_agent& ua) {
+            return make_query<bench_query>(ua);
+        });
+        printf("make_shared + std::map         %7.1f ns/cycle\n", heap_ns);
+        printf("query pool + active_query_table %6.1f ns/cycle\n", pooled_ns);
+    }
+
+    const query_pool_stats& stats = query_pool::current()->stats();
+    printf("pool: %llu allocations, %llu reused\n",
+            static_cast<unsigned long long>(stats.allocations), static_cast<unsigned long long>(stats.reuses));
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Keeps a population of timers armed the way the library does, with restarts far
+// more common than expiries, and compares tgl_timer_factory_wheel against a naive
+// factory keeping its timers in an ordered multimap. Measures the cost of the
+// start/cancel churn and then of expiring every timer.
+
+#include <tgl/impl/tgl_timer_wheel.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+class naive_timer_factory : public tgl_timer_factory {
+public:
+    class timer : public tgl_timer {
+    public:
+        timer(naive_timer_factory* factory, const std::function<void()>& cb)
+            : m_factory(factory)
+            , m_cb(cb)
+            , m_scheduled(false)
+        { }
+
+        ~timer() { cancel(); }
+
+        virtual void start(double seconds_from_now) override
+        {
+            cancel();
+            auto delay = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds_from_now));
+            m_it = m_factory->m_timers.emplace(clock_type::now() + delay, this);
+            m_scheduled = true;
+        }
+
+        virtual void cancel() override
+        {
+            if (m_scheduled) {
+                m_factory->m_timers.erase(m_it);
+                m_scheduled = false;
+            }
+        }
+
+    private:
+        friend class naive_timer_factory;
+        naive_timer_factory* m_factory;
+        std::function<void()> m_cb;
+        std::multimap<clock_type::time_point, timer*>::iterator m_it;
+        bool m_scheduled;
+    };
+
+    virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) override
+    {
+        return std::make_shared<timer>(this, cb);
+    }
+
+    size_t advance(clock_type::time_point now)
+    {
+        size_t expired = 0;
+        while (!m_timers.empty() && m_timers.begin()->first <= now) {
+            timer* t = m_timers.begin()->second;
+            m_timers.erase(m_timers.begin());
+            t->m_scheduled = false;
+            t->m_cb();
+            ++expired;
+        }
+        return expired;
+    }
+
+private:
+    std::multimap<clock_type::time_point, timer*> m_timers;
+};
+
+struct bench_params {
+    int timers;
+    int operations;
+};
+
+double seconds_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+template<typename Factory, typename Advance>
+void run(const char* name, Factory& factory, Advance advance, const bench_params& params)
+{
+    size_t fired = 0;
+    std::vector<std::shared_ptr<tgl_timer>> timers;
+    timers.reserve(params.timers);
+    for (int i = 0; i < params.timers; ++i) {
+        timers.push_back(factory.create_timer([&fired] { ++fired; }));
+    }
+
+    // Query timeouts, acks and keepalives: mostly seconds, a few an hour away.
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> pick(0, params.timers - 1);
+    std::uniform_int_distribution<int> action(0, 99);
+    std::uniform_real_distribution<double> delay(0.5, 60.0);
+
+    for (auto& timer : timers) {
+        timer->start(delay(random));
+    }
+
+    auto start = clock_type::now();
+    for (int i = 0; i < params.operations; ++i) {
+        auto& timer = timers[pick(random)];
+        int a = action(random);
+        if (a < 70) {
+            timer->start(delay(random));
+        } else if (a < 95) {
+            timer->cancel();
+        } else {
+            timer->start(3600);
+        }
+    }
+    double churn_seconds = seconds_since(start);
+
+    start = clock_type::now();
+    size_t expired = advance(clock_type::now() + std::chrono::hours(2));
+    double expiry_seconds = seconds_since(start);
+
+    printf("%-8s %8.1f ns/start or cancel %10.1f ns/expiry (%zu expired)\n", name,
+            churn_seconds * 1e9 / params.operations, expired ? expiry_seconds * 1e9 / expired : 0.0, expired);
+    if (fired != expired) {
+        fprintf(stderr, "%s: %zu callbacks for %zu expiries\n", name, fired, expired);
+        exit(1);
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    bench_params params;
+    params.timers = argc > 1 ? atoi(argv[1]) : 10000;
+    params.operations = argc > 2 ? atoi(argv[2]) : 2000000;
+    if (params.timers <= 0 || params.operations <= 0) {
+        fprintf(stderr, "usage: %s [timers] [operations]\n", argv[0]);
+        return 2;
+    }
+
+    printf("%d timers, %d operations\n", params.timers, params.operations);
+
+    naive_timer_factory naive;
+    run("multimap", naive, [&naive](clock_type::time_point now) { return naive.advance(now); }, params);
+
+    tgl_timer_factory_wheel wheel;
+    run("wheel", wheel, [&wheel](clock_type::time_point now) { return wheel.wheel()->advance(now); }, params);
+    return 0;
+}
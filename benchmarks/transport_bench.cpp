@@ -0,0 +1,231 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+// Frames a stream of packets with each MTProto transport and feeds it through
+// tgl_connection_base in read-sized chunks, the way a socket delivers it. Measures
+// the cost of parsing the length prefixes alone and of parsing plus one in-place
+// pass over every packet, standing in for decryption, and counts how many packets
+// could be handed over in place versus copied because they wrapped or were not
+// 4 byte aligned.
+
+#include "mtproto_transport.h"
+#include "tools.h"
+
+#include <tgl/impl/tgl_net_base.h>
+#include <tgl/tgl_log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace tgl::impl;
+
+namespace {
+
+constexpr size_t READ_CHUNK_SIZE = 64 * 1024;
+
+class bench_client : public tgl_mtproto_client {
+public:
+    bench_client(tgl_transport transport, bool touch)
+        : m_transport(transport)
+        , m_touch(touch)
+        , m_packets(0)
+        , m_in_place(0)
+        , m_copied(0)
+        , m_checksum(0)
+    { }
+
+    virtual int32_t id() const override { return 0; }
+    virtual void connection_status_changed(const std::shared_ptr<tgl_connection>&) override { }
+    virtual bool try_rpc_execute(const std::shared_ptr<tgl_connection>& c) override
+    {
+        const mtproto_transport& transport = mtproto_transport::get(c->transport());
+        while (true) {
+            size_t len = 0;
+            int header_size = transport.peek_header(*c, &len);
+            if (header_size < 0) {
+                return false;
+            }
+            if (!header_size || c->available_bytes_for_read() < header_size + len) {
+                return true;
+            }
+            c->skip(header_size);
+
+            char* packet = c->peek_contiguous(len);
+            if (packet && !(reinterpret_cast<uintptr_t>(packet) % sizeof(int32_t))) {
+                ++m_in_place;
+                process(packet, transport.unpadded_size(packet, len));
+                c->skip(len);
+            } else {
+                ++m_copied;
+                if (m_scratch.size() < len) {
+                    m_scratch.resize(len);
+                }
+                c->read(m_scratch.data(), len);
+                process(m_scratch.data(), transport.unpadded_size(m_scratch.data(), len));
+            }
+            ++m_packets;
+        }
+    }
+    virtual void ping() override { }
+    virtual tgl_online_status online_status() const override { return tgl_online_status::non_wwan_online; }
+    virtual bool ipv6_enabled() const override { return false; }
+    virtual tgl_transport transport() const override { return m_transport; }
+    virtual std::shared_ptr<tgl_timer_factory> timer_factory() const override { return nullptr; }
+    virtual void add_online_status_observer(const std::weak_ptr<tgl_online_status_observer>&) override { }
+    virtual void remove_online_status_observer(const std::weak_ptr<tgl_online_status_observer>&) override { }
+    virtual void bytes_sent(size_t) override { }
+    virtual void bytes_received(size_t) override { }
+
+    tgl_transport m_transport;
+    bool m_touch;
+    uint64_t m_packets;
+    uint64_t m_in_place;
+    uint64_t m_copied;
+    uint32_t m_checksum;
+
+private:
+    void process(char* packet, size_t len)
+    {
+        if (!m_touch) {
+            m_checksum += static_cast<unsigned char>(packet[0]);
+            return;
+        }
+        // Rewrite the packet word by word like an in-place decryption would.
+        uint32_t* words = reinterpret_cast<uint32_t*>(packet);
+        for (size_t i = 0; i < len / 4; ++i) {
+            words[i] ^= 0x5bd1e995;
+            m_checksum += words[i];
+        }
+    }
+
+    std::vector<char> m_scratch;
+};
+
+class bench_connection : public tgl_connection_base {
+public:
+    bench_connection(const std::shared_ptr<bench_client>& client)
+        : tgl_connection_base({ { "127.0.0.1", 0 } }, { { "", 0 } }, client)
+    { }
+
+    void feed(const char* data, size_t len)
+    {
+        while (len) {
+            size_t available = 0;
+            char* buffer = prepare_receive(READ_CHUNK_SIZE, &available);
+            available = std::min({ available, len, READ_CHUNK_SIZE });
+            memcpy(buffer, data, available);
+            data_received(available);
+            data += available;
+            len -= available;
+        }
+    }
+
+protected:
+    virtual bool connect() override { return true; }
+    virtual void disconnect() override { }
+    virtual void start_read() override { }
+    virtual void start_write() override { m_write_buffer_queue.clear(); }
+};
+
+// Packet sizes of a typical session: mostly small updates and rpc results with
+// the occasional 128KB file part.
+std::vector<size_t> packet_sizes(size_t count)
+{
+    std::vector<size_t> sizes;
+    srand(1);
+    for (size_t i = 0; i < count; ++i) {
+        // auth_key_id and msg_key, then a whole number of AES blocks.
+        size_t blocks;
+        int kind = rand() % 100;
+        if (kind < 60) {
+            blocks = 2 + rand() % 30;
+        } else if (kind < 97) {
+            blocks = 32 + rand() % 512;
+        } else {
+            blocks = 128 * 1024 / 16;
+        }
+        sizes.push_back(24 + blocks * 16);
+    }
+    return sizes;
+}
+
+std::vector<char> frame_stream(tgl_transport type, const std::vector<size_t>& sizes)
+{
+    const mtproto_transport& transport = mtproto_transport::get(type);
+    std::vector<char> stream;
+    for (size_t size : sizes) {
+        size_t header_size = transport.header_size(size);
+        size_t padding_len = transport.padding_size();
+        std::vector<char> packet(MTPROTO_TRANSPORT_HEADER_SIZE + size + padding_len, 0);
+        // A non-zero auth_key_id marks an encrypted packet.
+        packet[MTPROTO_TRANSPORT_HEADER_SIZE] = 1;
+        transport.write_header(packet.data() + MTPROTO_TRANSPORT_HEADER_SIZE, size, padding_len);
+        stream.insert(stream.end(), packet.begin() + MTPROTO_TRANSPORT_HEADER_SIZE - header_size, packet.end());
+    }
+    return stream;
+}
+
+void run(tgl_transport type, const std::vector<size_t>& sizes, bool touch, int rounds)
+{
+    std::vector<char> stream = frame_stream(type, sizes);
+    auto client = std::make_shared<bench_client>(type, touch);
+    auto connection = std::make_shared<bench_connection>(client);
+    connection->open();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        connection->feed(stream.data(), stream.size());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double bytes = static_cast<double>(stream.size()) * rounds;
+    printf("%-20s %-14s %8.1f ns/packet %8.1f MB/s %6.2f%% in place (checksum %08x)\n",
+            to_string(type).c_str(), touch ? "parse + pass" : "parse only",
+            seconds * 1e9 / client->m_packets, bytes / seconds / 1e6,
+            100.0 * client->m_in_place / client->m_packets, client->m_checksum);
+    connection->close();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    size_t packets = argc > 1 ? atoi(argv[1]) : 20000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    if (!packets || rounds <= 0) {
+        fprintf(stderr, "usage: %s [packets] [rounds]\n", argv[0]);
+        return 2;
+    }
+
+    tgl_init_log([](const std::string&, tgl_log_level) { }, tgl_log_level::level_error);
+
+    std::vector<size_t> sizes = packet_sizes(packets);
+    printf("%zu packets, %d rounds, %zu byte reads\n", packets, rounds, READ_CHUNK_SIZE);
+    for (bool touch : { false, true }) {
+        for (tgl_transport type : { tgl_transport::abridged, tgl_transport::intermediate, tgl_transport::padded_intermediate }) {
+            run(type, sizes, touch, rounds);
+        }
+    }
+    return 0;
+}
@@ -68,6 +68,11 @@ char *strndup (const char *s, size_t n) {
 #include "tree.h"
 
 int header;
+int ds_arena;
+
+#define DS_MALLOC (ds_arena ? "ds_malloc" : "malloc")
+#define DS_CALLOC (ds_arena ? "ds_calloc" : "calloc")
+#define DS_FREE (ds_arena ? "ds_free" : "free")
 
 #define tl_type_name_cmp(a,b) (a->name > b->name ? 1 : a->name < b->name ? -1 : 0)
 
@@ -792,6 +797,82 @@ int gen_field_autocomplete (struct arg *arg, int *vars, int num, int from_func,
   return 0;
 }
 
+/* Vector<T> fields and function results with a concrete, unparameterized T get
+   decoders of their own instead of going through fetch_ds_type_any once per
+   element. */
+struct tl_tree_type *gen_vector_elem (struct tl_tree *t) {
+  if (TL_TREE_METHODS (t)->type (t) != NODE_TYPE_TYPE) { return 0; }
+  struct tl_tree_type *v = (void *)t;
+  if (strcmp (v->type->id, "Vector") || v->children_num != 1) { return 0; }
+  if (TL_TREE_METHODS (v->children[0])->type (v->children[0]) != NODE_TYPE_TYPE) { return 0; }
+  struct tl_tree_type *e = (void *)v->children[0];
+  if (e->children_num || !strcmp (e->type->id, "Vector")) { return 0; }
+  int bare = e->self.flags & FLAG_BARE;
+  if (!bare && (!strcmp (e->type->id, "Int") || !strcmp (e->type->id, "Long") || !strcmp (e->type->id, "Double"))) { return 0; }
+  return e;
+}
+
+/* Size of a bulk-copied element, or 0 if the elements are fetched one by one. */
+int gen_vector_elem_bulk_size (struct tl_tree_type *e) {
+  if (!(e->self.flags & FLAG_BARE)) { return 0; }
+  if (!strcmp (e->type->id, "Int")) { return 4; }
+  if (!strcmp (e->type->id, "Long") || !strcmp (e->type->id, "Double")) { return 8; }
+  return 0;
+}
+
+void gen_vector_suffix (struct tl_tree_type *e) {
+  printf ("%s%s", (e->self.flags & FLAG_BARE) ? "bare_" : "", e->type->print_id);
+}
+
+#define MAX_VECTOR_ELEMS 1000
+struct tl_tree_type *vector_elems[MAX_VECTOR_ELEMS];
+int vector_elems_num;
+
+void gen_add_vector_elem (struct tl_tree_type *e) {
+  int l;
+  for (l = 0; l < vector_elems_num; l++) {
+    if (vector_elems[l]->type == e->type && (vector_elems[l]->self.flags & FLAG_BARE) == (e->self.flags & FLAG_BARE)) { return; }
+  }
+  assert (vector_elems_num < MAX_VECTOR_ELEMS);
+  vector_elems[vector_elems_num++] = e;
+}
+
+void gen_collect_vector_elems (void) {
+  vector_elems_num = 0;
+  int i, j, k;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j++) {
+      struct tl_combinator *c = tps[i]->constructors[j];
+      for (k = 0; k < c->args_num; k++) {
+        if (c->args[k]->var_num >= 0) { continue; }
+        struct tl_tree_type *e = gen_vector_elem (c->args[k]->type);
+        if (!e) { continue; }
+        gen_add_vector_elem (e);
+      }
+    }
+  }
+  for (i = 0; i < fn; i++) {
+    struct tl_tree_type *e = gen_vector_elem (fns[i]->result);
+    if (e) {
+      gen_add_vector_elem (e);
+    }
+  }
+}
+
+/* A generic Vector reached through fetch_ds_type_any (a function result or a
+   Vector<%T> field) is handed to the specialized code when its element type has
+   one, so fetching and freeing it use the same layout. */
+void gen_vector_dispatch (const char *call) {
+  int i;
+  for (i = 0; i < vector_elems_num; i++) {
+    static char suffix[1000];
+    sprintf (suffix, "%s%s", (vector_elems[i]->self.flags & FLAG_BARE) ? "bare_" : "", vector_elems[i]->type->print_id);
+    printf ("    if (&T->params[0].type == &tl_type_%s) { ", suffix);
+    printf (call, suffix);
+    printf (" }\n");
+  }
+}
+
 int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
   assert (arg);
   char *offset = "  ";
@@ -809,19 +890,19 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       assert (0);
     } else {
       assert (t == NAME_VAR_NUM);
-      printf ("%sassert (in_remaining (in) >= 4);\n", offset);
+      printf ("%sif (in_remaining (in) < 4) { return NULL; }\n", offset);
       if (arg->id && strlen (arg->id)) {
-        printf ("%sresult->%s = (decltype(result->%s))malloc (4);", offset, arg->id, arg->id);
+        printf ("%sresult->%s = (decltype(result->%s))%s (4);", offset, arg->id, arg->id, DS_MALLOC);
         printf ("%s*result->%s = prefetch_i32 (in);", offset, arg->id);
       } else {
-        printf ("%sresult->f%d = (decltype(result->f%d))malloc (4);", offset, num - 1, num - 1);
+        printf ("%sresult->f%d = (decltype(result->f%d))%s (4);", offset, num - 1, num - 1, DS_MALLOC);
         printf ("%s*result->f%d = prefetch_i32 (in);", offset, num - 1);
       }
       if (vars[arg->var_num] == 0) {
         printf ("%sstruct paramed_type *var%d = INT2PTR (fetch_i32 (in));\n", offset, arg->var_num);
         vars[arg->var_num] = 2;
       } else if (vars[arg->var_num] == 2) {
-        printf ("%sassert (vars%d == INT2PTR (fetch_i32 (in)));\n", offset, arg->var_num);
+        printf ("%sif (var%d != INT2PTR (fetch_i32 (in))) { return NULL; }\n", offset, arg->var_num);
       } else {
         assert (0);
         return -1;
@@ -830,11 +911,14 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
   } else {
     int t = TL_TREE_METHODS (arg->type)->type (arg->type);
     if (t == NODE_TYPE_TYPE || t == NODE_TYPE_VAR_TYPE) {    
-      printf ("%sconst struct paramed_type &field%d = \n", offset, num);
-      int result = gen_create (arg->type, vars, 2 + o);
-      (void)result;
-      assert(result >= 0);
-      printf (";\n");
+      struct tl_tree_type *elem = gen_vector_elem (arg->type);
+      if (!elem) {
+        printf ("%sconst struct paramed_type &field%d = \n", offset, num);
+        int result = gen_create (arg->type, vars, 2 + o);
+        (void)result;
+        assert(result >= 0);
+        printf (";\n");
+      }
       int bare = arg->flags & FLAG_BARE;
       if (!bare && t == NODE_TYPE_TYPE) {
         bare = ((struct tl_tree_type *)arg->type)->self.flags & FLAG_BARE;
@@ -851,11 +935,20 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
           printf ("(decltype(result->f%d))", num - 1);
         }
       }
-      if (!bare) {
+      if (elem) {
+        printf ("fetch_ds_type_%svector_", bare ? "bare_" : "");
+        gen_vector_suffix (elem);
+        printf (" (in);\n");
+      } else if (!bare) {
         printf ("fetch_ds_type_%s (in, &field%d);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
       } else {
         printf ("fetch_ds_type_bare_%s (in, &field%d);\n", t == NODE_TYPE_VAR_TYPE ? "any" : ((struct tl_tree_type *)arg->type)->type->print_id, num);
       }
+      if (arg->id && strlen (arg->id)) {
+        printf ("%sif (!result->%s) { return NULL; }\n", offset, arg->id);
+      } else {
+        printf ("%sif (!result->f%d) { return NULL; }\n", offset, num - 1);
+      }
     } else {
       assert (t == NODE_TYPE_ARRAY);
       printf ("%sint multiplicity%d = PTR2INT (\n", offset, num);
@@ -863,6 +956,7 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       (void)result;
       assert(result >= 0);
       printf ("%s);\n", offset);
+      printf ("%sif (multiplicity%d < 0 || multiplicity%d > in_remaining (in)) { return NULL; }\n", offset, num, num);
       printf ("%sconst struct paramed_type &field%d = \n", offset, num);
       result = gen_create (((struct tl_tree_array *)arg->type)->args[0]->type, vars, 2 + o);
       assert(result >= 0);
@@ -872,16 +966,16 @@ int gen_field_fetch_ds (struct arg *arg, int *vars, int num, int empty) {
       } else {
         printf ("%sresult->f%d = (decltype(result->f%d))", offset, num - 1, num - 1);
       }
-      printf ("calloc (1, multiplicity%d * sizeof (void *));\n", num);
+      printf ("%s (1, multiplicity%d * sizeof (void *));\n", DS_CALLOC, num);
       printf ("%s{\n", offset);
       printf ("%s  int i = 0;\n", offset);
       printf ("%s  while (i < multiplicity%d) {\n", offset, num);
       if (arg->id && strlen (arg->id)) {
-        printf ("%s    result->%s[i ++] =", offset, arg->id);
+        printf ("%s    if (!(result->%s[i ++] = ", offset, arg->id);
       } else {
-        printf ("%s    result->f%d[i ++] = ", offset, num - 1);
+        printf ("%s    if (!(result->f%d[i ++] = ", offset, num - 1);
       }
-      printf ("fetch_ds_type_%s (in, &field%d);\n", "any", num);
+      printf ("fetch_ds_type_%s (in, &field%d))) { return NULL; }\n", "any", num);
       printf ("%s  }\n", offset);
       printf ("%s}\n", offset);
     }
@@ -916,7 +1010,7 @@ int gen_field_free_ds (struct arg *arg, int *vars, int num, int empty) {
         } else if (vars[arg->var_num] == 2) {
           printf ("%sassert (vars%d == INT2PTR (*D->%s));\n", offset, arg->var_num, arg->id);
         }
-        printf ("%sfree (D->%s);\n", offset, arg->id);
+        printf ("%s%s (D->%s);\n", offset, DS_FREE, arg->id);
       } else {
         if (vars[arg->var_num] == 0) {
           printf ("%sstruct paramed_type *var%d = INT2PTR (*D->f%d);\n", offset, arg->var_num, num - 1);
@@ -924,12 +1018,21 @@ int gen_field_free_ds (struct arg *arg, int *vars, int num, int empty) {
         } else if (vars[arg->var_num] == 2) {
           printf ("%sassert (vars%d == *D->f%d);\n", offset, arg->var_num, num - 1);
         }
-        printf ("%sfree (D->f%d);\n", offset, num - 1);
+        printf ("%s%s (D->f%d);\n", offset, DS_FREE, num - 1);
       }
     }
   } else {
     int t = TL_TREE_METHODS (arg->type)->type (arg->type);
-    if (t == NODE_TYPE_TYPE || t == NODE_TYPE_VAR_TYPE) {    
+    struct tl_tree_type *elem = gen_vector_elem (arg->type);
+    if (elem) {
+      printf ("%sfree_ds_type_vector_", offset);
+      gen_vector_suffix (elem);
+      if (arg->id && strlen (arg->id)) {
+        printf (" ((struct tl_ds_vector *)D->%s);\n", arg->id);
+      } else {
+        printf (" ((struct tl_ds_vector *)D->f%d);\n", num - 1);
+      }
+    } else if (t == NODE_TYPE_TYPE || t == NODE_TYPE_VAR_TYPE) {    
       printf ("%sconst struct paramed_type &field%d = \n", offset, num);
       int result = gen_create (arg->type, vars, 2 + o);
       (void)result;
@@ -964,9 +1067,9 @@ int gen_field_free_ds (struct arg *arg, int *vars, int num, int empty) {
       printf ("%s  }\n", offset);
       printf ("%s}\n", offset);
       if (arg->id && strlen (arg->id)) {
-        printf ("%sfree (D->%s);\n", offset, arg->id);
+        printf ("%s%s (D->%s);\n", offset, DS_FREE, arg->id);
       } else {
-        printf ("%sfree (D->f%d);\n", offset, num - 1);
+        printf ("%s%s (D->f%d);\n", offset, DS_FREE, num - 1);
       }
     }
   }
@@ -1370,12 +1473,16 @@ void gen_constructor_autocomplete (struct tl_combinator *c) {
   printf ("}\n"); 
 }
 
+void gen_vector_dispatch (const char *call);
+
 void gen_constructor_fetch_ds (struct tl_combinator *c) {
   print_c_type_name (c->result, "", 0);
-  printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", c->print_id);
+  printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", c->print_id);
+  print_c_type_name (c->result, "", 0);
+  printf ("into) {\n");
   int i;
   for (i = 0; i < c->args_num; i++) if (c->args[i]->flags & FLAG_EXCL) {
-    printf (" assert (0);\n");
+    printf ("  return NULL;\n");
     printf ("}\n");
     return;
   }
@@ -1385,9 +1492,22 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
   int *vars = malloc0 (c->var_num * 4);;
   gen_uni_skip (c->result, s, vars, 1, 1);
 
+  if (c->name == NAME_INT) {
+    printf ("  if (in_remaining (in) < 4) { return NULL; }\n");
+  } else if (c->name == NAME_LONG || c->name == NAME_DOUBLE) {
+    printf ("  if (in_remaining (in) < 8) { return NULL; }\n");
+  } else if (c->name == NAME_STRING || c->name == NAME_BYTES) {
+    printf ("  ssize_t l = prefetch_strlen (in);\n");
+    printf ("  if (l < 0) { return NULL; }\n");
+  } else if (c->name == NAME_VECTOR) {
+    printf ("  if (!into) {\n");
+    gen_vector_dispatch ("return fetch_ds_type_bare_vector_%s (in);");
+    printf ("  }\n");
+  }
+
   printf ("  ");
   print_c_type_name (c->result, "  ", 0);
-  printf ("  result = (decltype(result))calloc (1, sizeof (*result));\n");
+  printf ("  result = into ? into : (decltype(result))%s (1, sizeof (*result));\n", DS_CALLOC);
 
   struct tl_type *T = ((struct tl_tree_type *)c->result)->type;
   if (T->constructors_num > 1) {
@@ -1395,30 +1515,24 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
   }
 
   if (c->name == NAME_INT) {
-    printf ("  assert (in_remaining (in) >= 4);\n");
     printf ("  *result = fetch_i32 (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_LONG) {
-    printf ("  assert (in_remaining (in) >= 8);\n");
     printf ("  *result = fetch_i64 (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_STRING || c->name == NAME_BYTES) {
-    printf ("  assert (in_remaining (in) >= 4);\n");
-    printf ("  ssize_t l = prefetch_strlen (in);\n");
-    printf ("  assert (l >= 0);\n");
     printf ("  result->len = l;\n");
-    printf ("  result->data = (decltype(result->data))malloc (l + 1);\n");
+    printf ("  result->data = (decltype(result->data))%s (l + 1);\n", DS_MALLOC);
     printf ("  result->data[l] = 0;\n");
     printf ("  memcpy (result->data, fetch_str (in, l), l);\n");
     printf ("  return result;\n");
     printf ("}\n");
     return;
   } else if (c->name == NAME_DOUBLE) {
-    printf ("  assert (in_remaining (in) >= 8);\n");
     printf ("  *result = fetch_double (in);\n");
     printf ("  return result;\n");
     printf ("}\n");
@@ -1441,7 +1555,7 @@ void gen_constructor_fetch_ds (struct tl_combinator *c) {
 void gen_constructor_free_ds (struct tl_combinator *c) {
   printf ("void free_ds_constructor_%s (", c->print_id);
   print_c_type_name (c->result, "", 0);
-  printf ("D, const struct paramed_type *T) {\n  TGL_UNUSED(D);\n");
+  printf ("D, const struct paramed_type *T, int in_place) {\n  TGL_UNUSED(D);\n");
   int i;
   for (i = 0; i < c->args_num; i++) if (c->args[i]->flags & FLAG_EXCL) {
     printf (" assert (0);\n");
@@ -1462,22 +1576,26 @@ void gen_constructor_free_ds (struct tl_combinator *c) {
   //struct tl_type *T = ((struct tl_tree_type *)c->result)->type;
 
   if (c->name == NAME_INT) {
-    printf ("  free (D);\n");
+    printf ("  if (!in_place) { %s (D); }\n", DS_FREE);
     printf ("}\n");
     return;
   } else if (c->name == NAME_LONG) {
-    printf ("  free (D);\n");
+    printf ("  if (!in_place) { %s (D); }\n", DS_FREE);
     printf ("}\n");
     return;
   } else if (c->name == NAME_STRING || c->name == NAME_BYTES) {
-    printf ("  free (D->data);\n");
-    printf ("  free (D);\n");
+    printf ("  %s (D->data);\n", DS_FREE);
+    printf ("  if (!in_place) { %s (D); }\n", DS_FREE);
     printf ("}\n");
     return;
   } else if (c->name == NAME_DOUBLE) {
-    printf ("  free (D);\n");
+    printf ("  if (!in_place) { %s (D); }\n", DS_FREE);
     printf ("}\n");
     return;
+  } else if (c->name == NAME_VECTOR) {
+    printf ("  if (!in_place) {\n");
+    gen_vector_dispatch ("free_ds_type_vector_%s (D); return;");
+    printf ("  }\n");
   }
  
   assert (c->result->methods->type (c->result) == NODE_TYPE_TYPE);
@@ -1488,7 +1606,7 @@ void gen_constructor_free_ds (struct tl_combinator *c) {
     (void)result;
     assert(result >= 0);
   }
-  printf ("  free (D);\n");
+  printf ("  if (!in_place) { %s (D); }\n", DS_FREE);
   free (vars);
   printf ("}\n"); 
 }
@@ -1707,29 +1825,37 @@ void gen_type_fetch_ds (struct tl_type *t) {
   //int empty = is_empty (t);;  
   print_c_type_name (t->constructors[0]->result, "", 0);
 
-  printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", t->print_id);
-  printf ("  assert (in_remaining (in) >= 4);\n");
+  printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", t->print_id);
+  print_c_type_name (t->constructors[0]->result, "", 0);
+  printf ("into) {\n");
+  printf ("  if (in_remaining (in) < 4) { return NULL; }\n");
   printf ("  uint32_t magic = fetch_i32 (in);\n");
   printf ("  switch (magic) {\n");
   int i;
   for (i = 0; i < t->constructors_num; i++) {
-     printf ("  case 0x%08x: return fetch_ds_constructor_%s (in, T); break;\n", t->constructors[i]->name, t->constructors[i]->print_id);
+     printf ("  case 0x%08x: return fetch_ds_constructor_%s (in, T, into); break;\n", t->constructors[i]->name, t->constructors[i]->print_id);
   }
-  printf ("  default: assert (0); return NULL;\n");
+  printf ("  default: return NULL;\n");
   printf ("  }\n");
   printf ("}\n");
   print_c_type_name (t->constructors[0]->result, "", 0);
-  printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T) {\n", t->print_id);
+  printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", t->print_id);
+  print_c_type_name (t->constructors[0]->result, "", 0);
+  printf ("into) {\n");
   if (t->constructors_num > 1) {
     printf ("  struct tgl_in_buffer save_in = *in;\n");
-  
+    printf ("  ");
+    print_c_type_name (t->constructors[0]->result, "  ", 0);
+    printf ("  result;\n");
+
     for (i = 0; i < t->constructors_num; i++) {
-      printf ("  if (skip_constructor_%s (in, T) >= 0) { *in = save_in; return fetch_ds_constructor_%s (in, T); }\n", t->constructors[i]->print_id, t->constructors[i]->print_id);
+      printf ("  if ((result = fetch_ds_constructor_%s (in, T, into))) { return result; }\n", t->constructors[i]->print_id);
+      printf ("  *in = save_in;\n");
+      printf ("  if (into) { memset (into, 0, sizeof (*into)); }\n");
     }
   } else {
-    printf ("  return fetch_ds_constructor_%s (in, T);\n", t->constructors[0]->print_id);
+    printf ("  return fetch_ds_constructor_%s (in, T, into);\n", t->constructors[0]->print_id);
   }
-  printf ("  assert (0);\n");
   printf ("  return NULL;\n");
   printf ("}\n");
 }
@@ -1737,22 +1863,98 @@ void gen_type_fetch_ds (struct tl_type *t) {
 void gen_type_free_ds (struct tl_type *t) {
   printf ("void free_ds_type_%s (", t->print_id);
   print_c_type_name (t->constructors[0]->result, "", 0);
-  printf ("D, const struct paramed_type *T) {\n  TGL_UNUSED(D);\n");
+  printf ("D, const struct paramed_type *T, int in_place) {\n  TGL_UNUSED(D);\n");
+  if (ds_arena) {
+    printf ("  if (ds_arena_owns (D)) { return; }\n");
+  }
   
   if (t->constructors_num > 1) {
     printf ("  switch (D->magic) {\n");
     int i;
     for (i = 0; i < t->constructors_num; i++) {
-      printf ("  case 0x%08x: free_ds_constructor_%s (D, T); return; \n", t->constructors[i]->name, t->constructors[i]->print_id);
+      printf ("  case 0x%08x: free_ds_constructor_%s (D, T, in_place); return; \n", t->constructors[i]->name, t->constructors[i]->print_id);
     }
     printf ("  default: assert (0);\n");
     printf ("  }\n");
   } else {
-    printf ("  free_ds_constructor_%s (D, T); return; \n", t->constructors[0]->print_id);
+    printf ("  free_ds_constructor_%s (D, T, in_place); return; \n", t->constructors[0]->print_id);
   }
   printf ("}\n");
 }
 
+void gen_vector_fetch_ds (struct tl_tree_type *e) {
+  int bulk = gen_vector_elem_bulk_size (e);
+  printf ("struct tl_ds_vector *fetch_ds_type_vector_");
+  gen_vector_suffix (e);
+  printf (" (struct tgl_in_buffer *in) {\n");
+  printf ("  if (in_remaining (in) < 4 || fetch_i32 (in) != 0x%08x) { return NULL; }\n", NAME_VECTOR);
+  printf ("  return fetch_ds_type_bare_vector_");
+  gen_vector_suffix (e);
+  printf (" (in);\n");
+  printf ("}\n");
+
+  printf ("struct tl_ds_vector *fetch_ds_type_bare_vector_");
+  gen_vector_suffix (e);
+  printf (" (struct tgl_in_buffer *in) {\n");
+  printf ("  if (in_remaining (in) < 4) { return NULL; }\n");
+  printf ("  int32_t cnt = fetch_i32 (in);\n");
+  if (bulk) {
+    printf ("  if (cnt < 0 || cnt > in_remaining (in) / %d) { return NULL; }\n", bulk);
+  } else {
+    printf ("  if (cnt < 0 || cnt > in_remaining (in) / 4) { return NULL; }\n");
+  }
+  printf ("  struct tl_ds_vector *result = (decltype(result))%s (1, sizeof (*result));\n", DS_CALLOC);
+  printf ("  result->f1 = (decltype(result->f1))%s (4);\n", DS_MALLOC);
+  printf ("  *result->f1 = cnt;\n");
+  printf ("  ");
+  print_c_type_name ((struct tl_tree *)e, "  ", 0);
+  printf ("elems;\n");
+  if (bulk) {
+    printf ("  result->f2 = (decltype(result->f2))%s (cnt * (sizeof (void *) + sizeof (*elems)));\n", DS_MALLOC);
+  } else {
+    printf ("  result->f2 = (decltype(result->f2))%s (1, cnt * (sizeof (void *) + sizeof (*elems)));\n", DS_CALLOC);
+  }
+  printf ("  elems = (decltype(elems))(result->f2 + cnt);\n");
+  if (bulk) {
+    printf ("  fetch_data (in, elems, cnt * %d);\n", bulk);
+    printf ("  for (int i = 0; i < cnt; i++) {\n");
+    printf ("    result->f2[i] = elems + i;\n");
+    printf ("  }\n");
+  } else {
+    printf ("  const struct paramed_type &elem = \n");
+    gen_create ((struct tl_tree *)e, 0, 2);
+    printf (";\n");
+    printf ("  for (int i = 0; i < cnt; i++) {\n");
+    printf ("    if (!(result->f2[i] = fetch_ds_type_%s%s (in, &elem, elems + i))) { return NULL; }\n", (e->self.flags & FLAG_BARE) ? "bare_" : "", e->type->print_id);
+    printf ("  }\n");
+  }
+  printf ("  return result;\n");
+  printf ("}\n");
+}
+
+void gen_vector_free_ds (struct tl_tree_type *e) {
+  printf ("void free_ds_type_vector_");
+  gen_vector_suffix (e);
+  printf (" (struct tl_ds_vector *D) {\n");
+  if (ds_arena) {
+    printf ("  if (ds_arena_owns (D)) { return; }\n");
+  }
+  if (!gen_vector_elem_bulk_size (e)) {
+    printf ("  const struct paramed_type &elem = \n");
+    gen_create ((struct tl_tree *)e, 0, 2);
+    printf (";\n");
+    printf ("  for (int i = 0; i < *D->f1; i++) {\n");
+    printf ("    free_ds_type_%s ((", e->type->print_id);
+    print_c_type_name ((struct tl_tree *)e, "", 0);
+    printf (")D->f2[i], &elem, 1);\n");
+    printf ("  }\n");
+  }
+  printf ("  %s (D->f2);\n", DS_FREE);
+  printf ("  %s (D->f1);\n", DS_FREE);
+  printf ("  %s (D);\n", DS_FREE);
+  printf ("}\n");
+}
+
 void gen_type_store_ds (struct tl_type *t) {
   int k;
   for (k = 0; k < 2; k++) {
@@ -2572,6 +2774,395 @@ void gen_types_source (void) {
   printf ("}\n");
 }
 
+int gen_view_field_num (struct tl_combinator *c) {
+  int i;
+  int n = 0;
+  for (i = 0; i < c->args_num; i++) if (!(c->args[i]->flags & FLAG_OPT_VAR)) {
+    n ++;
+  }
+  return n;
+}
+
+int gen_view_supported (struct tl_combinator *c) {
+  if (c->name == NAME_INT || c->name == NAME_LONG || c->name == NAME_DOUBLE || c->name == NAME_STRING || c->name == NAME_BYTES) {
+    return 0;
+  }
+  if (TL_TREE_METHODS (c->result)->type (c->result) != NODE_TYPE_TYPE || ((struct tl_tree_type *)c->result)->type->arity) {
+    return 0;
+  }
+  if (gen_view_field_num (c) > 32) {
+    return 0;
+  }
+  int i;
+  for (i = 0; i < c->args_num; i++) {
+    struct arg *arg = c->args[i];
+    if (arg->flags & FLAG_EXCL) {
+      return 0;
+    }
+    if (arg->flags & FLAG_OPT_VAR) {
+      continue;
+    }
+    if (!arg->id || !strlen (arg->id)) {
+      return 0;
+    }
+    if (arg->var_num < 0 && TL_TREE_METHODS (arg->type)->type (arg->type) != NODE_TYPE_TYPE) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int gen_view_field_bare (struct arg *arg) {
+  int bare = arg->flags & FLAG_BARE;
+  if (!bare) {
+    bare = ((struct tl_tree_type *)arg->type)->self.flags & FLAG_BARE;
+  }
+  return bare;
+}
+
+void gen_view_header (struct tl_combinator *c) {
+  int flags_field[1000];
+  int i;
+  int num = 0;
+  printf ("class tl_view_%s: public tl_view {\n", c->print_id);
+  printf ("public:\n");
+  printf ("  explicit tl_view_%s (const struct tgl_in_buffer &in, bool boxed = true) : tl_view (in, 0x%08x, boxed, %d) { }\n", c->print_id, c->name, gen_view_field_num (c));
+  for (i = 0; i < c->args_num; i++) if (!(c->args[i]->flags & FLAG_OPT_VAR)) {
+    struct arg *arg = c->args[i];
+    if (arg->exist_var_num >= 0) {
+      printf ("  bool has_%s () const { return (field_i32 (%d) >> %d) & 1; }\n", arg->id, flags_field[arg->exist_var_num], arg->exist_var_bit);
+    }
+    if (arg->var_num >= 0) {
+      assert (arg->var_num < 1000);
+      flags_field[arg->var_num] = num;
+      printf ("  int32_t %s () const { return field_i32 (%d); }\n", arg->id, num);
+      num ++;
+      continue;
+    }
+    struct tl_type *t = ((struct tl_tree_type *)arg->type)->type;
+    int bare = gen_view_field_bare (arg);
+    if (bare && t->name == NAME_INT) {
+      printf ("  int32_t %s () const { return field_i32 (%d); }\n", arg->id, num);
+    } else if (bare && t->name == NAME_LONG) {
+      printf ("  int64_t %s () const { return field_i64 (%d); }\n", arg->id, num);
+    } else if (bare && t->name == NAME_DOUBLE) {
+      printf ("  double %s () const { return field_double (%d); }\n", arg->id, num);
+    } else if (bare && (t->name == NAME_STRING || t->name == NAME_BYTES)) {
+      printf ("  struct tl_span %s () const { return field_string (%d); }\n", arg->id, num);
+    } else if (bare && !strcmp (t->id, "True")) {
+      assert (arg->exist_var_num >= 0);
+      printf ("  bool %s () const { return has_%s (); }\n", arg->id, arg->id);
+    } else {
+      printf ("  struct tgl_in_buffer %s () const { return field_buffer (%d); }\n", arg->id, num);
+    }
+    num ++;
+  }
+  printf ("private:\n");
+  printf ("  virtual int skip_field (int index, struct tgl_in_buffer *in) const override;\n");
+  printf ("};\n");
+}
+
+void gen_view_source (struct tl_combinator *c) {
+  int flags_field[1000];
+  int *vars = malloc0 (c->var_num * 4);
+  int i;
+  int num = 0;
+  printf ("int tl_view_%s::skip_field (int index, struct tgl_in_buffer *in) const {\n", c->print_id);
+  printf ("  switch (index) {\n");
+  for (i = 0; i < c->args_num; i++) if (!(c->args[i]->flags & FLAG_OPT_VAR)) {
+    struct arg *arg = c->args[i];
+    printf ("  case %d: {\n", num);
+    if (arg->exist_var_num >= 0) {
+      printf ("    if (!((field_i32 (%d) >> %d) & 1)) { return 0; }\n", flags_field[arg->exist_var_num], arg->exist_var_bit);
+    }
+    if (arg->var_num >= 0) {
+      flags_field[arg->var_num] = num;
+      printf ("    if (in_remaining (in) < 4) { return -1; }\n");
+      printf ("    fetch_i32 (in);\n");
+      printf ("    return 0;\n");
+    } else {
+      printf ("    const struct paramed_type &field = \n");
+      int result = gen_create (arg->type, vars, 4);
+      (void)result;
+      assert (result >= 0);
+      printf (";\n");
+      printf ("    return skip_type_%s%s (in, &field);\n", gen_view_field_bare (arg) ? "bare_" : "", ((struct tl_tree_type *)arg->type)->type->print_id);
+    }
+    printf ("  }\n");
+    num ++;
+  }
+  printf ("  default: return -1;\n");
+  printf ("  }\n");
+  printf ("}\n");
+  free (vars);
+}
+
+void gen_views_source (void) {
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include <assert.h>\n");
+
+  printf ("#include \"auto/auto_views.h\"\n");
+  printf ("#include \"auto/auto_skip.h\"\n");
+  printf ("#include \"auto/auto_types.h\"\n");
+  printf ("#include \"mtproto_common.h\"\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  int i, j;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j ++) if (gen_view_supported (tps[i]->constructors[j])) {
+      gen_view_source (tps[i]->constructors[j]);
+    }
+  }
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
+void gen_views_header (void) {
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include \"tl_view.h\"\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  int i, j;
+  for (i = 0; i < tn; i++) {
+    for (j = 0; j < tps[i]->constructors_num; j ++) if (gen_view_supported (tps[i]->constructors[j])) {
+      gen_view_header (tps[i]->constructors[j]);
+    }
+  }
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
+enum builder_arg_kind { BUILDER_ARG_FLAGS, BUILDER_ARG_TRUE, BUILDER_ARG_INT, BUILDER_ARG_LONG, BUILDER_ARG_DOUBLE, BUILDER_ARG_STRING, BUILDER_ARG_OBJECT };
+
+int gen_builder_arg_kind (struct arg *arg) {
+  if (arg->var_num >= 0) {
+    return BUILDER_ARG_FLAGS;
+  }
+  struct tl_type *t = ((struct tl_tree_type *)arg->type)->type;
+  if (!gen_view_field_bare (arg)) {
+    return BUILDER_ARG_OBJECT;
+  }
+  if (t->name == NAME_INT) {
+    return BUILDER_ARG_INT;
+  } else if (t->name == NAME_LONG) {
+    return BUILDER_ARG_LONG;
+  } else if (t->name == NAME_DOUBLE) {
+    return BUILDER_ARG_DOUBLE;
+  } else if (t->name == NAME_STRING || t->name == NAME_BYTES) {
+    return BUILDER_ARG_STRING;
+  } else if (!strcmp (t->id, "True")) {
+    return BUILDER_ARG_TRUE;
+  }
+  return BUILDER_ARG_OBJECT;
+}
+
+int gen_builder_supported (struct tl_combinator *f) {
+  int i;
+  for (i = 0; i < f->args_num; i++) {
+    struct arg *arg = f->args[i];
+    if (arg->flags & (FLAG_EXCL | FLAG_OPT_VAR)) {
+      return 0;
+    }
+    if (!arg->id || !strlen (arg->id)) {
+      return 0;
+    }
+    if (arg->var_num < 0 && TL_TREE_METHODS (arg->type)->type (arg->type) != NODE_TYPE_TYPE) {
+      return 0;
+    }
+    if (arg->var_num >= 0 && arg->var_num >= 1000) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void gen_builder_params (struct tl_combinator *f, int first) {
+  int i;
+  for (i = 0; i < f->args_num; i++) {
+    struct arg *arg = f->args[i];
+    if (gen_builder_arg_kind (arg) == BUILDER_ARG_TRUE) {
+      continue;
+    }
+    if (!first) {
+      printf (", ");
+    }
+    first = 0;
+    switch (gen_builder_arg_kind (arg)) {
+    case BUILDER_ARG_FLAGS:
+    case BUILDER_ARG_INT:
+      printf ("int32_t %s", arg->id);
+      break;
+    case BUILDER_ARG_LONG:
+      printf ("int64_t %s", arg->id);
+      break;
+    case BUILDER_ARG_DOUBLE:
+      printf ("double %s", arg->id);
+      break;
+    case BUILDER_ARG_STRING:
+      printf ("const tl_out_string &%s", arg->id);
+      break;
+    default:
+      printf ("const tl_out_object &%s", arg->id);
+      break;
+    }
+  }
+}
+
+void gen_builder_args (struct tl_combinator *f) {
+  int i;
+  int first = 1;
+  for (i = 0; i < f->args_num; i++) {
+    struct arg *arg = f->args[i];
+    if (gen_builder_arg_kind (arg) != BUILDER_ARG_TRUE) {
+      printf ("%s%s", first ? "" : ", ", arg->id);
+      first = 0;
+    }
+  }
+}
+
+void gen_builder_size (struct tl_combinator *f) {
+  char *flags[1000];
+  int i;
+  printf ("size_t tl_size_%s (", f->print_id);
+  gen_builder_params (f, 1);
+  printf (") {\n");
+  printf ("  size_t ints = 1;\n");
+  for (i = 0; i < f->args_num; i++) {
+    struct arg *arg = f->args[i];
+    int kind = gen_builder_arg_kind (arg);
+    if (kind == BUILDER_ARG_TRUE) {
+      continue;
+    }
+    char *offset = "  ";
+    if (arg->exist_var_num >= 0) {
+      printf ("  if (%s & (1 << %d)) {\n", flags[arg->exist_var_num], arg->exist_var_bit);
+      offset = "    ";
+    }
+    switch (kind) {
+    case BUILDER_ARG_FLAGS:
+      flags[arg->var_num] = arg->id;
+      /* fallthrough */
+    case BUILDER_ARG_INT:
+      printf ("%sints += 1;\n", offset);
+      break;
+    case BUILDER_ARG_LONG:
+    case BUILDER_ARG_DOUBLE:
+      printf ("%sints += 2;\n", offset);
+      break;
+    case BUILDER_ARG_STRING:
+      printf ("%sints += mtprotocol_serializer::string_i32_size (%s.size);\n", offset, arg->id);
+      break;
+    default:
+      printf ("%sints += %s.size ();\n", offset, arg->id);
+      break;
+    }
+    if (arg->exist_var_num >= 0) {
+      printf ("  }\n");
+    }
+  }
+  printf ("  return ints;\n");
+  printf ("}\n");
+}
+
+void gen_builder_out (struct tl_combinator *f) {
+  char *flags[1000];
+  int i;
+  printf ("void tl_out_%s (mtprotocol_serializer &out", f->print_id);
+  gen_builder_params (f, 0);
+  printf (") {\n");
+  printf ("  size_t at = out.reserve_i32s (tl_size_%s (", f->print_id);
+  gen_builder_args (f);
+  printf ("));\n");
+  printf ("  out.out_i32_at (at++, 0x%08x);\n", f->name);
+  for (i = 0; i < f->args_num; i++) {
+    struct arg *arg = f->args[i];
+    int kind = gen_builder_arg_kind (arg);
+    if (kind == BUILDER_ARG_TRUE) {
+      continue;
+    }
+    char *offset = "  ";
+    if (arg->exist_var_num >= 0) {
+      printf ("  if (%s & (1 << %d)) {\n", flags[arg->exist_var_num], arg->exist_var_bit);
+      offset = "    ";
+    }
+    switch (kind) {
+    case BUILDER_ARG_FLAGS:
+      flags[arg->var_num] = arg->id;
+      /* fallthrough */
+    case BUILDER_ARG_INT:
+      printf ("%sout.out_i32_at (at++, %s);\n", offset, arg->id);
+      break;
+    case BUILDER_ARG_LONG:
+      printf ("%sout.out_i64_at (at, %s);\n", offset, arg->id);
+      printf ("%sat += 2;\n", offset);
+      break;
+    case BUILDER_ARG_DOUBLE:
+      printf ("%sout.out_double_at (at, %s);\n", offset, arg->id);
+      printf ("%sat += 2;\n", offset);
+      break;
+    case BUILDER_ARG_STRING:
+      printf ("%sat += out.out_string_at (at, %s.data, %s.size);\n", offset, arg->id, arg->id);
+      break;
+    default:
+      printf ("%sout.out_i32s_at (at, %s.data (), %s.size ());\n", offset, arg->id, arg->id);
+      printf ("%sat += %s.size ();\n", offset, arg->id);
+      break;
+    }
+    if (arg->exist_var_num >= 0) {
+      printf ("  }\n");
+    }
+  }
+  printf ("  assert (at == out.i32_size ());\n");
+  printf ("}\n");
+}
+
+void gen_builders_source (void) {
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include <assert.h>\n");
+
+  printf ("#include \"auto/auto_builders.h\"\n");
+  printf ("#include \"mtproto_common.h\"\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  int i;
+  for (i = 0; i < fn; i++) if (gen_builder_supported (fns[i])) {
+    gen_builder_size (fns[i]);
+    gen_builder_out (fns[i]);
+  }
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
+void gen_builders_header (void) {
+  printf ("#include \"auto/auto.h\"\n");
+  printf ("#include \"mtproto_common.h\"\n");
+
+  printf ("namespace tgl {\n");
+  printf ("namespace impl {\n");
+
+  int i;
+  for (i = 0; i < fn; i++) if (gen_builder_supported (fns[i])) {
+    printf ("size_t tl_size_%s (", fns[i]->print_id);
+    gen_builder_params (fns[i], 1);
+    printf (");\n");
+    printf ("void tl_out_%s (mtprotocol_serializer &out", fns[i]->print_id);
+    gen_builder_params (fns[i], 0);
+    printf (");\n");
+  }
+
+  printf ("}\n");
+  printf ("}\n");
+}
+
 void gen_fetch_ds_source (void) {
   printf ("#include \"auto/auto.h\"\n");
   printf ("#include <assert.h>\n");
@@ -2579,12 +3170,16 @@ void gen_fetch_ds_source (void) {
   printf ("#include \"auto/auto_fetch_ds.h\"\n");
   printf ("#include \"auto/auto_skip.h\"\n");
   printf ("#include \"auto/auto_types.h\"\n");
+  if (ds_arena) {
+    printf ("#include \"ds_arena.h\"\n");
+  }
   printf ("#include \"mtproto_common.h\"\n");
 
   printf ("namespace tgl {\n");
   printf ("namespace impl {\n");
 
   int i, j;
+  gen_collect_vector_elems ();
   for (i = 0; i < tn; i++) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
       gen_constructor_fetch_ds (tps[i]->constructors[j]);
@@ -2593,6 +3188,9 @@ void gen_fetch_ds_source (void) {
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     gen_type_fetch_ds (tps[i]);
   }
+  for (i = 0; i < vector_elems_num; i++) {
+    gen_vector_fetch_ds (vector_elems[i]);
+  }
   printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T) {\n");
   printf ("  switch (T->type.name) {\n");
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type") && tps[i]->name) {
@@ -2620,14 +3218,29 @@ void gen_fetch_ds_header (void) {
   for (i = 0; i < tn; i++) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
       print_c_type_name (tps[i]->constructors[j]->result, "", 0);
-      printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->constructors[j]->print_id);
+      printf ("fetch_ds_constructor_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", tps[i]->constructors[j]->print_id);
+      print_c_type_name (tps[i]->constructors[j]->result, "", 0);
+      printf ("into = NULL);\n");
     }
   }
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     print_c_type_name (tps[i]->constructors[0]->result, "", 0);
-    printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->print_id);
+    printf ("fetch_ds_type_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", tps[i]->print_id);
     print_c_type_name (tps[i]->constructors[0]->result, "", 0);
-    printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T);\n", tps[i]->print_id);
+    printf ("into = NULL);\n");
+    print_c_type_name (tps[i]->constructors[0]->result, "", 0);
+    printf ("fetch_ds_type_bare_%s (struct tgl_in_buffer *in, const struct paramed_type *T, ", tps[i]->print_id);
+    print_c_type_name (tps[i]->constructors[0]->result, "", 0);
+    printf ("into = NULL);\n");
+  }
+  gen_collect_vector_elems ();
+  for (i = 0; i < vector_elems_num; i++) {
+    printf ("struct tl_ds_vector *fetch_ds_type_vector_");
+    gen_vector_suffix (vector_elems[i]);
+    printf (" (struct tgl_in_buffer *in);\n");
+    printf ("struct tl_ds_vector *fetch_ds_type_bare_vector_");
+    gen_vector_suffix (vector_elems[i]);
+    printf (" (struct tgl_in_buffer *in);\n");
   }
   printf ("void *fetch_ds_type_any (struct tgl_in_buffer *in, const struct paramed_type *T);\n");
 
@@ -2642,12 +3255,16 @@ void gen_free_ds_source (void) {
   printf ("#include \"auto/auto_free_ds.h\"\n");
   printf ("#include \"auto/auto_skip.h\"\n");
   printf ("#include \"auto/auto_types.h\"\n");
+  if (ds_arena) {
+    printf ("#include \"ds_arena.h\"\n");
+  }
   printf ("#include \"mtproto_common.h\"\n");
 
   printf ("namespace tgl {\n");
   printf ("namespace impl {\n");
 
   int i, j;
+  gen_collect_vector_elems ();
   for (i = 0; i < tn; i++) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
       gen_constructor_free_ds (tps[i]->constructors[j]);
@@ -2656,7 +3273,13 @@ void gen_free_ds_source (void) {
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     gen_type_free_ds (tps[i]);
   }
+  for (i = 0; i < vector_elems_num; i++) {
+    gen_vector_free_ds (vector_elems[i]);
+  }
   printf ("void free_ds_type_any (void *D, const struct paramed_type *T) {\n  TGL_UNUSED(D);\n");
+  if (ds_arena) {
+    printf ("  if (ds_arena_owns (D)) { return; }\n");
+  }
   printf ("  switch (T->type.name) {\n");
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type") && tps[i]->name) {
     printf ("  case 0x%08x: free_ds_type_%s ((", tps[i]->name, tps[i]->print_id);
@@ -2689,13 +3312,19 @@ void gen_free_ds_header (void) {
     for (j = 0; j < tps[i]->constructors_num; j ++) {
       printf ("void free_ds_constructor_%s (", tps[i]->constructors[j]->print_id); 
       print_c_type_name (tps[i]->constructors[j]->result, "", 0);
-      printf ("D, const struct paramed_type *T);\n");
+      printf ("D, const struct paramed_type *T, int in_place = 0);\n");
     }
   }
   for (i = 0; i < tn; i++) if (tps[i]->id[0] != '#' && strcmp (tps[i]->id, "Type")) {
     printf ("void free_ds_type_%s (", tps[i]->print_id);
     print_c_type_name (tps[i]->constructors[0]->result, "", 0);
-    printf ("D, const struct paramed_type *T);\n");
+    printf ("D, const struct paramed_type *T, int in_place = 0);\n");
+  }
+  gen_collect_vector_elems ();
+  for (i = 0; i < vector_elems_num; i++) {
+    printf ("void free_ds_type_vector_");
+    gen_vector_suffix (vector_elems[i]);
+    printf (" (struct tl_ds_vector *D);\n");
   }
   printf ("void free_ds_type_any (void *D, const struct paramed_type *T);\n");
 
@@ -2890,6 +3519,14 @@ int parse_tlo_file (void) {
       gen_free_ds_source ();
     } else if (!strcmp (gen_what[i], "free_ds_header")) {
       gen_free_ds_header ();
+    } else if (!strcmp (gen_what[i], "views")) {
+      gen_views_source ();
+    } else if (!strcmp (gen_what[i], "views_header")) {
+      gen_views_header ();
+    } else if (!strcmp (gen_what[i], "builders")) {
+      gen_builders_source ();
+    } else if (!strcmp (gen_what[i], "builders_header")) {
+      gen_builders_header ();
     } else if (!strcmp (gen_what[i], "store_ds")) {
       gen_store_ds_source ();
     } else if (!strcmp (gen_what[i], "store_ds_header")) {
@@ -2904,7 +3541,8 @@ int parse_tlo_file (void) {
 }
 
 void usage (void) {
-  printf ("usage: generate [-v] [-h] <tlo-file>\n"
+  printf ("usage: generate [-v] [-h] [-a] <tlo-file>\n"
+          "\t-a\tallocate fetch_ds structures from the current ds_arena\n"
        );
   exit (2);
 }
@@ -2973,7 +3611,7 @@ int main (int argc, char **argv) {
   signal (SIGSEGV, sig_segv_handler);
   signal (SIGABRT, sig_abrt_handler);
   int i;
-  while ((i = getopt (argc, argv, "vhHg:")) != -1) {
+  while ((i = getopt (argc, argv, "vhHag:")) != -1) {
     switch (i) {
     case 'h':
       usage ();
@@ -2984,6 +3622,9 @@ int main (int argc, char **argv) {
     case 'H':
       header ++;
       break;
+    case 'a':
+      ds_arena = 1;
+      break;
     case 'g':
       assert (gen_what_cnt < 1000);
       gen_what[gen_what_cnt ++] = optarg;
@@ -0,0 +1,136 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <tgl/impl/tgl_net_base.h>
+#include <tgl/impl/tgl_timer_wheel.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+// Implementations of tgl_connection and tgl_timer on top of Boost.Asio. Everything
+// runs on a caller supplied io_context, which has to be run from a single thread or
+// the thread tgl is driven from. It should include the public headers only.
+
+class tgl_asio_handler_memory;
+
+// Drives all the timers from one steady_timer. The timers live on a
+// tgl_timer_wheel that is advanced whenever the steady_timer fires, and the
+// steady_timer is only rearmed when the earliest expiry changes.
+class tgl_timer_factory_asio : public tgl_timer_factory {
+public:
+    explicit tgl_timer_factory_asio(boost::asio::io_context& io_context,
+            std::chrono::steady_clock::duration tick = std::chrono::milliseconds(1));
+    virtual ~tgl_timer_factory_asio();
+
+    tgl_timer_factory_asio(const tgl_timer_factory_asio&) = delete;
+    tgl_timer_factory_asio& operator=(const tgl_timer_factory_asio&) = delete;
+
+    virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) override;
+
+    const std::shared_ptr<tgl_timer_wheel>& wheel() const { return m_factory.wheel(); }
+
+private:
+    void arm(std::chrono::steady_clock::time_point expiry);
+    void timer_fired();
+
+    boost::asio::steady_timer m_timer;
+    std::chrono::steady_clock::time_point m_armed_expiry;
+    std::shared_ptr<tgl_asio_handler_memory> m_handler_memory;
+    // Expires with the factory, the handlers of cancelled waits still run afterwards.
+    std::shared_ptr<bool> m_alive;
+    tgl_timer_factory_wheel m_factory;
+};
+
+// Waits for the socket to become readable or writable and then reads into the
+// connection's read buffer or writes all the queued buffers with a single
+// scatter/gather call, so nothing is copied on the way and the handlers of the
+// waits reuse the same memory. Writes are sent on flush() or once the queue gets
+// long. Connecting races all the addresses of the DC, see
+// tgl_connection_base::connect_endpoints().
+class tgl_connection_asio : public tgl_connection_base {
+public:
+    tgl_connection_asio(boost::asio::io_context& io_context,
+            const tgl_socket_options& options,
+            const std::vector<std::pair<std::string, int>>& ipv4_options,
+            const std::vector<std::pair<std::string, int>>& ipv6_options,
+            const std::weak_ptr<tgl_mtproto_client>& client);
+    virtual ~tgl_connection_asio();
+
+protected:
+    virtual bool connect() override;
+    virtual void disconnect() override;
+    virtual void start_read() override;
+    virtual void start_write() override;
+
+    virtual int start_connect_attempt(const tgl_endpoint& endpoint) override;
+    virtual void close_connect_attempt(int id) override;
+    virtual bool adopt_connect_attempt(int id) override;
+    virtual ssize_t write_buffers(size_t count, bool* would_block) override;
+    virtual void wait_writable(bool writable) override;
+    virtual bool set_cork(bool cork) override;
+
+private:
+    using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
+
+    void close_socket();
+    void wait_readable();
+    void read_available();
+
+    boost::asio::io_context& m_io_context;
+    tgl_socket_options m_options;
+    socket_ptr m_socket;
+    std::map<int, socket_ptr> m_attempt_sockets;
+    int m_next_attempt_id;
+    std::vector<boost::asio::const_buffer> m_write_buffers;
+    std::shared_ptr<tgl_asio_handler_memory> m_read_handler_memory;
+    std::shared_ptr<tgl_asio_handler_memory> m_write_handler_memory;
+    bool m_waiting_readable;
+    bool m_waiting_writable;
+};
+
+class tgl_connection_factory_asio : public tgl_connection_factory {
+public:
+    explicit tgl_connection_factory_asio(boost::asio::io_context& io_context,
+            const tgl_socket_options& options = tgl_socket_options())
+        : m_io_context(io_context)
+        , m_options(options)
+    { }
+
+    virtual std::shared_ptr<tgl_connection> create_connection(
+            const std::vector<std::pair<std::string, int>>& ipv4_options,
+            const std::vector<std::pair<std::string, int>>& ipv6_options,
+            const std::weak_ptr<tgl_mtproto_client>& client) override
+    {
+        return std::make_shared<tgl_connection_asio>(m_io_context, m_options, ipv4_options, ipv6_options, client);
+    }
+
+private:
+    boost::asio::io_context& m_io_context;
+    tgl_socket_options m_options;
+};
@@ -26,9 +26,13 @@
 #include <tgl/tgl_timer.h>
 
 #include <chrono>
+#include <cstdint>
 #include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <cstring>
+#include <string>
 #include <vector>
 
 // This is a default base implementation of tgl_connection. It should include the public headers only.
@@ -47,6 +51,13 @@ public:
         std::memcpy(m_data.data(), data, size);
     }
 
+    tgl_net_buffer(std::vector<char>&& data, size_t position)
+        : m_data(std::move(data))
+        , m_current_position(position)
+    {
+        assert(m_data.size() >= m_current_position);
+    }
+
     char* data()
     {
         assert(m_data.size() >= m_current_position);
@@ -74,6 +85,92 @@ private:
     size_t m_current_position;
 };
 
+// A growable ring buffer of received bytes. The sockets write into it directly
+// through prepare() and commit(), and complete frames are read back in place
+// through contiguous() unless they wrap around the end of the storage.
+class tgl_net_ring_buffer {
+public:
+    tgl_net_ring_buffer();
+
+    size_t size() const { return m_write_position - m_read_position; }
+    bool empty() const { return size() == 0; }
+    size_t capacity() const { return m_data.size(); }
+
+    size_t peek(void* data, size_t len) const;
+    size_t read(void* data, size_t len);
+    size_t skip(size_t len);
+
+    // The next len unread bytes if they do not wrap, otherwise nullptr.
+    char* contiguous(size_t len);
+
+    // Makes room for at least min_free more bytes and returns the writable span
+    // after the unread bytes, which may be shorter than min_free if it wraps.
+    char* prepare(size_t min_free, size_t* available);
+    void commit(size_t len);
+
+    void append(const char* data, size_t len);
+    void clear();
+
+private:
+    size_t mask() const { return m_data.size() - 1; }
+    void grow(size_t min_capacity);
+
+    // The capacity is a power of two and the positions only ever grow, so
+    // the offset into m_data is the position masked by the capacity.
+    std::vector<char> m_data;
+    size_t m_read_position;
+    size_t m_write_position;
+};
+
+struct tgl_endpoint {
+    std::string address;
+    int port;
+    bool ipv6;
+};
+
+// The connect round trip times and failures of every endpoint connected to so
+// far, shared by all connections of the process.
+class tgl_endpoint_history {
+public:
+    static tgl_endpoint_history& instance();
+
+    void connected(const tgl_endpoint& endpoint, std::chrono::milliseconds rtt);
+    void failed(const tgl_endpoint& endpoint);
+
+    // The smoothed connect round trip time, zero if the endpoint never connected.
+    std::chrono::milliseconds rtt(const tgl_endpoint& endpoint) const;
+
+    // Orders the endpoints best first: the ones that connected last time by
+    // their round trip time, then the untried ones, then the ones that failed
+    // by how often they failed in a row. Ties keep their order.
+    void sort(std::vector<tgl_endpoint>& endpoints) const;
+
+private:
+    struct stats {
+        std::chrono::milliseconds srtt = std::chrono::milliseconds::zero();
+        int consecutive_failures = 0;
+    };
+
+    static std::string key(const tgl_endpoint& endpoint);
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, stats> m_stats;
+};
+
+// The socket settings shared by the socket based subclasses.
+struct tgl_socket_options {
+    bool tcp_nodelay = true;
+    // Cork the socket while a batch of queued buffers takes more than one writev()
+    // so that the kernel only sends full segments, and uncork it once the queue
+    // is drained. Only on Linux.
+    bool tcp_cork = true;
+    // SO_SNDBUF and SO_RCVBUF, 0 keeps the system default.
+    int send_buffer_size = 0;
+    int receive_buffer_size = 0;
+    // The free space reserved in the connection's read buffer for each read().
+    size_t read_chunk_size = 64 * 1024;
+};
+
 class tgl_connection_base : public std::enable_shared_from_this<tgl_connection_base>
         , public tgl_connection, public tgl_online_status_observer
 {
@@ -91,10 +188,30 @@ public:
 
     virtual ssize_t read(void* buffer, size_t len) override;
     virtual ssize_t write(const void* data, size_t len) override;
+    virtual ssize_t write_buffer(std::vector<char>&& buffer, size_t offset) override;
     virtual ssize_t peek(void* data, size_t len) override;
-    virtual size_t available_bytes_for_read() override { return m_available_bytes_for_read; }
+    virtual char* peek_contiguous(size_t len) override;
+    virtual ssize_t skip(size_t len) override;
+    virtual size_t available_bytes_for_read() override { return m_read_buffer.size(); }
     virtual void flush() override;
     virtual tgl_connection_status status() const override { return m_connection_status; }
+    virtual tgl_transport transport() const override { return m_transport; }
+    virtual void round_trip_measured(double seconds) override;
+    virtual void request_sent() override;
+
+    // The smoothed round trip time and its mean deviation in seconds, negative
+    // until the first round trip was measured.
+    double smoothed_rtt() const { return m_srtt; }
+    double rtt_variance() const { return m_rttvar; }
+
+    // The number of scatter/gather writes made by write_queued() and the buffers
+    // they carried, for measuring coalescing.
+    uint64_t writev_calls() const { return m_writev_calls; }
+    uint64_t buffers_written() const { return m_buffers_written; }
+
+    // The most buffers handed to a single write_buffers() call, and the queue
+    // length at which start_queued_write() writes without waiting for flush().
+    static constexpr size_t MAX_WRITE_BUFFERS = 64;
 
     virtual void on_online_status_changed(tgl_online_status status) override;
     bool is_online() const { return m_online_status == tgl_online_status::wwan_online || m_online_status == tgl_online_status::non_wwan_online; }
@@ -112,6 +229,12 @@ protected:
 
     bool is_connecting() const { return m_state == connection_state::connecting; }
     bool ipv6_enabled() const;
+    const std::shared_ptr<tgl_timer_factory>& timer_factory() const { return m_timer_factory; }
+
+    // Subclasses report how connecting to each endpoint went so that later
+    // connects start with the best known one.
+    void record_connect_result(const tgl_endpoint& endpoint, bool success,
+            std::chrono::milliseconds rtt = std::chrono::milliseconds::zero());
     void try_read();
     void try_write();
     int32_t client_id() const;
@@ -119,11 +242,58 @@ protected:
     void close_internal(bool);
     void connect_finished(bool success);
     void data_received(const std::shared_ptr<tgl_net_buffer>& buffer);
+
+    // Receiving straight into the read buffer: prepare_receive() returns where
+    // the next bytes go and data_received(size_t) hands them to the client.
+    char* prepare_receive(size_t min_size, size_t* available);
+    void data_received(size_t len);
     void lost();
     void error();
 
     void bytes_sent(size_t bytes);
 
+    // Racing the endpoints for subclasses that open their own sockets. connect()
+    // calls connect_endpoints(), which starts an attempt on the best endpoint and
+    // another one on the next endpoint whenever the previous ones have not
+    // connected within about twice the round trip time of the last endpoint. The
+    // subclass reports how each attempt went, and the first one that connects is
+    // handed back to it through adopt_connect_attempt() while the others are closed.
+    bool connect_endpoints();
+    void connect_attempt_failed(int attempt, const std::string& reason);
+    void connect_attempt_succeeded(int attempt);
+
+    // Returns an id for the new attempt, or -1 if it could not be started.
+    virtual int start_connect_attempt(const tgl_endpoint&) { return -1; }
+    virtual void close_connect_attempt(int) { }
+    // Makes the attempt the connection's socket, false if that fails.
+    virtual bool adopt_connect_attempt(int) { return false; }
+
+    // Writing m_write_buffer_queue to the socket of a subclass. write_queued()
+    // writes until the queue is drained or the socket is full, in which case the
+    // subclass calls it again once the socket is writable. It is the only place
+    // that touches the TCP_CORK state, through set_cork().
+    bool write_queued();
+    void start_queued_write();
+    bool socket_connected() const { return m_socket_connected; }
+
+    // Subclasses call this whenever they close their socket, it also closes the
+    // connect attempts still in flight.
+    void socket_closed();
+
+    // Writes the first count queued buffers with one scatter/gather call and
+    // returns the number of bytes written. Sets would_block if the socket is full
+    // and returns -1 on errors.
+    virtual ssize_t write_buffers(size_t, bool*) { return -1; }
+    // Asks to be called through write_queued() once the socket is writable again,
+    // or no longer.
+    virtual void wait_writable(bool) { }
+    // Corks or uncorks the socket, false if it was left as it was.
+    virtual bool set_cork(bool) { return false; }
+
+    // All the addresses of the DC best first, alternating between IPv6 and IPv4
+    // while there is no history, refreshed on every open(). The first address of
+    // each family is also kept in m_ipv4_address and m_ipv6_address.
+    std::vector<tgl_endpoint> m_endpoints;
     std::string m_ipv4_address;
     std::string m_ipv6_address;
     int m_ipv4_port;
@@ -140,35 +310,73 @@ private:
     };
 
     void bytes_received(size_t bytes);
+    void received(size_t len);
     void consume_data();
     void schedule_restart();
     void restart();
 
-    void start_ping_timer();
+    void schedule_ping_check(std::chrono::steady_clock::time_point deadline);
     void stop_ping_timer();
-    void ping();
+    void check_liveness();
+    void send_probe();
+    std::chrono::milliseconds retransmission_timeout() const;
+    std::chrono::milliseconds probe_delay() const;
+    std::chrono::milliseconds dead_timeout() const;
+
+    struct connect_attempt {
+        int id;
+        tgl_endpoint endpoint;
+        std::chrono::steady_clock::time_point start_time;
+    };
+
+    bool start_next_connect_attempt();
+    void schedule_next_connect_attempt(const tgl_endpoint& endpoint);
+    void close_connect_attempts();
 
     void clear_buffers();
     void set_state(connection_state state);
+    void update_endpoints();
 
     connection_state m_state;
 
+    std::vector<std::pair<std::string, int>> m_ipv4_options;
+    std::vector<std::pair<std::string, int>> m_ipv6_options;
+
     std::shared_ptr<tgl_timer_factory> m_timer_factory;
 
+    // Reads and writes only record the time, the ping timer checks them lazily
+    // when it fires and is only rescheduled when a deadline moves earlier.
     std::shared_ptr<tgl_timer> m_ping_timer;
+    std::chrono::time_point<std::chrono::steady_clock> m_ping_check_time;
     std::chrono::time_point<std::chrono::steady_clock> m_last_receive_time;
+    // When the last request was written, see request_sent().
+    std::chrono::time_point<std::chrono::steady_clock> m_last_request_time;
+    // When the ping still waiting for an answer was sent, zero if there is none.
+    std::chrono::time_point<std::chrono::steady_clock> m_probe_time;
+    double m_srtt;
+    double m_rttvar;
 
     std::shared_ptr<tgl_timer> m_restart_timer;
     std::chrono::time_point<std::chrono::steady_clock> m_last_restart_time;
     std::chrono::milliseconds m_restart_duration;
 
-    std::deque<std::shared_ptr<tgl_net_buffer>> m_read_buffer_queue;
-    size_t m_available_bytes_for_read;
+    std::vector<connect_attempt> m_connect_attempts;
+    size_t m_next_endpoint;
+    std::shared_ptr<tgl_timer> m_connect_attempt_timer;
+
+    bool m_socket_connected;
+    bool m_corked;
+    bool m_write_blocked;
+    uint64_t m_writev_calls;
+    uint64_t m_buffers_written;
+
+    tgl_net_ring_buffer m_read_buffer;
     std::weak_ptr<tgl_mtproto_client> m_mtproto_client;
     std::weak_ptr<tgl_online_status_observer> m_this_weak_observer;
 
     tgl_online_status m_online_status;
     tgl_connection_status m_connection_status;
+    tgl_transport m_transport;
 
     bool m_destructing;
 };
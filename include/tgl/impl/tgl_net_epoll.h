@@ -0,0 +1,147 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <tgl/impl/tgl_net_base.h>
+#include <tgl/impl/tgl_timer_wheel.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// A Linux implementation of tgl_connection on top of non-blocking sockets and epoll.
+// It should include the public headers only.
+
+// Dispatches the readiness events of the sockets registered with it. An embedder
+// either calls run_once() from its own thread or adds fd() to its own poll set and
+// calls run_once(0) whenever that becomes readable.
+class tgl_epoll_loop {
+public:
+    using handler = std::function<void(uint32_t events)>;
+
+    tgl_epoll_loop();
+    ~tgl_epoll_loop();
+
+    tgl_epoll_loop(const tgl_epoll_loop&) = delete;
+    tgl_epoll_loop& operator=(const tgl_epoll_loop&) = delete;
+
+    int fd() const { return m_epoll_fd; }
+
+    bool add(int fd, uint32_t events, const handler& h);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Waits up to timeout_ms (-1 waits forever) and dispatches the events.
+    // Returns the number of events dispatched or -1 on error.
+    int run_once(int timeout_ms);
+
+private:
+    int m_epoll_fd;
+    std::unordered_map<int, handler> m_handlers;
+};
+
+// Drives all the timers of a loop from one timerfd. The timers live on a
+// tgl_timer_wheel that is advanced whenever the timerfd fires, and the timerfd is
+// only rearmed when the earliest expiry changes.
+class tgl_timer_factory_epoll : public tgl_timer_factory {
+public:
+    explicit tgl_timer_factory_epoll(const std::shared_ptr<tgl_epoll_loop>& loop,
+            std::chrono::steady_clock::duration tick = std::chrono::milliseconds(1));
+    virtual ~tgl_timer_factory_epoll();
+
+    tgl_timer_factory_epoll(const tgl_timer_factory_epoll&) = delete;
+    tgl_timer_factory_epoll& operator=(const tgl_timer_factory_epoll&) = delete;
+
+    virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) override;
+
+    const std::shared_ptr<tgl_timer_wheel>& wheel() const { return m_factory.wheel(); }
+
+private:
+    void arm(std::chrono::steady_clock::time_point expiry);
+    void timer_fired();
+
+    std::shared_ptr<tgl_epoll_loop> m_loop;
+    int m_timer_fd;
+    std::chrono::steady_clock::time_point m_armed_expiry;
+    tgl_timer_factory_wheel m_factory;
+};
+
+// Writes are queued and sent with a single writev() on flush() or once the socket
+// becomes writable again, so the length prefix and the frame of a packet leave in
+// one system call. Connecting races all the addresses of the DC, see
+// tgl_connection_base::connect_endpoints().
+class tgl_connection_epoll : public tgl_connection_base {
+public:
+    tgl_connection_epoll(const std::shared_ptr<tgl_epoll_loop>& loop,
+            const tgl_socket_options& options,
+            const std::vector<std::pair<std::string, int>>& ipv4_options,
+            const std::vector<std::pair<std::string, int>>& ipv6_options,
+            const std::weak_ptr<tgl_mtproto_client>& client);
+    virtual ~tgl_connection_epoll();
+
+protected:
+    virtual bool connect() override;
+    virtual void disconnect() override;
+    virtual void start_read() override;
+    virtual void start_write() override;
+
+    virtual int start_connect_attempt(const tgl_endpoint& endpoint) override;
+    virtual void close_connect_attempt(int fd) override;
+    virtual bool adopt_connect_attempt(int fd) override;
+    virtual ssize_t write_buffers(size_t count, bool* would_block) override;
+    virtual void wait_writable(bool writable) override;
+    virtual bool set_cork(bool cork) override;
+
+private:
+    void attempt_finished(int fd);
+    void close_socket();
+    void handle_events(uint32_t events);
+    void read_available();
+
+    std::shared_ptr<tgl_epoll_loop> m_loop;
+    tgl_socket_options m_options;
+    int m_fd;
+    bool m_watching_writable;
+};
+
+class tgl_connection_factory_epoll : public tgl_connection_factory {
+public:
+    explicit tgl_connection_factory_epoll(const std::shared_ptr<tgl_epoll_loop>& loop,
+            const tgl_socket_options& options = tgl_socket_options())
+        : m_loop(loop)
+        , m_options(options)
+    { }
+
+    virtual std::shared_ptr<tgl_connection> create_connection(
+            const std::vector<std::pair<std::string, int>>& ipv4_options,
+            const std::vector<std::pair<std::string, int>>& ipv6_options,
+            const std::weak_ptr<tgl_mtproto_client>& client) override
+    {
+        return std::make_shared<tgl_connection_epoll>(m_loop, m_options, ipv4_options, ipv6_options, client);
+    }
+
+private:
+    std::shared_ptr<tgl_epoll_loop> m_loop;
+    tgl_socket_options m_options;
+};
@@ -0,0 +1,136 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <tgl/tgl_timer.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// A tgl_timer_factory backed by a hierarchical timing wheel. It should include the public headers only.
+
+// Four levels of 256 slots each. A timer lands in the level whose span covers
+// its delay and moves down a level whenever the level below it wraps around,
+// so starting and cancelling a timer are O(1) and all timers due in the same
+// tick expire as one batch. Not thread safe: the wheel, its timers and whatever
+// drives advance() have to stay on one thread.
+class tgl_timer_wheel {
+public:
+    using clock = std::chrono::steady_clock;
+
+    class entry;
+
+    explicit tgl_timer_wheel(clock::duration tick = std::chrono::milliseconds(1));
+    ~tgl_timer_wheel();
+
+    tgl_timer_wheel(const tgl_timer_wheel&) = delete;
+    tgl_timer_wheel& operator=(const tgl_timer_wheel&) = delete;
+
+    // Schedules e to expire at the first tick at or after expiry, rescheduling
+    // it if it is scheduled already.
+    void schedule(entry* e, clock::time_point expiry);
+    void unschedule(entry* e);
+
+    // Expires everything due at now. Returns the number of expired entries.
+    size_t advance(clock::time_point now);
+
+    // When advance() has work to do next, clock::time_point::max() if nothing
+    // is scheduled. May be earlier than the next expiry when timers have to
+    // move down a level first.
+    clock::time_point next_expiry() const;
+
+    // Called whenever a schedule() outside of advance() moves next_expiry() earlier,
+    // so that whatever drives the wheel can rearm its OS timer.
+    void set_wakeup_handler(const std::function<void(clock::time_point)>& handler) { m_wakeup_handler = handler; }
+
+    size_t size() const { return m_size; }
+
+    struct link {
+        link* prev;
+        link* next;
+    };
+
+    class entry : private link {
+    public:
+        entry()
+            : link{ nullptr, nullptr }
+            , m_expiry_tick(0)
+            , m_level(0)
+            , m_slot(0)
+        { }
+        virtual ~entry() { }
+
+        bool scheduled() const { return next != nullptr; }
+
+    protected:
+        virtual void expired() = 0;
+
+    private:
+        friend class tgl_timer_wheel;
+        uint64_t m_expiry_tick;
+        uint8_t m_level;
+        uint8_t m_slot;
+    };
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr size_t SLOTS = 1 << SLOT_BITS;
+    static constexpr size_t BITMAP_WORDS = SLOTS / 64;
+
+    uint64_t tick_at(clock::time_point t) const;
+    void insert(entry* e);
+    void remove(entry* e);
+    void cascade(int level, size_t slot);
+    int find_occupied(int level, size_t from) const;
+    uint64_t compute_wakeup_tick() const;
+
+    link m_slots[LEVELS][SLOTS];
+    uint64_t m_occupied[LEVELS][BITMAP_WORDS];
+    clock::time_point m_start;
+    clock::duration m_tick;
+    // Every tick before m_current_tick has been processed.
+    uint64_t m_current_tick;
+    uint64_t m_wakeup_tick;
+    size_t m_size;
+    bool m_advancing;
+    std::function<void(clock::time_point)> m_wakeup_handler;
+};
+
+// Creates tgl_timers on a tgl_timer_wheel. The embedder drives the wheel from a
+// single OS timer: arm it for wheel()->next_expiry(), call advance() when it
+// fires and rearm it from the wakeup handler.
+class tgl_timer_factory_wheel : public tgl_timer_factory {
+public:
+    explicit tgl_timer_factory_wheel(const std::shared_ptr<tgl_timer_wheel>& wheel = std::make_shared<tgl_timer_wheel>())
+        : m_wheel(wheel)
+    { }
+
+    virtual std::shared_ptr<tgl_timer> create_timer(const std::function<void()>& cb) override;
+
+    const std::shared_ptr<tgl_timer_wheel>& wheel() const { return m_wheel; }
+
+private:
+    std::shared_ptr<tgl_timer_wheel> m_wheel;
+};
@@ -28,6 +28,7 @@
 #include "tgl_online_status.h"
 #include "tgl_online_status_observer.h"
 #include "tgl_timer.h"
+#include "tgl_transport.h"
 
 class tgl_connection;
 
@@ -39,8 +40,12 @@ public:
     virtual void connection_status_changed(const std::shared_ptr<tgl_connection>& c) = 0;
     virtual bool try_rpc_execute(const std::shared_ptr<tgl_connection>& c) = 0;
     virtual void ping() = 0;
+    // Sends a ping on the given connection, whose answer shows the connection is alive.
+    virtual void ping(const std::shared_ptr<tgl_connection>& c) { ping(); }
     virtual tgl_online_status online_status() const = 0;
     virtual bool ipv6_enabled() const = 0;
+    // The transport new connections to this client should use.
+    virtual tgl_transport transport() const { return tgl_transport::abridged; }
     virtual std::shared_ptr<tgl_timer_factory> timer_factory() const = 0;
     virtual void add_online_status_observer(const std::weak_ptr<tgl_online_status_observer>& observer) = 0;
     virtual void remove_online_status_observer(const std::weak_ptr<tgl_online_status_observer>& observer) = 0;
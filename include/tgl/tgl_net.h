@@ -26,11 +26,65 @@
 #include <vector>
 
 #include "tgl_connection_status.h"
+#include "tgl_transport.h"
 
 struct tgl_net_stats
 {
-    uint64_t bytes_sent;
-    uint64_t bytes_received;
+    uint64_t bytes_sent = 0;
+    uint64_t bytes_received = 0;
+
+    // Outgoing messages packed into msg_container frames. The average number
+    // of messages per container is messages_in_containers / containers_sent.
+    uint64_t containers_sent = 0;
+    uint64_t messages_in_containers = 0;
+    // Bytes on the wire saved by sending containers instead of one encrypted
+    // frame per message.
+    uint64_t container_bytes_saved = 0;
+
+    // Message ids acknowledged inside an outgoing frame versus by a standalone
+    // msgs_ack sent from the idle ack timer.
+    uint64_t acks_piggybacked = 0;
+    uint64_t acks_sent_standalone = 0;
+
+    // The largest buffer gzip_packed payloads were inflated into, in bytes, and
+    // how many payloads were inflated into an already allocated buffer.
+    uint64_t inflate_high_water_mark = 0;
+    uint64_t inflate_buffer_reuses = 0;
+
+    // Messages the server rejected with bad_server_salt, which were resent with
+    // the new salt, and the get_future_salts requests that keep them rare.
+    uint64_t bad_server_salts = 0;
+    uint64_t future_salts_requests = 0;
+
+    // Outgoing requests deflated into gzip_packed: how many were tried, how many
+    // got smaller and were sent packed, the bytes that saved and the time spent
+    // deflating all of them.
+    uint64_t compression_attempts = 0;
+    uint64_t messages_compressed = 0;
+    uint64_t compression_bytes_saved = 0;
+    uint64_t compression_microseconds = 0;
+
+    // Answers to requests other than file transfers and the time from sending
+    // each of them to its answer arriving. The average round trip of control
+    // requests, e.g. sending a message while an upload is running, is
+    // rpc_answer_microseconds / rpc_answers.
+    uint64_t rpc_answers = 0;
+    uint64_t rpc_answer_microseconds = 0;
+
+    // Messages that were allowed on secondary connections, how many of them
+    // went to one, and the secondary connections started and stopped for them.
+    uint64_t worker_selections = 0;
+    uint64_t secondary_worker_selections = 0;
+    uint64_t secondary_workers_spawned = 0;
+    uint64_t secondary_workers_retired = 0;
+
+    // Temporary keys negotiated on a separate connection ahead of expiry, so
+    // that switching to one only takes binding it, and the times queued
+    // requests had to wait for a temporary key to be negotiated or bound along
+    // with how long they waited in total.
+    uint64_t temp_keys_pregenerated = 0;
+    uint64_t handshake_stalls = 0;
+    uint64_t handshake_stall_microseconds = 0;
 };
 
 class tgl_connection {
@@ -38,11 +92,45 @@ public:
     virtual void open() = 0;
     virtual void close() = 0;
     virtual ssize_t write(const void* data, size_t len) = 0;
+    // Writes the bytes of buffer starting at offset, taking ownership of the buffer.
+    // Connections that can queue the buffer itself should override this to avoid a copy.
+    virtual ssize_t write_buffer(std::vector<char>&& buffer, size_t offset)
+    {
+        return write(buffer.data() + offset, buffer.size() - offset);
+    }
     virtual ssize_t read(void* data, size_t len) = 0;
     virtual ssize_t peek(void* data, size_t len) = 0;
+    // Returns the next len unread bytes in place, or nullptr if the connection can not
+    // provide them as one contiguous writable span. The span stays valid until it is
+    // released with skip() and may be modified by the caller, e.g. decrypted in place.
+    virtual char* peek_contiguous(size_t len) { return nullptr; }
+    // Discards up to len unread bytes.
+    virtual ssize_t skip(size_t len)
+    {
+        char buffer[4096];
+        ssize_t skipped = 0;
+        while (len) {
+            ssize_t result = read(buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+            if (result <= 0) {
+                break;
+            }
+            skipped += result;
+            len -= result;
+        }
+        return skipped;
+    }
     virtual size_t available_bytes_for_read() = 0;
     virtual void flush() = 0;
     virtual tgl_connection_status status() const = 0;
+    // The framing of the packets on this connection. A connection sends the
+    // marker of its transport first thing after connecting.
+    virtual tgl_transport transport() const { return tgl_transport::abridged; }
+    // Called by the client with the time between sending a request on this
+    // connection and receiving its answer.
+    virtual void round_trip_measured(double seconds) { }
+    // Called by the client after writing a frame with requests the server is
+    // going to answer. Acks and other service messages don't count.
+    virtual void request_sent() { }
 
     virtual ~tgl_connection() { }
 };
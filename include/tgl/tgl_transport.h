@@ -0,0 +1,57 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cassert>
+#include <iostream>
+#include <string>
+
+// The MTProto transport framing of a connection. The connection announces it
+// with the first bytes it sends.
+enum class tgl_transport {
+    // 0xef, then a 1 or 4 byte length in words in front of every packet.
+    abridged,
+    // 0xeeeeeeee, then a 4 byte length in bytes in front of every packet.
+    intermediate,
+    // 0xdddddddd, then like intermediate but with 0 to 15 random bytes after every packet.
+    padded_intermediate,
+};
+
+inline static std::string to_string(tgl_transport transport)
+{
+    switch (transport) {
+    case tgl_transport::abridged:
+        return "abridged";
+    case tgl_transport::intermediate:
+        return "intermediate";
+    case tgl_transport::padded_intermediate:
+        return "padded intermediate";
+    default:
+        assert(false);
+        return "unknown transport";
+    }
+}
+
+inline static std::ostream& operator<<(std::ostream& os, tgl_transport transport)
+{
+    os << to_string(transport);
+    return os;
+}
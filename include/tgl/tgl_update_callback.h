@@ -99,6 +99,10 @@ public:
     virtual void our_id(int32_t id) = 0;
     virtual void notification(const std::string& type, const std::string& message) = 0;
     virtual void dc_updated(const tgl_dc* dc) = 0;
+    // A DH prime passed the primality checks. Handing the fingerprint back
+    // through tgl_user_agent::add_validated_dh_prime() on the next start skips
+    // the checks for this prime. Persisting it is optional.
+    virtual void dh_prime_validated(const std::string& fingerprint) { }
     virtual void active_dc_changed(int32_t new_dc_id) = 0;
     virtual void connection_status_changed(tgl_connection_status status) = 0;
     virtual ~tgl_update_callback() { }
@@ -60,6 +60,16 @@ public:
     virtual void set_dc_option(bool is_v6, int id, const std::string& ip, int port) = 0;
     virtual void set_dc_logged_in(int dc_id) = 0;
     virtual void set_active_dc(int dc_id) = 0;
+    // Restores a DH prime fingerprint reported by tgl_update_callback::dh_prime_validated.
+    virtual void add_validated_dh_prime(const std::string& fingerprint) = 0;
+    // An opaque snapshot of the session with each DC: the bound temporary key
+    // and its expiry, the server salts, the session id and message counters.
+    // Take it right before shut_down() and store it as securely as the auth
+    // keys. Handing it to resume_sessions() on the next start, after the auth
+    // keys and DC options were restored and before anything is sent, lets the
+    // DCs whose keys are still valid carry on without any handshake.
+    virtual std::string session_snapshot() const = 0;
+    virtual void resume_sessions(const std::string& snapshot) = 0;
 
     virtual void set_our_id(int32_t id) = 0;
     virtual const tgl_peer_id_t& our_id() const = 0;
@@ -72,6 +82,16 @@ public:
 
     virtual void set_pfs_enabled(bool) = 0;
     virtual void set_ipv6_enabled(bool) = 0;
+    // The transport framing of new connections, for all DCs or for one DC.
+    // The setting for a DC takes precedence.
+    virtual void set_transport(tgl_transport) = 0;
+    virtual void set_dc_transport(int dc_id, tgl_transport) = 0;
+    // Requests of at least this many bytes are sent gzip_packed whenever that
+    // makes them smaller. 0, the default, sends everything as it is.
+    virtual void set_compression_threshold(size_t bytes) = 0;
+    // Uploads and downloads run on separate sessions and connections per DC so
+    // that they never queue ahead of other requests. Enabled by default.
+    virtual void set_media_sessions_enabled(bool enabled) = 0;
 
     virtual void reset_authorization() = 0;
     virtual void add_rsa_key(const std::string& key) = 0;
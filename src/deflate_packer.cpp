@@ -0,0 +1,92 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "deflate_packer.h"
+
+#include "mtproto_common.h"
+#include "tgl/tgl_log.h"
+
+#include <cstring>
+#include <zlib.h>
+
+namespace tgl {
+namespace impl {
+
+deflate_packer::deflate_packer()
+    : m_stream(new z_stream)
+    , m_stream_initialized(false)
+{
+    memset(m_stream.get(), 0, sizeof(z_stream));
+}
+
+deflate_packer::~deflate_packer()
+{
+    if (m_stream_initialized) {
+        deflateEnd(m_stream.get());
+    }
+}
+
+std::shared_ptr<mtprotocol_serializer> deflate_packer::pack(const mtprotocol_serializer& message)
+{
+    if (!m_stream_initialized) {
+        if (deflateInit2(m_stream.get(), Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            TGL_ERROR("failed to call deflateInit2");
+            return nullptr;
+        }
+        m_stream_initialized = true;
+    } else if (deflateReset(m_stream.get()) != Z_OK) {
+        TGL_ERROR("failed to call deflateReset");
+        return nullptr;
+    }
+
+    // Anything that does not fit in the original size is not worth sending.
+    size_t size = message.char_size();
+    if (m_buffer.size() < size) {
+        m_buffer.resize(size);
+    }
+
+    z_stream* strm = m_stream.get();
+    strm->next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(message.char_data()));
+    strm->avail_in = size;
+    strm->next_out = m_buffer.data();
+    strm->avail_out = size;
+
+    int err = deflate(strm, Z_FINISH);
+    if (err != Z_STREAM_END) {
+        if (err != Z_OK && err != Z_BUF_ERROR) {
+            TGL_ERROR("deflate error = " << err);
+        }
+        return nullptr;
+    }
+
+    size_t packed_size = strm->total_out;
+    size_t packed_ints = 1 + mtprotocol_serializer::string_i32_size(packed_size);
+    if (packed_ints >= message.i32_size()) {
+        return nullptr;
+    }
+
+    auto packed = std::make_shared<mtprotocol_serializer>(packed_ints);
+    packed->out_i32(CODE_gzip_packed);
+    packed->out_string(reinterpret_cast<const char*>(m_buffer.data()), packed_size);
+    return packed;
+}
+
+}
+}
@@ -0,0 +1,56 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+struct z_stream_s;
+
+namespace tgl {
+namespace impl {
+
+class mtprotocol_serializer;
+
+// Packs outgoing messages into gzip_packed objects. One deflate stream and one
+// output buffer are reused for every message.
+class deflate_packer
+{
+public:
+    deflate_packer();
+    ~deflate_packer();
+
+    deflate_packer(const deflate_packer&) = delete;
+    deflate_packer& operator=(const deflate_packer&) = delete;
+
+    // Returns the message wrapped in gzip_packed, or nullptr if that would not
+    // make it smaller or deflating failed.
+    std::shared_ptr<mtprotocol_serializer> pack(const mtprotocol_serializer& message);
+
+private:
+    std::unique_ptr<z_stream_s> m_stream;
+    bool m_stream_initialized;
+    std::vector<unsigned char> m_buffer;
+};
+
+}
+}
@@ -55,6 +55,14 @@ public:
         }
     }
 
+    download_data(const char* data, size_t length)
+        : m_ref_data(nullptr)
+        , m_owning_data(new char[length])
+        , m_length(length)
+    {
+        memcpy(m_owning_data.get(), data, length);
+    }
+
     char* data() const { return m_owning_data ? m_owning_data.get() : m_ref_data; }
     size_t length() const { return m_length; }
     operator bool() const { return !!data() && !!length(); }
@@ -0,0 +1,180 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "ds_arena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace tgl {
+namespace impl {
+
+static constexpr size_t DS_ARENA_BLOCK_SIZE = 64 * 1024;
+static constexpr size_t DS_ARENA_MAX_RESERVED = 1024 * 1024;
+static constexpr size_t DS_ARENA_ALIGNMENT = alignof(std::max_align_t);
+
+ds_arena::scope::scope()
+    : m_arena(ds_arena::current())
+    , m_block(m_arena.m_block)
+    , m_offset(m_arena.m_offset)
+{
+    m_arena.m_depth++;
+}
+
+ds_arena::scope::~scope()
+{
+    assert(m_arena.m_depth > 0);
+    m_arena.m_depth--;
+    m_arena.release(m_block, m_offset);
+}
+
+ds_arena::fetch_scope::fetch_scope()
+    : m_arena(ds_arena::current())
+{
+    assert(m_arena.m_depth > 0);
+    m_arena.m_fetching++;
+}
+
+ds_arena::fetch_scope::~fetch_scope()
+{
+    assert(m_arena.m_fetching > 0);
+    m_arena.m_fetching--;
+}
+
+ds_arena& ds_arena::current()
+{
+    static thread_local ds_arena arena;
+    return arena;
+}
+
+ds_alloc_stats& ds_arena::stats()
+{
+    static thread_local ds_alloc_stats stats;
+    return stats;
+}
+
+ds_arena::ds_arena()
+    : m_blocks()
+    , m_block(0)
+    , m_offset(0)
+    , m_reserved(0)
+    , m_depth(0)
+    , m_fetching(0)
+{
+}
+
+void* ds_arena::allocate(size_t size)
+{
+    assert(active());
+    size = (std::max<size_t>(size, 1) + DS_ARENA_ALIGNMENT - 1) & ~(DS_ARENA_ALIGNMENT - 1);
+
+    while (m_block < m_blocks.size()) {
+        block& b = m_blocks[m_block];
+        if (m_offset + size <= b.size) {
+            void* ptr = b.data.get() + m_offset;
+            m_offset += size;
+            return ptr;
+        }
+        m_block++;
+        m_offset = 0;
+    }
+
+    size_t block_size = std::max(size, DS_ARENA_BLOCK_SIZE);
+    m_blocks.push_back(block { std::unique_ptr<char[]>(new char[block_size]), block_size });
+    m_reserved += block_size;
+    m_block = m_blocks.size() - 1;
+    m_offset = size;
+    return m_blocks.back().data.get();
+}
+
+bool ds_arena::owns(const void* ptr) const
+{
+    // Nothing is handed out outside of a scope, which is where almost every
+    // free_ds runs, and within one only the blocks up to the current one are.
+    if (m_block == 0 && m_offset == 0) {
+        return false;
+    }
+
+    const char* p = static_cast<const char*>(ptr);
+    for (size_t i = 0; i <= m_block && i < m_blocks.size(); ++i) {
+        const char* begin = m_blocks[i].data.get();
+        size_t used = i == m_block ? m_offset : m_blocks[i].size;
+        if (p >= begin && p < begin + used) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ds_arena::release(size_t block, size_t offset)
+{
+    m_block = block;
+    m_offset = offset;
+
+    if (m_depth == 0) {
+        assert(m_block == 0 && m_offset == 0);
+        // Keep the blocks for the next response but don't hold on to the
+        // memory an unusually large one needed.
+        while (m_reserved > DS_ARENA_MAX_RESERVED && m_blocks.size() > 1) {
+            m_reserved -= m_blocks.back().size;
+            m_blocks.pop_back();
+        }
+    }
+}
+
+void* ds_malloc(size_t size)
+{
+    ds_arena& arena = ds_arena::current();
+    if (arena.active()) {
+        ds_arena::stats().arena_allocations++;
+        return arena.allocate(size);
+    }
+    ds_arena::stats().heap_allocations++;
+    return malloc(size);
+}
+
+void* ds_calloc(size_t count, size_t size)
+{
+    ds_arena& arena = ds_arena::current();
+    if (arena.active()) {
+        if (size && count > std::numeric_limits<size_t>::max() / size) {
+            return nullptr;
+        }
+        ds_arena::stats().arena_allocations++;
+        void* ptr = arena.allocate(count * size);
+        memset(ptr, 0, count * size);
+        return ptr;
+    }
+    ds_arena::stats().heap_allocations++;
+    return calloc(count, size);
+}
+
+void ds_free(void* ptr)
+{
+    if (!ds_arena_owns(ptr)) {
+        free(ptr);
+    }
+}
+
+}
+}
@@ -0,0 +1,121 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// Allocation counters of the calling thread, see ds_malloc and ds_calloc.
+struct ds_alloc_stats {
+    uint64_t heap_allocations = 0;
+    uint64_t arena_allocations = 0;
+};
+
+// Bump allocator for the structures produced by the generated fetch_ds code.
+// While a fetch_scope is open inside a scope every fetch_ds allocation on this
+// thread is carved out of the arena, free_ds of such a structure is a no-op and
+// the whole tree is released at once when the scope closes. Everything else,
+// in particular structures fetched by the handlers of the decoded tree which may
+// outlive it, falls back to malloc and free.
+class ds_arena
+{
+public:
+    // Marks the arena on construction and releases everything allocated after
+    // the mark on destruction. Scopes nest, so a response decoded while
+    // handling another one does not clobber the outer structures.
+    class scope
+    {
+    public:
+        scope();
+        ~scope();
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        ds_arena& m_arena;
+        size_t m_block;
+        size_t m_offset;
+    };
+
+    // Routes the fetch_ds allocations of the calling thread to the arena while
+    // it lives. Open it around the fetch of a tree only, never around the code
+    // handling the tree.
+    class fetch_scope
+    {
+    public:
+        fetch_scope();
+        ~fetch_scope();
+
+        fetch_scope(const fetch_scope&) = delete;
+        fetch_scope& operator=(const fetch_scope&) = delete;
+
+    private:
+        ds_arena& m_arena;
+    };
+
+    static ds_arena& current();
+
+    bool active() const { return m_depth > 0 && m_fetching > 0; }
+    void* allocate(size_t size);
+    bool owns(const void* ptr) const;
+
+    // The memory the arena keeps around between responses, in bytes.
+    size_t reserved() const { return m_reserved; }
+
+    static ds_alloc_stats& stats();
+
+private:
+    struct block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    ds_arena();
+
+    void release(size_t block, size_t offset);
+
+    std::vector<block> m_blocks;
+    size_t m_block;
+    size_t m_offset;
+    size_t m_reserved;
+    int m_depth;
+    int m_fetching;
+};
+
+void* ds_malloc(size_t size);
+void* ds_calloc(size_t count, size_t size);
+void ds_free(void* ptr);
+
+// Whether ptr was handed out by the arena of this thread, whatever scope is
+// open, so that free_ds never passes arena memory to free().
+inline bool ds_arena_owns(const void* ptr)
+{
+    return ptr && ds_arena::current().owns(ptr);
+}
+
+}
+}
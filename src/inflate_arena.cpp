@@ -0,0 +1,161 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "inflate_arena.h"
+
+#include "mtproto_common.h"
+#include "tgl/tgl_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace tgl {
+namespace impl {
+
+static constexpr size_t MIN_INFLATE_BUFFER_SIZE = 64 * 1024;
+
+inflate_arena::lease::lease(inflate_arena& arena)
+    : m_arena(arena)
+    , m_buffer()
+{
+}
+
+inflate_arena::lease::~lease()
+{
+    if (m_buffer) {
+        m_arena.release(std::move(m_buffer));
+    }
+}
+
+bool inflate_arena::lease::inflate(const void* input, size_t length, tgl_in_buffer* in)
+{
+    if (!m_buffer) {
+        m_buffer = m_arena.acquire();
+    }
+    size_t total_out = 0;
+    if (!m_arena.inflate_into(*m_buffer, input, length, &total_out)) {
+        return false;
+    }
+    in->ptr = m_buffer->data();
+    in->end = in->ptr + total_out / 4;
+    return true;
+}
+
+inflate_arena::inflate_arena()
+    : m_stream(new z_stream)
+    , m_stream_initialized(false)
+    , m_high_water_mark(0)
+    , m_reuse_count(0)
+{
+    memset(m_stream.get(), 0, sizeof(z_stream));
+}
+
+inflate_arena::~inflate_arena()
+{
+    if (m_stream_initialized) {
+        inflateEnd(m_stream.get());
+    }
+}
+
+std::unique_ptr<std::vector<int32_t>> inflate_arena::acquire()
+{
+    if (m_free_buffers.empty()) {
+        return std::unique_ptr<std::vector<int32_t>>(new std::vector<int32_t>());
+    }
+    auto buffer = std::move(m_free_buffers.back());
+    m_free_buffers.pop_back();
+    return buffer;
+}
+
+void inflate_arena::release(std::unique_ptr<std::vector<int32_t>>&& buffer)
+{
+    m_free_buffers.push_back(std::move(buffer));
+}
+
+bool inflate_arena::inflate_into(std::vector<int32_t>& buffer, const void* input, size_t length, size_t* total_out)
+{
+    if (!m_stream_initialized) {
+        if (inflateInit2(m_stream.get(), 16 + MAX_WBITS) != Z_OK) {
+            TGL_ERROR("failed to call inflateInit2");
+            return false;
+        }
+        m_stream_initialized = true;
+    } else if (inflateReset(m_stream.get()) != Z_OK) {
+        TGL_ERROR("failed to call inflateReset");
+        return false;
+    }
+
+    // The gzip trailer ends with the uncompressed size modulo 2^32, which lets us
+    // size the buffer up front in the common case.
+    size_t expected_size = MIN_INFLATE_BUFFER_SIZE;
+    if (length >= 4) {
+        uint32_t isize;
+        memcpy(&isize, static_cast<const char*>(input) + length - 4, 4);
+        expected_size = std::max(expected_size, static_cast<size_t>(isize) + 4);
+    }
+    expected_size = std::min(expected_size, max_size());
+
+    if (buffer.empty()) {
+        buffer.resize(expected_size / 4);
+    } else {
+        m_reuse_count++;
+        if (buffer.size() * 4 < expected_size) {
+            buffer.resize(expected_size / 4);
+        }
+    }
+
+    z_stream* strm = m_stream.get();
+    strm->next_in = const_cast<Bytef*>(static_cast<const Bytef*>(input));
+    strm->avail_in = length;
+    strm->next_out = reinterpret_cast<Bytef*>(buffer.data());
+    strm->avail_out = buffer.size() * 4;
+
+    int err;
+    while ((err = inflate(strm, Z_NO_FLUSH)) == Z_OK || (err == Z_BUF_ERROR && !strm->avail_out)) {
+        if (strm->avail_out) {
+            if (!strm->avail_in) {
+                break;
+            }
+            continue;
+        }
+        size_t used = buffer.size() * 4;
+        if (used >= max_size()) {
+            TGL_ERROR("inflated data exceeds " << max_size() << " bytes");
+            return false;
+        }
+        buffer.resize(std::min(used * 2, max_size()) / 4);
+        strm->next_out = reinterpret_cast<Bytef*>(buffer.data()) + used;
+        strm->avail_out = buffer.size() * 4 - used;
+    }
+
+    m_high_water_mark = std::max(m_high_water_mark, buffer.size() * 4);
+
+    if (err != Z_STREAM_END) {
+        TGL_ERROR("inflate error = " << err << ", inflated " << strm->total_out << " bytes");
+        return false;
+    }
+
+    *total_out = strm->total_out;
+    return true;
+}
+
+}
+}
@@ -0,0 +1,89 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct z_stream_s;
+
+namespace tgl {
+namespace impl {
+
+struct tgl_in_buffer;
+
+// Keeps the buffers gzip_packed payloads are inflated into so that they can be
+// reused across responses instead of allocating the maximum size every time.
+// Buffers only grow to the largest decompressed size seen so far.
+class inflate_arena
+{
+public:
+    // Holds one inflated payload. The buffer goes back to the arena when this
+    // is destroyed. Nested payloads get their own buffers.
+    class lease
+    {
+    public:
+        explicit lease(inflate_arena& arena);
+        ~lease();
+
+        lease(const lease&) = delete;
+        lease& operator=(const lease&) = delete;
+
+        // Inflates the gzip stream and points in at the result.
+        // Returns false if the stream is corrupt or inflates beyond max_size().
+        bool inflate(const void* input, size_t length, tgl_in_buffer* in);
+
+    private:
+        inflate_arena& m_arena;
+        std::unique_ptr<std::vector<int32_t>> m_buffer;
+    };
+
+    inflate_arena();
+    ~inflate_arena();
+
+    inflate_arena(const inflate_arena&) = delete;
+    inflate_arena& operator=(const inflate_arena&) = delete;
+
+    static constexpr size_t max_size() { return 1 << 24; }
+
+    // The largest buffer the arena ever had to hold, in bytes.
+    size_t high_water_mark() const { return m_high_water_mark; }
+
+    // How many payloads were inflated into a buffer that was already allocated.
+    uint64_t reuse_count() const { return m_reuse_count; }
+    void reset_reuse_count() { m_reuse_count = 0; }
+
+private:
+    std::unique_ptr<std::vector<int32_t>> acquire();
+    void release(std::unique_ptr<std::vector<int32_t>>&& buffer);
+    bool inflate_into(std::vector<int32_t>& buffer, const void* input, size_t length, size_t* total_out);
+
+    std::unique_ptr<z_stream_s> m_stream;
+    bool m_stream_initialized;
+    std::vector<std::unique_ptr<std::vector<int32_t>>> m_free_buffers;
+    size_t m_high_water_mark;
+    uint64_t m_reuse_count;
+};
+
+}
+}
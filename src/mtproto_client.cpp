@@ -30,7 +30,9 @@
 #include "crypto/crypto_rand.h"
 #include "crypto/crypto_rsa_pem.h"
 #include "crypto/crypto_sha.h"
+#include "inflate_arena.h"
 #include "mtproto_common.h"
+#include "mtproto_transport.h"
 #include "mtproto_utils.h"
 #include "query/query_bind_temp_auth_key.h"
 #include "query/query_export_auth.h"
@@ -65,6 +67,36 @@ static constexpr int MAX_MESSAGE_INTS = 1048576;
 static constexpr int ACK_TIMEOUT = 1;
 static constexpr size_t MAX_SECONDARY_WORKERS_PER_SESSION = 3;
 static constexpr double MAX_SECONDARY_WORKER_IDLE_TIME = 15.0;
+// A secondary worker is only started once even the least loaded worker has this
+// many bytes waiting for an answer, and an idle one is only stopped while the
+// least loaded of the others has less than half of it, so that a burst of small
+// requests neither opens connections nor makes them flap.
+static constexpr size_t SECONDARY_WORKER_SPAWN_BYTES = 128 * 1024;
+static constexpr size_t SECONDARY_WORKER_RETIRE_BYTES = SECONDARY_WORKER_SPAWN_BYTES / 2;
+// Round trips below this, or not measured yet, don't make a worker look faster.
+static constexpr double WORKER_MIN_RTT = 0.05;
+static constexpr size_t MAX_CONTAINER_MESSAGES = 1020;
+static constexpr size_t MAX_CONTAINER_INTS = (1 << 20) / 4;
+static constexpr size_t CONTAINER_HEADER_INTS = 2; // CODE_msg_container + count
+static constexpr size_t CONTAINER_ENTRY_HEADER_INTS = 4; // msg_id + seq_no + bytes
+// Each salt is valid for about an hour and the server hands out at most 64 at a
+// time. More are asked for once the known ones run out within the refresh time.
+static constexpr int32_t FUTURE_SALTS_COUNT = 32;
+static constexpr double FUTURE_SALTS_REFRESH_TIME = 2 * 3600;
+static constexpr double FUTURE_SALTS_REQUEST_TIMEOUT = 60;
+// The next temporary key is negotiated in the background once this much of the
+// lifetime of the current one has passed, which leaves plenty of time for a slow
+// or retried handshake before the server starts rejecting the current key.
+static constexpr double TEMP_KEY_REFRESH_FRACTION = 0.75;
+// A saved temporary key is only resumed with if it stays valid at least this long.
+static constexpr int32_t TEMP_KEY_RESUME_MIN_LIFETIME = 60;
+// Flags of a session record in session_snapshot().
+static constexpr int32_t SESSION_RECORD_PFS = 1 << 0;
+static constexpr int32_t SESSION_RECORD_CONFIGURED = 1 << 1;
+static constexpr int32_t SESSION_RECORD_SESSION = 1 << 2;
+static constexpr int32_t SESSION_RECORD_MAX_SALTS = 64;
+// flags, auth key ids, expiry, temp key, time delta, salt, session id, seq_no, last msg_id, salt count
+static constexpr ssize_t SESSION_RECORD_FIXED_INTS = 1 + 2 + 2 + 1 + 64 + 2 + 2 + 2 + 1 + 2 + 1;
 
 #pragma pack(push,4)
 struct encrypted_message {
@@ -119,13 +151,20 @@ inline static std::ostream& operator<<(std::ostream& os, mtproto_client::state s
     return os;
 }
 
-mtproto_client::mtproto_client(user_agent& ua, int32_t id)
+mtproto_client::mtproto_client(user_agent& ua, int32_t id, bool is_media)
     : m_user_agent(ua)
     , m_id(id)
+    , m_is_media(is_media)
     , m_state(state::init)
     , m_auth_key_id(0)
     , m_temp_auth_key_id(0)
+    , m_prev_temp_auth_key_id(0)
+    , m_next_temp_auth_key_id(0)
+    , m_next_server_salt(0)
+    , m_temp_key_switch_msg_id(0)
+    , m_temp_key_expires(0)
     , m_server_salt(0)
+    , m_future_salts_request_time(0)
     , m_server_time_delta(0)
     , m_server_time_udelta(0)
     , m_auth_transfer_in_process(false)
@@ -135,10 +174,14 @@ mtproto_client::mtproto_client(user_agent& ua, int32_t id)
     , m_configured(false)
     , m_bound(false)
     , m_session_cleanup_timer()
+    , m_temp_key_refresh_time(0)
+    , m_temp_key_handshake_start(0)
     , m_rsa_key()
 {
     memset(m_auth_key.data(), 0, m_auth_key.size());
     memset(m_temp_auth_key.data(), 0, m_temp_auth_key.size());
+    memset(m_prev_temp_auth_key.data(), 0, m_prev_temp_auth_key.size());
+    memset(m_next_temp_auth_key.data(), 0, m_next_temp_auth_key.size());
     memset(m_nonce.data(), 0, m_nonce.size());
     memset(m_new_nonce.data(), 0, m_new_nonce.size());
     memset(m_server_nonce.data(), 0, m_server_nonce.size());
@@ -150,10 +193,10 @@ void mtproto_client::ping()
         return;
     }
 
-    int32_t buffer[3];
-    buffer[0] = CODE_ping;
-    *reinterpret_cast<int64_t*>(buffer + 1) = tgl_random<int64_t>();
-    send_message(buffer, 3);
+    auto s = std::make_shared<mtprotocol_serializer>(3);
+    s->out_i32(CODE_ping);
+    s->out_i64(tgl_random<int64_t>());
+    send_message(s);
 }
 
 bool mtproto_client::try_rpc_execute(const std::shared_ptr<tgl_connection>& c)
@@ -165,44 +208,24 @@ bool mtproto_client::try_rpc_execute(const std::shared_ptr<tgl_connection>& c)
 
     assert(c);
 
+    const mtproto_transport& transport = mtproto_transport::get(c->transport());
     while (true) {
-        if (c->available_bytes_for_read() < 1) {
+        size_t len = 0;
+        int header_size = transport.peek_header(*c, &len);
+        if (header_size < 0) {
+            TGL_WARNING("malformed " << c->transport() << " transport header from DC " << m_id);
+            return false;
+        }
+        if (!header_size || c->available_bytes_for_read() < header_size + len) {
             return true;
         }
-        unsigned len = 0;
-        ssize_t result = c->peek(&len, 1);
-        TGL_ASSERT_UNUSED(result, result == 1);
-        if (len >= 1 && len <= 0x7e) {
-            if (c->available_bytes_for_read() < 1 + 4 * len) {
-                return true;
-            }
-        } else {
-            if (c->available_bytes_for_read() < 4) {
-                return true;
-            }
-            result = c->peek(&len, 4);
-            TGL_ASSERT_UNUSED(result, result == 4);
-            len = (len >> 8);
-            if (c->available_bytes_for_read() < 4 + 4 * len) {
-                return true;
-            }
-            len = 0x7f;
+        if (len < 4) {
+            TGL_WARNING("packet of " << len << " bytes from DC " << m_id << " is too short");
+            return false;
         }
 
-        if (len >= 1 && len <= 0x7e) {
-            unsigned t = 0;
-            result = c->read(&t, 1);
-            TGL_ASSERT_UNUSED(result, result == 1);
-            TGL_ASSERT(t == len);
-            TGL_ASSERT(len >= 1);
-        } else {
-            TGL_ASSERT(len == 0x7f);
-            result = c->read(&len, 4);
-            TGL_ASSERT_UNUSED(result, result == 4);
-            len = (len >> 8);
-            TGL_ASSERT(len >= 1);
-        }
-        len *= 4;
+        ssize_t result = c->skip(header_size);
+        TGL_ASSERT_UNUSED(result, result == header_size);
         int op;
         result = c->peek(&op, 4);
         TGL_ASSERT_UNUSED(result, result == 4);
@@ -214,6 +237,70 @@ bool mtproto_client::try_rpc_execute(const std::shared_ptr<tgl_connection>& c)
 
 #define MAX_RESPONSE_SIZE        (1L << 24)
 
+// A frame is MTPROTO_TRANSPORT_HEADER_SIZE free bytes followed by the packet, for
+// encrypted frames MTPROTO_FRAME_HEADER_SIZE bytes of header (the free bytes and the
+// encrypted_message header) and the encrypted payload. This fills in the length prefix
+// of the connection's transport right in front of the packet and hands the frame over
+// to the connection, followed by the padding the transport asks for.
+static void send_frame(const std::shared_ptr<tgl_connection>& c, std::vector<char>&& frame)
+{
+    static_assert(MTPROTO_FRAME_HEADER_SIZE == MTPROTO_TRANSPORT_HEADER_SIZE + offsetof(encrypted_message, message),
+            "frame header size mismatch");
+    const mtproto_transport& transport = mtproto_transport::get(c->transport());
+    size_t len = frame.size() - MTPROTO_TRANSPORT_HEADER_SIZE;
+    assert(len > 0 && !(len & 0xfc000003));
+
+    size_t padding_len = transport.padding_size();
+    size_t offset = MTPROTO_TRANSPORT_HEADER_SIZE - transport.header_size(len);
+    transport.write_header(frame.data() + MTPROTO_TRANSPORT_HEADER_SIZE, len, padding_len);
+
+    ssize_t result = c->write_buffer(std::move(frame), offset);
+    TGL_ASSERT_UNUSED(result, result == static_cast<ssize_t>(len + MTPROTO_TRANSPORT_HEADER_SIZE - offset));
+    if (padding_len) {
+        unsigned char padding[16];
+        TGLC_rand_pseudo_bytes(padding, padding_len);
+        result = c->write(padding, padding_len);
+        TGL_ASSERT_UNUSED(result, result == static_cast<ssize_t>(padding_len));
+    }
+    c->flush();
+}
+
+void mtproto_client::ping(const std::shared_ptr<tgl_connection>& c)
+{
+    if (!is_configured() || !m_session || m_state != state::authorized || !m_temp_auth_key_id) {
+        return;
+    }
+
+    std::shared_ptr<worker> w;
+    if (m_session->primary_worker && m_session->primary_worker->connection == c) {
+        w = m_session->primary_worker;
+    } else {
+        for (const auto& secondary_worker: m_session->secondary_workers) {
+            if (secondary_worker->connection == c) {
+                w = secondary_worker;
+                break;
+            }
+        }
+    }
+    if (!w) {
+        ping();
+        return;
+    }
+
+    // The pong has to come back on the connection being probed, so send the
+    // ping on it rather than on whatever worker send_message() would pick.
+    flush_send_queue(w);
+    int32_t msg[3];
+    msg[0] = CODE_ping;
+    int64_t ping_id = tgl_random<int64_t>();
+    memcpy(msg + 1, &ping_id, 8);
+    ensure_session_id();
+    int64_t msg_id = generate_next_msg_id();
+    m_session->add_job(w, msg_id, sizeof(msg), std::chrono::steady_clock::now());
+    // Not content related, like the ping sent by ping().
+    send_frame(c, encrypt_message(msg, 3, msg_id, next_seq_no(false)));
+}
+
 void mtproto_client::rpc_send_packet(const char* data, size_t len)
 {
     struct {
@@ -227,44 +314,20 @@ void mtproto_client::rpc_send_packet(const char* data, size_t len)
     unenc_msg_header.out_msg_id = generate_next_msg_id();
     unenc_msg_header.msg_len = len;
 
-    int total_len = len + 20;
-    assert(total_len > 0 && !(total_len & 0xfc000003));
-    total_len >>= 2;
+    size_t total_len = len + 20;
+    assert(!(total_len & 0xfc000003));
     TGL_DEBUG("writing packet: total_len = " << total_len << ", len = " << len);
 
-    const std::shared_ptr<tgl_connection>& c = m_session->primary_worker->connection;
-    if (total_len < 0x7f) {
-        int result = c->write(&total_len, 1);
-        TGL_ASSERT_UNUSED(result, result == 1);
-    } else {
-        total_len = (total_len << 8) | 0x7f;
-        int result = c->write(&total_len, 4);
-        TGL_ASSERT_UNUSED(result, result == 4);
-    }
-    c->write(&unenc_msg_header, 20);
-    c->write(data, len);
-    c->flush();
-}
+    // Hand the whole packet to the connection in one buffer rather than one write per part.
+    std::vector<char> packet;
+    packet.reserve(MTPROTO_TRANSPORT_HEADER_SIZE + total_len);
+    packet.resize(MTPROTO_TRANSPORT_HEADER_SIZE);
+    packet.insert(packet.end(), reinterpret_cast<const char*>(&unenc_msg_header), reinterpret_cast<const char*>(&unenc_msg_header) + 20);
+    packet.insert(packet.end(), data, data + len);
 
-static int rpc_send_message(const std::shared_ptr<tgl_connection>& c, void* data, int len)
-{
-    assert(len > 0 && !(len & 0xfc000003));
-
-    int total_len = len >> 2;
-    if (total_len < 0x7f) {
-        int result = c->write(&total_len, 1);
-        TGL_ASSERT_UNUSED(result, result == 1);
-    } else {
-        total_len = (total_len << 8) | 0x7f;
-        int result = c->write(&total_len, 4);
-        TGL_ASSERT_UNUSED(result, result == 4);
-    }
-
-    int result = c->write(data, len);
-    TGL_ASSERT_UNUSED(result, result == len);
-    c->flush();
-
-    return 1;
+    send_frame(m_session->primary_worker->connection, std::move(packet));
+    // Each step of the key exchange is answered.
+    m_session->primary_worker->connection->request_sent();
 }
 
 static int check_unauthorized_header(tgl_in_buffer* in)
@@ -318,12 +381,13 @@ void mtproto_client::send_req_pq_temp_packet()
     m_state = state::reqpq_sent_temp;
 }
 
-void mtproto_client::send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp_key, int32_t temp_key_expire_time)
+bool mtproto_client::send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp_key, int32_t temp_key_expire_time)
 {
     std::unique_ptr<TGLC_bn, TGLC_bn_deleter> p(TGLC_bn_new());
     std::unique_ptr<TGLC_bn, TGLC_bn_deleter> q(TGLC_bn_new());
-    auto result = bn_factorize(pq, p.get(), q.get());
-    TGL_ASSERT_UNUSED(result, result >= 0);
+    if (bn_factorize(pq, p.get(), q.get()) < 0) {
+        return false;
+    }
 
     mtprotocol_serializer s;
     size_t at = s.reserve_i32s(5);
@@ -367,6 +431,7 @@ void mtproto_client::send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp
     m_state = temp_key ? state::reqdh_sent_temp : state::reqdh_sent;
     TGL_DEBUG("sending request dh (temp_key=" << std::boolalpha << temp_key << ") to DC " << m_id);
     rpc_send_packet(s.char_data(), s.char_size());
+    return true;
 }
 
 void mtproto_client::send_dh_params(TGLC_bn_ctx* ctx, TGLC_bn* dh_prime, TGLC_bn* g_a, int g, bool temp_key)
@@ -479,7 +544,10 @@ bool mtproto_client::process_respq_answer(const char* packet, int len, bool temp
         return false;
     }
 
-    send_req_dh_packet(m_user_agent.bn_ctx()->ctx, pq.get(), temp_key, m_user_agent.temp_key_expire_time());
+    if (!send_req_dh_packet(m_user_agent.bn_ctx()->ctx, pq.get(), temp_key, m_user_agent.temp_key_expire_time())) {
+        TGL_ERROR("can not factorize pq for DC " << m_id);
+        return false;
+    }
 
     return true;
 }
@@ -576,7 +644,7 @@ bool mtproto_client::process_dh_answer(const char* packet, int len, bool temp_ke
     result = fetch_bignum(&in, g_a.get());
     TGL_ASSERT_UNUSED(result, result > 0);
 
-    if (tglmp_check_DH_params(m_user_agent.bn_ctx()->ctx, dh_prime.get(), g) < 0) {
+    if (!m_user_agent.check_dh_params(dh_prime.get(), g)) {
         TGL_ERROR("bad DH params");
         return false;
     }
@@ -610,6 +678,9 @@ bool mtproto_client::process_dh_answer(const char* packet, int len, bool temp_ke
 
 void mtproto_client::create_temp_auth_key()
 {
+    if (!is_temp_key_generator() && !m_temp_key_handshake_start) {
+        m_temp_key_handshake_start = tgl_get_monotonic_time();
+    }
     send_req_pq_temp_packet();
 }
 
@@ -685,7 +756,7 @@ bool mtproto_client::process_auth_complete(const char* packet, int len, bool tem
     }
 
     calculate_auth_key_id(temp_key);
-    if (!temp_key) {
+    if (!temp_key && !m_is_media) {
         m_user_agent.callback()->dc_updated(this);
     }
 
@@ -695,7 +766,14 @@ bool mtproto_client::process_auth_complete(const char* packet, int len, bool tem
 
     TGL_DEBUG("auth success for DC " << m_id << " " << (temp_key ? "(temp)" : "") << " salt=" << m_server_salt);
     if (temp_key) {
-        bind_temp_auth_key(m_user_agent.temp_key_expire_time());
+        if (auto owner = m_temp_key_owner.lock()) {
+            // The owner binds the key on its own connection when it switches
+            // to it, nothing is left to do here.
+            set_bound();
+            owner->temp_auth_key_pregenerated(*this);
+        } else {
+            bind_temp_auth_key(m_user_agent.temp_key_expire_time());
+        }
     } else {
         set_authorized();
         if (m_user_agent.pfs_enabled()) {
@@ -756,12 +834,13 @@ void mtproto_client::bind_temp_auth_key(int32_t temp_key_expire_time)
     s.out_i64(m_session->session_id);
     int expires = tgl_get_system_time() + m_server_time_delta + temp_key_expire_time;
     s.out_i32(expires);
+    m_temp_key_expires = expires;
 
     int data[1000];
     memset(data, 0, sizeof(data));
     int len = encrypt_inner_temp(s.i32_data(), s.i32_size(), data, msg_id);
 
-    auto q = std::make_shared<query_bind_temp_auth_key>(m_user_agent, shared_from_this(), msg_id);
+    auto q = make_query<query_bind_temp_auth_key>(m_user_agent, shared_from_this(), msg_id);
     m_bind_temp_auth_key_query = q;
 
     q->out_i32(CODE_auth_bind_temp_auth_key);
@@ -773,11 +852,233 @@ void mtproto_client::bind_temp_auth_key(int32_t temp_key_expire_time)
     assert(q->msg_id() == msg_id);
 }
 
+void mtproto_client::temp_auth_key_bound()
+{
+    set_bound();
+    temp_auth_key_changed();
+
+    if (m_temp_key_handshake_start) {
+        if (!m_pending_queries.empty()) {
+            auto& stats = m_user_agent.net_stats();
+            stats.handshake_stalls++;
+            stats.handshake_stall_microseconds += (tgl_get_monotonic_time() - m_temp_key_handshake_start) * 1000000;
+        }
+        m_temp_key_handshake_start = 0;
+    }
+
+    schedule_temp_key_refresh();
+    configure();
+}
+
+void mtproto_client::temp_auth_key_changed()
+{
+    if (m_is_media || is_temp_key_generator()) {
+        return;
+    }
+
+    if (auto media = m_user_agent.existing_media_client(m_id)) {
+        media->share_temp_auth_key(*this);
+    }
+}
+
+void mtproto_client::share_temp_auth_key(const mtproto_client& main)
+{
+    assert(m_is_media);
+    bool bound = main.is_bound() && main.m_temp_auth_key_id;
+    if (main.m_temp_auth_key_id == m_temp_auth_key_id && bound == is_bound()) {
+        return;
+    }
+
+    // Whatever is queued was meant for the key we had.
+    flush_send_queues();
+
+    if (m_temp_auth_key_id && m_temp_auth_key_id != main.m_temp_auth_key_id) {
+        m_temp_key_switch_msg_id = m_session ? m_session->last_msg_id : 0;
+        m_prev_temp_auth_key = m_temp_auth_key;
+        m_prev_temp_auth_key_id = m_temp_auth_key_id;
+    }
+    m_temp_auth_key = main.m_temp_auth_key;
+    m_temp_auth_key_id = main.m_temp_auth_key_id;
+    m_temp_key_expires = main.m_temp_key_expires;
+    m_server_salt = main.m_server_salt;
+    m_future_salts.clear();
+    m_future_salts_request_time = 0;
+    m_server_time_delta = main.m_server_time_delta;
+    m_server_time_udelta = main.m_server_time_udelta;
+    set_bound(bound);
+    set_configured(false);
+
+    if (!bound) {
+        TGL_DEBUG("media client of DC " << m_id << " waits for the temp auth key of the main client");
+        return;
+    }
+
+    TGL_DEBUG("media client of DC " << m_id << " uses temp auth key " << m_temp_auth_key_id);
+    m_state = state::authorized;
+    if (m_session) {
+        configure();
+    }
+}
+
+void mtproto_client::schedule_temp_key_refresh()
+{
+    if (!m_user_agent.pfs_enabled() || !m_temp_key_expires) {
+        return;
+    }
+
+    double remaining = m_temp_key_expires - (tgl_get_system_time() + m_server_time_delta);
+    double delay = std::max(remaining - m_user_agent.temp_key_expire_time() * (1 - TEMP_KEY_REFRESH_FRACTION), 0.0);
+    m_temp_key_refresh_time = tgl_get_monotonic_time() + delay;
+    if (!m_temp_key_refresh_timer) {
+        std::weak_ptr<mtproto_client> weak_this(shared_from_this());
+        m_temp_key_refresh_timer = m_user_agent.timer_factory()->create_timer([weak_this] {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->refresh_temp_auth_key();
+            }
+        });
+    }
+    m_temp_key_refresh_timer->start(delay);
+}
+
+void mtproto_client::refresh_temp_auth_key()
+{
+    if (m_next_temp_auth_key_id) {
+        switch_to_next_temp_auth_key();
+    } else {
+        pregenerate_temp_auth_key();
+    }
+}
+
+void mtproto_client::pregenerate_temp_auth_key()
+{
+    if (!m_user_agent.pfs_enabled() || m_state != state::authorized || !is_bound()) {
+        return;
+    }
+
+    // Don't open connections for an idle DC, create_session() picks this up
+    // once there is traffic again.
+    if (!m_session) {
+        return;
+    }
+
+    if (m_temp_key_generator) {
+        m_temp_key_generator->clear_session();
+    }
+
+    TGL_DEBUG("pregenerating temp auth key for DC " << m_id);
+    m_temp_key_refresh_time = 0;
+    m_temp_key_generator = std::make_shared<mtproto_client>(m_user_agent, m_id);
+    m_temp_key_generator->m_temp_key_owner = shared_from_this();
+    m_temp_key_generator->set_auth_key(m_auth_key.data(), m_auth_key.size());
+    for (const auto& option: m_ipv4_options) {
+        m_temp_key_generator->add_ipv4_option(option.first, option.second);
+    }
+    for (const auto& option: m_ipv6_options) {
+        m_temp_key_generator->add_ipv6_option(option.first, option.second);
+    }
+    m_temp_key_generator->create_session();
+}
+
+void mtproto_client::temp_auth_key_pregenerated(const mtproto_client& generator)
+{
+    // The current key may have been dropped and renegotiated in the foreground
+    // while the generator was busy, its key is of no use then.
+    if (m_temp_key_generator.get() != &generator || m_state != state::authorized || !is_bound()) {
+        return;
+    }
+
+    TGL_DEBUG("pregenerated temp auth key " << generator.m_temp_auth_key_id << " for DC " << m_id);
+    m_next_temp_auth_key = generator.m_temp_auth_key;
+    m_next_temp_auth_key_id = generator.m_temp_auth_key_id;
+    m_next_server_salt = generator.m_server_salt;
+
+    // We are called from within the answer processing of the generator, its
+    // session is closed and the key switched to from the timer instead.
+    m_temp_key_refresh_time = tgl_get_monotonic_time();
+    m_temp_key_refresh_timer->start(0);
+}
+
+void mtproto_client::switch_to_next_temp_auth_key()
+{
+    if (m_temp_key_generator) {
+        m_temp_key_generator->clear_session();
+        m_temp_key_generator.reset();
+    }
+
+    if (m_state != state::authorized || !is_bound()) {
+        m_next_temp_auth_key_id = 0;
+        return;
+    }
+
+    TGL_DEBUG("switching DC " << m_id << " to pregenerated temp auth key " << m_next_temp_auth_key_id);
+
+    // Binding the new key unbinds the current one, so everything queued goes
+    // out before the bind and everything after it waits for the answer like
+    // after any other handshake, just without the key exchange.
+    flush_send_queues();
+    m_temp_key_switch_msg_id = m_session ? m_session->last_msg_id : 0;
+
+    m_prev_temp_auth_key = m_temp_auth_key;
+    m_prev_temp_auth_key_id = m_temp_auth_key_id;
+    m_temp_auth_key = m_next_temp_auth_key;
+    m_temp_auth_key_id = m_next_temp_auth_key_id;
+    m_server_salt = m_next_server_salt;
+    memset(m_next_temp_auth_key.data(), 0, m_next_temp_auth_key.size());
+    m_next_temp_auth_key_id = 0;
+    m_next_server_salt = 0;
+    m_future_salts.clear();
+    m_future_salts_request_time = 0;
+    m_temp_key_refresh_time = 0;
+    m_user_agent.net_stats().temp_keys_pregenerated++;
+
+    set_bound(false);
+    set_configured(false);
+    m_temp_key_handshake_start = tgl_get_monotonic_time();
+    temp_auth_key_changed();
+
+    // Without a session the key is bound once connected.
+    if (m_session) {
+        bind_temp_auth_key(m_user_agent.temp_key_expire_time());
+    }
+}
+
 double mtproto_client::get_server_time()
 {
     return tgl_get_monotonic_time() + m_server_time_udelta;
 }
 
+int64_t mtproto_client::current_server_salt()
+{
+    int64_t salt = m_future_salts.current(get_server_time());
+    if (salt && salt != m_server_salt) {
+        TGL_DEBUG("switching DC " << m_id << " from server salt " << m_server_salt << " to " << salt);
+        m_server_salt = salt;
+    }
+    return m_server_salt;
+}
+
+void mtproto_client::request_future_salts_if_needed()
+{
+    if (!is_configured() || !m_session) {
+        return;
+    }
+
+    double server_time = get_server_time();
+    if (m_future_salts.remaining(server_time) >= FUTURE_SALTS_REFRESH_TIME
+            || (m_future_salts_request_time && server_time - m_future_salts_request_time < FUTURE_SALTS_REQUEST_TIMEOUT)) {
+        return;
+    }
+
+    TGL_DEBUG("requesting future salts from DC " << m_id);
+    m_future_salts_request_time = server_time;
+    m_user_agent.net_stats().future_salts_requests++;
+    auto s = std::make_shared<mtprotocol_serializer>(2);
+    s->out_i32(CODE_get_future_salts);
+    s->out_i32(FUTURE_SALTS_COUNT);
+    // A request the server answers, so it takes an odd seq_no.
+    send_message(s, 0, false, false);
+}
+
 int64_t mtproto_client::generate_next_msg_id()
 {
     int64_t next_id = static_cast<int64_t>(get_server_time()*(1LL << 32)) & -4;
@@ -789,6 +1090,25 @@ int64_t mtproto_client::generate_next_msg_id()
     return next_id;
 }
 
+int32_t mtproto_client::next_seq_no(bool useful)
+{
+    assert(m_session);
+    int32_t seq_no = m_session->seq_no;
+    if (useful) {
+        seq_no |= 1;
+    }
+    m_session->seq_no += 2;
+    return seq_no;
+}
+
+void mtproto_client::ensure_session_id()
+{
+    assert(m_session);
+    while (!m_session->session_id) {
+        tgl_secure_random(reinterpret_cast<unsigned char*>(&m_session->session_id), 8);
+    }
+}
+
 void mtproto_client::init_enc_msg(encrypted_message& enc_msg, bool useful)
 {
     assert(m_state == state::authorized);
@@ -796,19 +1116,13 @@ void mtproto_client::init_enc_msg(encrypted_message& enc_msg, bool useful)
     assert(m_session);
 
     enc_msg.auth_key_id = m_temp_auth_key_id;
-    enc_msg.server_salt = m_server_salt;
-    while (!m_session->session_id) {
-        tgl_secure_random(reinterpret_cast<unsigned char*>(&m_session->session_id), 8);
-    }
+    enc_msg.server_salt = current_server_salt();
+    ensure_session_id();
     enc_msg.session_id = m_session->session_id;
     if (!enc_msg.msg_id) {
         enc_msg.msg_id = generate_next_msg_id();
     }
-    enc_msg.seq_no = m_session->seq_no;
-    if (useful) {
-        enc_msg.seq_no |= 1;
-    }
-    m_session->seq_no += 2;
+    enc_msg.seq_no = next_seq_no(useful);
 };
 
 void mtproto_client::init_enc_msg_inner_temp(encrypted_message& enc_msg, int64_t msg_id)
@@ -849,8 +1163,119 @@ static std::unique_ptr<char[]> allocate_encrypted_message_buffer(int msg_ints)
     return buffer;
 }
 
-int64_t mtproto_client::send_message_impl(
-        const int32_t* msg, size_t msg_ints, int64_t msg_id_override,
+static size_t standalone_frame_size(const mtproto_transport& transport, size_t msg_ints)
+{
+    const size_t MINSZ = offsetof(struct encrypted_message, message);
+    const size_t UNENCSZ = offsetof(struct encrypted_message, server_salt);
+    size_t len = UNENCSZ + tgl_pad_aes_encrypt_dest_buffer_size(MINSZ - UNENCSZ + msg_ints * 4);
+    return len + transport.header_size(len);
+}
+
+std::vector<char> mtproto_client::encrypt_message(const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no)
+{
+    const size_t MINSZ = offsetof(struct encrypted_message, message);
+    const size_t UNENCSZ = offsetof(struct encrypted_message, server_salt);
+    const size_t msg_len = msg_ints * 4;
+    const size_t enc_len = MINSZ - UNENCSZ + msg_len;
+    const size_t padded_len = tgl_pad_aes_encrypt_dest_buffer_size(enc_len);
+
+    encrypted_message header;
+    header.server_salt = current_server_salt();
+    header.session_id = m_session->session_id;
+    header.msg_id = msg_id;
+    header.seq_no = seq_no;
+    header.msg_len = msg_len;
+    const unsigned char* plain_header = reinterpret_cast<const unsigned char*>(&header.server_salt);
+
+    std::vector<char> frame(MTPROTO_TRANSPORT_HEADER_SIZE + UNENCSZ + padded_len);
+    encrypted_message* enc = reinterpret_cast<encrypted_message*>(frame.data() + MTPROTO_TRANSPORT_HEADER_SIZE);
+    enc->auth_key_id = m_temp_auth_key_id;
+
+    unsigned char sha1_buffer[20];
+    TGLC_sha1_ctx sha1_ctx;
+    TGLC_sha1_init(&sha1_ctx);
+    TGLC_sha1_update(&sha1_ctx, plain_header, MINSZ - UNENCSZ);
+    TGLC_sha1_update(&sha1_ctx, reinterpret_cast<const unsigned char*>(msg), msg_len);
+    TGLC_sha1_final(&sha1_ctx, sha1_buffer);
+    memcpy(enc->msg_key, sha1_buffer + 4, 16);
+
+    TGLC_aes_key aes_key;
+    unsigned char aes_iv[32];
+    tgl_init_aes_auth(&aes_key, aes_iv, m_temp_auth_key.data(), enc->msg_key, AES_ENCRYPT);
+
+    // AES-IGE carries its state in aes_iv, so the header, the whole blocks of the
+    // message and the padded last block can be encrypted straight into the frame
+    // one after another without assembling the plain text first.
+    unsigned char* out = reinterpret_cast<unsigned char*>(&enc->server_salt);
+    static_assert(!((MINSZ - UNENCSZ) & 15), "the header has to be a whole number of AES blocks");
+    TGLC_aes_ige_encrypt(plain_header, out, MINSZ - UNENCSZ, &aes_key, aes_iv, 1);
+    out += MINSZ - UNENCSZ;
+
+    size_t whole_blocks_len = msg_len & ~static_cast<size_t>(15);
+    if (whole_blocks_len) {
+        TGLC_aes_ige_encrypt(reinterpret_cast<const unsigned char*>(msg), out, whole_blocks_len, &aes_key, aes_iv, 1);
+        out += whole_blocks_len;
+    }
+
+    if (whole_blocks_len < msg_len) {
+        unsigned char last_block[16];
+        size_t tail = msg_len - whole_blocks_len;
+        memcpy(last_block, reinterpret_cast<const unsigned char*>(msg) + whole_blocks_len, tail);
+        auto result = TGLC_rand_pseudo_bytes(last_block + tail, 16 - tail);
+        TGL_ASSERT_UNUSED(result, result >= 0);
+        TGLC_aes_ige_encrypt(last_block, out, 16, &aes_key, aes_iv, 1);
+        out += 16;
+    }
+    assert(out == reinterpret_cast<unsigned char*>(frame.data() + frame.size()));
+
+    return frame;
+}
+
+void mtproto_client::encrypt_frame(mtprotocol_serializer& s, int64_t msg_id, int32_t seq_no)
+{
+    const size_t MINSZ = offsetof(struct encrypted_message, message);
+    const size_t UNENCSZ = offsetof(struct encrypted_message, server_salt);
+    size_t msg_len = s.char_size();
+    size_t padded_len = tgl_pad_aes_encrypt_dest_buffer_size(MINSZ - UNENCSZ + msg_len);
+    s.reserve_i32s((padded_len - (MINSZ - UNENCSZ) - msg_len) / 4);
+
+    encrypted_message* enc = reinterpret_cast<encrypted_message*>(s.frame_data() + MTPROTO_TRANSPORT_HEADER_SIZE);
+    enc->auth_key_id = m_temp_auth_key_id;
+    enc->server_salt = current_server_salt();
+    enc->session_id = m_session->session_id;
+    enc->msg_id = msg_id;
+    enc->seq_no = seq_no;
+    enc->msg_len = msg_len;
+
+    int l = aes_encrypt_message(m_temp_auth_key.data(), enc);
+    TGL_ASSERT_UNUSED(l, l > 0 && static_cast<size_t>(l) == padded_len);
+}
+
+std::shared_ptr<mtprotocol_serializer> mtproto_client::compress_message(const std::shared_ptr<mtprotocol_serializer>& msg)
+{
+    size_t threshold = m_user_agent.compression_threshold();
+    if (!threshold || msg->char_size() < threshold) {
+        return msg;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto packed = m_user_agent.deflater().pack(*msg);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    tgl_net_stats& stats = m_user_agent.net_stats();
+    stats.compression_attempts++;
+    stats.compression_microseconds += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    if (!packed) {
+        return msg;
+    }
+
+    TGL_DEBUG("packed a message of " << msg->char_size() << " bytes into " << packed->char_size() << " bytes for DC " << m_id);
+    stats.messages_compressed++;
+    stats.compression_bytes_saved += msg->char_size() - packed->char_size();
+    return packed;
+}
+
+int64_t mtproto_client::send_message_impl(const std::shared_ptr<mtprotocol_serializer>& uncompressed_msg, int64_t msg_id_override,
         bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load)
 {
     if (!m_session || !m_session->primary_worker) {
@@ -858,6 +1283,15 @@ int64_t mtproto_client::send_message_impl(
         return -1;
     }
 
+    // Only requests get packed. Messages with a fixed msg_id are part of the
+    // key exchange, and file parts, the only requests allowed on secondary
+    // connections, hardly ever compress.
+    std::shared_ptr<mtprotocol_serializer> msg = uncompressed_msg;
+    if (useful && !msg_id_override && !allow_secondary_connections) {
+        msg = compress_message(msg);
+    }
+
+    size_t msg_ints = msg->i32_size();
     if (msg_ints <= 0) {
         TGL_ERROR("message length is zero or negative");
         return -1;
@@ -870,7 +1304,7 @@ int64_t mtproto_client::send_message_impl(
 
     assert(is_configured() || force_send);
 
-    auto best_worker = select_best_worker(allow_secondary_connections);
+    auto best_worker = select_best_worker(allow_secondary_connections, msg_ints * 4);
     assert(best_worker);
 
     if (!best_worker->connection || best_worker->connection->status() == tgl_connection_status::disconnected) {
@@ -879,30 +1313,166 @@ int64_t mtproto_client::send_message_impl(
         return -1;
     }
 
-    std::unique_ptr<char[]> buffer = allocate_encrypted_message_buffer(msg_ints);
-    encrypted_message* enc_msg = reinterpret_cast<encrypted_message*>(buffer.get());
+    // Messages with a fixed msg_id (e.g. the bind temp auth key message, whose msg_id is
+    // part of its encrypted payload), containers and messages too big to share a container
+    // are sent on their own. Everything else is queued until the next flush.
+    if (msg_id_override || msg->i32_data()[0] == static_cast<int32_t>(CODE_msg_container)
+            || msg_ints + CONTAINER_HEADER_INTS + CONTAINER_ENTRY_HEADER_INTS > MAX_CONTAINER_INTS) {
+        flush_send_queue(best_worker);
 
-    memcpy(enc_msg->message, msg, msg_ints * 4);
-    enc_msg->msg_len = msg_ints * 4;
+        assert(m_state == state::authorized);
+        assert(m_temp_auth_key_id);
+        ensure_session_id();
+        int64_t msg_id = msg_id_override ? msg_id_override : generate_next_msg_id();
 
-    enc_msg->msg_id = msg_id_override;
-    init_enc_msg(*enc_msg, useful);
-    int64_t msg_id = enc_msg->msg_id;
+        if (count_work_load) {
+            m_session->add_job(best_worker, msg_id, msg_ints * 4, std::chrono::steady_clock::now());
+        }
 
-    int l = aes_encrypt_message(m_temp_auth_key.data(), enc_msg);
-    assert(l > 0);
+        send_frame(best_worker->connection, encrypt_message(msg->i32_data(), msg_ints, msg_id, next_seq_no(useful)));
+        if (count_work_load) {
+            best_worker->connection->request_sent();
+        }
+
+        return msg_id;
+    }
+
+    if (best_worker->send_queue.size() >= MAX_CONTAINER_MESSAGES
+            || CONTAINER_HEADER_INTS + best_worker->send_queue_ints + CONTAINER_ENTRY_HEADER_INTS + msg_ints > MAX_CONTAINER_INTS) {
+        flush_send_queue(best_worker);
+    }
+
+    ensure_session_id();
+    int64_t msg_id = generate_next_msg_id();
+    best_worker->send_queue.emplace_back(msg_id, next_seq_no(useful), msg);
+    best_worker->send_queue_ints += CONTAINER_ENTRY_HEADER_INTS + msg_ints;
 
     if (count_work_load) {
-        best_worker->work_load.insert(msg_id);
+        m_session->add_job(best_worker, msg_id, msg_ints * 4);
     }
 
-    const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
-    rpc_send_message(best_worker->connection, enc_msg, l + UNENCSZ);
+    if (!m_session->flush_timer) {
+        std::weak_ptr<mtproto_client> weak_this(shared_from_this());
+        m_session->flush_timer = m_user_agent.timer_factory()->create_timer([weak_this] {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->flush_send_queues();
+            }
+        });
+    }
+    // Zero timeout: everything queued during the current event loop iteration goes out together.
+    m_session->flush_timer->start(0);
 
     return msg_id;
 }
 
-std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_workers)
+void mtproto_client::flush_send_queues()
+{
+    if (!m_session) {
+        return;
+    }
+
+    if (m_session->primary_worker) {
+        flush_send_queue(m_session->primary_worker);
+    }
+    for (const auto& w: m_session->secondary_workers) {
+        flush_send_queue(w);
+    }
+}
+
+void mtproto_client::flush_send_queue(const std::shared_ptr<worker>& w)
+{
+    if (w->send_queue.empty()) {
+        return;
+    }
+
+    std::vector<outgoing_message> queue;
+    queue.swap(w->send_queue);
+    size_t queue_ints = w->send_queue_ints;
+    w->send_queue_ints = 0;
+
+    if (m_state != state::authorized || !m_temp_auth_key_id || !w->connection) {
+        TGL_WARNING("dropping " << queue.size() << " queued messages for DC " << m_id << " since it is not authorized any more");
+        // No answer will ever arrive for these, so take them off the worker's load now.
+        for (const auto& m: queue) {
+            m_session->finish_job(m.msg_id);
+        }
+        return;
+    }
+
+    // Piggyback the pending acks on this frame instead of waiting for the ack timer.
+    size_t ack_ints = 3 + 2 * m_session->ack_set.size();
+    if (!m_session->ack_set.empty() && is_configured() && queue.size() < MAX_CONTAINER_MESSAGES
+            && CONTAINER_HEADER_INTS + queue_ints + CONTAINER_ENTRY_HEADER_INTS + ack_ints <= MAX_CONTAINER_INTS) {
+        m_user_agent.net_stats().acks_piggybacked += m_session->ack_set.size();
+        auto s = std::make_shared<mtprotocol_serializer>();
+        serialize_pending_acks(*s);
+        queue.emplace_back(generate_next_msg_id(), next_seq_no(false), s);
+        queue_ints += CONTAINER_ENTRY_HEADER_INTS + s->i32_size();
+    }
+
+    // The round trips of the queued requests start now.
+    auto now = std::chrono::steady_clock::now();
+    bool has_requests = false;
+    for (const auto& m: queue) {
+        auto it = m_session->jobs.find(m.msg_id);
+        if (it != m_session->jobs.end()) {
+            it->second.sent_time = now;
+            has_requests = true;
+        }
+    }
+
+    if (queue.size() == 1) {
+        const outgoing_message& m = queue.front();
+        send_frame(w->connection, encrypt_message(m.body->i32_data(), m.body->i32_size(), m.msg_id, m.seq_no));
+        if (has_requests) {
+            w->connection->request_sent();
+        }
+        return;
+    }
+
+    const mtproto_transport& transport = mtproto_transport::get(w->connection->transport());
+    size_t container_ints = CONTAINER_HEADER_INTS + queue_ints;
+    mtprotocol_serializer container(container_ints + 4, true);
+    container.out_i32(CODE_msg_container);
+    container.out_i32(queue.size());
+    size_t standalone_bytes = 0;
+    for (const auto& m: queue) {
+        container.out_i64(m.msg_id);
+        container.out_i32(m.seq_no);
+        container.out_i32(m.body->char_size());
+        container.out_i32s(m.body->i32_data(), m.body->i32_size());
+        standalone_bytes += standalone_frame_size(transport, m.body->i32_size());
+    }
+    assert(container.i32_size() == container_ints);
+
+    // The container gets a newer msg_id than anything it carries.
+    int64_t container_msg_id = generate_next_msg_id();
+    encrypt_frame(container, container_msg_id, next_seq_no(false));
+
+    TGL_DEBUG("sending container #" << container_msg_id << " with " << queue.size() << " messages to DC " << m_id);
+    send_frame(w->connection, container.release_frame());
+    if (has_requests) {
+        w->connection->request_sent();
+    }
+
+    size_t container_bytes = standalone_frame_size(transport, container_ints);
+    tgl_net_stats& stats = m_user_agent.net_stats();
+    stats.containers_sent++;
+    stats.messages_in_containers += queue.size();
+    if (standalone_bytes > container_bytes) {
+        stats.container_bytes_saved += standalone_bytes - container_bytes;
+    }
+}
+
+// The cost of a worker is how long a message of msg_bytes would take to be
+// answered on it, taken to grow with the bytes already in flight there and with
+// its round trip time.
+static double worker_cost(const worker& w, size_t msg_bytes)
+{
+    return static_cast<double>(w.bytes_in_flight + msg_bytes) * std::max(w.srtt, WORKER_MIN_RTT);
+}
+
+std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_workers, size_t msg_bytes)
 {
     assert(m_session);
     assert(m_session->primary_worker);
@@ -910,59 +1480,86 @@ std::shared_ptr<worker> mtproto_client::select_best_worker(bool allow_secondary_
     std::shared_ptr<worker> best_worker = m_session->primary_worker;
 
     if (!allow_secondary_workers) {
-        TGL_DEBUG("selected the primary worker with work_load " << best_worker->work_load.size());
+        TGL_DEBUG("selected the primary worker with " << best_worker->jobs << " jobs");
         return best_worker;
     }
 
-    auto min_work_load = best_worker->work_load.size();
+    tgl_net_stats& stats = m_user_agent.net_stats();
+    stats.worker_selections++;
+
+    double min_cost = worker_cost(*best_worker, msg_bytes);
     for (const auto& w: m_session->secondary_workers) {
         if (!w->connection || w->connection->status() == tgl_connection_status::disconnected) {
             continue;
         }
-        if (w->work_load.size() < min_work_load) {
-            min_work_load = w->work_load.size();
+        double cost = worker_cost(*w, msg_bytes);
+        if (cost < min_cost) {
+            min_cost = cost;
             best_worker = w;
         }
     }
 
-    if (best_worker->work_load.size() != 0 && m_session->secondary_workers.size() < MAX_SECONDARY_WORKERS_PER_SESSION) {
+    if (best_worker->bytes_in_flight >= SECONDARY_WORKER_SPAWN_BYTES
+            && m_session->secondary_workers.size() < MAX_SECONDARY_WORKERS_PER_SESSION) {
         std::weak_ptr<mtproto_client> weak_this(shared_from_this());
         auto connection = m_user_agent.connection_factory()->create_connection(
                 m_ipv4_options, m_ipv6_options, weak_this);
         connection->open();
         best_worker = std::make_shared<worker>(connection);
-        best_worker->live_timer = m_user_agent.timer_factory()->create_timer([best_worker, weak_this]{
-            if (best_worker->work_load.size()) {
-                TGL_DEBUG("a worker idle timer fired but it still has " << best_worker->work_load.size() << " jobs to do, refreshing the timer");
-                best_worker->live_timer->start(MAX_SECONDARY_WORKER_IDLE_TIME);
+        std::weak_ptr<worker> weak_worker(best_worker);
+        best_worker->live_timer = m_user_agent.timer_factory()->create_timer([weak_worker, weak_this] {
+            auto w = weak_worker.lock();
+            if (!w) {
                 return;
             }
-            if (best_worker->connection) {
-               TGL_DEBUG("an idle worker stopped");
-               best_worker->connection->close();
+            if (w->jobs) {
+                TGL_DEBUG("a worker idle timer fired but it still has " << w->jobs << " jobs to do, refreshing the timer");
+                w->live_timer->start(MAX_SECONDARY_WORKER_IDLE_TIME);
+                return;
             }
-            if (auto client = weak_this.lock()) {
-                if (client->m_session) {
-                    client->m_session->secondary_workers.erase(best_worker);
-                    TGL_DEBUG("now we have " << client->m_session->secondary_workers.size() << " secondary workers");
+            auto client = weak_this.lock();
+            if (client && client->m_session && client->m_session->secondary_workers.count(w)) {
+                if (client->least_loaded_worker_bytes(w) >= SECONDARY_WORKER_RETIRE_BYTES) {
+                    TGL_DEBUG("keeping an idle worker since the others are still busy");
+                    w->live_timer->start(MAX_SECONDARY_WORKER_IDLE_TIME);
+                    return;
                 }
+                client->m_session->remove_secondary_worker(w);
+                client->m_user_agent.net_stats().secondary_workers_retired++;
+                TGL_DEBUG("an idle worker stopped, now we have " << client->m_session->secondary_workers.size() << " secondary workers");
+            }
+            if (w->connection) {
+                w->connection->close();
             }
         });
         m_session->secondary_workers.insert(best_worker);
+        stats.secondary_workers_spawned++;
         TGL_DEBUG("started a secondary worker, now we have " << m_session->secondary_workers.size() << " secondary workers");
     }
 
     if (best_worker == m_session->primary_worker) {
-        TGL_DEBUG("selected the primary worker with work_load " << best_worker->work_load.size());
+        TGL_DEBUG("selected the primary worker with " << best_worker->bytes_in_flight << " bytes in flight");
     } else {
         assert(best_worker->live_timer);
         best_worker->live_timer->cancel();
-        TGL_DEBUG("selected a secondary worker with work_load " << best_worker->work_load.size());
+        stats.secondary_worker_selections++;
+        TGL_DEBUG("selected a secondary worker with " << best_worker->bytes_in_flight << " bytes in flight");
     }
 
     return best_worker;
 }
 
+size_t mtproto_client::least_loaded_worker_bytes(const std::shared_ptr<worker>& except) const
+{
+    size_t min_bytes = m_session->primary_worker ? m_session->primary_worker->bytes_in_flight : 0;
+    for (const auto& w: m_session->secondary_workers) {
+        if (w != except) {
+            min_bytes = std::min(min_bytes, w->bytes_in_flight);
+        }
+    }
+    return min_bytes;
+}
+
 int mtproto_client::encrypt_inner_temp(const int32_t* msg, int msg_ints, void* data, int64_t msg_id)
 {
     const int UNENCSZ = offsetof(struct encrypted_message, server_salt);
@@ -1027,6 +1624,8 @@ int mtproto_client::work_new_session_created(tgl_in_buffer* in, int64_t msg_id)
     m_server_salt = fetch_i64(in);
 
     if (m_user_agent.is_started()
+            && !m_is_media
+            && !is_temp_key_generator()
             && !m_user_agent.is_diff_locked()
             && m_user_agent.active_client()->is_logged_in()) {
         m_user_agent.get_difference(false, nullptr);
@@ -1064,26 +1663,25 @@ void mtproto_client::worker_job_done(int64_t id)
         return;
     }
 
-    if (const auto& w = m_session->primary_worker) {
-        auto it = w->work_load.lower_bound(id);
-        if (it != w->work_load.end() && *it == id) {
-            w->work_load.erase(it);
-            assert(!w->live_timer);
-            return;
-        }
+    in_flight_job job = m_session->finish_job(id);
+    const auto& w = job.owner;
+    if (!w) {
+        return;
     }
 
-    for (const auto& w: m_session->secondary_workers) {
-        auto it = w->work_load.lower_bound(id);
-        if (it != w->work_load.end() && *it == id) {
-            w->work_load.erase(it);
-            if (w->work_load.empty() && w->live_timer) {
-                assert(w != m_session->primary_worker);
-                w->live_timer->start(MAX_SECONDARY_WORKER_IDLE_TIME);
-            }
-            break;
+    if (job.sent_time != std::chrono::steady_clock::time_point()) {
+        double rtt = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.sent_time).count();
+        w->srtt = w->srtt ? w->srtt + (rtt - w->srtt) / 8 : rtt;
+        if (w->connection) {
+            w->connection->round_trip_measured(rtt);
         }
     }
+
+    if (w == m_session->primary_worker) {
+        assert(!w->live_timer);
+    } else if (!w->jobs && w->live_timer) {
+        w->live_timer->start(MAX_SECONDARY_WORKER_IDLE_TIME);
+    }
 }
 
 int mtproto_client::query_error(tgl_in_buffer* in, int64_t id)
@@ -1137,14 +1735,14 @@ int mtproto_client::work_packed(tgl_in_buffer* in, int64_t msg_id)
 {
     auto result = fetch_i32(in);
     TGL_ASSERT_UNUSED(result, result == static_cast<int32_t>(CODE_gzip_packed));
-    constexpr size_t MAX_PACKED_SIZE = 1 << 24;
-    std::unique_ptr<int32_t[]> unzipped_buffer(new int32_t[MAX_PACKED_SIZE >> 2]);
-
     ssize_t l = prefetch_strlen(in);
     const char* s = fetch_str(in, l);
 
-    int total_out = tgl_inflate(s, l, unzipped_buffer.get(), MAX_PACKED_SIZE);
-    tgl_in_buffer new_in = { unzipped_buffer.get(), unzipped_buffer.get() + total_out / 4 };
+    inflate_arena::lease unzipped_buffer(m_user_agent.inflater());
+    tgl_in_buffer new_in = { nullptr, nullptr };
+    if (!unzipped_buffer.inflate(s, l, &new_in)) {
+        return -1;
+    }
     int r = rpc_execute_answer(&new_in, msg_id, true);
     return r;
 }
@@ -1170,10 +1768,43 @@ int mtproto_client::work_bad_server_salt(tgl_in_buffer* in)
             << " error_code = " << error_code << " new_server_salt =" << new_server_salt
             << " old_server_salt = " << m_server_salt);
     m_server_salt = new_server_salt;
+    m_user_agent.net_stats().bad_server_salts++;
+
+    // The schedule has been wrong, start over from the salt the server just told us.
+    m_future_salts.clear();
+    m_future_salts_request_time = 0;
     restart_query(id);
     return 0;
 }
 
+int mtproto_client::work_future_salts(tgl_in_buffer* in)
+{
+    auto result = fetch_i32(in);
+    TGL_ASSERT_UNUSED(result, result == static_cast<int32_t>(CODE_future_salts));
+    int64_t id = fetch_i64(in); // req_msg_id
+    fetch_i32(in); // now
+
+    // A bare vector of bare future_salt.
+    int32_t n = fetch_i32(in);
+    if (n < 0 || in->end - in->ptr != static_cast<ptrdiff_t>(n) * 4) {
+        TGL_WARNING("malformed future salts from DC " << m_id);
+        return -1;
+    }
+
+    std::vector<server_salt_schedule::salt> salts(n);
+    for (auto& salt : salts) {
+        salt.valid_since = fetch_i32(in);
+        salt.valid_until = fetch_i32(in);
+        salt.value = fetch_i64(in);
+    }
+    TGL_DEBUG("got " << n << " future salts from DC " << m_id);
+
+    worker_job_done(id);
+    m_future_salts.update(std::move(salts));
+    m_future_salts_request_time = 0;
+    return 0;
+}
+
 int mtproto_client::work_pong(tgl_in_buffer* in)
 {
     auto result = fetch_i32(in);
@@ -1273,6 +1904,8 @@ int mtproto_client::rpc_execute_answer(tgl_in_buffer* in, int64_t msg_id, bool i
         return work_packed(in, msg_id);
     case CODE_bad_server_salt:
         return work_bad_server_salt(in);
+    case CODE_future_salts:
+        return work_future_salts(in);
     case CODE_pong:
         return work_pong(in);
     case CODE_msg_detailed_info:
@@ -1308,7 +1941,8 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
     }
     assert(len >= MINSZ && (len & 15) == (UNENCSZ & 15));
 
-    if (enc->auth_key_id != m_temp_auth_key_id && enc->auth_key_id != m_auth_key_id) {
+    bool prev_temp_key = m_prev_temp_auth_key_id && enc->auth_key_id == m_prev_temp_auth_key_id;
+    if (enc->auth_key_id != m_temp_auth_key_id && enc->auth_key_id != m_auth_key_id && !prev_temp_key) {
         TGL_WARNING("received msg from DC " << m_id << " with auth_key_id " << enc->auth_key_id <<
                 " (perm_auth_key_id " << m_auth_key_id << " temp_auth_key_id "<< m_temp_auth_key_id << "), dropping");
         return true;
@@ -1320,6 +1954,8 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
         assert(enc->auth_key_id == m_temp_auth_key_id);
         assert(m_temp_auth_key_id);
         tgl_init_aes_auth(&aes_key, aes_iv, m_temp_auth_key.data() + 8, enc->msg_key, AES_DECRYPT);
+    } else if (prev_temp_key) {
+        tgl_init_aes_auth(&aes_key, aes_iv, m_prev_temp_auth_key.data() + 8, enc->msg_key, AES_DECRYPT);
     } else {
         assert(enc->auth_key_id == m_auth_key_id);
         assert(m_auth_key_id);
@@ -1373,7 +2009,8 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
     }
     m_session->received_messages++;
 
-    if (m_server_salt != enc->server_salt) {
+    // The salts of the replaced key are of no use for the current one.
+    if (m_server_salt != enc->server_salt && !prev_temp_key) {
         TGL_DEBUG("updating server salt from " << m_server_salt << " to " << enc->server_salt);
         m_server_salt = enc->server_salt;
     }
@@ -1395,6 +2032,7 @@ bool mtproto_client::process_rpc_message(encrypted_message* enc, int len)
     }
 
     assert(in.ptr == in.end);
+    request_future_salts_if_needed();
     return true;
 }
 
@@ -1405,31 +2043,49 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
 
     if (len >= MAX_RESPONSE_SIZE/* - 12*/ || len < 0/*12*/) {
         TGL_WARNING("answer too long, skipping. lengeth:" << len);
+        c->skip(len);
         return true;
     }
 
-    std::unique_ptr<char[]> response(new char[len]);
     TGL_DEBUG("response of " << len << " bytes received from DC " << m_id);
-    int result = c->read(response.get(), len);
-    TGL_ASSERT_UNUSED(result, result == len);
 
+    // Decode and decrypt the frame where the connection buffered it, unless it wraps
+    // around the end of the read buffer or is not aligned for the 32-bit TL words.
+    char* frame = c->peek_contiguous(len);
+    std::unique_ptr<char[]> response;
+    if (!frame || reinterpret_cast<uintptr_t>(frame) % sizeof(int32_t)) {
+        response.reset(new char[len]);
+        int result = c->read(response.get(), len);
+        TGL_ASSERT_UNUSED(result, result == len);
+        frame = response.get();
+    }
+
+    bool success = process_frame(frame, op, mtproto_transport::get(c->transport()).unpadded_size(frame, len));
+    if (!response) {
+        c->skip(len);
+    }
+    return success;
+}
+
+bool mtproto_client::process_frame(char* frame, int op, int len)
+{
     state current_state = m_state;
     if (current_state != state::authorized) {
         TGL_DEBUG("state = " << current_state << " for DC " << m_id);
     }
     switch (current_state) {
     case state::reqpq_sent:
-        return process_respq_answer(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_respq_answer(frame/* + 8*/, len/* - 12*/, false);
     case state::reqdh_sent:
-        return process_dh_answer(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_dh_answer(frame/* + 8*/, len/* - 12*/, false);
     case state::client_dh_sent:
-        return process_auth_complete(response.get()/* + 8*/, len/* - 12*/, false);
+        return process_auth_complete(frame/* + 8*/, len/* - 12*/, false);
     case state::reqpq_sent_temp:
-        return process_respq_answer(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_respq_answer(frame/* + 8*/, len/* - 12*/, true);
     case state::reqdh_sent_temp:
-        return process_dh_answer(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_dh_answer(frame/* + 8*/, len/* - 12*/, true);
     case state::client_dh_sent_temp:
-        return process_auth_complete(response.get()/* + 8*/, len/* - 12*/, true);
+        return process_auth_complete(frame/* + 8*/, len/* - 12*/, true);
     case state::authorized:
         if (op < 0 && op >= -999) {
             if (m_user_agent.pfs_enabled() && op == -404) {
@@ -1442,7 +2098,7 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
                 return false;
             }
         } else {
-            return process_rpc_message(reinterpret_cast<encrypted_message*>(response.get()/* + 8*/), len/* - 12*/);
+            return process_rpc_message(reinterpret_cast<encrypted_message*>(frame/* + 8*/), len/* - 12*/);
         }
     default:
         TGL_ERROR("cannot receive answer in state " << m_state);
@@ -1452,6 +2108,21 @@ bool mtproto_client::rpc_execute(const std::shared_ptr<tgl_connection>& c, int o
 
 void mtproto_client::restart_temp_authorization()
 {
+    if (m_is_media) {
+        auto main = m_user_agent.client_at(m_id);
+        if (!main) {
+            return;
+        }
+        if (main->is_bound() && main->m_temp_auth_key_id == m_temp_auth_key_id) {
+            // The key we share was unbound, the main client renegotiates it for
+            // both of us and hands it over once it is bound.
+            main->restart_temp_authorization();
+        } else {
+            share_temp_auth_key(*main);
+        }
+        return;
+    }
+
     TGL_DEBUG("restarting temp authorization for DC " << m_id);
     reset_temp_authorization();
     assert(is_authorized());
@@ -1467,6 +2138,15 @@ void mtproto_client::restart_temp_authorization()
 
 void mtproto_client::restart_authorization()
 {
+    if (m_is_media || is_temp_key_generator()) {
+        // The permanent key belongs to the main client of the DC, only the
+        // temporary one is ours to renegotiate or to take over again.
+        if (m_user_agent.pfs_enabled()) {
+            restart_temp_authorization();
+        }
+        return;
+    }
+
     TGL_DEBUG("restarting authorization for DC " << m_id);
     reset_authorization();
     if (!m_session) {
@@ -1484,12 +2164,21 @@ void mtproto_client::connected(bool pfs_enabled, int32_t temp_key_expire_time)
         m_state = state::authorized;
     }
 
+    if (is_temp_key_generator() && is_bound()) {
+        // The key was handed over already, this session is about to go away.
+        return;
+    }
+
     state current_state = m_state;
     if (current_state == state::authorized && !pfs_enabled) {
         m_temp_auth_key_id = m_auth_key_id;
         memcpy(m_temp_auth_key.data(), m_auth_key.data(), 256);
         set_bound();
     }
+    if (m_is_media && !is_bound()) {
+        TGL_DEBUG("media client of DC " << m_id << " has no bound temp auth key yet");
+        return;
+    }
     switch (current_state) {
     case state::init:
         TGL_DEBUG("DC " << m_id << " is in init state");
@@ -1525,7 +2214,7 @@ void mtproto_client::configure()
 {
     TGL_DEBUG("start configuring DC " << id());
     std::weak_ptr<mtproto_client> weak_this(shared_from_this());
-    auto q = std::make_shared<query_help_get_config>(m_user_agent,
+    auto q = make_query<query_help_get_config>(m_user_agent,
             [weak_this](bool success) {
                 if (auto shared_this = weak_this.lock()) {
                     shared_this->configured(success);
@@ -1546,6 +2235,8 @@ void mtproto_client::configured(bool success)
         return;
     }
 
+    request_future_salts_if_needed();
+
     if (this == m_user_agent.active_client().get() || is_logged_in()) {
         TGL_DEBUG("sart sending pending queries if we have");
         send_pending_queries();
@@ -1560,13 +2251,8 @@ void mtproto_client::configured(bool success)
     }
 }
 
-void mtproto_client::send_all_acks()
+void mtproto_client::serialize_pending_acks(mtprotocol_serializer& s)
 {
-    if (!is_configured() || !m_session) {
-        return;
-    }
-
-    mtprotocol_serializer s;
     s.out_i32(CODE_msgs_ack);
     s.out_i32(CODE_vector);
     s.out_i32(m_session->ack_set.size());
@@ -1574,7 +2260,19 @@ void mtproto_client::send_all_acks()
         s.out_i64(id);
     }
     m_session->ack_set.clear();
-    send_ack_message(s.i32_data(), s.i32_size());
+    m_session->ev->cancel();
+}
+
+void mtproto_client::send_all_acks()
+{
+    if (!is_configured() || !m_session || m_session->ack_set.empty()) {
+        return;
+    }
+
+    m_user_agent.net_stats().acks_sent_standalone += m_session->ack_set.size();
+    auto s = std::make_shared<mtprotocol_serializer>();
+    serialize_pending_acks(*s);
+    send_ack_message(s);
 }
 
 void mtproto_client::insert_msg_id(int64_t id)
@@ -1592,7 +2290,12 @@ void mtproto_client::insert_msg_id(int64_t id)
 void mtproto_client::create_session()
 {
     assert(!m_session);
-    m_session = std::make_unique<struct session>();
+    if (m_resumed_session) {
+        m_session = std::move(m_resumed_session);
+    } else {
+        m_session = std::make_unique<struct session>();
+    }
+    m_future_salts_request_time = 0;
     while (!m_session->session_id) {
         tgl_secure_random(reinterpret_cast<unsigned char*>(&m_session->session_id), 8);
     }
@@ -1608,6 +2311,10 @@ void mtproto_client::create_session()
             shared_this->send_all_acks();
         }
     });
+
+    if (m_temp_key_refresh_time && tgl_get_monotonic_time() >= m_temp_key_refresh_time) {
+        refresh_temp_auth_key();
+    }
 }
 
 void mtproto_client::reset_authorization()
@@ -1627,9 +2334,28 @@ void mtproto_client::reset_temp_authorization()
     memset(m_new_nonce.data(), 0, m_new_nonce.size());
     memset(m_server_nonce.data(), 0, m_server_nonce.size());
     m_temp_auth_key_id = 0;
+    m_temp_key_expires = 0;
+    m_resumed_session.reset();
+    memset(m_prev_temp_auth_key.data(), 0, m_prev_temp_auth_key.size());
+    m_prev_temp_auth_key_id = 0;
+    if (m_temp_key_refresh_timer) {
+        m_temp_key_refresh_timer->cancel();
+    }
+    m_temp_key_refresh_time = 0;
+    if (m_temp_key_generator) {
+        m_temp_key_generator->clear_session();
+        m_temp_key_generator.reset();
+    }
+    memset(m_next_temp_auth_key.data(), 0, m_next_temp_auth_key.size());
+    m_next_temp_auth_key_id = 0;
+    m_next_server_salt = 0;
+    m_temp_key_switch_msg_id = 0;
     m_server_salt = 0;
+    m_future_salts.clear();
+    m_future_salts_request_time = 0;
     set_configured(false);
     set_bound(false);
+    temp_auth_key_changed();
 }
 
 void mtproto_client::send_pending_queries()
@@ -1730,10 +2456,9 @@ void mtproto_client::connection_status_changed(const std::shared_ptr<tgl_connect
 
     if (c != m_session->primary_worker->connection) {
         if (c->status() == tgl_connection_status::closed) {
-            auto it = m_session->secondary_workers.begin();
-            for (; it != m_session->secondary_workers.end(); ++it) {
-                if ((*it)->connection == c) {
-                    m_session->secondary_workers.erase(it);
+            for (const auto& w: m_session->secondary_workers) {
+                if (w->connection == c) {
+                    m_session->remove_secondary_worker(w);
                     break;
                 }
             }
@@ -1745,11 +2470,21 @@ void mtproto_client::connection_status_changed(const std::shared_ptr<tgl_connect
         m_user_agent.callback()->connection_status_changed(c->status());
     }
 
-    for (const auto& weak_observer: m_connection_status_observers) {
-        if (const auto& observer = weak_observer.lock()) {
-            observer->connection_status_changed(c->status());
+    // Observers may unregister while being notified, and the ones that went
+    // away without unregistering are dropped here.
+    std::vector<std::shared_ptr<connection_status_observer>> observers;
+    observers.reserve(m_connection_status_observers.size());
+    for (auto it = m_connection_status_observers.begin(); it != m_connection_status_observers.end(); ) {
+        if (auto observer = it->second.lock()) {
+            observers.push_back(std::move(observer));
+            ++it;
+        } else {
+            it = m_connection_status_observers.erase(it);
         }
     }
+    for (const auto& observer: observers) {
+        observer->connection_status_changed(c->status());
+    }
 
     if (c->status() == tgl_connection_status::connected) {
         connected(m_user_agent.pfs_enabled(), m_user_agent.temp_key_expire_time());
@@ -1767,15 +2502,17 @@ tgl_connection_status mtproto_client::connection_status() const
 
 void mtproto_client::add_connection_status_observer(const std::weak_ptr<connection_status_observer>& weak_observer)
 {
-    m_connection_status_observers.insert(weak_observer);
     if (auto observer = weak_observer.lock()) {
+        m_connection_status_observers[observer.get()] = weak_observer;
         observer->connection_status_changed(connection_status());
     }
 }
 
-void mtproto_client::remove_connection_status_observer(const std::weak_ptr<connection_status_observer>& observer)
+void mtproto_client::remove_connection_status_observer(const std::weak_ptr<connection_status_observer>& weak_observer)
 {
-    m_connection_status_observers.erase(observer);
+    if (auto observer = weak_observer.lock()) {
+        m_connection_status_observers.erase(observer.get());
+    }
 }
 
 void mtproto_client::transfer_auth_to_me()
@@ -1791,7 +2528,7 @@ void mtproto_client::transfer_auth_to_me()
     TGL_DEBUG("transferring auth from DC " << m_user_agent.active_client()->id() << " to DC " << id());
 
     std::weak_ptr<mtproto_client> weak_this(shared_from_this());
-    auto q = std::make_shared<query_export_auth>(m_user_agent, shared_from_this(), [this, weak_this](bool success) {
+    auto q = make_query<query_export_auth>(m_user_agent, shared_from_this(), [this, weak_this](bool success) {
         auto shared_this = weak_this.lock();
         if (!shared_this) {
             return;
@@ -1815,6 +2552,143 @@ size_t mtproto_client::max_connections() const
     return MAX_SECONDARY_WORKERS_PER_SESSION + 1;
 }
 
+bool mtproto_client::save_session(mtprotocol_serializer& s) const
+{
+    if (m_is_media || !is_authorized() || !is_bound() || m_state != state::authorized || !m_temp_auth_key_id) {
+        return false;
+    }
+
+    bool pfs = m_temp_auth_key_id != m_auth_key_id;
+    if (pfs && !m_temp_key_expires) {
+        return false;
+    }
+
+    // A resumed session nobody used yet is still worth saving.
+    const struct session* session = m_session ? m_session.get() : m_resumed_session.get();
+
+    int32_t flags = 0;
+    if (pfs) {
+        flags |= SESSION_RECORD_PFS;
+    }
+    if (is_configured()) {
+        flags |= SESSION_RECORD_CONFIGURED;
+    }
+    if (session && session->session_id) {
+        flags |= SESSION_RECORD_SESSION;
+    }
+
+    // Without PFS the permanent key does the job of the temporary one, it is
+    // restored separately and has no business in here.
+    std::array<unsigned char, 256> temp_auth_key;
+    memset(temp_auth_key.data(), 0, temp_auth_key.size());
+    if (pfs) {
+        temp_auth_key = m_temp_auth_key;
+    }
+
+    s.out_i32(flags);
+    s.out_i64(m_auth_key_id);
+    s.out_i64(pfs ? m_temp_auth_key_id : 0);
+    s.out_i32(pfs ? m_temp_key_expires : 0);
+    s.out_i32s(reinterpret_cast<const int32_t*>(temp_auth_key.data()), temp_auth_key.size() / 4);
+    s.out_i64(m_server_time_delta);
+    s.out_i64(m_server_salt);
+    s.out_i64(session ? session->session_id : 0);
+    s.out_i32(session ? session->seq_no : 0);
+    s.out_i64(session ? session->last_msg_id : 0);
+
+    const auto& salts = m_future_salts.salts();
+    int32_t salt_count = std::min<size_t>(salts.size(), SESSION_RECORD_MAX_SALTS);
+    s.out_i32(salt_count);
+    for (int32_t i = 0; i < salt_count; ++i) {
+        s.out_i32(salts[i].valid_since);
+        s.out_i32(salts[i].valid_until);
+        s.out_i64(salts[i].value);
+    }
+
+    return true;
+}
+
+bool mtproto_client::resume_session(tgl_in_buffer* in, bool configured)
+{
+    if (in_remaining(in) < SESSION_RECORD_FIXED_INTS * 4) {
+        TGL_WARNING("session record of DC " << m_id << " is truncated");
+        return false;
+    }
+
+    int32_t flags = fetch_i32(in);
+    int64_t auth_key_id = fetch_i64(in);
+    int64_t temp_auth_key_id = fetch_i64(in);
+    int32_t temp_key_expires = fetch_i32(in);
+    std::array<unsigned char, 256> temp_auth_key;
+    fetch_data(in, temp_auth_key.data(), temp_auth_key.size());
+    int64_t server_time_delta = fetch_i64(in);
+    int64_t server_salt = fetch_i64(in);
+    int64_t session_id = fetch_i64(in);
+    int32_t seq_no = fetch_i32(in);
+    int64_t last_msg_id = fetch_i64(in);
+    int32_t salt_count = fetch_i32(in);
+    if (salt_count < 0 || salt_count > SESSION_RECORD_MAX_SALTS || in_remaining(in) != salt_count * 16) {
+        TGL_WARNING("session record of DC " << m_id << " is malformed");
+        return false;
+    }
+
+    std::vector<server_salt_schedule::salt> salts(salt_count);
+    for (auto& salt: salts) {
+        salt.valid_since = fetch_i32(in);
+        salt.valid_until = fetch_i32(in);
+        salt.value = fetch_i64(in);
+    }
+
+    if (m_is_media || m_session || !is_authorized() || auth_key_id != m_auth_key_id) {
+        TGL_DEBUG("the saved session does not apply to DC " << m_id);
+        return false;
+    }
+
+    bool pfs = flags & SESSION_RECORD_PFS;
+    if (pfs != m_user_agent.pfs_enabled()) {
+        TGL_DEBUG("the saved session of DC " << m_id << " was made with PFS " << (pfs ? "enabled" : "disabled"));
+        return false;
+    }
+
+    if (pfs) {
+        if (temp_key_expires - (tgl_get_system_time() + server_time_delta) < TEMP_KEY_RESUME_MIN_LIFETIME) {
+            TGL_DEBUG("the saved temp auth key of DC " << m_id << " expired");
+            return false;
+        }
+        m_temp_auth_key = temp_auth_key;
+        calculate_auth_key_id(true);
+        if (m_temp_auth_key_id != temp_auth_key_id) {
+            TGL_WARNING("the saved temp auth key of DC " << m_id << " is corrupted");
+            reset_temp_authorization();
+            return false;
+        }
+        m_temp_key_expires = temp_key_expires;
+    } else {
+        m_temp_auth_key_id = m_auth_key_id;
+        memcpy(m_temp_auth_key.data(), m_auth_key.data(), 256);
+    }
+
+    m_state = state::authorized;
+    set_bound();
+    set_configured(configured && (flags & SESSION_RECORD_CONFIGURED));
+
+    m_server_time_delta = server_time_delta;
+    m_server_time_udelta = tgl_get_system_time() + server_time_delta - tgl_get_monotonic_time();
+    m_server_salt = server_salt;
+    m_future_salts.update(std::move(salts));
+
+    if ((flags & SESSION_RECORD_SESSION) && session_id) {
+        m_resumed_session = std::make_unique<struct session>();
+        m_resumed_session->session_id = session_id;
+        m_resumed_session->seq_no = seq_no;
+        m_resumed_session->last_msg_id = last_msg_id;
+    }
+
+    schedule_temp_key_refresh();
+
+    return true;
+}
+
 tgl_online_status mtproto_client::online_status() const
 {
     return m_user_agent.online_status();
@@ -1830,6 +2704,11 @@ bool mtproto_client::ipv6_enabled() const
     return m_user_agent.ipv6_enabled();
 }
 
+tgl_transport mtproto_client::transport() const
+{
+    return m_user_agent.transport(m_id);
+}
+
 void mtproto_client::add_online_status_observer(const std::weak_ptr<tgl_online_status_observer>& observer)
 {
     m_user_agent.add_online_status_observer(observer);
@@ -23,6 +23,7 @@
 #pragma once
 
 #include "crypto/crypto_bn.h"
+#include "server_salt_schedule.h"
 #include "session.h"
 #include "tgl/tgl_mtproto_client.h"
 #include "tgl/tgl_dc.h"
@@ -35,6 +36,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 class tgl_connection;
@@ -44,6 +46,7 @@ class tgl_timer;
 namespace tgl {
 namespace impl {
 
+class mtprotocol_serializer;
 class rsa_public_key;
 class query;
 
@@ -54,7 +57,12 @@ class mtproto_client: public std::enable_shared_from_this<mtproto_client>
         , public tgl_mtproto_client
         , public tgl_dc {
 public:
-    mtproto_client(user_agent& ua, int32_t id);
+    // A media client carries the file transfer traffic of a DC on its own
+    // session and connections. It borrows the permanent auth key and the bound
+    // temporary key of the main client of the DC and never generates, binds or
+    // persists a key itself. The server keeps a single temporary key bound to a
+    // permanent one, so binding a second key would unbind the main client's.
+    mtproto_client(user_agent& ua, int32_t id, bool is_media = false);
 
     mtproto_client(const mtproto_client&) = delete;
     mtproto_client(mtproto_client&&) = delete;
@@ -87,9 +95,11 @@ public:
     virtual void connection_status_changed(const std::shared_ptr<tgl_connection>& c) override;
     virtual bool try_rpc_execute(const std::shared_ptr<tgl_connection>& c) override;
     virtual void ping() override;
+    virtual void ping(const std::shared_ptr<tgl_connection>& c) override;
     virtual tgl_online_status online_status() const override;
     virtual std::shared_ptr<tgl_timer_factory> timer_factory() const override;
     virtual bool ipv6_enabled() const override;
+    virtual tgl_transport transport() const override;
     virtual void add_online_status_observer(const std::weak_ptr<tgl_online_status_observer>& observer) override;
     virtual void remove_online_status_observer(const std::weak_ptr<tgl_online_status_observer>& observer) override;
     virtual void bytes_sent(size_t bytes) override;
@@ -107,6 +117,10 @@ public:
 
     void clear_session()
     {
+        if (m_temp_key_generator) {
+            m_temp_key_generator->clear_session();
+            m_temp_key_generator.reset();
+        }
         if (m_session) {
             m_session->clear();
             m_session.reset();
@@ -115,10 +129,10 @@ public:
 
     void create_session();
 
-    int64_t send_message(const int32_t* message, size_t message_ints,
+    int64_t send_message(const std::shared_ptr<mtprotocol_serializer>& message,
             int64_t message_id_override, bool force_send, bool allow_secondary_connections)
     {
-        return send_message_impl(message, message_ints, message_id_override, force_send, true, allow_secondary_connections, true);
+        return send_message_impl(message, message_id_override, force_send, true, allow_secondary_connections, true);
     }
 
     void reset_authorization();
@@ -132,6 +146,8 @@ public:
     void remove_pending_query(const std::shared_ptr<query>& q);
     void send_pending_queries();
 
+    bool is_media() const { return m_is_media; }
+
     bool is_authorized() const { return m_authorized; }
     void set_authorized(bool b = true) { m_authorized = b; }
 
@@ -142,6 +158,16 @@ public:
 
     bool is_bound() const { return m_bound; }
     void set_bound(bool b = true) { m_bound = b; }
+    void temp_auth_key_bound();
+    // Whether a message was sent with a temporary key we switched away from,
+    // which the server may have unbound by the time it got the message.
+    bool sent_with_replaced_temp_key(int64_t msg_id) const
+    {
+        return m_prev_temp_auth_key_id && msg_id <= m_temp_key_switch_msg_id;
+    }
+    // Makes a media client use the temporary key of the main client of its DC.
+    // Requests are held back while that key is not bound.
+    void share_temp_auth_key(const mtproto_client& main);
 
     const std::shared_ptr<query>& logout_query() const { return m_logout_query; }
     void set_logout_query(const std::shared_ptr<query>& q) { m_logout_query = q; }
@@ -166,23 +192,43 @@ public:
 
     size_t max_connections() const;
 
+    // Writes what it takes to resume the session with this DC after a restart,
+    // returns false without writing anything if there is nothing to resume.
+    bool save_session(mtprotocol_serializer& s) const;
+    // Resumes from a record written by save_session() if it still applies to
+    // our auth key and the temporary key is valid for a while. The connection
+    // is only configured again if configured is false.
+    bool resume_session(tgl_in_buffer* in, bool configured);
+
 private:
     void connected(bool pfs_enabled, int32_t temp_key_expire_time);
     void configured(bool success);
     void reset_temp_authorization();
     void cleanup_timer_expired();
     void send_all_acks();
+    void serialize_pending_acks(mtprotocol_serializer& s);
     int64_t generate_next_msg_id();
+    int32_t next_seq_no(bool useful);
+    void ensure_session_id();
     double get_server_time();
     void create_temp_auth_key();
     void restart_session();
     void rpc_send_packet(const char* data, size_t len);
+    int64_t current_server_salt();
+    void request_future_salts_if_needed();
     void send_req_pq_packet();
     void send_req_pq_temp_packet();
     int encrypt_inner_temp(const int32_t* msg, int msg_ints, void* data, int64_t msg_id);
-    void send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp_key, int32_t temp_key_expire_time);
+    bool send_req_dh_packet(TGLC_bn_ctx* ctx, TGLC_bn* pq, bool temp_key, int32_t temp_key_expire_time);
     void send_dh_params(TGLC_bn_ctx* ctx, TGLC_bn* dh_prime, TGLC_bn* g_a, int g, bool temp_key);
     void bind_temp_auth_key(int32_t temp_key_expire_time);
+    void temp_auth_key_changed();
+    void schedule_temp_key_refresh();
+    void pregenerate_temp_auth_key();
+    void refresh_temp_auth_key();
+    void temp_auth_key_pregenerated(const mtproto_client& generator);
+    void switch_to_next_temp_auth_key();
+    bool is_temp_key_generator() const { return !m_temp_key_owner.expired(); }
     void init_enc_msg(encrypted_message& enc_msg, bool useful);
     void init_enc_msg_inner_temp(encrypted_message& enc_msg, int64_t msg_id);
     void restart_authorization(bool temp_key);
@@ -191,6 +237,7 @@ private:
     int work_new_session_created(tgl_in_buffer* in, int64_t msg_id);
     int work_packed(tgl_in_buffer* in, int64_t msg_id);
     int work_bad_server_salt(tgl_in_buffer* in);
+    int work_future_salts(tgl_in_buffer* in);
     int work_rpc_result(tgl_in_buffer* in, int64_t msg_id);
     int work_pong(tgl_in_buffer* in);
     int work_bad_msg_notification(tgl_in_buffer* in);
@@ -200,6 +247,7 @@ private:
     void insert_msg_id(int64_t id);
     void calculate_auth_key_id(bool temp_key);
     bool rpc_execute(const std::shared_ptr<tgl_connection>& c, int op, int len);
+    bool process_frame(char* frame, int op, int len);
     bool process_respq_answer(const char* packet, int len, bool temp_key);
     bool process_dh_answer(const char* packet, int len, bool temp_key);
     bool process_auth_complete(const char* packet, int len, bool temp_key);
@@ -208,20 +256,27 @@ private:
     void restart_query(int64_t msg_id);
     void ack_query(int64_t msg_id);
 
-    int64_t send_message(const int32_t* message, size_t message_ints)
+    int64_t send_message(const std::shared_ptr<mtprotocol_serializer>& message)
     {
-        return send_message_impl(message, message_ints, 0, false, false, false, true);
+        return send_message_impl(message, 0, false, false, false, true);
     }
 
-    int64_t send_ack_message(const int32_t* message, size_t message_ints)
+    int64_t send_ack_message(const std::shared_ptr<mtprotocol_serializer>& message)
     {
-        return send_message_impl(message, message_ints, 0, false, false, false, false);
+        return send_message_impl(message, 0, false, false, false, false);
     }
 
-    int64_t send_message_impl(const int32_t* msg, size_t msg_ints,
+    std::shared_ptr<mtprotocol_serializer> compress_message(const std::shared_ptr<mtprotocol_serializer>& msg);
+    int64_t send_message_impl(const std::shared_ptr<mtprotocol_serializer>& uncompressed_msg,
             int64_t msg_id_override, bool force_send, bool useful, bool allow_secondary_connections, bool count_work_load);
+    std::vector<char> encrypt_message(const int32_t* msg, size_t msg_ints, int64_t msg_id, int32_t seq_no);
+    void encrypt_frame(mtprotocol_serializer& s, int64_t msg_id, int32_t seq_no);
+
+    void flush_send_queues();
+    void flush_send_queue(const std::shared_ptr<worker>& w);
 
-    std::shared_ptr<worker> select_best_worker(bool allow_secondary_workers);
+    std::shared_ptr<worker> select_best_worker(bool allow_secondary_workers, size_t msg_bytes);
+    size_t least_loaded_worker_bytes(const std::shared_ptr<worker>& except) const;
     void worker_job_done(int64_t id);
 
     void clear_bind_temp_auth_key_query();
@@ -229,8 +284,11 @@ private:
 private:
     user_agent& m_user_agent;
     int32_t m_id;
+    const bool m_is_media;
     state m_state;
     std::unique_ptr<struct session> m_session;
+    // Set by resume_session(), picked up by create_session() instead of a new one.
+    std::unique_ptr<struct session> m_resumed_session;
     std::array<unsigned char, 256> m_auth_key;
     std::array<unsigned char, 256> m_temp_auth_key;
     std::array<unsigned char, 16> m_nonce;
@@ -238,7 +296,22 @@ private:
     std::array<unsigned char, 32> m_new_nonce;
     int64_t m_auth_key_id;
     int64_t m_temp_auth_key_id;
+    // The temporary key replaced by the last switch of keys. The server still
+    // encrypts the answers to the messages sent with it using it.
+    std::array<unsigned char, 256> m_prev_temp_auth_key;
+    int64_t m_prev_temp_auth_key_id;
+    // The key negotiated in the background and not switched to yet, and the
+    // last msg_id sent with the previous key when we switched.
+    std::array<unsigned char, 256> m_next_temp_auth_key;
+    int64_t m_next_temp_auth_key_id;
+    int64_t m_next_server_salt;
+    int64_t m_temp_key_switch_msg_id;
+    // The server time the bound temporary key expires at, 0 without PFS.
+    int32_t m_temp_key_expires;
     int64_t m_server_salt;
+    server_salt_schedule m_future_salts;
+    // The server time get_future_salts was last sent at, 0 if no request is pending.
+    double m_future_salts_request_time;
 
     int64_t m_server_time_delta;
     double m_server_time_udelta;
@@ -259,8 +332,23 @@ private:
     std::shared_ptr<query> m_bind_temp_auth_key_query;
 
     std::shared_ptr<tgl_timer> m_session_cleanup_timer;
+
+    // The next temporary key is negotiated by a helper client on its own
+    // connection while this one keeps using the current key, and bound by this
+    // one when it switches to it. The helper points back at us through
+    // m_temp_key_owner.
+    std::shared_ptr<mtproto_client> m_temp_key_generator;
+    std::weak_ptr<mtproto_client> m_temp_key_owner;
+    std::shared_ptr<tgl_timer> m_temp_key_refresh_timer;
+    // The monotonic time the next key is due to be pregenerated, 0 if none is.
+    double m_temp_key_refresh_time;
+    // The monotonic time the running foreground temporary key handshake started.
+    double m_temp_key_handshake_start;
+
     std::shared_ptr<rsa_public_key> m_rsa_key;
-    std::set<std::weak_ptr<connection_status_observer>, std::owner_less<std::weak_ptr<connection_status_observer>>> m_connection_status_observers;
+    // Every query executing on this client registers here, so these are hashed
+    // by address rather than kept in an ordered set.
+    std::unordered_map<connection_status_observer*, std::weak_ptr<connection_status_observer>> m_connection_status_observers;
 };
 
 }
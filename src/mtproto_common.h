@@ -118,23 +118,33 @@ void tgl_prng_seed(const char* password_filename, int password_length);
 int tgl_serialize_bignum(const TGLC_bn* b, char* buffer, int maxlen);
 int64_t tgl_do_compute_rsa_key_fingerprint(const TGLC_rsa* key);
 
+// Room for the transport length prefix (up to 4 bytes) and the encrypted_message header
+// (auth_key_id, msg_key, server_salt, session_id, msg_id, seq_no and msg_len).
+static constexpr size_t MTPROTO_FRAME_HEADER_SIZE = 4 + 56;
+
 class mtprotocol_serializer
 {
 public:
-    explicit mtprotocol_serializer(size_t initial_buffer_capacity = 256 /*int32_ts*/)
+    // A serializer created with reserve_frame_header keeps MTPROTO_FRAME_HEADER_SIZE bytes
+    // in front of the payload so the message can be padded, encrypted and handed over to
+    // the connection in place. The header is invisible to the out_* and i32_* methods.
+    explicit mtprotocol_serializer(size_t initial_buffer_capacity = 256 /*int32_ts*/, bool reserve_frame_header = false)
+        : m_header_size(reserve_frame_header ? MTPROTO_FRAME_HEADER_SIZE : 0)
     {
-        m_data.reserve(initial_buffer_capacity);
+        m_data.reserve(m_header_size + initial_buffer_capacity * 4);
+        m_data.resize(m_header_size);
     }
 
     void out_i32s(const int32_t* ints, size_t num)
     {
-        m_data.resize(m_data.size() + num);
-        memcpy(m_data.data() + m_data.size() - num, ints, num * 4);
+        size_t old_size = i32_size();
+        m_data.resize(m_data.size() + num * 4);
+        out_i32s_at(old_size, ints, num);
     }
 
     void out_i32s_at(size_t at, const int32_t* ints, size_t num)
     {
-        memcpy(m_data.data() + at, ints, num * 4);
+        memcpy(i32_ptr(at), ints, num * 4);
     }
 
     void out_i32_at(size_t at, int32_t i)
@@ -149,47 +159,60 @@ public:
 
     void out_i64(int64_t i)
     {
-        size_t old_size = m_data.size();
-        m_data.resize(old_size + 2);
+        size_t old_size = i32_size();
+        m_data.resize(m_data.size() + 8);
         out_i64_at(old_size, i);
     }
 
     void out_i64_at(size_t at, int64_t i)
     {
-        memcpy(m_data.data() + at, &i, 8);
+        memcpy(i32_ptr(at), &i, 8);
     }
 
     void out_double(double d)
+    {
+        out_double_at(reserve_i32s(2), d);
+    }
+
+    void out_double_at(size_t at, double d)
     {
         static_assert(sizeof(double) == 8, "We assume double is 8 bytes");
-        m_data.resize(m_data.size() + 2);
-        *reinterpret_cast<double*>(m_data.data() + m_data.size() - 2) = d;
+        memcpy(i32_ptr(at), &d, 8);
     }
 
     void out_string(const char* str, size_t size)
+    {
+        size_t at = reserve_i32s(string_i32_size(size));
+        out_string_at(at, str, size);
+    }
+
+    // Writes a string into room made with reserve_i32s() and returns the number of ints used.
+    size_t out_string_at(size_t at, const char* str, size_t size)
     {
         if (size >= (1 << 24)) {
             throw std::invalid_argument("string is too big");
         }
-        char* dest = nullptr;
+        size_t num = string_i32_size(size);
+        char* dest = reinterpret_cast<char*>(i32_ptr(at));
+        char* end = dest + num * 4;
         if (size < 0xfe) {
-            size_t num = ((1 + size) + 3) / 4;
-            m_data.resize(m_data.size() + num);
-            dest = reinterpret_cast<char*>(m_data.data() + m_data.size() - num);
             *dest++ = static_cast<char>(size);
         } else {
-            size_t num = ((4 + size) + 3) / 4;
-            m_data.resize(m_data.size() + num);
-            dest = reinterpret_cast<char*>(m_data.data() + m_data.size() - num);
             *reinterpret_cast<int32_t*>(dest) = static_cast<int32_t>((size << 8) + 0xfe);
             dest += 4;
         }
 
         memcpy(dest, str, size);
         dest += size;
-        while (dest < reinterpret_cast<char*>(m_data.data() + m_data.size())) {
+        while (dest < end) {
             *dest++ = 0;
         }
+        return num;
+    }
+
+    static size_t string_i32_size(size_t size)
+    {
+        return size < 0xfe ? (1 + size + 3) / 4 : (4 + size + 3) / 4;
     }
 
     void out_string(const char* str)
@@ -209,9 +232,8 @@ public:
             throw std::invalid_argument("bad big number");
         }
         assert(!(required_size & 3));
-        int num = required_size / 4;
-        m_data.resize(m_data.size() + num);
-        int actual_size = tgl_serialize_bignum(n, reinterpret_cast<char*>(m_data.data() + m_data.size() - num), required_size);
+        m_data.resize(m_data.size() + required_size);
+        int actual_size = tgl_serialize_bignum(n, m_data.data() + m_data.size() - required_size, required_size);
         TGL_ASSERT_UNUSED(actual_size, required_size == actual_size);
     }
 
@@ -224,30 +246,95 @@ public:
 
     size_t reserve_i32s(size_t num_of_i32)
     {
-        size_t old_size = m_data.size();
-        m_data.resize(old_size + num_of_i32);
+        size_t old_size = i32_size();
+        m_data.resize(m_data.size() + num_of_i32 * 4);
         return old_size;
     }
 
     size_t ensure_char_size(size_t bytes)
     {
         size_t new_size = (bytes + 3) / 4;
-        size_t old_size = m_data.size();
+        size_t old_size = i32_size();
         if (old_size < new_size) {
-            m_data.resize(new_size, 0);
+            m_data.resize(m_header_size + new_size * 4, 0);
         }
         return old_size * 4;
     }
 
-    void clear() { m_data.clear(); }
+    void clear() { m_data.resize(m_header_size); }
+
+    const int32_t* i32_data() const { return reinterpret_cast<const int32_t*>(m_data.data() + m_header_size); }
+    size_t i32_size() const { return (m_data.size() - m_header_size) / 4; }
+    const char* char_data() const { return m_data.data() + m_header_size; }
+    size_t char_size() const { return m_data.size() - m_header_size; }
+
+    bool has_frame_header() const { return m_header_size != 0; }
+
+    // The reserved header followed by the payload.
+    char* frame_data()
+    {
+        assert(has_frame_header());
+        return m_data.data();
+    }
+
+    // Gives away the whole buffer including the reserved header, leaving the serializer empty.
+    std::vector<char> release_frame()
+    {
+        assert(has_frame_header());
+        std::vector<char> frame;
+        frame.swap(m_data);
+        m_data.resize(m_header_size);
+        return frame;
+    }
+
+private:
+    int32_t* i32_ptr(size_t at) { return reinterpret_cast<int32_t*>(m_data.data() + m_header_size) + at; }
+
+    size_t m_header_size;
+    std::vector<char> m_data;
+};
+
+// A string or bytes argument of the generated tl_out_* builders.
+struct tl_out_string {
+    tl_out_string(const char* data, size_t size) : data(data), size(size) { }
+    tl_out_string(const std::string& str) : data(str.data()), size(str.size()) { }
+
+    const char* data;
+    size_t size;
+};
+
+// An already serialized object argument of the generated tl_out_* builders.
+// Small objects such as an InputPeer can be written into the object itself;
+// anything bigger refers to a serializer that outlives the builder call.
+class tl_out_object
+{
+public:
+    static constexpr size_t INLINE_SIZE = 8;
+
+    tl_out_object() : m_external(nullptr), m_size(0) { }
+    tl_out_object(const int32_t* data, size_t size) : m_external(data), m_size(size) { }
+    explicit tl_out_object(const mtprotocol_serializer& s) : tl_out_object(s.i32_data(), s.i32_size()) { }
+
+    void out_i32(int32_t i)
+    {
+        assert(!m_external && m_size + 1 <= INLINE_SIZE);
+        m_inline[m_size++] = i;
+    }
+
+    void out_i64(int64_t i)
+    {
+        assert(!m_external && m_size + 2 <= INLINE_SIZE);
+        memcpy(m_inline + m_size, &i, 8);
+        m_size += 2;
+    }
 
-    const int32_t* i32_data() const { return m_data.data(); }
-    size_t i32_size() const { return m_data.size(); }
-    const char* char_data() const { return reinterpret_cast<const char*>(m_data.data()); }
-    size_t char_size() const { return m_data.size() * 4; }
+    const int32_t* data() const { return m_external ? m_external : m_inline; }
+    size_t size() const { return m_size; }
 
 private:
-    std::vector<int32_t> m_data;
+    const int32_t* m_external;
+    size_t m_size;
+    int32_t m_inline[INLINE_SIZE];
 };
 
 struct tgl_in_buffer {
@@ -0,0 +1,159 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "mtproto_transport.h"
+
+#include "tools.h"
+
+#include <cstring>
+
+namespace tgl {
+namespace impl {
+
+namespace {
+
+// A 1 byte length in words, or 0x7f followed by a 3 byte length in words.
+class mtproto_transport_abridged : public mtproto_transport {
+public:
+    virtual size_t header_size(size_t len) const override
+    {
+        return (len >> 2) < 0x7f ? 1 : 4;
+    }
+
+    virtual void write_header(char* packet, size_t len, size_t padding_len) const override
+    {
+        assert(!padding_len);
+        assert(!(len & 3) && len < (1 << 26));
+        uint32_t words = len >> 2;
+        if (words < 0x7f) {
+            packet[-1] = static_cast<char>(words);
+        } else {
+            words = (words << 8) | 0x7f;
+            memcpy(packet - 4, &words, 4);
+        }
+    }
+
+    virtual int peek_header(tgl_connection& c, size_t* len) const override
+    {
+        uint32_t words = 0;
+        if (c.peek(&words, 1) < 1) {
+            return 0;
+        }
+        if (words >= 1 && words <= 0x7e) {
+            *len = words * 4;
+            return 1;
+        }
+        if (c.peek(&words, 4) < 4) {
+            return 0;
+        }
+        *len = (words >> 8) * 4;
+        return 4;
+    }
+};
+
+// A 4 byte length in bytes. Every packet stays 4 byte aligned in the stream.
+class mtproto_transport_intermediate : public mtproto_transport {
+public:
+    virtual size_t header_size(size_t) const override
+    {
+        return 4;
+    }
+
+    virtual void write_header(char* packet, size_t len, size_t padding_len) const override
+    {
+        uint32_t total_len = len + padding_len;
+        assert(total_len < 0x80000000u);
+        memcpy(packet - 4, &total_len, 4);
+    }
+
+    virtual int peek_header(tgl_connection& c, size_t* len) const override
+    {
+        uint32_t total_len = 0;
+        if (c.peek(&total_len, 4) < 4) {
+            return 0;
+        }
+        // The top bit marks a quick ack which is never requested.
+        if (total_len & 0x80000000u) {
+            return -1;
+        }
+        *len = total_len;
+        return 4;
+    }
+};
+
+// Intermediate with up to 15 random bytes after every packet, which the length covers.
+class mtproto_transport_padded_intermediate : public mtproto_transport_intermediate {
+public:
+    virtual size_t padding_size() const override
+    {
+        return tgl_random<uint32_t>() & 15;
+    }
+
+    virtual size_t unpadded_size(const char* packet, size_t len) const override
+    {
+        // auth_key_id and msg_key in front of the encrypted part of a message, and
+        // auth_key_id, msg_id and msg_len in front of an unencrypted one.
+        const size_t UNENCSZ = 24;
+        const size_t UNAUTHSZ = 20;
+        int64_t auth_key_id = 0;
+        if (len >= UNAUTHSZ) {
+            memcpy(&auth_key_id, packet, 8);
+        }
+
+        if (len >= UNAUTHSZ && !auth_key_id) {
+            int32_t msg_len;
+            memcpy(&msg_len, packet + 16, 4);
+            if (msg_len >= 0 && static_cast<size_t>(msg_len) <= len - UNAUTHSZ) {
+                return UNAUTHSZ + msg_len;
+            }
+            return len;
+        }
+
+        if (len >= UNENCSZ + 16) {
+            // The encrypted part is a whole number of AES blocks.
+            return UNENCSZ + ((len - UNENCSZ) & ~static_cast<size_t>(15));
+        }
+
+        // An error code.
+        return len < 4 ? len : 4;
+    }
+};
+
+}
+
+const mtproto_transport& mtproto_transport::get(tgl_transport transport)
+{
+    static const mtproto_transport_abridged abridged;
+    static const mtproto_transport_intermediate intermediate;
+    static const mtproto_transport_padded_intermediate padded_intermediate;
+
+    switch (transport) {
+    case tgl_transport::intermediate:
+        return intermediate;
+    case tgl_transport::padded_intermediate:
+        return padded_intermediate;
+    case tgl_transport::abridged:
+    default:
+        return abridged;
+    }
+}
+
+}
+}
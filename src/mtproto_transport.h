@@ -0,0 +1,62 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "tgl/tgl_net.h"
+
+#include <cstddef>
+
+namespace tgl {
+namespace impl {
+
+// The longest length prefix of all transports. Outgoing frames keep this many
+// bytes free in front of the packet so the prefix can be written in place.
+static constexpr size_t MTPROTO_TRANSPORT_HEADER_SIZE = 4;
+
+// Frames MTProto packets on a connection according to its tgl_transport.
+class mtproto_transport {
+public:
+    static const mtproto_transport& get(tgl_transport transport);
+
+    virtual ~mtproto_transport() { }
+
+    // The size of the length prefix of a packet of len bytes.
+    virtual size_t header_size(size_t len) const = 0;
+
+    // Writes the length prefix of a packet of len bytes that is followed by
+    // padding_len bytes of padding into the header_size(len) bytes before packet.
+    virtual void write_header(char* packet, size_t len, size_t padding_len) const = 0;
+
+    // The number of random bytes to send after a packet.
+    virtual size_t padding_size() const { return 0; }
+
+    // Parses the length prefix at the front of the unread bytes of c without
+    // consuming it. Returns the size of the prefix and stores the length of the
+    // packet that follows in len, 0 if the prefix has not arrived completely yet,
+    // or -1 if it is malformed.
+    virtual int peek_header(tgl_connection& c, size_t* len) const = 0;
+
+    // The size of a received packet of len bytes without the padding the server added.
+    virtual size_t unpadded_size(const char* packet, size_t len) const { return len; }
+};
+
+}
+}
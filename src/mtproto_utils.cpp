@@ -26,6 +26,7 @@
 #include "tgl/tgl_log.h"
 #include "tools.h"
 
+#include <algorithm>
 #include <memory>
 #include <string.h>
 
@@ -47,7 +48,7 @@ inline static int check_prime(TGLC_bn_ctx* ctx, TGLC_bn* p)
 // Complete set of checks see at https://core.telegram.org/mtproto/security_guidelines
 
 // Checks that(p,g) is acceptable pair for DH
-int tglmp_check_DH_params(TGLC_bn_ctx* ctx, TGLC_bn* p, int g)
+int tglmp_check_DH_params(TGLC_bn_ctx* ctx, TGLC_bn* p, int g, bool p_known_safe_prime)
 {
     if (g < 2 || g > 7) {
         return -1;
@@ -96,7 +97,15 @@ int tglmp_check_DH_params(TGLC_bn_ctx* ctx, TGLC_bn* p, int g)
         break;
     }
 
-    if (res < 0 || !check_prime(ctx, p)) {
+    if (res < 0) {
+        return -1;
+    }
+
+    if (p_known_safe_prime) {
+        return 0;
+    }
+
+    if (!check_prime(ctx, p)) {
         return -1;
     }
 
@@ -159,51 +168,102 @@ static void ull2BN(TGLC_bn* b, unsigned long long val) {
     }
 }
 
-int bn_factorize(TGLC_bn* pq, TGLC_bn* p, TGLC_bn* q)
+static inline unsigned long long mulmod(unsigned long long a, unsigned long long b, unsigned long long m)
 {
-    // Should work in any case
-    // Rewrite this code
-    unsigned long long what = BN2ull(pq);
+#if defined(__SIZEOF_INT128__)
+    return static_cast<unsigned long long>(static_cast<unsigned __int128>(a) * b % m);
+#else
+    unsigned long long c = 0;
+    a %= m;
+    while (b) {
+        if (b & 1) {
+            c = c >= m - a ? c - (m - a) : c + a;
+        }
+        a = a >= m - a ? a - (m - a) : a + a;
+        b >>= 1;
+    }
+    return c;
+#endif
+}
 
-    int it = 0;
-
-    unsigned long long g = 0;
-    for (int i = 0; i < 3 || it < 1000; i++) {
-        int q = ((tgl_random<int>() & 15) + 17) % what;
-        unsigned long long x = tgl_random<long long>() % (what - 1) + 1, y = x;
-        int lim = 1 << (i + 18);
-        for (int j = 1; j < lim; j++) {
-            ++it;
-            unsigned long long a = x, b = x, c = q;
-            while (b) {
-                if (b & 1) {
-                    c += a;
-                    if (c >= what) {
-                        c -= what;
-                    }
-                }
-                a += a;
-                if (a >= what) {
-                    a -= what;
-                }
-                b >>= 1;
-            }
-            x = c;
-            unsigned long long z = x < y ? what + x - y : x - y;
-            g = gcd(z, what);
-            if (g != 1) {
-                break;
-            }
-            if (!(j & (j - 1))) {
-                y = x;
-            }
+static inline unsigned long long absdiff(unsigned long long x, unsigned long long y)
+{
+    return x > y ? x - y : y - x;
+}
+
+// Brent's variant of Pollard's rho: the product of BATCH differences is
+// accumulated before taking one gcd, and the batch is replayed one step at a
+// time only when that gcd hits the whole number. Returns a non-trivial factor of
+// n or n if the walk for this c cycled or ran past MAX_STEPS without finding one.
+static unsigned long long brent_rho(unsigned long long n, unsigned long long y, unsigned long long c)
+{
+    static constexpr unsigned long long BATCH = 128;
+    static constexpr unsigned long long MAX_STEPS = 1ull << 20;
+    auto f = [n, c](unsigned long long v) {
+        unsigned long long r = mulmod(v, v, n) + c;
+        return r >= n || r < c ? r - n : r;
+    };
+
+    unsigned long long g = 1;
+    unsigned long long r = 1;
+    unsigned long long product = 1;
+    unsigned long long x = y;
+    unsigned long long saved_y = y;
+    while (g == 1) {
+        if (r > MAX_STEPS) {
+            return n;
+        }
+        x = y;
+        for (unsigned long long i = 0; i < r; ++i) {
+            y = f(y);
         }
-        if (g > 1 && g < what) {
-            break;
+        for (unsigned long long k = 0; k < r && g == 1; k += BATCH) {
+            saved_y = y;
+            unsigned long long steps = std::min(BATCH, r - k);
+            for (unsigned long long i = 0; i < steps; ++i) {
+                y = f(y);
+                product = mulmod(product, absdiff(x, y), n);
+            }
+            g = gcd(product, n);
         }
+        r *= 2;
+    }
+
+    if (g == n) {
+        do {
+            saved_y = f(saved_y);
+            g = gcd(absdiff(x, saved_y), n);
+        } while (g == 1);
+    }
+    return g;
+}
+
+int bn_factorize(TGLC_bn* pq, TGLC_bn* p, TGLC_bn* q)
+{
+    unsigned long long what = BN2ull(pq);
+    if (what < 4) {
+        TGL_ERROR("can not factorize " << what);
+        return -1;
     }
 
-    assert(g > 1 && g < what);
+    // pq comes from an unauthenticated res_pq, so a prime or otherwise
+    // unfactorable value must not keep us here forever.
+    static constexpr int MAX_ATTEMPTS = 4;
+
+    unsigned long long g = what;
+    if (!(what & 1)) {
+        g = 2;
+    }
+    for (int i = 0; i < MAX_ATTEMPTS && g == what; ++i) {
+        unsigned long long y = tgl_random<unsigned long long>() % (what - 1) + 1;
+        unsigned long long c = tgl_random<unsigned long long>() % (what - 1) + 1;
+        g = brent_rho(what, y, c);
+    }
+
+    if (g <= 1 || g >= what) {
+        TGL_ERROR("can not factorize " << what);
+        return -1;
+    }
     unsigned long long p1 = g;
     unsigned long long p2 = what / g;
     if (p1 > p2) {
@@ -26,7 +26,9 @@
 namespace tgl {
 namespace impl {
 
-int tglmp_check_DH_params(TGLC_bn_ctx* ctx, TGLC_bn* p, int g);
+// The primality tests of p and (p - 1) / 2 dominate, they are skipped when the
+// caller already validated the same p.
+int tglmp_check_DH_params(TGLC_bn_ctx* ctx, TGLC_bn* p, int g, bool p_known_safe_prime = false);
 int tglmp_check_g_a(TGLC_bn* p, TGLC_bn* g_a);
 int bn_factorize(TGLC_bn* pq, TGLC_bn* p, TGLC_bn* q);
 
@@ -0,0 +1,446 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include <tgl/impl/tgl_net_asio.h>
+
+#include <tgl/tgl_log.h>
+
+#include <boost/asio/ip/address.hpp>
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+// The storage for one outstanding asynchronous operation, handed to the next one
+// once that completes instead of going back to the heap. Anything that does not
+// fit, or a second operation while the first is still pending, is allocated
+// normally.
+class tgl_asio_handler_memory {
+public:
+    tgl_asio_handler_memory()
+        : m_in_use(false)
+    { }
+
+    tgl_asio_handler_memory(const tgl_asio_handler_memory&) = delete;
+    tgl_asio_handler_memory& operator=(const tgl_asio_handler_memory&) = delete;
+
+    void* allocate(size_t size)
+    {
+        if (!m_in_use && size <= sizeof(m_storage)) {
+            m_in_use = true;
+            return &m_storage;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer)
+    {
+        if (pointer == &m_storage) {
+            m_in_use = false;
+        } else {
+            ::operator delete(pointer);
+        }
+    }
+
+private:
+    typename std::aligned_storage<512>::type m_storage;
+    bool m_in_use;
+};
+
+namespace {
+
+template<typename T>
+class handler_allocator {
+public:
+    using value_type = T;
+
+    explicit handler_allocator(tgl_asio_handler_memory* memory)
+        : m_memory(memory)
+    { }
+
+    template<typename U>
+    handler_allocator(const handler_allocator<U>& other)
+        : m_memory(other.m_memory)
+    { }
+
+    T* allocate(size_t n) { return static_cast<T*>(m_memory->allocate(sizeof(T) * n)); }
+    void deallocate(T* pointer, size_t) { m_memory->deallocate(pointer); }
+
+    bool operator==(const handler_allocator& other) const { return m_memory == other.m_memory; }
+    bool operator!=(const handler_allocator& other) const { return m_memory != other.m_memory; }
+
+private:
+    template<typename> friend class handler_allocator;
+    tgl_asio_handler_memory* m_memory;
+};
+
+// Asio allocates the state of an operation with the allocator associated with
+// its handler. The handler keeps the memory alive, Asio moves it out of that
+// memory before releasing it.
+template<typename Handler>
+class allocating_handler {
+public:
+    using allocator_type = handler_allocator<Handler>;
+
+    allocating_handler(const std::shared_ptr<tgl_asio_handler_memory>& memory, Handler&& handler)
+        : m_memory(memory)
+        , m_handler(std::move(handler))
+    { }
+
+    allocator_type get_allocator() const { return allocator_type(m_memory.get()); }
+
+    template<typename... Args>
+    void operator()(Args&&... args) { m_handler(std::forward<Args>(args)...); }
+
+private:
+    std::shared_ptr<tgl_asio_handler_memory> m_memory;
+    Handler m_handler;
+};
+
+template<typename Handler>
+allocating_handler<typename std::decay<Handler>::type> make_allocating_handler(
+        const std::shared_ptr<tgl_asio_handler_memory>& memory, Handler&& handler)
+{
+    return allocating_handler<typename std::decay<Handler>::type>(memory, std::forward<Handler>(handler));
+}
+
+}
+
+tgl_timer_factory_asio::tgl_timer_factory_asio(boost::asio::io_context& io_context,
+        std::chrono::steady_clock::duration tick)
+    : m_timer(io_context)
+    , m_armed_expiry(std::chrono::steady_clock::time_point::max())
+    , m_handler_memory(std::make_shared<tgl_asio_handler_memory>())
+    , m_alive(std::make_shared<bool>(true))
+    , m_factory(std::make_shared<tgl_timer_wheel>(tick))
+{
+    m_factory.wheel()->set_wakeup_handler([this](std::chrono::steady_clock::time_point expiry) {
+        if (expiry < m_armed_expiry) {
+            arm(expiry);
+        }
+    });
+}
+
+tgl_timer_factory_asio::~tgl_timer_factory_asio()
+{
+    // The timers keep the wheel alive.
+    m_factory.wheel()->set_wakeup_handler(nullptr);
+}
+
+std::shared_ptr<tgl_timer> tgl_timer_factory_asio::create_timer(const std::function<void()>& cb)
+{
+    return m_factory.create_timer(cb);
+}
+
+void tgl_timer_factory_asio::arm(std::chrono::steady_clock::time_point expiry)
+{
+    if (expiry == m_armed_expiry) {
+        return;
+    }
+
+    m_armed_expiry = expiry;
+    if (expiry == std::chrono::steady_clock::time_point::max()) {
+        m_timer.cancel();
+        return;
+    }
+
+    // Rearming cancels the pending wait, whose handler then runs with operation_aborted.
+    m_timer.expires_at(expiry);
+    std::weak_ptr<bool> alive = m_alive;
+    m_timer.async_wait(make_allocating_handler(m_handler_memory, [this, alive](const boost::system::error_code& ec) {
+        if (ec != boost::asio::error::operation_aborted && !alive.expired()) {
+            timer_fired();
+        }
+    }));
+}
+
+void tgl_timer_factory_asio::timer_fired()
+{
+    m_armed_expiry = std::chrono::steady_clock::time_point::max();
+    const auto& wheel = m_factory.wheel();
+    wheel->advance(std::chrono::steady_clock::now());
+    arm(wheel->next_expiry());
+}
+
+tgl_connection_asio::tgl_connection_asio(boost::asio::io_context& io_context,
+        const tgl_socket_options& options,
+        const std::vector<std::pair<std::string, int>>& ipv4_options,
+        const std::vector<std::pair<std::string, int>>& ipv6_options,
+        const std::weak_ptr<tgl_mtproto_client>& client)
+    : tgl_connection_base(ipv4_options, ipv6_options, client)
+    , m_io_context(io_context)
+    , m_options(options)
+    , m_next_attempt_id(0)
+    , m_read_handler_memory(std::make_shared<tgl_asio_handler_memory>())
+    , m_write_handler_memory(std::make_shared<tgl_asio_handler_memory>())
+    , m_waiting_readable(false)
+    , m_waiting_writable(false)
+{
+    m_write_buffers.reserve(MAX_WRITE_BUFFERS);
+}
+
+tgl_connection_asio::~tgl_connection_asio()
+{
+    close_socket();
+}
+
+bool tgl_connection_asio::connect()
+{
+    close_socket();
+    return connect_endpoints();
+}
+
+int tgl_connection_asio::start_connect_attempt(const tgl_endpoint& endpoint)
+{
+    boost::system::error_code ec;
+    auto address = boost::asio::ip::make_address(endpoint.address, ec);
+    if (ec || address.is_v6() != endpoint.ipv6) {
+        TGL_ERROR("invalid IPv" << (endpoint.ipv6 ? 6 : 4) << " address " << endpoint.address);
+        return -1;
+    }
+
+    boost::asio::ip::tcp::endpoint peer(address, endpoint.port);
+    auto socket = std::make_shared<boost::asio::ip::tcp::socket>(m_io_context);
+    if (socket->open(peer.protocol(), ec)) {
+        TGL_ERROR("failed to create socket: " << ec.message());
+        return -1;
+    }
+
+    if (m_options.tcp_nodelay && socket->set_option(boost::asio::ip::tcp::no_delay(true), ec)) {
+        TGL_WARNING("failed to set TCP_NODELAY: " << ec.message());
+    }
+    if (m_options.send_buffer_size > 0
+            && socket->set_option(boost::asio::socket_base::send_buffer_size(m_options.send_buffer_size), ec)) {
+        TGL_WARNING("failed to set SO_SNDBUF: " << ec.message());
+    }
+    if (m_options.receive_buffer_size > 0
+            && socket->set_option(boost::asio::socket_base::receive_buffer_size(m_options.receive_buffer_size), ec)) {
+        TGL_WARNING("failed to set SO_RCVBUF: " << ec.message());
+    }
+    if (socket->non_blocking(true, ec)) {
+        TGL_ERROR("failed to make the socket non-blocking: " << ec.message());
+        return -1;
+    }
+
+    // The handler always runs after connect() returned, so the transport marker
+    // open() queues goes out before anything connect_finished() triggers.
+    int id = m_next_attempt_id++;
+    if (m_next_attempt_id < 0) {
+        m_next_attempt_id = 0;
+    }
+    std::weak_ptr<tgl_connection_asio> weak_this(std::static_pointer_cast<tgl_connection_asio>(shared_from_this()));
+    socket->async_connect(peer, [weak_this, id](const boost::system::error_code& ec) {
+        if (auto shared_this = weak_this.lock()) {
+            if (ec) {
+                shared_this->connect_attempt_failed(id, ec.message());
+            } else {
+                shared_this->connect_attempt_succeeded(id);
+            }
+        }
+    });
+
+    m_attempt_sockets[id] = socket;
+    return id;
+}
+
+void tgl_connection_asio::close_connect_attempt(int id)
+{
+    auto it = m_attempt_sockets.find(id);
+    if (it == m_attempt_sockets.end()) {
+        return;
+    }
+    boost::system::error_code ignored;
+    it->second->close(ignored);
+    m_attempt_sockets.erase(it);
+}
+
+bool tgl_connection_asio::adopt_connect_attempt(int id)
+{
+    auto it = m_attempt_sockets.find(id);
+    if (it == m_attempt_sockets.end()) {
+        return false;
+    }
+    m_socket = it->second;
+    m_attempt_sockets.erase(it);
+    wait_readable();
+    return true;
+}
+
+void tgl_connection_asio::disconnect()
+{
+    close_socket();
+}
+
+void tgl_connection_asio::close_socket()
+{
+    if (m_socket) {
+        // The pending waits complete with operation_aborted and find a different m_socket.
+        boost::system::error_code ignored;
+        m_socket->close(ignored);
+        m_socket.reset();
+    }
+    m_waiting_readable = false;
+    m_waiting_writable = false;
+    socket_closed();
+}
+
+void tgl_connection_asio::wait_readable()
+{
+    if (!m_socket || m_waiting_readable) {
+        return;
+    }
+
+    m_waiting_readable = true;
+    std::weak_ptr<tgl_connection_asio> weak_this(std::static_pointer_cast<tgl_connection_asio>(shared_from_this()));
+    socket_ptr socket = m_socket;
+    m_socket->async_wait(boost::asio::ip::tcp::socket::wait_read, make_allocating_handler(m_read_handler_memory,
+            [weak_this, socket](const boost::system::error_code& ec) {
+        auto shared_this = weak_this.lock();
+        if (!shared_this || shared_this->m_socket != socket) {
+            return;
+        }
+        shared_this->m_waiting_readable = false;
+        if (ec) {
+            TGL_WARNING("waiting for data failed: " << ec.message());
+            shared_this->close_socket();
+            shared_this->error();
+            return;
+        }
+        shared_this->read_available();
+    }));
+}
+
+void tgl_connection_asio::wait_writable(bool writable)
+{
+    // A wait that is no longer needed finds the queue empty when it completes.
+    if (!writable || !m_socket || m_waiting_writable) {
+        return;
+    }
+
+    m_waiting_writable = true;
+    std::weak_ptr<tgl_connection_asio> weak_this(std::static_pointer_cast<tgl_connection_asio>(shared_from_this()));
+    socket_ptr socket = m_socket;
+    m_socket->async_wait(boost::asio::ip::tcp::socket::wait_write, make_allocating_handler(m_write_handler_memory,
+            [weak_this, socket](const boost::system::error_code& ec) {
+        auto shared_this = weak_this.lock();
+        if (!shared_this || shared_this->m_socket != socket) {
+            return;
+        }
+        shared_this->m_waiting_writable = false;
+        if (ec) {
+            TGL_WARNING("waiting for the socket to drain failed: " << ec.message());
+            shared_this->close_socket();
+            shared_this->error();
+            return;
+        }
+        shared_this->write_queued();
+    }));
+}
+
+void tgl_connection_asio::read_available()
+{
+    while (m_socket) {
+        size_t available = 0;
+        char* data = prepare_receive(m_options.read_chunk_size, &available);
+        boost::system::error_code ec;
+        size_t result = m_socket->read_some(boost::asio::buffer(data, available), ec);
+        if (ec == boost::asio::error::would_block) {
+            wait_readable();
+            return;
+        }
+
+        if (ec == boost::asio::error::eof) {
+            close_socket();
+            lost();
+            return;
+        }
+
+        if (ec) {
+            TGL_WARNING("read failed: " << ec.message());
+            close_socket();
+            error();
+            return;
+        }
+
+        data_received(result);
+
+        if (result < available) {
+            wait_readable();
+            return;
+        }
+    }
+}
+
+ssize_t tgl_connection_asio::write_buffers(size_t count, bool* would_block)
+{
+    m_write_buffers.clear();
+    for (const auto& buffer : m_write_buffer_queue) {
+        if (m_write_buffers.size() == count) {
+            break;
+        }
+        m_write_buffers.push_back(boost::asio::const_buffer(buffer->data(), buffer->size()));
+    }
+
+    boost::system::error_code ec;
+    size_t result = m_socket->write_some(m_write_buffers, ec);
+    if (ec == boost::asio::error::would_block) {
+        *would_block = true;
+        return 0;
+    }
+    if (ec) {
+        TGL_WARNING("write failed: " << ec.message());
+        return -1;
+    }
+    return result;
+}
+
+bool tgl_connection_asio::set_cork(bool cork)
+{
+#if defined(__linux__)
+    if (cork && !m_options.tcp_cork) {
+        return false;
+    }
+    boost::system::error_code ec;
+    if (m_socket->set_option(boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_CORK>(cork), ec)) {
+        TGL_WARNING("failed to set TCP_CORK: " << ec.message());
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void tgl_connection_asio::start_read()
+{
+    if (socket_connected()) {
+        read_available();
+    }
+}
+
+void tgl_connection_asio::start_write()
+{
+    start_queued_write();
+}
@@ -24,29 +24,263 @@
 #include <tgl/tgl_mtproto_client.h>
 #include <tgl/tgl_connection_status.h>
 
-// This is a default base implementation of tgl_connection. It should include the public headers only.
+#include <algorithm>
+#include <cmath>
+#include <tuple>
 
-constexpr std::chrono::seconds PING_CHECK_DURATION(10);
+// This is a default base implementation of tgl_connection. It should include the public headers only.
 
 constexpr std::chrono::milliseconds MIN_RESTART_DURATION(250);
 constexpr std::chrono::milliseconds MAX_RESTART_DURATION(59000); // a little bit less than PING_FAIL_DURATION
+
+// Ping an idle connection this often to keep it alive.
 constexpr std::chrono::milliseconds PING_DURATION(30000);
+// The longest a ping may go unanswered before the connection is considered dead,
+// also used as long as no round trip was measured.
 constexpr std::chrono::milliseconds PING_FAIL_DURATION(60000);
+// The bounds of the retransmission timeout derived from the measured round trips
+// as in RFC 6298, starting at INITIAL_RTO.
+constexpr std::chrono::milliseconds INITIAL_RTO(1000);
+constexpr std::chrono::milliseconds MIN_RTO(200);
+// A ping is sent once requests went unanswered for PROBE_RTOS timeouts and the
+// connection is dead once the ping went unanswered for DEAD_RTOS timeouts.
+constexpr int PROBE_RTOS = 2;
+constexpr int DEAD_RTOS = 4;
+constexpr std::chrono::milliseconds MIN_PROBE_DELAY(1000);
+constexpr std::chrono::milliseconds MIN_DEAD_DURATION(5000);
+
+constexpr size_t MIN_READ_BUFFER_CAPACITY = 16 * 1024;
+
+// How long to wait for a connect attempt before starting the next one, when
+// nothing is known about the endpoint, and the bounds when its RTT is known.
+constexpr std::chrono::milliseconds CONNECT_ATTEMPT_DELAY(250);
+constexpr std::chrono::milliseconds MIN_CONNECT_ATTEMPT_DELAY(100);
+constexpr std::chrono::milliseconds MAX_CONNECT_ATTEMPT_DELAY(2000);
+
+constexpr size_t tgl_connection_base::MAX_WRITE_BUFFERS;
+
+tgl_net_ring_buffer::tgl_net_ring_buffer()
+    : m_data()
+    , m_read_position(0)
+    , m_write_position(0)
+{
+}
+
+size_t tgl_net_ring_buffer::peek(void* data_out, size_t len) const
+{
+    char* data = static_cast<char*>(data_out);
+    len = std::min(len, size());
+    if (!len) {
+        return 0;
+    }
+
+    size_t offset = m_read_position & mask();
+    size_t first = std::min(len, m_data.size() - offset);
+    memcpy(data, m_data.data() + offset, first);
+    memcpy(data + first, m_data.data(), len - first);
+    return len;
+}
+
+size_t tgl_net_ring_buffer::read(void* data, size_t len)
+{
+    return skip(peek(data, len));
+}
+
+size_t tgl_net_ring_buffer::skip(size_t len)
+{
+    len = std::min(len, size());
+    m_read_position += len;
+    if (empty()) {
+        // Start over at the beginning so that the next frame is unlikely to wrap.
+        m_read_position = 0;
+        m_write_position = 0;
+    }
+    return len;
+}
+
+char* tgl_net_ring_buffer::contiguous(size_t len)
+{
+    if (!len || len > size()) {
+        return nullptr;
+    }
+
+    size_t offset = m_read_position & mask();
+    if (offset + len > m_data.size()) {
+        return nullptr;
+    }
+    return m_data.data() + offset;
+}
+
+char* tgl_net_ring_buffer::prepare(size_t min_free, size_t* available)
+{
+    if (m_data.size() - size() < min_free) {
+        grow(size() + min_free);
+    }
+
+    size_t read_offset = m_read_position & mask();
+    size_t write_offset = m_write_position & mask();
+    if (write_offset >= read_offset && m_data.size() - write_offset < min_free && size() <= m_data.size() / 4) {
+        // A short partial frame at the end would make the rest of it wrap. Moving it
+        // to the front is cheaper than copying the whole frame out once it is complete.
+        memmove(m_data.data(), m_data.data() + read_offset, size());
+        m_write_position = size();
+        m_read_position = 0;
+        write_offset = m_write_position;
+    }
+
+    *available = std::min(m_data.size() - size(), m_data.size() - write_offset);
+    return m_data.data() + write_offset;
+}
+
+void tgl_net_ring_buffer::commit(size_t len)
+{
+    assert(len <= m_data.size() - size());
+    m_write_position += len;
+}
+
+void tgl_net_ring_buffer::append(const char* data, size_t len)
+{
+    while (len) {
+        size_t available = 0;
+        char* span = prepare(len, &available);
+        available = std::min(available, len);
+        memcpy(span, data, available);
+        commit(available);
+        data += available;
+        len -= available;
+    }
+}
+
+void tgl_net_ring_buffer::clear()
+{
+    // Keep the storage, a frame being processed may still point into it.
+    m_read_position = 0;
+    m_write_position = 0;
+}
+
+void tgl_net_ring_buffer::grow(size_t min_capacity)
+{
+    size_t capacity = std::max(m_data.size(), MIN_READ_BUFFER_CAPACITY);
+    while (capacity < min_capacity) {
+        capacity *= 2;
+    }
+
+    std::vector<char> data(capacity);
+    size_t len = peek(data.data(), size());
+    m_data.swap(data);
+    m_read_position = 0;
+    m_write_position = len;
+}
+
+tgl_endpoint_history& tgl_endpoint_history::instance()
+{
+    static tgl_endpoint_history history;
+    return history;
+}
+
+std::string tgl_endpoint_history::key(const tgl_endpoint& endpoint)
+{
+    return endpoint.address + "#" + std::to_string(endpoint.port);
+}
+
+void tgl_endpoint_history::connected(const tgl_endpoint& endpoint, std::chrono::milliseconds rtt)
+{
+    // Zero stands for no connect so far.
+    rtt = std::max(rtt, std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats& s = m_stats[key(endpoint)];
+    s.srtt = s.srtt == std::chrono::milliseconds::zero() ? rtt : (s.srtt * 7 + rtt) / 8;
+    s.consecutive_failures = 0;
+}
+
+void tgl_endpoint_history::failed(const tgl_endpoint& endpoint)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats[key(endpoint)].consecutive_failures++;
+}
+
+std::chrono::milliseconds tgl_endpoint_history::rtt(const tgl_endpoint& endpoint) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_stats.find(key(endpoint));
+    return it != m_stats.end() ? it->second.srtt : std::chrono::milliseconds::zero();
+}
+
+void tgl_endpoint_history::sort(std::vector<tgl_endpoint>& endpoints) const
+{
+    // (0, rtt) for the ones that connected last time, (1, 0) for the untried
+    // ones and (2, failures) for the ones that failed last time.
+    using rank = std::tuple<int, int64_t>;
+    std::vector<std::pair<rank, tgl_endpoint>> ranked;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& endpoint : endpoints) {
+            rank r(1, 0);
+            auto it = m_stats.find(key(endpoint));
+            if (it != m_stats.end()) {
+                if (it->second.consecutive_failures) {
+                    r = rank(2, it->second.consecutive_failures);
+                } else if (it->second.srtt != std::chrono::milliseconds::zero()) {
+                    r = rank(0, it->second.srtt.count());
+                }
+            }
+            ranked.emplace_back(r, endpoint);
+        }
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<rank, tgl_endpoint>& a, const std::pair<rank, tgl_endpoint>& b) {
+        return a.first < b.first;
+    });
+
+    endpoints.clear();
+    for (auto& entry : ranked) {
+        endpoints.push_back(std::move(entry.second));
+    }
+}
+
+static size_t transport_marker(tgl_transport transport, uint32_t* marker)
+{
+    switch (transport) {
+    case tgl_transport::intermediate:
+        *marker = 0xeeeeeeee;
+        return 4;
+    case tgl_transport::padded_intermediate:
+        *marker = 0xdddddddd;
+        return 4;
+    case tgl_transport::abridged:
+    default:
+        *marker = 0xef;
+        return 1;
+    }
+}
 
 tgl_connection_base::tgl_connection_base(
         const std::vector<std::pair<std::string, int>>& ipv4_options,
         const std::vector<std::pair<std::string, int>>& ipv6_options,
         const std::weak_ptr<tgl_mtproto_client>& weak_client)
     : m_state(connection_state::none)
+    , m_ipv4_options(ipv4_options)
+    , m_ipv6_options(ipv6_options)
     , m_ping_timer()
+    , m_ping_check_time()
     , m_last_receive_time()
+    , m_last_request_time()
+    , m_probe_time()
+    , m_srtt(-1)
+    , m_rttvar(0)
     , m_restart_timer()
     , m_last_restart_time()
     , m_restart_duration(MIN_RESTART_DURATION)
-    , m_available_bytes_for_read(0)
+    , m_next_endpoint(0)
+    , m_socket_connected(false)
+    , m_corked(false)
+    , m_write_blocked(false)
+    , m_writev_calls(0)
+    , m_buffers_written(0)
     , m_mtproto_client(weak_client)
     , m_online_status(tgl_online_status::not_online)
     , m_connection_status(tgl_connection_status::disconnected)
+    , m_transport(tgl_transport::abridged)
     , m_destructing(false)
 {
     if (auto client = weak_client.lock()) {
@@ -57,6 +291,7 @@ tgl_connection_base::tgl_connection_base(
     m_ipv4_port = std::get<1>(ipv4_options[0]);
     m_ipv6_address = std::get<0>(ipv6_options[0]);
     m_ipv6_port = std::get<1>(ipv6_options[0]);
+    update_endpoints();
 }
 
 tgl_connection_base::~tgl_connection_base()
@@ -69,24 +304,83 @@ tgl_connection_base::~tgl_connection_base()
     TGL_DEBUG("connection to mtproto_client " << client_id() << " destroyed");
 }
 
-void tgl_connection_base::ping()
+void tgl_connection_base::round_trip_measured(double seconds)
+{
+    if (m_srtt < 0) {
+        m_srtt = seconds;
+        m_rttvar = seconds / 2;
+    } else {
+        m_rttvar = 0.75 * m_rttvar + 0.25 * std::abs(m_srtt - seconds);
+        m_srtt = 0.875 * m_srtt + 0.125 * seconds;
+    }
+}
+
+std::chrono::milliseconds tgl_connection_base::retransmission_timeout() const
+{
+    if (m_srtt < 0) {
+        return INITIAL_RTO;
+    }
+    std::chrono::milliseconds rto(static_cast<int64_t>((m_srtt + 4 * m_rttvar) * 1000));
+    return std::max(rto, MIN_RTO);
+}
+
+std::chrono::milliseconds tgl_connection_base::probe_delay() const
+{
+    return std::min(std::max(retransmission_timeout() * PROBE_RTOS, MIN_PROBE_DELAY), PING_DURATION);
+}
+
+std::chrono::milliseconds tgl_connection_base::dead_timeout() const
+{
+    if (m_srtt < 0) {
+        return PING_FAIL_DURATION;
+    }
+    return std::min(std::max(retransmission_timeout() * DEAD_RTOS, MIN_DEAD_DURATION), PING_FAIL_DURATION);
+}
+
+void tgl_connection_base::send_probe()
+{
+    auto client = m_mtproto_client.lock();
+    if (!client) {
+        close();
+        return;
+    }
+    m_probe_time = std::chrono::steady_clock::now();
+    client->ping(shared_from_this());
+}
+
+void tgl_connection_base::check_liveness()
 {
-    auto duration_since_last_receive = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_last_receive_time);
-    if (duration_since_last_receive > PING_FAIL_DURATION) {
+    using time_point = std::chrono::steady_clock::time_point;
+    m_ping_check_time = time_point();
+    auto now = std::chrono::steady_clock::now();
+
+    if (m_probe_time != time_point() && m_last_receive_time >= m_probe_time) {
+        m_probe_time = time_point();
+    }
+
+    if (m_probe_time != time_point() ? now - m_probe_time > dead_timeout() : now - m_last_receive_time > PING_FAIL_DURATION) {
         TGL_WARNING("connection failed or ping timeout, scheduling restart");
         set_state(connection_state::failed);
         schedule_restart();
-    } else if (duration_since_last_receive > PING_DURATION && m_state == connection_state::ready) {
-        auto client = m_mtproto_client.lock();
-        if (!client) {
-            close();
+        return;
+    }
+
+    bool awaiting_answer = m_last_request_time > m_last_receive_time;
+    if (m_probe_time == time_point() && m_state == connection_state::ready
+            && (now - m_last_receive_time > PING_DURATION || (awaiting_answer && now - m_last_request_time > probe_delay()))) {
+        send_probe();
+        if (m_state == connection_state::closed) {
             return;
         }
-        client->ping();
-        start_ping_timer();
-    } else {
-        start_ping_timer();
     }
+
+    time_point deadline = m_last_receive_time + PING_DURATION;
+    if (m_probe_time != time_point()) {
+        deadline = std::min(deadline, m_probe_time + dead_timeout());
+    } else if (awaiting_answer) {
+        deadline = std::min(deadline, m_last_request_time + probe_delay());
+    }
+    schedule_ping_check(std::max(deadline, now + MIN_RTO));
 }
 
 void tgl_connection_base::stop_ping_timer()
@@ -94,54 +388,45 @@ void tgl_connection_base::stop_ping_timer()
     if (m_ping_timer) {
         m_ping_timer->cancel();
     }
+    m_ping_check_time = std::chrono::steady_clock::time_point();
 }
 
-void tgl_connection_base::start_ping_timer()
+void tgl_connection_base::schedule_ping_check(std::chrono::steady_clock::time_point deadline)
 {
-    stop_ping_timer();
+    if (m_ping_check_time != std::chrono::steady_clock::time_point() && m_ping_check_time <= deadline) {
+        return;
+    }
+
     if (!m_ping_timer && m_timer_factory) {
         std::weak_ptr<tgl_connection_base> weak_this(shared_from_this());
         m_ping_timer = m_timer_factory->create_timer([weak_this] {
             if (auto shared_this = weak_this.lock()) {
-                shared_this->ping();
+                shared_this->check_liveness();
             }
         });
     }
 
     if (m_ping_timer) {
-        m_ping_timer->start(PING_CHECK_DURATION.count());
+        m_ping_timer->cancel();
+        auto delay = std::chrono::duration_cast<std::chrono::duration<double>>(deadline - std::chrono::steady_clock::now());
+        m_ping_timer->start(std::max(delay.count(), 0.0));
+        m_ping_check_time = deadline;
     }
 }
 
-ssize_t tgl_connection_base::peek(void* data_out, size_t len)
+ssize_t tgl_connection_base::peek(void* data, size_t len)
 {
-    unsigned char* data = static_cast<unsigned char*>(data_out);
-    if (!len || !m_available_bytes_for_read) {
-        return 0;
-    }
-    assert(len > 0);
-    if (len > m_available_bytes_for_read) {
-        len = m_available_bytes_for_read;
-    }
+    return m_read_buffer.peek(data, len);
+}
 
-    int read_bytes = 0;
-    size_t i = 0;
-    auto buffer = m_read_buffer_queue[i];
-    while (len) {
-        size_t buffer_size = buffer->size();
-        if (buffer_size >= len) {
-            memcpy(data, buffer->data(), len);
-            return read_bytes + len;
-        } else {
-            memcpy(data, buffer->data(), buffer_size);
-            read_bytes += buffer_size;
-            data += buffer_size;
-            len -= buffer_size;
-            buffer = m_read_buffer_queue[++i];
-        }
-    }
+char* tgl_connection_base::peek_contiguous(size_t len)
+{
+    return m_read_buffer.contiguous(len);
+}
 
-    return read_bytes;
+ssize_t tgl_connection_base::skip(size_t len)
+{
+    return m_read_buffer.skip(len);
 }
 
 void tgl_connection_base::open()
@@ -150,6 +435,7 @@ void tgl_connection_base::open()
 
     if (auto client = m_mtproto_client.lock()) {
         client->add_online_status_observer(m_this_weak_observer);
+        m_transport = client->transport();
     }
 
     if (m_state == connection_state::closed) {
@@ -157,6 +443,7 @@ void tgl_connection_base::open()
     }
 
     set_state(connection_state::connecting);
+    update_endpoints();
 
     if (!connect()) {
         if (m_state != connection_state::closed) {
@@ -167,9 +454,10 @@ void tgl_connection_base::open()
         return;
     }
 
-    char byte = 0xef;
-    ssize_t result = write(&byte, 1);
-    TGL_ASSERT_UNUSED(result, result == 1);
+    uint32_t marker;
+    ssize_t marker_size = transport_marker(m_transport, &marker);
+    ssize_t result = write(&marker, marker_size);
+    TGL_ASSERT_UNUSED(result, result == marker_size);
     flush();
 }
 
@@ -189,11 +477,14 @@ void tgl_connection_base::connect_finished(bool success)
 
     set_state(connection_state::ready);
 
-    client->ping();
-    start_ping_timer();
     m_restart_duration = MIN_RESTART_DURATION;
-
     m_last_receive_time = std::chrono::steady_clock::now();
+    m_probe_time = std::chrono::steady_clock::time_point();
+
+    send_probe();
+    if (m_state == connection_state::ready) {
+        schedule_ping_check(m_probe_time + dead_timeout());
+    }
 }
 
 void tgl_connection_base::lost()
@@ -330,85 +621,258 @@ void tgl_connection_base::close_internal(bool call_disconnect)
 void tgl_connection_base::clear_buffers()
 {
     m_write_buffer_queue.clear();
-    m_read_buffer_queue.clear();
-    m_available_bytes_for_read = 0;
+    m_read_buffer.clear();
 }
 
 void tgl_connection_base::data_received(const std::shared_ptr<tgl_net_buffer>& buffer)
 {
-    bytes_received(buffer->size());
+    m_read_buffer.append(buffer->data(), buffer->size());
+    received(buffer->size());
+}
+
+char* tgl_connection_base::prepare_receive(size_t min_size, size_t* available)
+{
+    return m_read_buffer.prepare(min_size, available);
+}
+
+void tgl_connection_base::data_received(size_t len)
+{
+    m_read_buffer.commit(len);
+    received(len);
+}
+
+void tgl_connection_base::received(size_t len)
+{
+    bytes_received(len);
 
     if (m_state == connection_state::closed) {
         TGL_WARNING("invalid read from closed connection");
+        m_read_buffer.clear();
         return;
     }
 
-    TGL_DEBUG("received " << buffer->size() << " bytes from mtproto_client " << client_id());
+    TGL_DEBUG("received " << len << " bytes from mtproto_client " << client_id());
 
-    if (buffer->size() > 0) {
+    if (len > 0) {
         m_last_receive_time = std::chrono::steady_clock::now();
-        stop_ping_timer();
-        start_ping_timer();
-        m_read_buffer_queue.push_back(buffer);
     }
 
-    m_available_bytes_for_read += buffer->size();
-    if (m_read_buffer_queue.size()) {
+    if (!m_read_buffer.empty()) {
         consume_data();
     }
 }
 
-ssize_t tgl_connection_base::read(void* data_out, size_t len)
+ssize_t tgl_connection_base::read(void* data, size_t len)
+{
+    return m_read_buffer.read(data, len);
+}
+
+ssize_t tgl_connection_base::write(const void* data, size_t len)
 {
-    unsigned char* data = static_cast<unsigned char*>(data_out);
     if (!len) {
         return 0;
     }
 
-    assert(len > 0);
-    if (len > m_available_bytes_for_read) {
-        len = m_available_bytes_for_read;
+    m_write_buffer_queue.push_back(std::make_shared<tgl_net_buffer>(static_cast<const char*>(data), len));
+    try_write();
+    return len;
+}
+
+ssize_t tgl_connection_base::write_buffer(std::vector<char>&& buffer, size_t offset)
+{
+    assert(buffer.size() >= offset);
+    ssize_t len = buffer.size() - offset;
+    if (!len) {
+        return 0;
     }
 
-    size_t read_bytes = 0;
-    auto buffer = m_read_buffer_queue.front();
-    while (len) {
-        size_t buffer_size = buffer->size();
-        if (buffer_size >= len) {
-            memcpy(data, buffer->data(), len);
-            buffer->advance(len);
-            if (buffer->empty()) {
-                m_read_buffer_queue.pop_front();
+    m_write_buffer_queue.push_back(std::make_shared<tgl_net_buffer>(std::move(buffer), offset));
+    try_write();
+    return len;
+}
+
+void tgl_connection_base::request_sent()
+{
+    bool was_awaiting_answer = m_last_request_time > m_last_receive_time;
+    m_last_request_time = std::chrono::steady_clock::now();
+    // The first request after a quiet period may need an earlier check.
+    if (!was_awaiting_answer && m_state == connection_state::ready
+            && m_probe_time == std::chrono::steady_clock::time_point()) {
+        schedule_ping_check(m_last_request_time + probe_delay());
+    }
+}
+
+void tgl_connection_base::flush()
+{
+    if (m_socket_connected && !m_write_blocked) {
+        write_queued();
+    }
+}
+
+void tgl_connection_base::start_queued_write()
+{
+    // Writes are batched until flush(), unless the queue gets long enough to fill a write.
+    if (m_socket_connected && !m_write_blocked && m_write_buffer_queue.size() >= MAX_WRITE_BUFFERS) {
+        write_queued();
+    }
+}
+
+bool tgl_connection_base::write_queued()
+{
+    m_write_blocked = false;
+    while (!m_write_buffer_queue.empty()) {
+        bool would_block = false;
+        ssize_t result = write_buffers(std::min(m_write_buffer_queue.size(), MAX_WRITE_BUFFERS), &would_block);
+        if (would_block) {
+            m_write_blocked = true;
+            wait_writable(true);
+            return true;
+        }
+        if (result < 0) {
+            disconnect();
+            error();
+            return false;
+        }
+
+        ++m_writev_calls;
+        bytes_sent(result);
+
+        size_t written = result;
+        while (written) {
+            const auto& buffer = m_write_buffer_queue.front();
+            if (buffer->size() > written) {
+                buffer->advance(written);
+                break;
             }
-            m_available_bytes_for_read -= len;
-            return read_bytes + len;
-        } else {
-            memcpy(data, buffer->data(), buffer_size);
-            m_available_bytes_for_read -= buffer_size;
-            read_bytes += buffer_size;
-            data += buffer_size;
-            len -= buffer_size;
-            m_read_buffer_queue.pop_front();
-            buffer = m_read_buffer_queue.front();
+            written -= buffer->size();
+            m_write_buffer_queue.pop_front();
+            ++m_buffers_written;
+        }
+
+        // The batch takes more than one write, hold back partial segments until it is done.
+        if (!m_corked && !m_write_buffer_queue.empty()) {
+            m_corked = set_cork(true);
         }
     }
 
-    return read_bytes;
+    if (m_corked && set_cork(false)) {
+        m_corked = false;
+    }
+    wait_writable(false);
+    return true;
 }
 
-ssize_t tgl_connection_base::write(const void* data, size_t len)
+void tgl_connection_base::socket_closed()
 {
-    if (!len) {
-        return 0;
+    close_connect_attempts();
+    m_socket_connected = false;
+    m_corked = false;
+    m_write_blocked = false;
+}
+
+bool tgl_connection_base::connect_endpoints()
+{
+    socket_closed();
+    m_next_endpoint = 0;
+    return start_next_connect_attempt();
+}
+
+bool tgl_connection_base::start_next_connect_attempt()
+{
+    while (m_next_endpoint < m_endpoints.size()) {
+        const tgl_endpoint& endpoint = m_endpoints[m_next_endpoint++];
+        int id = start_connect_attempt(endpoint);
+        if (id < 0) {
+            record_connect_result(endpoint, false);
+            continue;
+        }
+        TGL_DEBUG("connecting to " << endpoint.address << ":" << endpoint.port);
+        m_connect_attempts.push_back({ id, endpoint, std::chrono::steady_clock::now() });
+        schedule_next_connect_attempt(endpoint);
+        return true;
     }
+    return false;
+}
 
-    m_write_buffer_queue.push_back(std::make_shared<tgl_net_buffer>(static_cast<const char*>(data), len));
-    try_write();
-    return len;
+void tgl_connection_base::schedule_next_connect_attempt(const tgl_endpoint& endpoint)
+{
+    if (m_next_endpoint >= m_endpoints.size() || !m_timer_factory) {
+        return;
+    }
+
+    std::chrono::milliseconds delay = CONNECT_ATTEMPT_DELAY;
+    std::chrono::milliseconds rtt = tgl_endpoint_history::instance().rtt(endpoint);
+    if (rtt != std::chrono::milliseconds::zero()) {
+        delay = std::min(std::max(rtt * 2, MIN_CONNECT_ATTEMPT_DELAY), MAX_CONNECT_ATTEMPT_DELAY);
+    }
+
+    if (!m_connect_attempt_timer) {
+        std::weak_ptr<tgl_connection_base> weak_this(shared_from_this());
+        m_connect_attempt_timer = m_timer_factory->create_timer([weak_this] {
+            if (auto shared_this = weak_this.lock()) {
+                if (!shared_this->m_connect_attempts.empty()) {
+                    shared_this->start_next_connect_attempt();
+                }
+            }
+        });
+    }
+    m_connect_attempt_timer->start(delay.count() / 1000.0);
 }
 
-void tgl_connection_base::flush()
+void tgl_connection_base::connect_attempt_failed(int attempt, const std::string& reason)
+{
+    auto it = std::find_if(m_connect_attempts.begin(), m_connect_attempts.end(), [attempt](const connect_attempt& a) {
+        return a.id == attempt;
+    });
+    if (it == m_connect_attempts.end()) {
+        return;
+    }
+
+    TGL_WARNING("failed to connect to " << it->endpoint.address << ":" << it->endpoint.port << ": " << reason);
+    record_connect_result(it->endpoint, false);
+    close_connect_attempt(attempt);
+    m_connect_attempts.erase(it);
+    if (!start_next_connect_attempt() && m_connect_attempts.empty()) {
+        connect_finished(false);
+    }
+}
+
+void tgl_connection_base::connect_attempt_succeeded(int attempt)
+{
+    auto it = std::find_if(m_connect_attempts.begin(), m_connect_attempts.end(), [attempt](const connect_attempt& a) {
+        return a.id == attempt;
+    });
+    if (it == m_connect_attempts.end()) {
+        return;
+    }
+
+    record_connect_result(it->endpoint, true,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - it->start_time));
+
+    // Keep the winner and drop the attempts still in flight.
+    m_connect_attempts.erase(it);
+    close_connect_attempts();
+
+    if (!adopt_connect_attempt(attempt)) {
+        connect_finished(false);
+        return;
+    }
+
+    m_socket_connected = true;
+    if (write_queued()) {
+        connect_finished(true);
+    }
+}
+
+void tgl_connection_base::close_connect_attempts()
 {
+    if (m_connect_attempt_timer) {
+        m_connect_attempt_timer->cancel();
+    }
+    for (const auto& attempt : m_connect_attempts) {
+        close_connect_attempt(attempt.id);
+    }
+    m_connect_attempts.clear();
 }
 
 void tgl_connection_base::on_online_status_changed(tgl_online_status status)
@@ -457,6 +921,62 @@ void tgl_connection_base::set_state(connection_state state)
     }
 }
 
+void tgl_connection_base::update_endpoints()
+{
+    tgl_endpoint_history& history = tgl_endpoint_history::instance();
+
+    std::vector<tgl_endpoint> ipv4_endpoints;
+    for (const auto& option : m_ipv4_options) {
+        if (!option.first.empty()) {
+            ipv4_endpoints.push_back({ option.first, option.second, false });
+        }
+    }
+    history.sort(ipv4_endpoints);
+
+    std::vector<tgl_endpoint> ipv6_endpoints;
+    for (const auto& option : m_ipv6_options) {
+        if (!option.first.empty()) {
+            ipv6_endpoints.push_back({ option.first, option.second, true });
+        }
+    }
+    history.sort(ipv6_endpoints);
+
+    if (!ipv4_endpoints.empty()) {
+        m_ipv4_address = ipv4_endpoints[0].address;
+        m_ipv4_port = ipv4_endpoints[0].port;
+    }
+    if (!ipv6_endpoints.empty()) {
+        m_ipv6_address = ipv6_endpoints[0].address;
+        m_ipv6_port = ipv6_endpoints[0].port;
+    }
+
+    if (!ipv6_enabled()) {
+        ipv6_endpoints.clear();
+    }
+
+    m_endpoints.clear();
+    for (size_t i = 0; i < std::max(ipv4_endpoints.size(), ipv6_endpoints.size()); ++i) {
+        if (i < ipv6_endpoints.size()) {
+            m_endpoints.push_back(ipv6_endpoints[i]);
+        }
+        if (i < ipv4_endpoints.size()) {
+            m_endpoints.push_back(ipv4_endpoints[i]);
+        }
+    }
+    history.sort(m_endpoints);
+}
+
+void tgl_connection_base::record_connect_result(const tgl_endpoint& endpoint, bool success, std::chrono::milliseconds rtt)
+{
+    if (success) {
+        TGL_DEBUG("connected to " << endpoint.address << ":" << endpoint.port << " in " << rtt.count() << "ms");
+        tgl_endpoint_history::instance().connected(endpoint, rtt);
+    } else {
+        TGL_DEBUG("failed to connect to " << endpoint.address << ":" << endpoint.port);
+        tgl_endpoint_history::instance().failed(endpoint);
+    }
+}
+
 bool tgl_connection_base::ipv6_enabled() const
 {
     if (auto client = m_mtproto_client.lock()) {
@@ -0,0 +1,427 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include <tgl/impl/tgl_net_epoll.h>
+
+#include <tgl/tgl_log.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+constexpr int MAX_EPOLL_EVENTS = 64;
+
+tgl_epoll_loop::tgl_epoll_loop()
+    : m_epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+{
+    if (m_epoll_fd < 0) {
+        TGL_ERROR("epoll_create1 failed: " << strerror(errno));
+    }
+}
+
+tgl_epoll_loop::~tgl_epoll_loop()
+{
+    if (m_epoll_fd >= 0) {
+        ::close(m_epoll_fd);
+    }
+}
+
+bool tgl_epoll_loop::add(int fd, uint32_t events, const handler& h)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        TGL_ERROR("failed to add fd " << fd << " to epoll: " << strerror(errno));
+        return false;
+    }
+    m_handlers[fd] = h;
+    return true;
+}
+
+bool tgl_epoll_loop::modify(int fd, uint32_t events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        TGL_ERROR("failed to modify fd " << fd << " in epoll: " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void tgl_epoll_loop::remove(int fd)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    m_handlers.erase(fd);
+}
+
+int tgl_epoll_loop::run_once(int timeout_ms)
+{
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int n = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        TGL_ERROR("epoll_wait failed: " << strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        // A handler may remove itself or other fds of this batch.
+        auto it = m_handlers.find(events[i].data.fd);
+        if (it == m_handlers.end()) {
+            continue;
+        }
+        handler h = it->second;
+        h(events[i].events);
+    }
+    return n;
+}
+
+tgl_timer_factory_epoll::tgl_timer_factory_epoll(const std::shared_ptr<tgl_epoll_loop>& loop,
+        std::chrono::steady_clock::duration tick)
+    : m_loop(loop)
+    , m_timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+    , m_armed_expiry(std::chrono::steady_clock::time_point::max())
+    , m_factory(std::make_shared<tgl_timer_wheel>(tick))
+{
+    if (m_timer_fd < 0) {
+        TGL_ERROR("timerfd_create failed: " << strerror(errno));
+        return;
+    }
+    m_loop->add(m_timer_fd, EPOLLIN, [this](uint32_t) { timer_fired(); });
+    m_factory.wheel()->set_wakeup_handler([this](std::chrono::steady_clock::time_point expiry) {
+        if (expiry < m_armed_expiry) {
+            arm(expiry);
+        }
+    });
+}
+
+tgl_timer_factory_epoll::~tgl_timer_factory_epoll()
+{
+    // The timers keep the wheel alive.
+    m_factory.wheel()->set_wakeup_handler(nullptr);
+    if (m_timer_fd >= 0) {
+        m_loop->remove(m_timer_fd);
+        ::close(m_timer_fd);
+    }
+}
+
+std::shared_ptr<tgl_timer> tgl_timer_factory_epoll::create_timer(const std::function<void()>& cb)
+{
+    return m_factory.create_timer(cb);
+}
+
+void tgl_timer_factory_epoll::arm(std::chrono::steady_clock::time_point expiry)
+{
+    if (m_timer_fd < 0 || expiry == m_armed_expiry) {
+        return;
+    }
+
+    // steady_clock is CLOCK_MONOTONIC, and an all zero it_value disarms the timer.
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (expiry != std::chrono::steady_clock::time_point::max()) {
+        auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(expiry.time_since_epoch());
+        auto nanoseconds = std::max(since_epoch.count(), static_cast<decltype(since_epoch.count())>(1));
+        spec.it_value.tv_sec = nanoseconds / 1000000000;
+        spec.it_value.tv_nsec = nanoseconds % 1000000000;
+    }
+    if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        TGL_ERROR("timerfd_settime failed: " << strerror(errno));
+        return;
+    }
+    m_armed_expiry = expiry;
+}
+
+void tgl_timer_factory_epoll::timer_fired()
+{
+    uint64_t expirations;
+    if (::read(m_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        TGL_ERROR("failed to read timerfd: " << strerror(errno));
+    }
+
+    m_armed_expiry = std::chrono::steady_clock::time_point::max();
+    const auto& wheel = m_factory.wheel();
+    wheel->advance(std::chrono::steady_clock::now());
+    arm(wheel->next_expiry());
+}
+
+tgl_connection_epoll::tgl_connection_epoll(const std::shared_ptr<tgl_epoll_loop>& loop,
+        const tgl_socket_options& options,
+        const std::vector<std::pair<std::string, int>>& ipv4_options,
+        const std::vector<std::pair<std::string, int>>& ipv6_options,
+        const std::weak_ptr<tgl_mtproto_client>& client)
+    : tgl_connection_base(ipv4_options, ipv6_options, client)
+    , m_loop(loop)
+    , m_options(options)
+    , m_fd(-1)
+    , m_watching_writable(false)
+{
+}
+
+tgl_connection_epoll::~tgl_connection_epoll()
+{
+    close_socket();
+}
+
+bool tgl_connection_epoll::connect()
+{
+    close_socket();
+    return connect_endpoints();
+}
+
+int tgl_connection_epoll::start_connect_attempt(const tgl_endpoint& endpoint)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (endpoint.ipv6) {
+        struct sockaddr_in6* addr6 = reinterpret_cast<struct sockaddr_in6*>(&addr);
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = htons(endpoint.port);
+        if (inet_pton(AF_INET6, endpoint.address.c_str(), &addr6->sin6_addr) != 1) {
+            TGL_ERROR("invalid IPv6 address " << endpoint.address);
+            return -1;
+        }
+        addr_len = sizeof(*addr6);
+    } else {
+        struct sockaddr_in* addr4 = reinterpret_cast<struct sockaddr_in*>(&addr);
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = htons(endpoint.port);
+        if (inet_pton(AF_INET, endpoint.address.c_str(), &addr4->sin_addr) != 1) {
+            TGL_ERROR("invalid IPv4 address " << endpoint.address);
+            return -1;
+        }
+        addr_len = sizeof(*addr4);
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (fd < 0) {
+        TGL_ERROR("failed to create socket: " << strerror(errno));
+        return -1;
+    }
+
+    int flag = 1;
+    if (m_options.tcp_nodelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) < 0) {
+        TGL_WARNING("failed to set TCP_NODELAY: " << strerror(errno));
+    }
+    if (m_options.send_buffer_size > 0
+            && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &m_options.send_buffer_size, sizeof(m_options.send_buffer_size)) < 0) {
+        TGL_WARNING("failed to set SO_SNDBUF: " << strerror(errno));
+    }
+    if (m_options.receive_buffer_size > 0
+            && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &m_options.receive_buffer_size, sizeof(m_options.receive_buffer_size)) < 0) {
+        TGL_WARNING("failed to set SO_RCVBUF: " << strerror(errno));
+    }
+
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), addr_len) < 0 && errno != EINPROGRESS) {
+        TGL_WARNING("failed to connect to " << endpoint.address << ":" << endpoint.port << ": " << strerror(errno));
+        ::close(fd);
+        return -1;
+    }
+
+    // Even if the connect completed right away we wait for the socket to be reported
+    // writable: open() queues the transport marker after connect() returns and it has
+    // to go out before anything connect_finished() triggers.
+    std::weak_ptr<tgl_connection_epoll> weak_this(std::static_pointer_cast<tgl_connection_epoll>(shared_from_this()));
+    if (!m_loop->add(fd, EPOLLIN | EPOLLOUT, [weak_this, fd](uint32_t) {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->attempt_finished(fd);
+            }
+        })) {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void tgl_connection_epoll::attempt_finished(int fd)
+{
+    int error_code = 0;
+    socklen_t len = sizeof(error_code);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error_code, &len) < 0 || error_code) {
+        connect_attempt_failed(fd, strerror(error_code ? error_code : errno));
+        return;
+    }
+    connect_attempt_succeeded(fd);
+}
+
+void tgl_connection_epoll::close_connect_attempt(int fd)
+{
+    m_loop->remove(fd);
+    ::close(fd);
+}
+
+bool tgl_connection_epoll::adopt_connect_attempt(int fd)
+{
+    m_loop->remove(fd);
+    std::weak_ptr<tgl_connection_epoll> weak_this(std::static_pointer_cast<tgl_connection_epoll>(shared_from_this()));
+    if (!m_loop->add(fd, EPOLLIN | EPOLLOUT, [weak_this](uint32_t events) {
+            if (auto shared_this = weak_this.lock()) {
+                shared_this->handle_events(events);
+            }
+        })) {
+        ::close(fd);
+        return false;
+    }
+
+    m_fd = fd;
+    m_watching_writable = true;
+    return true;
+}
+
+void tgl_connection_epoll::disconnect()
+{
+    close_socket();
+}
+
+void tgl_connection_epoll::close_socket()
+{
+    if (m_fd >= 0) {
+        m_loop->remove(m_fd);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_watching_writable = false;
+    socket_closed();
+}
+
+void tgl_connection_epoll::handle_events(uint32_t events)
+{
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_available();
+    }
+
+    if (m_fd >= 0 && (events & EPOLLOUT)) {
+        write_queued();
+    }
+}
+
+void tgl_connection_epoll::read_available()
+{
+    while (m_fd >= 0) {
+        size_t available = 0;
+        char* data = prepare_receive(m_options.read_chunk_size, &available);
+        ssize_t result = ::read(m_fd, data, available);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            TGL_WARNING("read failed: " << strerror(errno));
+            close_socket();
+            error();
+            return;
+        }
+
+        if (result == 0) {
+            close_socket();
+            lost();
+            return;
+        }
+
+        data_received(static_cast<size_t>(result));
+
+        if (static_cast<size_t>(result) < available) {
+            return;
+        }
+    }
+}
+
+ssize_t tgl_connection_epoll::write_buffers(size_t count, bool* would_block)
+{
+    struct iovec iov[MAX_WRITE_BUFFERS];
+    int iov_count = 0;
+    for (const auto& buffer : m_write_buffer_queue) {
+        if (static_cast<size_t>(iov_count) == count) {
+            break;
+        }
+        iov[iov_count].iov_base = buffer->data();
+        iov[iov_count].iov_len = buffer->size();
+        ++iov_count;
+    }
+
+    while (true) {
+        ssize_t result = ::writev(m_fd, iov, iov_count);
+        if (result >= 0) {
+            return result;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            *would_block = true;
+            return 0;
+        }
+        TGL_WARNING("writev failed: " << strerror(errno));
+        return -1;
+    }
+}
+
+bool tgl_connection_epoll::set_cork(bool cork)
+{
+    if (cork && !m_options.tcp_cork) {
+        return false;
+    }
+    int flag = cork ? 1 : 0;
+    if (setsockopt(m_fd, IPPROTO_TCP, TCP_CORK, &flag, sizeof(flag)) < 0) {
+        TGL_WARNING("failed to set TCP_CORK: " << strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void tgl_connection_epoll::wait_writable(bool writable)
+{
+    if (m_watching_writable == writable) {
+        return;
+    }
+    if (m_loop->modify(m_fd, writable ? EPOLLIN | EPOLLOUT : EPOLLIN)) {
+        m_watching_writable = writable;
+    }
+}
+
+void tgl_connection_epoll::start_read()
+{
+    if (socket_connected()) {
+        read_available();
+    }
+}
+
+void tgl_connection_epoll::start_write()
+{
+    start_queued_write();
+}
@@ -0,0 +1,132 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "active_query_table.h"
+
+#include "query.h"
+
+#include <cassert>
+#include <utility>
+
+namespace tgl {
+namespace impl {
+
+static constexpr size_t ACTIVE_QUERY_TABLE_INITIAL_SLOTS = 64;
+
+active_query_table::active_query_table()
+    : m_slots(ACTIVE_QUERY_TABLE_INITIAL_SLOTS)
+    , m_mask(ACTIVE_QUERY_TABLE_INITIAL_SLOTS - 1)
+    , m_size(0)
+{
+}
+
+size_t active_query_table::home(int64_t msg_id) const
+{
+    // msg_ids are the time shifted left by 32 bits with the low bits mostly
+    // zero, so mix them before taking the slot.
+    uint64_t h = static_cast<uint64_t>(msg_id) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h >> 32) & m_mask;
+}
+
+size_t active_query_table::find_slot(int64_t msg_id) const
+{
+    size_t i = home(msg_id);
+    while (m_slots[i].msg_id && m_slots[i].msg_id != msg_id) {
+        i = (i + 1) & m_mask;
+    }
+    return i;
+}
+
+bool active_query_table::insert(int64_t msg_id, const std::shared_ptr<query>& q)
+{
+    assert(msg_id);
+    size_t i = find_slot(msg_id);
+    if (m_slots[i].msg_id) {
+        m_slots[i].q = q;
+        return false;
+    }
+
+    // Keep the load factor at most 1/2.
+    if (2 * (m_size + 1) > m_slots.size()) {
+        grow();
+        i = find_slot(msg_id);
+    }
+    m_slots[i].msg_id = msg_id;
+    m_slots[i].q = q;
+    m_size++;
+    return true;
+}
+
+std::shared_ptr<query> active_query_table::find(int64_t msg_id) const
+{
+    assert(msg_id);
+    const slot& s = m_slots[find_slot(msg_id)];
+    return s.msg_id ? s.q : nullptr;
+}
+
+bool active_query_table::erase(int64_t msg_id)
+{
+    assert(msg_id);
+    size_t i = find_slot(msg_id);
+    if (!m_slots[i].msg_id) {
+        return false;
+    }
+
+    m_slots[i].msg_id = 0;
+    m_slots[i].q.reset();
+    m_size--;
+
+    // Move back every following entry of the cluster that the hole now
+    // separates from its home slot.
+    size_t hole = i;
+    for (size_t j = (i + 1) & m_mask; m_slots[j].msg_id; j = (j + 1) & m_mask) {
+        size_t h = home(m_slots[j].msg_id);
+        if (((j - h) & m_mask) >= ((j - hole) & m_mask)) {
+            m_slots[hole] = std::move(m_slots[j]);
+            m_slots[j].msg_id = 0;
+            hole = j;
+        }
+    }
+    return true;
+}
+
+void active_query_table::clear()
+{
+    for (auto& s: m_slots) {
+        s.msg_id = 0;
+        s.q.reset();
+    }
+    m_size = 0;
+}
+
+void active_query_table::grow()
+{
+    std::vector<slot> old_slots(m_slots.size() * 2);
+    old_slots.swap(m_slots);
+    m_mask = m_slots.size() - 1;
+    for (auto& s: old_slots) {
+        if (s.msg_id) {
+            m_slots[find_slot(s.msg_id)] = std::move(s);
+        }
+    }
+}
+
+}
+}
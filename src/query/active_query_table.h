@@ -0,0 +1,67 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+class query;
+
+// The queries waiting for an answer, by msg_id. An open addressing table with
+// linear probing: msg_ids are never 0, so 0 marks a free slot, and erasing
+// shifts the following entries of the probe sequence back instead of leaving
+// tombstones, so lookups never get slower as queries come and go.
+class active_query_table
+{
+public:
+    active_query_table();
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Returns false and replaces the query if there already was one for msg_id.
+    bool insert(int64_t msg_id, const std::shared_ptr<query>& q);
+    std::shared_ptr<query> find(int64_t msg_id) const;
+    bool erase(int64_t msg_id);
+    void clear();
+
+private:
+    struct slot {
+        int64_t msg_id;
+        std::shared_ptr<query> q;
+    };
+
+    size_t home(int64_t msg_id) const;
+    size_t find_slot(int64_t msg_id) const;
+    void grow();
+
+    std::vector<slot> m_slots;
+    size_t m_mask;
+    size_t m_size;
+};
+
+}
+}
@@ -23,14 +23,14 @@
 
 #include "auto/auto_fetch_ds.h"
 #include "auto/auto_free_ds.h"
-#include "auto/auto_skip.h"
+#include "ds_arena.h"
+#include "inflate_arena.h"
 #include "query_user_info.h"
 #include "tgl/tgl_timer.h"
 
 namespace tgl {
 namespace impl {
 
-constexpr int32_t TGL_SCHEME_LAYER = 45;
 constexpr int TGL_MAX_DC_NUM = 100;
 
 void query::clear_timers()
@@ -54,12 +54,13 @@ inline bool query::is_in_the_same_session() const
 bool query::send()
 {
     m_ack_received = false;
+    m_send_time = std::chrono::steady_clock::now();
 
     will_send();
 
     TGL_DEBUG("sending query \"" << m_name << "\" of size " << m_serializer->char_size() << " to DC " << m_client->id());
 
-    m_msg_id = m_client->send_message(m_serializer->i32_data(), m_serializer->i32_size(), m_msg_id_override, is_force(), is_file_transfer());
+    m_msg_id = m_client->send_message(m_serializer, m_msg_id_override, is_force(), is_file_transfer());
     if (m_msg_id == -1) {
         m_msg_id = 0;
         handle_error(400, "client failed to send message");
@@ -197,33 +198,46 @@ bool query::execute_after_pending()
 
 void query::out_peer_id(const tgl_peer_id_t& id, int64_t access_hash)
 {
+    tl_out_object peer = input_peer(id, access_hash);
+    m_serializer->out_i32s(peer.data(), peer.size());
+}
+
+void query::out_input_peer(const tgl_input_peer_t& id)
+{
+    out_peer_id(tgl_peer_id_t(id.peer_type, id.peer_id), id.access_hash);
+}
+
+tl_out_object query::input_peer(const tgl_peer_id_t& id, int64_t access_hash) const
+{
+    tl_out_object peer;
     switch (id.peer_type) {
     case tgl_peer_type::chat:
-        m_serializer->out_i32(CODE_input_peer_chat);
-        m_serializer->out_i32(id.peer_id);
+        peer.out_i32(CODE_input_peer_chat);
+        peer.out_i32(id.peer_id);
         break;
     case tgl_peer_type::user:
         if (id.peer_id == m_user_agent.our_id().peer_id) {
-            m_serializer->out_i32(CODE_input_peer_self);
+            peer.out_i32(CODE_input_peer_self);
         } else {
-            m_serializer->out_i32(CODE_input_peer_user);
-            m_serializer->out_i32(id.peer_id);
-            m_serializer->out_i64(access_hash);
+            peer.out_i32(CODE_input_peer_user);
+            peer.out_i32(id.peer_id);
+            peer.out_i64(access_hash);
         }
         break;
     case tgl_peer_type::channel:
-        m_serializer->out_i32(CODE_input_peer_channel);
-        m_serializer->out_i32(id.peer_id);
-        m_serializer->out_i64(access_hash);
+        peer.out_i32(CODE_input_peer_channel);
+        peer.out_i32(id.peer_id);
+        peer.out_i64(access_hash);
         break;
     default:
         assert(false);
     }
+    return peer;
 }
 
-void query::out_input_peer(const tgl_input_peer_t& id)
+tl_out_object query::input_peer(const tgl_input_peer_t& id) const
 {
-    out_peer_id(tgl_peer_id_t(id.peer_type, id.peer_id), id.access_hash);
+    return input_peer(tgl_peer_id_t(id.peer_type, id.peer_id), id.access_hash);
 }
 
 void query::ack()
@@ -337,7 +351,11 @@ int query::handle_error(int error_code, const std::string& error_string)
                 error_handled = true;
             } else if (error_string == "AUTH_KEY_PERM_EMPTY") {
                 assert(m_user_agent.pfs_enabled());
-                m_client->restart_temp_authorization();
+                // Only the key we switched away from was unbound if the message
+                // went out with it, retrying is enough then.
+                if (!m_client->sent_with_replaced_temp_key(msg_id())) {
+                    m_client->restart_temp_authorization();
+                }
                 if (should_retry_after_recover_from_error()) {
                     should_retry = true;
                 }
@@ -398,7 +416,7 @@ bool query::handle_session_password_needed(bool& should_retry)
             return;
         }
         m_user_agent.set_dc_logged_in(m_user_agent.active_client()->id());
-        auto q = std::make_shared<query_user_info>(m_user_agent, nullptr);
+        auto q = make_query<query_user_info>(m_user_agent, nullptr);
         q->out_i32(CODE_users_get_full_user);
         q->out_i32(CODE_input_user_self);
         q->execute(m_user_agent.active_client());
@@ -499,43 +517,59 @@ int query::on_error_internal(int error_code, const std::string& error_string)
 
 int query::handle_result(tgl_in_buffer* in)
 {
+    if (!is_file_transfer()) {
+        tgl_net_stats& stats = m_user_agent.net_stats();
+        stats.rpc_answers++;
+        stats.rpc_answer_microseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - m_send_time).count();
+    }
+
     int32_t op = prefetch_i32(in);
 
     tgl_in_buffer save_in = { nullptr, nullptr };
-    std::unique_ptr<int32_t[]> packed_buffer;
+    inflate_arena::lease packed_buffer(m_user_agent.inflater());
 
     if (op == CODE_gzip_packed) {
         fetch_i32(in);
         int l = prefetch_strlen(in);
         const char* s = fetch_str(in, l);
 
-        constexpr size_t MAX_PACKED_SIZE = 1 << 24;
-        packed_buffer.reset(new int32_t[MAX_PACKED_SIZE / 4]);
-
-        int total_out = tgl_inflate(s, l, packed_buffer.get(), MAX_PACKED_SIZE);
-        TGL_DEBUG("inflated " << total_out << " bytes");
         save_in = *in;
-        in->ptr = packed_buffer.get();
-        in->end = in->ptr + total_out / 4;
+        if (!packed_buffer.inflate(s, l, in)) {
+            TGL_ERROR("failed to inflate the result of query #" << msg_id() << " (query type " << name() << ")");
+            *in = save_in;
+            return -1;
+        }
+        TGL_DEBUG("inflated " << 4 * (in->end - in->ptr) << " bytes");
     }
 
     TGL_DEBUG("result for query #" << msg_id() << ". Size " << (long)4 * (in->end - in->ptr) << " bytes");
 
-    tgl_in_buffer skip_in = *in;
-    if (skip_type_any(&skip_in, &m_type) < 0) {
-        TGL_ERROR("skipped " << (long)(skip_in.ptr - in->ptr) << " int out of " << (long)(skip_in.end - in->ptr) << " (type " << m_type.type.id << ") (query type " << name() << ")");
-        TGL_ERROR("0x" << std::hex << *(in->ptr - 1) << " 0x" << *(in->ptr) << " 0x" << *(in->ptr + 1) << " 0x" << *(in->ptr + 2));
-        TGL_ERROR(in->print_buffer());
-        assert(false);
-    }
-
-    assert(skip_in.ptr == skip_in.end);
-
-    void* DS = fetch_ds_type_any(in, &m_type);
-    assert(DS);
+    if (on_answer_view(*in)) {
+        m_client->remove_connection_status_observer(shared_from_this());
+        in->ptr = in->end;
+    } else {
+        ds_arena::scope ds_scope;
+        tgl_in_buffer fetch_in = *in;
+        void* DS;
+        {
+            ds_arena::fetch_scope fetch;
+            DS = fetch_ds_type_any(in, &m_type);
+        }
+        if (!DS || in->ptr != in->end) {
+            TGL_ERROR("fetched " << (long)(in->ptr - fetch_in.ptr) << " int out of " << (long)(fetch_in.end - fetch_in.ptr) << " (type " << m_type.type.id << ") (query type " << name() << ")");
+            TGL_ERROR(fetch_in.print_buffer());
+            if (save_in.ptr) {
+                *in = save_in;
+            } else {
+                in->ptr = in->end;
+            }
+            return -1;
+        }
 
-    on_answer_internal(DS);
-    free_ds_type_any(DS, &m_type);
+        on_answer_internal(DS);
+        free_ds_type_any(DS, &m_type);
+    }
 
     assert(in->ptr == in->end);
 
@@ -25,10 +25,12 @@
 #include "auto/auto_types.h"
 #include "mtproto_common.h"
 #include "mtproto_client.h"
+#include "query_pool.h"
 #include "tgl/tgl_connection_status.h"
 #include "tgl/tgl_peer_id.h"
 #include "user_agent.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -37,12 +39,16 @@ class tgl_timer;
 namespace tgl {
 namespace impl {
 
+// The API layer every connection is initialized with, see out_header().
+static constexpr int32_t TGL_SCHEME_LAYER = 45;
+
 class query: public std::enable_shared_from_this<query>, public mtproto_client::connection_status_observer
 {
 public:
     enum class execution_option { UNKNOWN, NORMAL, LOGIN, LOGOUT, FORCE };
 
-    query(user_agent& ua, const std::string& name, const paramed_type& type, int64_t msg_id_override = 0)
+    // The name is for logging only and has to be a string literal.
+    query(user_agent& ua, const char* name, const paramed_type& type, int64_t msg_id_override = 0)
         : m_user_agent(ua)
         , m_msg_id(0)
         , m_msg_id_override(msg_id_override)
@@ -53,7 +59,7 @@ public:
         , m_ack_received(false)
         , m_name(name)
         , m_type(type)
-        , m_serializer(std::make_shared<mtprotocol_serializer>())
+        , m_serializer(std::allocate_shared<mtprotocol_serializer>(query_allocator<mtprotocol_serializer>()))
         , m_timer()
         , m_client()
     {
@@ -116,14 +122,22 @@ public:
     void out_peer_id(const tgl_peer_id_t& id, int64_t access_hash);
     void out_input_peer(const tgl_input_peer_t& id);
 
+    // InputPeer arguments for the generated tl_out_* builders.
+    tl_out_object input_peer(const tgl_peer_id_t& id, int64_t access_hash) const;
+    tl_out_object input_peer(const tgl_input_peer_t& id) const;
+
     void out_header();
 
-    const std::string& name() const { return m_name; }
+    const char* name() const { return m_name; }
     int64_t session_id() const { return m_session_id; }
     int64_t msg_id() const { return m_msg_id_override ? m_msg_id_override : m_msg_id; }
     const std::shared_ptr<mtproto_client>& client() const { return m_client; }
 
     virtual void on_answer(void* DS) = 0;
+    // Queries that only read a few fields of a large answer can look at it in
+    // the receive buffer through a tl_view instead of having it fetched.
+    // Returning true means the answer was handled and on_answer() is skipped.
+    virtual bool on_answer_view(const tgl_in_buffer& answer) { return false; }
     virtual int on_error(int error_code, const std::string& error_string) = 0;
     virtual void on_timeout() { }
     virtual void on_connection_status_changed(tgl_connection_status status) { }
@@ -169,7 +183,8 @@ private:
     execution_option m_exec_option;
     tgl_connection_status m_connection_status;
     bool m_ack_received;
-    const std::string m_name;
+    std::chrono::steady_clock::time_point m_send_time;
+    const char* const m_name;
     paramed_type m_type;
     std::shared_ptr<mtprotocol_serializer> m_serializer;
     std::shared_ptr<tgl_timer> m_timer;
@@ -42,9 +42,8 @@ public:
 
     virtual void on_answer(void*) override
     {
-        m_client->set_bound();
         TGL_DEBUG("bind temp auth key successfully for DC " << m_client->id());
-        m_client->configure();
+        m_client->temp_auth_key_bound();
     }
 
     virtual int on_error(int error_code, const std::string& error_string) override
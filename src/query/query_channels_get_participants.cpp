@@ -120,7 +120,7 @@ void query_channels_get_participants::assemble()
 
 void query_channels_get_participants::get_more()
 {
-    auto q = std::make_shared<query_channels_get_participants>(m_user_agent, m_state, m_callback);
+    auto q = make_query<query_channels_get_participants>(m_user_agent, m_state, m_callback);
     q->execute(client());
 }
 
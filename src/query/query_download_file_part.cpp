@@ -21,17 +21,17 @@
 
 #include "query_download_file_part.h"
 
+#include "auto/auto_types.h"
+#include "auto/auto_views.h"
 #include "download_task.h"
 #include "tgl/tgl_log.h"
 
-#include <cassert>
-
 namespace tgl {
 namespace impl {
 
 query_download_file_part::query_download_file_part(user_agent& ua,
         const std::shared_ptr<download_task>& download,
-        const std::function<void(const tl_ds_upload_file*)>& callback)
+        const std::function<void(const tl_span*)>& callback)
     : query(ua, "download", TYPE_TO_PARAM(upload_file))
     , m_download(download)
     , m_callback(callback)
@@ -40,9 +40,36 @@ query_download_file_part::query_download_file_part(user_agent& ua,
 
 void query_download_file_part::on_answer(void* D)
 {
+    // Only reached if the answer could not be handled by on_answer_view().
+    const tl_ds_upload_file* DS_UF = static_cast<const tl_ds_upload_file*>(D);
+    tl_span bytes = { nullptr, 0 };
+    if (DS_UF && DS_UF->bytes && DS_UF->bytes->data && DS_UF->bytes->len > 0) {
+        bytes.data = DS_UF->bytes->data;
+        bytes.len = DS_UF->bytes->len;
+    }
+    if (m_callback) {
+        m_callback(&bytes);
+    }
+}
+
+bool query_download_file_part::on_answer_view(const tgl_in_buffer& answer)
+{
+    // The file part is written out straight from the receive buffer rather
+    // than being copied into a tl_ds_upload_file first.
+    tl_view_upload_file view(answer);
+    if (!view.valid() || view.end() != answer.end) {
+        TGL_ERROR("malformed upload.file answer");
+        if (m_callback) {
+            m_callback(nullptr);
+        }
+        return true;
+    }
+
     if (m_callback) {
-        m_callback(static_cast<tl_ds_upload_file*>(D));
+        tl_span bytes = view.bytes();
+        m_callback(&bytes);
     }
+    return true;
 }
 
 int query_download_file_part::on_error(int error_code, const std::string& error_string)
@@ -27,14 +27,15 @@ namespace tgl {
 namespace impl {
 
 class download_task;
-struct tl_ds_upload_file;
+struct tl_span;
 
 class query_download_file_part: public query
 {
 public:
     query_download_file_part(user_agent& ua, const std::shared_ptr<download_task>& download,
-            const std::function<void(const tl_ds_upload_file*)>& callback);
+            const std::function<void(const tl_span*)>& callback);
     virtual void on_answer(void* answer) override;
+    virtual bool on_answer_view(const tgl_in_buffer& answer) override;
     virtual int on_error(int error_code, const std::string& error_string) override;
     virtual double timeout_interval() const override { return 20.0; }
     virtual void on_connection_status_changed(tgl_connection_status status) override;
@@ -46,7 +47,7 @@ private:
 
 private:
     std::shared_ptr<download_task> m_download;
-    std::function<void(const tl_ds_upload_file*)> m_callback;
+    std::function<void(const tl_span*)> m_callback;
 };
 
 }
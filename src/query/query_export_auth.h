@@ -49,7 +49,7 @@ public:
         tl_ds_auth_exported_authorization* DS_EA = static_cast<tl_ds_auth_exported_authorization*>(D);
         m_user_agent.set_our_id(DS_LVAL(DS_EA->id));
 
-        auto q = std::make_shared<query_import_auth>(m_user_agent, m_client, m_callback);
+        auto q = make_query<query_import_auth>(m_user_agent, m_client, m_callback);
         q->out_header();
         q->out_i32(CODE_auth_import_authorization);
         q->out_i32(m_user_agent.our_id().peer_id);
@@ -56,7 +56,7 @@ static void set_password(user_agent& ua,
         return;
     }
 
-    std::shared_ptr<query> q = std::make_shared<query_update_password_settings>(ua, callback);
+    std::shared_ptr<query> q = make_query<query_update_password_settings>(ua, callback);
     q->out_i32(CODE_account_update_password_settings);
 
     if (current_password.size() && current_salt.size()) {
@@ -137,7 +137,7 @@ void query_get_dialogs::assemble()
 
 void query_get_dialogs::get_more()
 {
-    auto q = std::make_shared<query_get_dialogs>(m_user_agent, m_state, m_callback);
+    auto q = make_query<query_get_dialogs>(m_user_agent, m_state, m_callback);
     q->execute(client());
 }
 
@@ -168,13 +168,13 @@ query_messages_send_encrypted_base::create_by_out_seq_no(const std::shared_ptr<s
         try {
             switch (message->constructor_code()) {
                 case CODE_messages_send_encrypted:
-                    queries.push_back(std::make_shared<query_messages_send_encrypted_message>(*ua, sc, message, nullptr));
+                    queries.push_back(make_query<query_messages_send_encrypted_message>(*ua, sc, message, nullptr));
                     break;
                 case CODE_messages_send_encrypted_service:
-                    queries.push_back(std::make_shared<query_messages_send_encrypted_action>(*ua, sc, message, nullptr));
+                    queries.push_back(make_query<query_messages_send_encrypted_action>(*ua, sc, message, nullptr));
                     break;
                 case CODE_messages_send_encrypted_file:
-                    queries.push_back(std::make_shared<query_messages_send_encrypted_file>(*ua, sc, message, nullptr));
+                    queries.push_back(make_query<query_messages_send_encrypted_file>(*ua, sc, message, nullptr));
                     break;
                 default:
                     TGL_WARNING("unknown constructor code 0x" << std::hex << message->constructor_code()
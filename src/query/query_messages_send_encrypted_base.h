@@ -42,7 +42,7 @@ class message;
 class query_messages_send_encrypted_base: public query {
 public:
     query_messages_send_encrypted_base(user_agent& ua,
-            const std::string& name,
+            const char* name,
             const std::shared_ptr<secret_chat>& sc,
             const std::shared_ptr<message>& m,
             const std::function<void(bool, const std::shared_ptr<message>&)>& callback,
@@ -0,0 +1,98 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "query_pool.h"
+
+#include <cassert>
+
+namespace tgl {
+namespace impl {
+
+constexpr size_t query_pool::SIZE_CLASS_BYTES;
+constexpr size_t query_pool::SIZE_CLASSES;
+constexpr size_t query_pool::MAX_FREE_BLOCKS_PER_CLASS;
+
+thread_local bool query_pool::s_destroyed = false;
+
+query_pool* query_pool::current()
+{
+    if (s_destroyed) {
+        return nullptr;
+    }
+    static thread_local query_pool pool;
+    return &pool;
+}
+
+query_pool::query_pool()
+    : m_stats()
+{
+    m_free_lists.fill(nullptr);
+    m_free_counts.fill(0);
+}
+
+query_pool::~query_pool()
+{
+    s_destroyed = true;
+    for (free_block* head: m_free_lists) {
+        while (head) {
+            free_block* next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+}
+
+void* query_pool::allocate(size_t size)
+{
+    m_stats.allocations++;
+    size_t size_class = (size + SIZE_CLASS_BYTES - 1) / SIZE_CLASS_BYTES;
+    if (!size_class || size_class > SIZE_CLASSES) {
+        return ::operator new(size);
+    }
+
+    free_block*& head = m_free_lists[size_class - 1];
+    if (head) {
+        free_block* block = head;
+        head = block->next;
+        m_free_counts[size_class - 1]--;
+        m_stats.reuses++;
+        return block;
+    }
+
+    return ::operator new(size_class * SIZE_CLASS_BYTES);
+}
+
+void query_pool::deallocate(void* ptr, size_t size)
+{
+    size_t size_class = (size + SIZE_CLASS_BYTES - 1) / SIZE_CLASS_BYTES;
+    if (!size_class || size_class > SIZE_CLASSES || m_free_counts[size_class - 1] >= MAX_FREE_BLOCKS_PER_CLASS) {
+        ::operator delete(ptr);
+        return;
+    }
+
+    assert(ptr);
+    free_block* block = static_cast<free_block*>(ptr);
+    block->next = m_free_lists[size_class - 1];
+    m_free_lists[size_class - 1] = block;
+    m_free_counts[size_class - 1]++;
+}
+
+}
+}
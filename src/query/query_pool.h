@@ -0,0 +1,119 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace tgl {
+namespace impl {
+
+struct query_pool_stats {
+    uint64_t allocations = 0;
+    uint64_t reuses = 0;
+};
+
+// Free lists of the memory of finished queries. A query and its shared_ptr
+// control block are allocated as one block through query_allocator, and when
+// the last reference goes the block is kept on the free list of its size class
+// for the next query of about the same size instead of going back to the heap.
+class query_pool
+{
+public:
+    ~query_pool();
+
+    query_pool(const query_pool&) = delete;
+    query_pool& operator=(const query_pool&) = delete;
+
+    // The pool of the calling thread, nullptr while the thread is exiting so
+    // that queries outliving the pool go back to the heap.
+    static query_pool* current();
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+
+    const query_pool_stats& stats() const { return m_stats; }
+
+private:
+    static constexpr size_t SIZE_CLASS_BYTES = 64;
+    static constexpr size_t SIZE_CLASSES = 32;
+    static constexpr size_t MAX_FREE_BLOCKS_PER_CLASS = 256;
+
+    struct free_block {
+        free_block* next;
+    };
+
+    query_pool();
+
+    static thread_local bool s_destroyed;
+
+    std::array<free_block*, SIZE_CLASSES> m_free_lists;
+    std::array<size_t, SIZE_CLASSES> m_free_counts;
+    query_pool_stats m_stats;
+};
+
+template<typename T>
+class query_allocator
+{
+public:
+    using value_type = T;
+
+    query_allocator() = default;
+    template<typename U>
+    query_allocator(const query_allocator<U>&) { }
+
+    T* allocate(size_t n)
+    {
+        query_pool* pool = n == 1 ? query_pool::current() : nullptr;
+        if (!pool) {
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+        return static_cast<T*>(pool->allocate(sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n)
+    {
+        query_pool* pool = n == 1 ? query_pool::current() : nullptr;
+        if (!pool) {
+            ::operator delete(ptr);
+            return;
+        }
+        pool->deallocate(ptr, sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const query_allocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const query_allocator<U>&) const { return false; }
+};
+
+template<typename Query, typename... Args>
+std::shared_ptr<Query> make_query(Args&&... args)
+{
+    return std::allocate_shared<Query>(query_allocator<Query>(), std::forward<Args>(args)...);
+}
+
+}
+}
@@ -117,7 +117,7 @@ void query_search_message::assemble()
 
 void query_search_message::search_more()
 {
-    auto q = std::make_shared<query_search_message>(m_user_agent, m_state, m_callback);
+    auto q = make_query<query_search_message>(m_user_agent, m_state, m_callback);
     q->execute(client());
 }
 
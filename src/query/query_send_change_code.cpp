@@ -84,7 +84,7 @@ void query_send_change_code::set_number_result(bool success, const std::shared_p
 void query_send_change_code::set_number_code(const std::string& code, tgl_login_action action)
 {
     std::weak_ptr<query_send_change_code> weak_this(shared_from_this());
-    auto q = std::make_shared<query_set_phone>(m_user_agent,
+    auto q = make_query<query_set_phone>(m_user_agent,
             [weak_this](bool success, const std::shared_ptr<tgl_user>& user) {
                 if (auto shared_this = weak_this.lock()) {
                     shared_this->set_number_result(success, user);
@@ -111,7 +111,7 @@ bool query_sign_in::handle_session_password_needed(bool& should_retry)
             return;
         }
         m_user_agent.set_dc_logged_in(m_user_agent.active_client()->id());
-        auto q = std::make_shared<query_user_info>(m_user_agent, [this, weak_this](bool success, const std::shared_ptr<user>& u) {
+        auto q = make_query<query_user_info>(m_user_agent, [this, weak_this](bool success, const std::shared_ptr<user>& u) {
             auto shared_this = weak_this.lock();
             if (!shared_this) {
                 return;
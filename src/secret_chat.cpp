@@ -296,8 +296,8 @@ void secret_chat::set_dh_params(int32_t root, unsigned char* prime, int32_t vers
     set_encr_prime(prime, 256);
     m_encr_param_version = version;
 
-    auto res = tglmp_check_DH_params(ua->bn_ctx()->ctx, encr_prime_bn()->bn, encr_root());
-    TGL_ASSERT_UNUSED(res, res >= 0);
+    bool ok = ua->check_dh_params(encr_prime_bn()->bn, encr_root());
+    TGL_ASSERT_UNUSED(ok, ok);
 }
 
 void secret_chat::set_state(const tgl_secret_chat_state& new_state)
@@ -979,9 +979,9 @@ void secret_chat::send_message(const std::shared_ptr<class message>& message,
                 }
                 return;
             }
-            q = std::make_shared<query_messages_send_encrypted_action>(*ua, shared_from_this(), message, callback);
+            q = make_query<query_messages_send_encrypted_action>(*ua, shared_from_this(), message, callback);
         } else {
-            q = std::make_shared<query_messages_send_encrypted_message>(*ua, shared_from_this(), message, callback);
+            q = make_query<query_messages_send_encrypted_message>(*ua, shared_from_this(), message, callback);
         }
     }
 
@@ -1076,7 +1076,7 @@ void secret_chat::mark_messages_read(int32_t max_time,
         return;
     }
 
-    auto q = std::make_shared<query_mark_read_encr>(*ua, shared_from_this(), max_time, callback);
+    auto q = make_query<query_mark_read_encr>(*ua, shared_from_this(), max_time, callback);
     q->out_i32(CODE_messages_read_encrypted_history);
     q->out_i32(CODE_input_encrypted_chat);
     q->out_i32(id().peer_id);
@@ -0,0 +1,65 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "server_salt_schedule.h"
+
+#include <algorithm>
+
+namespace tgl {
+namespace impl {
+
+// Move on to the next salt this many seconds before it becomes valid, so that
+// a clock running slightly behind the server's does not keep using a salt the
+// server already dropped.
+static constexpr double SALT_SWITCH_MARGIN = 5;
+
+void server_salt_schedule::update(std::vector<salt>&& salts)
+{
+    std::sort(salts.begin(), salts.end(), [](const salt& a, const salt& b) {
+        return a.valid_since < b.valid_since;
+    });
+    m_salts.assign(salts.begin(), salts.end());
+}
+
+int64_t server_salt_schedule::current(double server_time)
+{
+    double switch_time = server_time + SALT_SWITCH_MARGIN;
+    while (m_salts.size() > 1 && m_salts[1].valid_since <= switch_time) {
+        m_salts.pop_front();
+    }
+    if (!m_salts.empty() && m_salts.front().valid_until <= switch_time) {
+        m_salts.pop_front();
+    }
+    if (m_salts.empty() || m_salts.front().valid_since > switch_time) {
+        return 0;
+    }
+    return m_salts.front().value;
+}
+
+double server_salt_schedule::remaining(double server_time) const
+{
+    if (m_salts.empty()) {
+        return 0;
+    }
+    return std::max(m_salts.back().valid_until - server_time, 0.0);
+}
+
+}
+}
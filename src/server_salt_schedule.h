@@ -0,0 +1,60 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace tgl {
+namespace impl {
+
+// The salts a DC announced through get_future_salts, ordered by when they
+// become valid, so that the client can move on to the next salt by itself
+// instead of learning about it from a bad_server_salt.
+class server_salt_schedule
+{
+public:
+    struct salt {
+        int32_t valid_since;
+        int32_t valid_until;
+        int64_t value;
+    };
+
+    void update(std::vector<salt>&& salts);
+    void clear() { m_salts.clear(); }
+    bool empty() const { return m_salts.empty(); }
+    const std::deque<salt>& salts() const { return m_salts; }
+
+    // Drops the salts that have been superseded at server_time and returns the
+    // newest one valid by then, 0 if none is known. Switches a few seconds
+    // early to allow for clock skew against the server.
+    int64_t current(double server_time);
+
+    // For how many more seconds from server_time the schedule has a salt.
+    double remaining(double server_time) const;
+
+private:
+    std::deque<salt> m_salts;
+};
+
+}
+}
@@ -34,20 +34,77 @@ void session::clear()
     seq_no = 0;
     received_messages = 0;
     if (primary_worker) {
+        primary_worker->send_queue.clear();
+        primary_worker->send_queue_ints = 0;
         if (primary_worker->connection) {
             primary_worker->connection->close();
         }
         primary_worker = nullptr;
     }
     for (const auto& w: secondary_workers) {
+        w->send_queue.clear();
+        w->send_queue_ints = 0;
         if (w->connection) {
             w->connection->close();
         }
     }
     secondary_workers.clear();
+    jobs.clear();
     ack_set.clear();
     ev->cancel();
     ev = nullptr;
+    if (flush_timer) {
+        flush_timer->cancel();
+        flush_timer = nullptr;
+    }
+}
+
+void session::add_job(const std::shared_ptr<worker>& w, int64_t msg_id, size_t bytes,
+        std::chrono::steady_clock::time_point sent_time)
+{
+    in_flight_job& job = jobs[msg_id];
+    if (job.owner) {
+        job.owner->jobs--;
+        job.owner->bytes_in_flight -= job.bytes;
+    }
+    job.owner = w;
+    job.sent_time = sent_time;
+    job.bytes = bytes;
+    w->jobs++;
+    w->bytes_in_flight += bytes;
+}
+
+in_flight_job session::finish_job(int64_t msg_id)
+{
+    auto it = jobs.find(msg_id);
+    if (it == jobs.end()) {
+        return in_flight_job();
+    }
+
+    in_flight_job job = std::move(it->second);
+    jobs.erase(it);
+    job.owner->jobs--;
+    job.owner->bytes_in_flight -= job.bytes;
+    return job;
+}
+
+void session::remove_secondary_worker(const std::shared_ptr<worker>& worker_to_remove)
+{
+    // The argument may be the element being erased.
+    std::shared_ptr<worker> w = worker_to_remove;
+    if (!secondary_workers.erase(w)) {
+        return;
+    }
+
+    for (auto it = jobs.begin(); it != jobs.end(); ) {
+        if (it->second.owner == w) {
+            it = jobs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    w->jobs = 0;
+    w->bytes_in_flight = 0;
 }
 
 }
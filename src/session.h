@@ -23,6 +23,7 @@
 
 #include "tgl/tgl_timer.h"
 
+#include <chrono>
 #include <memory>
 #include <set>
 #include <stdint.h>
@@ -36,12 +37,42 @@ class tgl_timer;
 namespace tgl {
 namespace impl {
 
+class mtprotocol_serializer;
+
+struct outgoing_message
+{
+    int64_t msg_id;
+    int32_t seq_no;
+    std::shared_ptr<const mtprotocol_serializer> body;
+    outgoing_message(int64_t id, int32_t seq, const std::shared_ptr<const mtprotocol_serializer>& msg)
+        : msg_id(id), seq_no(seq), body(msg) { }
+};
+
 struct worker
 {
     std::shared_ptr<tgl_connection> connection;
     std::shared_ptr<tgl_timer> live_timer;
-    std::set<int64_t> work_load;
-    explicit worker(const std::shared_ptr<tgl_connection>& c): connection(c) { }
+    // The number and total size of the messages sent on this worker that are
+    // waiting for an answer.
+    size_t jobs;
+    size_t bytes_in_flight;
+    // The smoothed time between sending a message on this worker and its
+    // answer, in seconds, 0 until the first answer.
+    double srtt;
+    // Messages waiting to be packed into one msg_container at the next flush.
+    std::vector<outgoing_message> send_queue;
+    size_t send_queue_ints;
+    explicit worker(const std::shared_ptr<tgl_connection>& c)
+        : connection(c), jobs(0), bytes_in_flight(0), srtt(0), send_queue_ints(0) { }
+};
+
+struct in_flight_job
+{
+    std::shared_ptr<worker> owner;
+    // When the message was written to the connection, zero while it waits in
+    // the send_queue of its owner.
+    std::chrono::steady_clock::time_point sent_time;
+    size_t bytes;
 };
 
 struct session
@@ -52,8 +83,11 @@ struct session
     int32_t received_messages;
     std::shared_ptr<worker> primary_worker;
     std::unordered_set<std::shared_ptr<worker>> secondary_workers;
+    // The messages waiting for an answer by msg_id, whatever worker sent them.
+    std::unordered_map<int64_t, in_flight_job> jobs;
     std::set<int64_t> ack_set;
     std::shared_ptr<tgl_timer> ev;
+    std::shared_ptr<tgl_timer> flush_timer;
     session()
         : session_id(0)
         , last_msg_id(0)
@@ -61,9 +95,17 @@ struct session
         , received_messages(0)
         , ack_set()
         , ev()
+        , flush_timer()
     { }
 
     void clear();
+
+    void add_job(const std::shared_ptr<worker>& w, int64_t msg_id, size_t bytes,
+            std::chrono::steady_clock::time_point sent_time = std::chrono::steady_clock::time_point());
+    // Forgets the job of msg_id and returns it, with a null owner if there was none.
+    in_flight_job finish_job(int64_t msg_id);
+    // Drops a secondary worker together with the jobs it still had.
+    void remove_secondary_worker(const std::shared_ptr<worker>& w);
 };
 
 }
@@ -0,0 +1,323 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include <tgl/impl/tgl_timer_wheel.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+constexpr uint64_t NO_WAKEUP = std::numeric_limits<uint64_t>::max();
+
+int lowest_bit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+class tgl_timer_wheel_timer: public std::enable_shared_from_this<tgl_timer_wheel_timer>,
+        public tgl_timer, public tgl_timer_wheel::entry {
+public:
+    tgl_timer_wheel_timer(const std::shared_ptr<tgl_timer_wheel>& wheel, const std::function<void()>& cb)
+        : m_wheel(wheel)
+        , m_cb(cb)
+    { }
+
+    ~tgl_timer_wheel_timer()
+    {
+        m_wheel->unschedule(this);
+    }
+
+    virtual void start(double seconds_from_now) override
+    {
+        auto delay = std::chrono::duration_cast<tgl_timer_wheel::clock::duration>(
+                std::chrono::duration<double>(std::max(seconds_from_now, 0.0)));
+        m_wheel->schedule(this, tgl_timer_wheel::clock::now() + delay);
+    }
+
+    virtual void cancel() override
+    {
+        m_wheel->unschedule(this);
+    }
+
+protected:
+    virtual void expired() override
+    {
+        // The callback may drop the last reference to the timer.
+        auto self = shared_from_this();
+        m_cb();
+    }
+
+private:
+    std::shared_ptr<tgl_timer_wheel> m_wheel;
+    std::function<void()> m_cb;
+};
+
+}
+
+tgl_timer_wheel::tgl_timer_wheel(clock::duration tick)
+    : m_start(clock::now())
+    , m_tick(std::max(tick, clock::duration(1)))
+    , m_current_tick(0)
+    , m_wakeup_tick(NO_WAKEUP)
+    , m_size(0)
+    , m_advancing(false)
+{
+    for (int level = 0; level < LEVELS; ++level) {
+        for (size_t slot = 0; slot < SLOTS; ++slot) {
+            m_slots[level][slot].prev = &m_slots[level][slot];
+            m_slots[level][slot].next = &m_slots[level][slot];
+        }
+        std::fill(m_occupied[level], m_occupied[level] + BITMAP_WORDS, 0);
+    }
+}
+
+tgl_timer_wheel::~tgl_timer_wheel()
+{
+    for (int level = 0; level < LEVELS; ++level) {
+        for (size_t slot = 0; slot < SLOTS; ++slot) {
+            link* head = &m_slots[level][slot];
+            while (head->next != head) {
+                remove(static_cast<entry*>(head->next));
+            }
+        }
+    }
+}
+
+uint64_t tgl_timer_wheel::tick_at(clock::time_point t) const
+{
+    if (t <= m_start) {
+        return 0;
+    }
+    // Round up so that nothing expires early.
+    auto elapsed = t - m_start;
+    return static_cast<uint64_t>((elapsed + m_tick - clock::duration(1)) / m_tick);
+}
+
+void tgl_timer_wheel::schedule(entry* e, clock::time_point expiry)
+{
+    if (e->scheduled()) {
+        remove(e);
+    }
+
+    uint64_t tick = std::max(tick_at(expiry), m_current_tick);
+    e->m_expiry_tick = tick;
+    insert(e);
+    ++m_size;
+
+    if (tick < m_wakeup_tick) {
+        m_wakeup_tick = tick;
+        if (!m_advancing && m_wakeup_handler) {
+            m_wakeup_handler(m_start + m_tick * tick);
+        }
+    }
+}
+
+void tgl_timer_wheel::unschedule(entry* e)
+{
+    if (e->scheduled()) {
+        remove(e);
+    }
+}
+
+void tgl_timer_wheel::insert(entry* e)
+{
+    uint64_t delta = e->m_expiry_tick - m_current_tick;
+    uint64_t tick = e->m_expiry_tick;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    if (delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))) {
+        // Beyond the span of the wheel, park it in the furthest slot and
+        // look again when that one cascades.
+        tick = m_current_tick + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+    }
+
+    size_t slot = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    link* head = &m_slots[level][slot];
+    e->prev = head->prev;
+    e->next = head;
+    head->prev->next = e;
+    head->prev = e;
+    e->m_level = static_cast<uint8_t>(level);
+    e->m_slot = static_cast<uint8_t>(slot);
+    m_occupied[level][slot / 64] |= uint64_t(1) << (slot % 64);
+}
+
+void tgl_timer_wheel::remove(entry* e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+    e->prev = nullptr;
+    e->next = nullptr;
+    --m_size;
+
+    // An entry of a batch being expired is no longer in its slot, which may
+    // have been refilled since.
+    const link* head = &m_slots[e->m_level][e->m_slot];
+    if (head->next == head) {
+        m_occupied[e->m_level][e->m_slot / 64] &= ~(uint64_t(1) << (e->m_slot % 64));
+    }
+}
+
+void tgl_timer_wheel::cascade(int level, size_t slot)
+{
+    link* head = &m_slots[level][slot];
+    link* first = head->next;
+    if (first == head) {
+        return;
+    }
+    head->prev->next = nullptr;
+    head->prev = head;
+    head->next = head;
+    m_occupied[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+
+    while (first) {
+        entry* e = static_cast<entry*>(first);
+        first = first->next;
+        insert(e);
+    }
+}
+
+int tgl_timer_wheel::find_occupied(int level, size_t from) const
+{
+    for (size_t word = from / 64; word < BITMAP_WORDS; ++word) {
+        uint64_t bits = m_occupied[level][word];
+        if (word == from / 64) {
+            bits &= ~uint64_t(0) << (from % 64);
+        }
+        if (bits) {
+            return static_cast<int>(word * 64 + lowest_bit(bits));
+        }
+    }
+    return -1;
+}
+
+uint64_t tgl_timer_wheel::compute_wakeup_tick() const
+{
+    if (!m_size) {
+        return NO_WAKEUP;
+    }
+    size_t index = m_current_tick & (SLOTS - 1);
+    if (index == 0) {
+        // The upper levels cascade before the first slot of a rotation is expired.
+        for (int level = 1; level < LEVELS; ++level) {
+            size_t slot = (m_current_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+            if (m_occupied[level][slot / 64] & (uint64_t(1) << (slot % 64))) {
+                return m_current_tick;
+            }
+            if (slot != 0) {
+                break;
+            }
+        }
+    }
+
+    uint64_t rotation_start = m_current_tick - index;
+    int slot = find_occupied(0, index);
+    if (slot >= 0) {
+        return rotation_start + slot;
+    }
+    // Whatever is left is due in the next rotation of the first level or has
+    // to cascade into it at its start.
+    return rotation_start + SLOTS;
+}
+
+size_t tgl_timer_wheel::advance(clock::time_point now)
+{
+    if (now < m_start) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>((now - m_start) / m_tick);
+    size_t expired = 0;
+    m_advancing = true;
+    while (m_current_tick <= target) {
+        if (!m_size) {
+            m_current_tick = target + 1;
+            break;
+        }
+
+        size_t index = m_current_tick & (SLOTS - 1);
+        if (index == 0) {
+            for (int level = 1; level < LEVELS; ++level) {
+                size_t slot = (m_current_tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+                cascade(level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        } else if (find_occupied(0, index) < 0) {
+            // Nothing left in this rotation, skip to the next one.
+            m_current_tick = std::min(target + 1, (m_current_tick | (SLOTS - 1)) + 1);
+            continue;
+        }
+
+        link batch;
+        link* head = &m_slots[0][index];
+        if (head->next != head) {
+            batch.next = head->next;
+            batch.prev = head->prev;
+            batch.next->prev = &batch;
+            batch.prev->next = &batch;
+            head->next = head;
+            head->prev = head;
+            m_occupied[0][index / 64] &= ~(uint64_t(1) << (index % 64));
+        } else {
+            batch.next = &batch;
+            batch.prev = &batch;
+        }
+
+        // Timers started by the callbacks go to the ticks after this one.
+        ++m_current_tick;
+
+        while (batch.next != &batch) {
+            entry* e = static_cast<entry*>(batch.next);
+            remove(e);
+            e->expired();
+            ++expired;
+        }
+    }
+    m_advancing = false;
+    m_wakeup_tick = compute_wakeup_tick();
+    return expired;
+}
+
+tgl_timer_wheel::clock::time_point tgl_timer_wheel::next_expiry() const
+{
+    if (m_wakeup_tick == NO_WAKEUP) {
+        return clock::time_point::max();
+    }
+    return m_start + m_tick * m_wakeup_tick;
+}
+
+std::shared_ptr<tgl_timer> tgl_timer_factory_wheel::create_timer(const std::function<void()>& cb)
+{
+    return std::make_shared<tgl_timer_wheel_timer>(m_wheel, cb);
+}
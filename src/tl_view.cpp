@@ -0,0 +1,122 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#include "tl_view.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace tgl {
+namespace impl {
+
+tl_view::tl_view(const tgl_in_buffer& in, uint32_t magic, bool boxed, int fields_num)
+    : m_begin(in.ptr)
+    , m_limit(in.end)
+    , m_fields_num(fields_num)
+    , m_known(0)
+{
+    assert(fields_num >= 0 && fields_num <= MAX_FIELDS);
+    if (boxed) {
+        if (m_begin >= m_limit || static_cast<uint32_t>(*m_begin) != magic) {
+            m_known = -1;
+            return;
+        }
+        m_begin++;
+    }
+    m_offsets[0] = 0;
+    m_known = 1;
+}
+
+const int32_t* tl_view::field(int index) const
+{
+    assert(index >= 0 && index <= m_fields_num);
+    if (m_known < 0) {
+        return nullptr;
+    }
+
+    while (m_known <= index) {
+        tgl_in_buffer in = { m_begin + m_offsets[m_known - 1], m_limit };
+        if (skip_field(m_known - 1, &in) < 0) {
+            m_known = -1;
+            return nullptr;
+        }
+        m_offsets[m_known] = in.ptr - m_begin;
+        m_known++;
+    }
+
+    return m_begin + m_offsets[index];
+}
+
+int32_t tl_view::field_i32(int index) const
+{
+    const int32_t* begin = field(index);
+    const int32_t* end = field(index + 1);
+    return begin && end && end - begin >= 1 ? *begin : 0;
+}
+
+int64_t tl_view::field_i64(int index) const
+{
+    const int32_t* begin = field(index);
+    const int32_t* end = field(index + 1);
+    int64_t value = 0;
+    if (begin && end && end - begin >= 2) {
+        memcpy(&value, begin, sizeof(value));
+    }
+    return value;
+}
+
+double tl_view::field_double(int index) const
+{
+    const int32_t* begin = field(index);
+    const int32_t* end = field(index + 1);
+    double value = 0;
+    if (begin && end && end - begin >= 2) {
+        memcpy(&value, begin, sizeof(value));
+    }
+    return value;
+}
+
+tl_span tl_view::field_string(int index) const
+{
+    const int32_t* begin = field(index);
+    const int32_t* end = field(index + 1);
+    if (!begin || !end || begin == end) {
+        return tl_span { nullptr, 0 };
+    }
+    tgl_in_buffer in = { begin, end };
+    ssize_t len = prefetch_strlen(&in);
+    if (len < 0) {
+        return tl_span { nullptr, 0 };
+    }
+    return tl_span { fetch_str(&in, len), static_cast<size_t>(len) };
+}
+
+tgl_in_buffer tl_view::field_buffer(int index) const
+{
+    const int32_t* begin = field(index);
+    const int32_t* end = field(index + 1);
+    if (!begin || !end) {
+        return tgl_in_buffer { nullptr, nullptr };
+    }
+    return tgl_in_buffer { begin, end };
+}
+
+}
+}
@@ -0,0 +1,80 @@
+/*
+    This file is part of tgl-library
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    Copyright Topology LP 2017
+*/
+
+#pragma once
+
+#include "mtproto_common.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tgl {
+namespace impl {
+
+// A string or bytes field pointing into the buffer it was read from.
+struct tl_span {
+    const char* data;
+    size_t len;
+};
+
+// Read-only access to one constructor in a receive buffer without fetching it
+// into tl_ds structures. The generated tl_view_* classes in auto/auto_views.h
+// name the fields; offsets are found by skipping the preceding fields the
+// first time a field is asked for and remembered after that.
+//
+// A view never reads outside of the buffer it was given. A malformed object
+// makes valid() false and the accessors return zeroes and empty spans. Spans
+// and buffers returned by a view are only good as long as the buffer is.
+class tl_view
+{
+public:
+    static constexpr int MAX_FIELDS = 32;
+
+    // Checks the whole object and returns whether it is well formed.
+    bool valid() const { return field(m_fields_num) != nullptr; }
+
+    // The first int after the object, or nullptr if it is malformed.
+    const int32_t* end() const { return field(m_fields_num); }
+
+protected:
+    tl_view(const tgl_in_buffer& in, uint32_t magic, bool boxed, int fields_num);
+    virtual ~tl_view() { }
+
+    // Skips field index, which starts at in->ptr. Returns -1 if it is malformed.
+    virtual int skip_field(int index, tgl_in_buffer* in) const = 0;
+
+    const int32_t* field(int index) const;
+
+    int32_t field_i32(int index) const;
+    int64_t field_i64(int index) const;
+    double field_double(int index) const;
+    tl_span field_string(int index) const;
+    tgl_in_buffer field_buffer(int index) const;
+
+private:
+    const int32_t* m_begin;
+    const int32_t* m_limit;
+    int m_fields_num;
+    mutable int m_known;
+    mutable uint32_t m_offsets[MAX_FIELDS + 1];
+};
+
+}
+}
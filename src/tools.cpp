@@ -32,37 +32,6 @@
 #include "valgrind/memcheck.h"
 #endif
 
-#include <zlib.h>
-
-namespace tgl {
-namespace impl {
-
-int tgl_inflate(const void* input, int ilen, void* output, int olen)
-{
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
-    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
-        TGL_ERROR("failed to call inflateInit2");
-        return 0;
-    }
-    strm.avail_in = ilen;
-    strm.next_in = (Bytef*)input;
-    strm.avail_out = olen ;
-    strm.next_out = (Bytef*)output;
-    int err = inflate(&strm, Z_FINISH);
-    int total_out = strm.total_out;
-
-    if (err != Z_OK && err != Z_STREAM_END) {
-        TGL_ERROR("inflate error = " << err << ", inflated " << strm.total_out << " bytes");
-        total_out = 0;
-    }
-    inflateEnd(&strm);
-    return total_out;
-}
-
-}
-}
-
 void tgl_secure_random(unsigned char* s, int l)
 {
     if (tgl::impl::TGLC_rand_bytes(s, l) <= 0) {
@@ -21,6 +21,7 @@
 
 #include "transfer_manager.h"
 
+#include "auto/auto_builders.h"
 #include "auto/auto_fetch_ds.h"
 #include "auto/auto_free_ds.h"
 #include "auto/auto_skip.h"
@@ -41,6 +42,7 @@
 #include "tgl/tgl_mime_type.h"
 #include "tgl/tgl_secure_random.h"
 #include "tgl/tgl_update_callback.h"
+#include "tl_view.h"
 #include "upload_task.h"
 
 #include <boost/filesystem.hpp>
@@ -109,7 +111,7 @@ void transfer_manager::upload_avatar_end(const std::shared_ptr<upload_task>& u,
     }
 
     if (u->avatar > 0) {
-        auto q = std::make_shared<query_send_messages>(*ua, callback);
+        auto q = make_query<query_send_messages>(*ua, callback);
         if (u->to_id.peer_type == tgl_peer_type::channel) {
             q->out_i32(CODE_channels_edit_photo);
             q->out_i32(CODE_input_channel);
@@ -139,7 +141,7 @@ void transfer_manager::upload_avatar_end(const std::shared_ptr<upload_task>& u,
 
         q->execute(ua->active_client());
     } else {
-        auto q = std::make_shared<query_set_photo>(*ua, callback);
+        auto q = make_query<query_set_photo>(*ua, callback);
         q->out_i32(CODE_photos_upload_profile_photo);
         if (u->size < BIG_FILE_THRESHOLD) {
             q->out_i32(CODE_input_file);
@@ -173,7 +175,7 @@ void transfer_manager::upload_unencrypted_file_end(const std::shared_ptr<upload_
 
     auto extra = std::make_shared<messages_send_extra>();
     extra->id = u->message_id;
-    auto q = std::make_shared<query_send_messages>(*ua, extra,
+    auto q = make_query<query_send_messages>(*ua, extra,
             [=](bool success, const std::shared_ptr<tgl_message>& message) {
                 u->set_status(success ? tgl_upload_status::succeeded : tgl_upload_status::failed);
             });
@@ -300,7 +302,7 @@ void transfer_manager::upload_encrypted_file_end(const std::shared_ptr<upload_ta
             nullptr,
             nullptr);
     m->set_pending(true).set_unread(true);
-    auto q = std::make_shared<query_messages_send_encrypted_file>(*ua, sc, u, m,
+    auto q = make_query<query_messages_send_encrypted_file>(*ua, sc, u, m,
             [=](bool success, const std::shared_ptr<tgl_message>&) {
                 u->set_status(success ? tgl_upload_status::succeeded : tgl_upload_status::failed);
             });
@@ -390,18 +392,9 @@ void transfer_manager::upload_part(const std::shared_ptr<upload_task>& u)
 
     auto offset = u->part_num * MAX_PART_SIZE;
     u->running_parts.insert(u->part_num);
-    auto q = std::make_shared<query_upload_file_part>(*ua, u, std::bind(&transfer_manager::upload_part_finished,
+    auto q = make_query<query_upload_file_part>(*ua, u, std::bind(&transfer_manager::upload_part_finished,
             shared_from_this(), u, u->part_num, std::placeholders::_1));
-    if (u->size < BIG_FILE_THRESHOLD) {
-        q->out_i32(CODE_upload_save_file_part);
-        q->out_i64(u->id);
-        q->out_i32(u->part_num++);
-    } else {
-        q->out_i32(CODE_upload_save_big_file_part);
-        q->out_i64(u->id);
-        q->out_i32(u->part_num++);
-        q->out_i32((u->size + MAX_PART_SIZE - 1) / MAX_PART_SIZE);
-    }
+    int32_t part_num = u->part_num++;
 
     auto sending_buffer = u->read_callback(MAX_PART_SIZE);
     size_t read_size = sending_buffer->size();
@@ -431,12 +424,19 @@ void transfer_manager::upload_part(const std::shared_ptr<upload_task>& u)
                 reinterpret_cast<unsigned char*>(sending_buffer->data()), read_size, &aes_key, u->iv.data(), 1);
         memset(&aes_key, 0, sizeof(aes_key));
     }
-    q->out_string(reinterpret_cast<const char*>(sending_buffer->data()), read_size);
+
+    tl_out_string bytes(reinterpret_cast<const char*>(sending_buffer->data()), read_size);
+    if (u->size < BIG_FILE_THRESHOLD) {
+        tl_out_upload_save_file_part(*q->serializer(), u->id, part_num, bytes);
+    } else {
+        tl_out_upload_save_big_file_part(*q->serializer(), u->id, part_num,
+                (u->size + MAX_PART_SIZE - 1) / MAX_PART_SIZE, bytes);
+    }
 
     if (offset != u->size) {
         assert(MAX_PART_SIZE == read_size);
     }
-    q->execute(ua->active_client());
+    q->execute(ua->media_client(ua->active_client()->id()));
 }
 
 void transfer_manager::upload_thumb(const std::shared_ptr<upload_task>& u)
@@ -458,17 +458,15 @@ void transfer_manager::upload_thumb(const std::shared_ptr<upload_task>& u)
         return;
     }
 
-    auto q = std::make_shared<query_upload_file_part>(*ua, u, std::bind(&transfer_manager::upload_part_finished,
+    auto q = make_query<query_upload_file_part>(*ua, u, std::bind(&transfer_manager::upload_part_finished,
             shared_from_this(), u, std::numeric_limits<size_t>::max(), std::placeholders::_1));
     while (u->thumb_id == 0) {
         u->thumb_id = tgl_random<int64_t>();
     }
-    q->out_i32(CODE_upload_save_file_part);
-    q->out_i64(u->thumb_id);
-    q->out_i32(0);
-    q->out_string(reinterpret_cast<char*>(u->thumb.data()), u->thumb.size());
+    tl_out_upload_save_file_part(*q->serializer(), u->thumb_id, 0,
+            tl_out_string(reinterpret_cast<const char*>(u->thumb.data()), u->thumb.size()));
 
-    q->execute(ua->active_client());
+    q->execute(ua->media_client(ua->active_client()->id()));
 }
 
 
@@ -543,9 +541,9 @@ void transfer_manager::upload_document(const tgl_input_peer_t& to_id,
 
     if (!u->is_encrypted() && thumb_size > 0) {
         upload_thumb(u);
-        upload_multiple_parts(u, ua->active_client()->max_connections() - 1);
+        upload_multiple_parts(u, ua->media_client(ua->active_client()->id())->max_connections() - 1);
     } else {
-        upload_multiple_parts(u, ua->active_client()->max_connections());
+        upload_multiple_parts(u, ua->media_client(ua->active_client()->id())->max_connections());
     }
 }
 
@@ -690,10 +688,10 @@ void transfer_manager::download_end(const std::shared_ptr<download_task>& d)
 }
 
 void transfer_manager::download_part_finished(const std::shared_ptr<download_task>& d, size_t offset,
-        const tl_ds_upload_file* DS_UF)
+        const tl_span* bytes)
 {
-    if (!DS_UF || d->check_cancelled()) {
-        if (!DS_UF) {
+    if (!bytes || d->check_cancelled()) {
+        if (!bytes) {
             d->set_status(tgl_download_status::failed);
         }
         d->running_parts.clear();
@@ -712,7 +710,7 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
         }
     }
 
-    if (!DS_UF->bytes || !DS_UF->bytes->data || DS_UF->bytes->len <= 0) {
+    if (!bytes->data || !bytes->len) {
         TGL_ERROR("the server returned nothing to us");
         d->set_status(tgl_download_status::failed);
         d->running_parts.clear();
@@ -721,7 +719,8 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
     }
 
     if (!d->iv.empty()) {
-        d->running_parts[offset] = download_data(DS_UF->bytes->data, DS_UF->bytes->len, false);
+        // The bytes may point into the receive buffer, so decrypt a copy.
+        d->running_parts[offset] = download_data(bytes->data, bytes->len);
         auto it = d->running_parts.begin();
         for (;it != d->running_parts.end() && d->decryption_offset == it->first && it->second; ++it) {
             char* data = it->second.data();
@@ -745,18 +744,14 @@ void transfer_manager::download_part_finished(const std::shared_ptr<download_tas
             d->file_stream->write(data, length);
             d->decryption_offset += length;
         }
-        if (it == d->running_parts.begin()) {
-            d->running_parts[offset] = download_data(DS_UF->bytes->data, DS_UF->bytes->len, true);
-        } else {
-            d->running_parts.erase(d->running_parts.begin(), it);
-        }
+        d->running_parts.erase(d->running_parts.begin(), it);
     } else {
         d->file_stream->seekp(offset);
-        d->file_stream->write(DS_UF->bytes->data, DS_UF->bytes->len);
+        d->file_stream->write(bytes->data, bytes->len);
         d->running_parts.erase(offset);
     }
 
-    d->downloaded_bytes += DS_UF->bytes->len;
+    d->downloaded_bytes += bytes->len;
 
     if (d->status == tgl_download_status::waiting || d->status == tgl_download_status::connecting) {
         d->set_status(tgl_download_status::downloading);
@@ -799,25 +794,24 @@ void transfer_manager::download_part(const std::shared_ptr<download_task>& d)
 
     d->running_parts[d->offset] = download_data();
 
-    auto q = std::make_shared<query_download_file_part>(*ua, d, std::bind(&transfer_manager::download_part_finished,
+    auto q = make_query<query_download_file_part>(*ua, d, std::bind(&transfer_manager::download_part_finished,
             shared_from_this(), d, d->offset, std::placeholders::_1));
 
-    q->out_i32(CODE_upload_get_file);
+    tl_out_object location;
     if (d->location.local_id()) {
-        q->out_i32(CODE_input_file_location);
-        q->out_i64(d->location.volume());
-        q->out_i32(d->location.local_id());
-        q->out_i64(d->location.secret());
+        location.out_i32(CODE_input_file_location);
+        location.out_i64(d->location.volume());
+        location.out_i32(d->location.local_id());
+        location.out_i64(d->location.secret());
     } else {
-        q->out_i32(d->type);
-        q->out_i64(d->location.document_id());
-        q->out_i64(d->location.access_hash());
+        location.out_i32(d->type);
+        location.out_i64(d->location.document_id());
+        location.out_i64(d->location.access_hash());
     }
-    q->out_i32(d->offset);
-    q->out_i32(MAX_PART_SIZE);
+    tl_out_upload_get_file(*q->serializer(), location, d->offset, MAX_PART_SIZE);
     d->offset += MAX_PART_SIZE;
 
-    q->execute(ua->client_at(d->location.dc()));
+    q->execute(ua->media_client(d->location.dc()));
 }
 
 void transfer_manager::download_by_file_location(int64_t download_id,
@@ -858,7 +852,7 @@ void transfer_manager::download_by_file_location(int64_t download_id,
     if (file_size <= 0) { // It's likely for avatar which doesn't have a file size
         download_part(d);
     } else {
-        download_multiple_parts(d, ua->client_at(d->location.dc())->max_connections());
+        download_multiple_parts(d, ua->media_client(d->location.dc())->max_connections());
     }
 }
 
@@ -897,7 +891,7 @@ void transfer_manager::download_document(int64_t download_id,
         d->ext = tgl_extension_by_mime_type(document->mime_type);
     }
     d->set_status(tgl_download_status::waiting);
-    download_multiple_parts(d, ua->client_at(d->location.dc())->max_connections());
+    download_multiple_parts(d, ua->media_client(d->location.dc())->max_connections());
 }
 
 void transfer_manager::cancel_download(int64_t download_id)
@@ -32,9 +32,9 @@ namespace impl {
 class download_task;
 class query_download_file_part;
 class query_upload_file_part;
+struct tl_span;
 class upload_task;
 class user_agent;
-struct tl_ds_upload_file;
 
 class transfer_manager: public std::enable_shared_from_this<transfer_manager>, public tgl_transfer_manager
 {
@@ -99,7 +99,7 @@ private:
                       const tgl_read_callback& read_callback,
                       const tgl_upload_part_done_callback& done_callback);
 
-    void download_part_finished(const std::shared_ptr<download_task>&, size_t offset, const tl_ds_upload_file*);
+    void download_part_finished(const std::shared_ptr<download_task>&, size_t offset, const tl_span* bytes);
 
     void download_multiple_parts(const std::shared_ptr<download_task>&, size_t count);
     void download_part(const std::shared_ptr<download_task>&);
@@ -26,6 +26,7 @@
 #include "auto/auto_fetch_ds.h"
 #include "auto/auto_free_ds.h"
 #include "chat.h"
+#include "ds_arena.h"
 #include "file_location.h"
 #include "message.h"
 #include "mtproto_common.h"
@@ -723,9 +724,15 @@ void updater::work_any_updates(const tl_ds_updates* DS_U, const std::shared_ptr<
 void updater::work_any_updates(tgl_in_buffer* in)
 {
     paramed_type type = TYPE_TO_PARAM(updates);
-    tl_ds_updates* DS_U = fetch_ds_type_updates(in, &type);
-    if (!DS_U) {
+    ds_arena::scope ds_scope;
+    tl_ds_updates* DS_U;
+    {
+        ds_arena::fetch_scope fetch;
+        DS_U = fetch_ds_type_updates(in, &type);
+    }
+    if (!DS_U || in->ptr != in->end) {
         TGL_WARNING("failed to fetch updates from response from the server, likely corrupt data");
+        in->ptr = in->end;
         return;
     }
 
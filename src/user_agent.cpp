@@ -22,6 +22,7 @@
 #include "user_agent.h"
 
 #include "auto/auto.h"
+#include "auto/auto_builders.h"
 #include "auto/auto_fetch_ds.h"
 #include "auto/auto_free_ds.h"
 #include "auto/auto_skip.h"
@@ -118,6 +119,8 @@
 constexpr int MAX_DC_ID = 10;
 constexpr int32_t TG_APP_ID = 10534;
 constexpr const char* TG_APP_HASH = "844584f2b1fd2daecee726166dcc1ef8";
+// Bumped whenever the layout of session_snapshot() changes, older snapshots are ignored.
+constexpr int32_t SESSION_SNAPSHOT_VERSION = 1;
 
 std::shared_ptr<tgl_user_agent> tgl_user_agent::create(
         const std::vector<std::string>& rsa_keys,
@@ -179,12 +182,16 @@ user_agent::user_agent()
     , m_seq(0)
     , m_app_id(0)
     , m_temp_key_expire_time(0)
-    , m_bytes_sent(0)
-    , m_bytes_received(0)
+    , m_net_stats()
+    , m_inflate_arena()
+    , m_deflater()
     , m_is_started(false)
     , m_test_mode(false)
     , m_pfs_enabled(false)
     , m_ipv6_enabled(false)
+    , m_transport(tgl_transport::abridged)
+    , m_compression_threshold(0)
+    , m_media_sessions_enabled(true)
     , m_diff_locked(false)
     , m_password_locked(false)
     , m_phone_number_input_locked(false)
@@ -200,6 +207,7 @@ void user_agent::shut_down()
 
     m_online_status_observers.clear();
     m_clients.clear();
+    m_media_clients.clear();
     m_active_queries.clear();
     m_retry_queries.clear();
     m_secret_chats.clear();
@@ -224,6 +232,108 @@ void user_agent::set_dc_auth_key(int dc_id, const char* key, size_t key_length)
     m_callback->dc_updated(client.get());
 }
 
+void user_agent::add_validated_dh_prime(const std::string& fingerprint)
+{
+    if (fingerprint.size() != 32) {
+        TGL_ERROR("invalid DH prime fingerprint, db corrupted?");
+        return;
+    }
+    m_validated_dh_primes.insert(fingerprint);
+}
+
+std::string user_agent::session_snapshot() const
+{
+    mtprotocol_serializer s;
+    s.out_i32(SESSION_SNAPSHOT_VERSION);
+    s.out_i32(TGL_SCHEME_LAYER);
+    size_t count_at = s.i32_size();
+    s.out_i32(0);
+
+    int32_t count = 0;
+    for (const auto& client: m_clients) {
+        mtprotocol_serializer record;
+        if (!client || !client->save_session(record)) {
+            continue;
+        }
+        s.out_i32(client->id());
+        s.out_i32(record.i32_size());
+        s.out_i32s(record.i32_data(), record.i32_size());
+        count++;
+    }
+    s.out_i32_at(count_at, count);
+
+    return std::string(s.char_data(), s.char_size());
+}
+
+void user_agent::resume_sessions(const std::string& snapshot)
+{
+    if (snapshot.size() < 12 || (snapshot.size() & 3)) {
+        TGL_WARNING("ignoring malformed session snapshot");
+        return;
+    }
+
+    std::vector<int32_t> data(snapshot.size() / 4);
+    memcpy(data.data(), snapshot.data(), snapshot.size());
+    tgl_in_buffer in = { data.data(), data.data() + data.size() };
+
+    if (fetch_i32(&in) != SESSION_SNAPSHOT_VERSION) {
+        TGL_WARNING("ignoring session snapshot of another version");
+        return;
+    }
+
+    // The connections of the sessions were initialized with the layer of the
+    // snapshot, a different one makes them configure again.
+    bool same_layer = fetch_i32(&in) == TGL_SCHEME_LAYER;
+    int32_t count = fetch_i32(&in);
+    for (int32_t i = 0; i < count; ++i) {
+        if (in_remaining(&in) < 8) {
+            TGL_WARNING("session snapshot is truncated");
+            return;
+        }
+        int32_t dc_id = fetch_i32(&in);
+        int32_t record_ints = fetch_i32(&in);
+        if (record_ints < 0 || in_remaining(&in) < record_ints * 4) {
+            TGL_WARNING("session snapshot is truncated");
+            return;
+        }
+
+        tgl_in_buffer record = { in.ptr, in.ptr + record_ints };
+        in.ptr += record_ints;
+
+        auto client = client_at(dc_id);
+        if (!client) {
+            TGL_WARNING("no DC " << dc_id << " to resume the session of");
+            continue;
+        }
+        if (client->resume_session(&record, same_layer)) {
+            TGL_DEBUG("resumed session with DC " << dc_id);
+        }
+    }
+}
+
+bool user_agent::check_dh_params(TGLC_bn* p, int g)
+{
+    if (TGLC_bn_num_bytes(p) != 256) {
+        return false;
+    }
+
+    unsigned char prime[256];
+    TGLC_bn_bn2bin(p, prime);
+    std::string fingerprint(32, '\0');
+    TGLC_sha256(prime, sizeof(prime), reinterpret_cast<unsigned char*>(&fingerprint[0]));
+
+    bool known = m_validated_dh_primes.count(fingerprint);
+    if (tglmp_check_DH_params(m_bn_ctx->ctx, p, g, known) < 0) {
+        return false;
+    }
+
+    if (!known) {
+        m_validated_dh_primes.insert(fingerprint);
+        m_callback->dh_prime_validated(fingerprint);
+    }
+    return true;
+}
+
 void user_agent::set_our_id(int id)
 {
     if (m_our_id.peer_id == id) {
@@ -348,6 +458,7 @@ void user_agent::reset_authorization()
             client->set_logged_in(false);
         }
     }
+    clear_media_clients();
 
     m_qts = 0;
     m_pts = 0;
@@ -440,31 +551,22 @@ void user_agent::add_active_query(const std::shared_ptr<query>& q)
 {
     auto id = q->msg_id();
     assert(id);
-    auto inserted_iterator_pair = m_active_queries.emplace(id, q);
-    if (inserted_iterator_pair.second) {
+    if (m_active_queries.insert(id, q)) {
         q->client()->increase_active_queries();
-    } else {
-        inserted_iterator_pair.first->second = q;
     }
 }
 
 std::shared_ptr<query> user_agent::get_active_query(int64_t id) const
 {
     assert(id);
-    auto it = m_active_queries.find(id);
-    if (it == m_active_queries.end()) {
-        return nullptr;
-    }
-    return it->second;
+    return m_active_queries.find(id);
 }
 
 void user_agent::remove_active_query(const std::shared_ptr<query>& q)
 {
     auto id = q->msg_id();
     assert(id);
-    auto it = m_active_queries.find(id);
-    if (it != m_active_queries.end()) {
-        m_active_queries.erase(it);
+    if (m_active_queries.erase(id)) {
         q->client()->decrease_active_queries();
     }
 }
@@ -502,6 +604,62 @@ std::shared_ptr<mtproto_client> user_agent::allocate_client(int id)
     return client;
 }
 
+std::shared_ptr<mtproto_client> user_agent::media_client(int id)
+{
+    auto client = client_at(id);
+    if (!m_media_sessions_enabled || !client || !client->is_authorized() || !client->is_logged_in()
+            || !client->is_bound()) {
+        return client;
+    }
+
+    if (static_cast<size_t>(id) >= m_media_clients.size()) {
+        m_media_clients.resize(id + 1, nullptr);
+    }
+
+    auto& media = m_media_clients[id];
+    if (!media) {
+        TGL_DEBUG("creating media client for DC " << id);
+        media = std::make_shared<mtproto_client>(*this, id, true);
+        media->set_auth_key(client->auth_key().data(), client->auth_key().size());
+        media->set_logged_in();
+        for (const auto& option: client->ipv4_options()) {
+            media->add_ipv4_option(option.first, option.second);
+        }
+        for (const auto& option: client->ipv6_options()) {
+            media->add_ipv6_option(option.first, option.second);
+        }
+        media->share_temp_auth_key(*client);
+    }
+
+    return media;
+}
+
+std::shared_ptr<mtproto_client> user_agent::existing_media_client(int id) const
+{
+    if (id < 0 || static_cast<size_t>(id) >= m_media_clients.size()) {
+        return nullptr;
+    }
+    return m_media_clients[id];
+}
+
+void user_agent::clear_media_clients()
+{
+    for (const auto& client: m_media_clients) {
+        if (client) {
+            client->clear_session();
+        }
+    }
+    m_media_clients.clear();
+}
+
+void user_agent::set_media_sessions_enabled(bool enabled)
+{
+    m_media_sessions_enabled = enabled;
+    if (!enabled) {
+        clear_media_clients();
+    }
+}
+
 void user_agent::state_lookup_timeout()
 {
     lookup_state();
@@ -583,7 +741,7 @@ void user_agent::clear_all_locks()
 void user_agent::send_code(const std::string& phone, const std::function<void(bool, bool, const std::string&)>& callback)
 {
     TGL_NOTICE("requesting confirmation code from dc " << active_client()->id());
-    auto q = std::make_shared<query_send_code>(*this, callback);
+    auto q = make_query<query_send_code>(*this, callback);
     q->out_i32(CODE_auth_send_code);
     q->out_std_string(phone);
     q->out_i32(0);
@@ -598,7 +756,7 @@ void user_agent::call_me(const std::string& phone, const std::string& hash,
 {
     TGL_DEBUG("calling user at phone number: " << phone);
 
-    auto q = std::make_shared<query_phone_call>(*this, callback);
+    auto q = make_query<query_phone_call>(*this, callback);
     q->out_header();
     q->out_i32(CODE_auth_send_call);
     q->out_std_string(phone);
@@ -611,7 +769,7 @@ void user_agent::send_code_result(const std::string& phone,
         const std::string& code,
         const std::function<void(bool success, const std::shared_ptr<user>&)>& callback)
 {
-    auto q = std::make_shared<query_sign_in>(*this, callback);
+    auto q = make_query<query_sign_in>(*this, callback);
     q->out_i32(CODE_auth_sign_in);
     q->out_std_string(phone);
     q->out_std_string(hash);
@@ -637,7 +795,7 @@ void user_agent::logout()
 
     std::weak_ptr<user_agent> weak_ua = shared_from_this();
     auto do_logout = [=] {
-        auto q = std::make_shared<query_logout>(*this, [=](bool success) {
+        auto q = make_query<query_logout>(*this, [=](bool success) {
             if (auto ua = weak_ua.lock()) {
                 ua->callback()->logged_out(success);
             }
@@ -657,7 +815,7 @@ void user_agent::logout()
 
 void user_agent::update_contact_list(const std::function<void(bool, const std::vector<std::shared_ptr<tgl_user>>&)>& callback)
 {
-    auto q = std::make_shared<query_get_contacts>(*this, callback);
+    auto q = make_query<query_get_contacts>(*this, callback);
     q->out_i32(CODE_contacts_get_contacts);
     q->out_string("");
     q->execute(active_client());
@@ -671,67 +829,61 @@ void user_agent::send_text_message(const std::shared_ptr<class message>& message
         return;
     }
 
-    auto q = std::make_shared<query_msg_send>(*this, message, callback);
-    q->out_i32(CODE_messages_send_message);
+    auto q = make_query<query_msg_send>(*this, message, callback);
 
     unsigned f = (disable_preview ? 2 : 0) | (message->reply_id() ? 1 : 0) | (message->reply_markup() ? 4 : 0) | (message->entities().size() > 0 ? 8 : 0);
     if (message->from_id().peer_type == tgl_peer_type::channel) {
         f |= 16;
     }
-    q->out_i32(f);
-    q->out_input_peer(message->to_id());
-    if (message->reply_id()) {
-        q->out_i32(message->reply_id());
-    }
-    q->out_std_string(message->text());
-    q->out_i64(message->id());
 
+    mtprotocol_serializer reply_markup(0);
     if (message->reply_markup()) {
         if (!message->reply_markup()->button_matrix.empty()) {
-            q->out_i32(CODE_reply_keyboard_markup);
-            q->out_i32(message->reply_markup()->flags);
-            q->out_i32(CODE_vector);
-            q->out_i32(message->reply_markup()->button_matrix.size());
+            reply_markup.out_i32(CODE_reply_keyboard_markup);
+            reply_markup.out_i32(message->reply_markup()->flags);
+            reply_markup.out_i32(CODE_vector);
+            reply_markup.out_i32(message->reply_markup()->button_matrix.size());
             for (size_t i = 0; i < message->reply_markup()->button_matrix.size(); ++i) {
-                q->out_i32(CODE_keyboard_button_row);
-                q->out_i32(CODE_vector);
-                q->out_i32(message->reply_markup()->button_matrix[i].size());
+                reply_markup.out_i32(CODE_keyboard_button_row);
+                reply_markup.out_i32(CODE_vector);
+                reply_markup.out_i32(message->reply_markup()->button_matrix[i].size());
                 for (size_t j = 0; j < message->reply_markup()->button_matrix[i].size(); ++j) {
-                    q->out_i32(CODE_keyboard_button);
-                    q->out_std_string(message->reply_markup()->button_matrix[i][j]);
+                    reply_markup.out_i32(CODE_keyboard_button);
+                    reply_markup.out_std_string(message->reply_markup()->button_matrix[i][j]);
                 }
             }
         } else {
-            q->out_i32(CODE_reply_keyboard_hide);
+            reply_markup.out_i32(CODE_reply_keyboard_hide);
         }
     }
 
+    mtprotocol_serializer entities(0);
     if (message->entities().size() > 0) {
-        q->out_i32(CODE_vector);
-        q->out_i32(message->entities().size());
+        entities.out_i32(CODE_vector);
+        entities.out_i32(message->entities().size());
         for (size_t i = 0; i < message->entities().size(); i++) {
             auto entity = message->entities()[i];
             switch (entity->type) {
             case tgl_message_entity_type::bold:
-                q->out_i32(CODE_message_entity_bold);
-                q->out_i32(entity->start);
-                q->out_i32(entity->length);
+                entities.out_i32(CODE_message_entity_bold);
+                entities.out_i32(entity->start);
+                entities.out_i32(entity->length);
                 break;
             case tgl_message_entity_type::italic:
-                q->out_i32(CODE_message_entity_italic);
-                q->out_i32(entity->start);
-                q->out_i32(entity->length);
+                entities.out_i32(CODE_message_entity_italic);
+                entities.out_i32(entity->start);
+                entities.out_i32(entity->length);
                 break;
             case tgl_message_entity_type::code:
-                q->out_i32(CODE_message_entity_code);
-                q->out_i32(entity->start);
-                q->out_i32(entity->length);
+                entities.out_i32(CODE_message_entity_code);
+                entities.out_i32(entity->start);
+                entities.out_i32(entity->length);
                 break;
             case tgl_message_entity_type::text_url:
-                q->out_i32(CODE_message_entity_text_url);
-                q->out_i32(entity->start);
-                q->out_i32(entity->length);
-                q->out_std_string(entity->text_url);
+                entities.out_i32(CODE_message_entity_text_url);
+                entities.out_i32(entity->start);
+                entities.out_i32(entity->length);
+                entities.out_std_string(entity->text_url);
                 break;
             default:
                 assert(0);
@@ -739,6 +891,9 @@ void user_agent::send_text_message(const std::shared_ptr<class message>& message
         }
     }
 
+    tl_out_messages_send_message(*q->serializer(), f, q->input_peer(message->to_id()), message->reply_id(),
+            message->text(), message->id(), tl_out_object(reply_markup), tl_out_object(entities));
+
     m_callback->new_messages({message});
     q->execute(active_client());
 }
@@ -842,13 +997,13 @@ void user_agent::mark_message_read(const tgl_input_peer_t& id, int max_id_or_tim
     }
 
     if (id.peer_type != tgl_peer_type::channel) {
-        auto q = std::make_shared<query_mark_message_read>(*this, id, max_id_or_time, callback);
+        auto q = make_query<query_mark_message_read>(*this, id, max_id_or_time, callback);
         q->out_i32(CODE_messages_read_history);
         q->out_input_peer(id);
         q->out_i32(max_id_or_time);
         q->execute(active_client());
     } else {
-        auto q = std::make_shared<query_mark_message_read>(*this, id, max_id_or_time, callback);
+        auto q = make_query<query_mark_message_read>(*this, id, max_id_or_time, callback);
         q->out_i32(CODE_channels_read_history);
         q->out_i32(CODE_input_channel);
         q->out_i32(id.peer_id);
@@ -861,14 +1016,9 @@ void user_agent::mark_message_read(const tgl_input_peer_t& id, int max_id_or_tim
 void user_agent::get_history(const tgl_input_peer_t& id, int offset, int limit,
         const std::function<void(bool, const std::vector<std::shared_ptr<tgl_message>>& list)>& callback) {
     assert(id.peer_type != tgl_peer_type::enc_chat);
-    auto q = std::make_shared<query_get_history>(*this, id, limit, offset, 0/*max_id*/, callback);
-    q->out_i32(CODE_messages_get_history);
-    q->out_input_peer(id);
-    q->out_i32(0); // offset_id
-    q->out_i32(offset); // add_offset
-    q->out_i32(limit);
-    q->out_i32(0); // max_id
-    q->out_i32(0); // min_id
+    auto q = make_query<query_get_history>(*this, id, limit, offset, 0/*max_id*/, callback);
+    tl_out_messages_get_history(*q->serializer(), q->input_peer(id), 0 /*offset_id*/, offset /*add_offset*/, limit,
+            0 /*max_id*/, 0 /*min_id*/);
     q->execute(active_client());
 }
 
@@ -882,7 +1032,7 @@ void user_agent::get_dialog_list(int limit, int offset,
     state->limit = limit;
     state->offset = offset;
     state->channels = 0;
-    auto q = std::make_shared<query_get_dialogs>(*this, state, callback);
+    auto q = make_query<query_get_dialogs>(*this, state, callback);
     q->execute(active_client());
 }
 
@@ -898,14 +1048,14 @@ void user_agent::get_channels_dialog_list(int limit, int offset,
     state->channels = 1;
     state->offset_date = 0;
     state->offset_peer.peer_type = tgl_peer_type::unknown;
-    auto q = std::make_shared<query_get_dialogs>(*this, state, callback);
+    auto q = make_query<query_get_dialogs>(*this, state, callback);
     q->execute(active_client());
 }
 
 void user_agent::set_profile_name(const std::string& first_name, const std::string& last_name,
         const std::function<void(bool)>& callback)
 {
-    auto q = std::make_shared<query_set_profile_name>(*this, callback);
+    auto q = make_query<query_set_profile_name>(*this, callback);
     q->out_i32(CODE_account_update_profile);
     q->out_std_string(first_name);
     q->out_std_string(last_name);
@@ -914,7 +1064,7 @@ void user_agent::set_profile_name(const std::string& first_name, const std::stri
 
 void user_agent::set_username(const std::string& username, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_set_profile_name>(*this, callback);
+    auto q = make_query<query_set_profile_name>(*this, callback);
     q->out_i32(CODE_account_update_username);
     q->out_std_string(username);
     q->execute(active_client());
@@ -922,7 +1072,7 @@ void user_agent::set_username(const std::string& username, const std::function<v
 
 void user_agent::check_username(const std::string& username, const std::function<void(int result)>& callback)
 {
-    auto q = std::make_shared<query_check_username>(*this, callback);
+    auto q = make_query<query_check_username>(*this, callback);
     q->out_i32(CODE_account_check_username);
     q->out_std_string(username);
     q->execute(active_client());
@@ -932,7 +1082,7 @@ void user_agent::search_contact(const std::string& name, int limit,
         const std::function<void(const std::vector<std::shared_ptr<tgl_user>>&,
                            const std::vector<std::shared_ptr<tgl_chat>>&)>& callback)
 {
-    auto q = std::make_shared<query_search_contact>(*this, callback);
+    auto q = make_query<query_search_contact>(*this, callback);
     q->out_i32(CODE_contacts_search);
     q->out_std_string(name);
     q->out_i32(limit);
@@ -941,7 +1091,7 @@ void user_agent::search_contact(const std::string& name, int limit,
 
 void user_agent::resolve_username(const std::string& name, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_resolve_username>(*this, callback);
+    auto q = make_query<query_resolve_username>(*this, callback);
     q->out_i32(CODE_contacts_resolve_username);
     q->out_std_string(name);
     q->execute(active_client());
@@ -963,7 +1113,7 @@ void user_agent::forward_messages(const tgl_input_peer_t& from_id, const tgl_inp
     E->multi = true;
     E->count = message_ids.size();
 
-    auto q = std::make_shared<query_send_messages>(*this, E, callback);
+    auto q = make_query<query_send_messages>(*this, E, callback);
     q->out_i32(CODE_messages_forward_messages);
 
     unsigned f = 0;
@@ -1017,7 +1167,7 @@ void user_agent::forward_message(const tgl_input_peer_t& from_id, const tgl_inpu
 
     std::shared_ptr<messages_send_extra> E = std::make_shared<messages_send_extra>();
     tgl_secure_random(reinterpret_cast<unsigned char*>(&E->id), 8);
-    auto q = std::make_shared<query_send_messages>(*this, E, callback);
+    auto q = make_query<query_send_messages>(*this, E, callback);
     q->out_i32(CODE_messages_forward_message);
     q->out_input_peer(from_id);
     q->out_i32(message_id);
@@ -1042,7 +1192,7 @@ void user_agent::send_contact(const tgl_input_peer_t& id,
     std::shared_ptr<messages_send_extra> E = std::make_shared<messages_send_extra>();
     tgl_secure_random(reinterpret_cast<unsigned char*>(&E->id), 8);
 
-    auto q = std::make_shared<query_send_messages>(*this, E, callback);
+    auto q = make_query<query_send_messages>(*this, E, callback);
     q->out_i32(CODE_messages_send_media);
     q->out_i32(reply_id ? 1 : 0);
     if (reply_id) {
@@ -1116,7 +1266,7 @@ void user_agent::forward_media(const tgl_input_peer_t& to_id, int64_t message_id
     std::shared_ptr<messages_send_extra> E = std::make_shared<messages_send_extra>();
     tgl_secure_random(reinterpret_cast<unsigned char*>(&E->id), 8);
 
-    auto q = std::make_shared<query_send_messages>(*this, E, callback);
+    auto q = make_query<query_send_messages>(*this, E, callback);
     q->out_i32(CODE_messages_send_media);
     int f = 0;
     if (post_as_channel_message) {
@@ -1169,7 +1319,7 @@ void user_agent::send_location(const tgl_input_peer_t& peer_id, double latitude,
         std::shared_ptr<messages_send_extra> E = std::make_shared<messages_send_extra>();
         tgl_secure_random(reinterpret_cast<unsigned char*>(&E->id), 8);
 
-        auto q = std::make_shared<query_send_messages>(*this, E, callback);
+        auto q = make_query<query_send_messages>(*this, E, callback);
         q->out_i32(CODE_messages_send_media);
         unsigned f = reply_id ? 1 : 0;
         if (post_as_channel_message) {
@@ -1219,7 +1369,7 @@ void tgl_do_reply_location(tgl_message_id_t *_reply_id, double latitude, double
 void user_agent::rename_chat(const tgl_input_peer_t& id, const std::string& new_title,
                         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_edit_chat_title);
     assert(id.peer_type == tgl_peer_type::chat);
     q->out_i32(id.peer_id);
@@ -1230,7 +1380,7 @@ void user_agent::rename_chat(const tgl_input_peer_t& id, const std::string& new_
 void user_agent::rename_channel(const tgl_input_peer_t& id, const std::string& name,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_edit_title);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1242,7 +1392,7 @@ void user_agent::rename_channel(const tgl_input_peer_t& id, const std::string& n
 
 void user_agent::join_channel(const tgl_input_peer_t& id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_join_channel);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1253,7 +1403,7 @@ void user_agent::join_channel(const tgl_input_peer_t& id, const std::function<vo
 
 void user_agent::leave_channel(const tgl_input_peer_t& id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_leave_channel);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1266,7 +1416,7 @@ void user_agent::delete_channel(const tgl_input_peer_t& channel_id, const std::f
 {
     std::shared_ptr<messages_send_extra> extra = std::make_shared<messages_send_extra>();
     extra->multi = true;
-    auto q = std::make_shared<query_send_messages>(*this, extra, [=](bool success, const std::vector<std::shared_ptr<tgl_message>>&) {
+    auto q = make_query<query_send_messages>(*this, extra, [=](bool success, const std::vector<std::shared_ptr<tgl_message>>&) {
         if (callback) {
             callback(success);
         }
@@ -1283,7 +1433,7 @@ void user_agent::channel_edit_title(const tgl_input_peer_t& channel_id,
         const std::string& title,
         const std::function<void(bool success)>& callback)
 {
-     auto q = std::make_shared<query_send_messages>(*this, callback);
+     auto q = make_query<query_send_messages>(*this, callback);
      q->out_i32(CODE_channels_edit_title);
      assert(channel_id.peer_type == tgl_peer_type::channel);
      q->out_i32(CODE_input_channel);
@@ -1296,7 +1446,7 @@ void user_agent::channel_edit_title(const tgl_input_peer_t& channel_id,
 void user_agent::channel_set_about(const tgl_input_peer_t& id, const std::string& about,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_channels_set_about>(*this, callback);
+    auto q = make_query<query_channels_set_about>(*this, callback);
     q->out_i32(CODE_channels_edit_about);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1309,7 +1459,7 @@ void user_agent::channel_set_about(const tgl_input_peer_t& id, const std::string
 void user_agent::channel_set_username(const tgl_input_peer_t& id, const std::string& username,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_channels_set_about>(*this, callback);
+    auto q = make_query<query_channels_set_about>(*this, callback);
     q->out_i32(CODE_channels_update_username);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1322,7 +1472,7 @@ void user_agent::channel_set_username(const tgl_input_peer_t& id, const std::str
 void user_agent::channel_set_admin(const tgl_input_peer_t& channel_id, const tgl_input_peer_t& user_id, int type,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_edit_admin);
     assert(channel_id.peer_type == tgl_peer_type::channel);
     assert(user_id.peer_type == tgl_peer_type::user);
@@ -1355,13 +1505,13 @@ void user_agent::get_channel_participants(const tgl_input_peer_t& channel_id, in
     state->channel_id = channel_id;
     state->limit = limit;
     state->offset = offset;
-    auto q = std::make_shared<query_channels_get_participants>(*this, state, callback);
+    auto q = make_query<query_channels_get_participants>(*this, state, callback);
     q->execute(active_client());
 }
 
 void user_agent::get_channel_participant_self(const tgl_input_peer_t& channel_id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_channel_get_participant>(*this, channel_id.peer_id, callback);
+    auto q = make_query<query_channel_get_participant>(*this, channel_id.peer_id, callback);
     q->out_i32(CODE_channels_get_participant);
     q->out_i32(CODE_input_channel);
     q->out_i32(channel_id.peer_id);
@@ -1372,7 +1522,7 @@ void user_agent::get_channel_participant_self(const tgl_input_peer_t& channel_id
 
 void user_agent::get_chat_info(int32_t id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_get_chat_info>(*this, callback);
+    auto q = make_query<query_get_chat_info>(*this, callback);
     q->out_i32(CODE_messages_get_full_chat);
     q->out_i32(id);
     q->execute(active_client());
@@ -1381,7 +1531,7 @@ void user_agent::get_chat_info(int32_t id, const std::function<void(bool success
 void user_agent::get_channel_info(const tgl_input_peer_t& id,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_get_channel_info>(*this, callback);
+    auto q = make_query<query_get_channel_info>(*this, callback);
     q->out_i32(CODE_channels_get_full_channel);
     assert(id.peer_type == tgl_peer_type::channel);
     q->out_i32(CODE_input_channel);
@@ -1400,7 +1550,7 @@ void user_agent::get_user_info(const tgl_input_peer_t& id, const std::function<v
         return;
     }
 
-    auto q = std::make_shared<query_user_info>(*this, callback);
+    auto q = make_query<query_user_info>(*this, callback);
     q->out_i32(CODE_users_get_full_user);
     assert(id.peer_type == tgl_peer_type::user);
     q->out_i32(CODE_input_user);
@@ -1412,7 +1562,7 @@ void user_agent::get_user_info(const tgl_input_peer_t& id, const std::function<v
 void user_agent::add_contacts(const std::vector<std::tuple<std::string, std::string, std::string>>& contacts, bool replace,
         const std::function<void(bool success, const std::vector<int32_t>& user_ids)>& callback)
 {
-    auto q = std::make_shared<query_add_contacts>(*this, callback);
+    auto q = make_query<query_add_contacts>(*this, callback);
     q->out_i32(CODE_contacts_import_contacts);
     q->out_i32(CODE_vector);
     q->out_i32(contacts.size());
@@ -1447,7 +1597,7 @@ void user_agent::delete_contact(const tgl_input_peer_t& id, const std::function<
 
     std::weak_ptr<user_agent> weak_ua = shared_from_this();
     int32_t user_id = id.peer_id;
-    auto q = std::make_shared<query_delete_contact>(*this, [=](bool success) {
+    auto q = make_query<query_delete_contact>(*this, [=](bool success) {
         if (success) {
             if (auto ua = weak_ua.lock()) {
                 ua->callback()->user_deleted(user_id);
@@ -1474,7 +1624,7 @@ void user_agent::search_message(const tgl_input_peer_t& id, int from, int to, in
         return;
     }
     auto state = std::make_shared<message_search_state>(id, from, to, limit, offset, query);
-    auto q = std::make_shared<query_search_message>(*this, state, callback);
+    auto q = make_query<query_search_message>(*this, state, callback);
     q->execute(active_client());
 }
 
@@ -1483,7 +1633,7 @@ void user_agent::lookup_state()
     if (is_diff_locked()) {
         return;
     }
-    auto q = std::make_shared<query_lookup_state>(*this, nullptr);
+    auto q = make_query<query_lookup_state>(*this, nullptr);
     q->out_header();
     q->out_i32(CODE_updates_get_state);
     q->execute(active_client());
@@ -1505,7 +1655,7 @@ void user_agent::get_difference(bool sync_from_start, const std::function<void(b
         if (date() == 0) {
             set_date(1, true);
         }
-        auto q = std::make_shared<query_get_difference>(*this, callback);
+        auto q = make_query<query_get_difference>(*this, callback);
         q->out_header();
         q->out_i32(CODE_updates_get_difference);
         q->out_i32(pts());
@@ -1513,7 +1663,7 @@ void user_agent::get_difference(bool sync_from_start, const std::function<void(b
         q->out_i32(qts());
         q->execute(active_client());
     } else {
-        auto q = std::make_shared<query_get_state>(*this, callback);
+        auto q = make_query<query_get_state>(*this, callback);
         q->out_header();
         q->out_i32(CODE_updates_get_state);
         q->execute(active_client());
@@ -1542,7 +1692,7 @@ void user_agent::get_channel_difference(const tgl_input_peer_t& channel_id,
     }
     c->set_diff_locked(true);
 
-    auto q = std::make_shared<query_get_channel_difference>(*this, c, callback);
+    auto q = make_query<query_get_channel_difference>(*this, c, callback);
     q->out_header();
     q->out_i32(CODE_updates_get_channel_difference);
     q->out_i32(CODE_input_channel);
@@ -1556,7 +1706,7 @@ void user_agent::get_channel_difference(const tgl_input_peer_t& channel_id,
 
 void user_agent::add_user_to_chat(const tgl_peer_id_t& chat_id, const tgl_input_peer_t& user_id, int32_t limit,
         const std::function<void(bool success)>& callback) {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_add_chat_user);
     q->out_i32(chat_id.peer_id);
 
@@ -1572,7 +1722,7 @@ void user_agent::add_user_to_chat(const tgl_peer_id_t& chat_id, const tgl_input_
 void user_agent::delete_user_from_chat(int32_t chat_id, const tgl_input_peer_t& user_id,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_delete_chat_user);
     q->out_i32(chat_id);
 
@@ -1598,7 +1748,7 @@ void user_agent::channel_invite_user(const tgl_input_peer_t& channel_id, const s
         return;
     }
 
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_invite_to_channel);
     q->out_i32(CODE_input_channel);
     q->out_i32(channel_id.peer_id);
@@ -1619,7 +1769,7 @@ void user_agent::channel_invite_user(const tgl_input_peer_t& channel_id, const s
 void user_agent::channel_delete_user(const tgl_input_peer_t& channel_id, const tgl_input_peer_t& user_id,
     const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_channels_kick_from_channel);
     q->out_i32(CODE_input_channel);
     q->out_i32(channel_id.peer_id);
@@ -1637,7 +1787,7 @@ void user_agent::channel_delete_user(const tgl_input_peer_t& channel_id, const t
 void user_agent::create_group_chat(const std::vector<tgl_input_peer_t>& user_ids, const std::string& chat_topic,
         const std::function<void(int32_t chat_id)>& callback)
 {
-    auto q = std::make_shared<query_create_chat>(*this, callback);
+    auto q = make_query<query_create_chat>(*this, callback);
     q->out_i32(CODE_messages_create_chat);
     q->out_i32(CODE_vector);
     q->out_i32(user_ids.size()); // Number of users, currently we support only 1 user.
@@ -1670,7 +1820,7 @@ void user_agent::create_channel(const std::string& topic, const std::string& abo
     if (mega_group) {
         flags |= 2;
     }
-    auto q = std::make_shared<query_create_chat>(*this, callback, true);
+    auto q = make_query<query_create_chat>(*this, callback, true);
     q->out_i32(CODE_channels_create_channel);
     q->out_i32(flags);
     q->out_std_string(topic);
@@ -1702,7 +1852,7 @@ void user_agent::delete_message(const tgl_input_peer_t& chat, int64_t message_id
         }
         return;
     }
-    auto q = std::make_shared<query_delete_message>(*this, chat, message_id, callback);
+    auto q = make_query<query_delete_message>(*this, chat, message_id, callback);
     if (chat.peer_type == tgl_peer_type::channel) {
         q->out_i32(CODE_channels_delete_messages);
         q->out_i32(CODE_input_channel);
@@ -1724,7 +1874,7 @@ void user_agent::delete_message(const tgl_input_peer_t& chat, int64_t message_id
 
 void user_agent::export_card(const std::function<void(bool success, const std::vector<int>& card)>& callback)
 {
-    auto q = std::make_shared<query_export_card>(*this, callback);
+    auto q = make_query<query_export_card>(*this, callback);
     q->out_i32(CODE_contacts_export_card);
     q->execute(active_client());
 }
@@ -1732,7 +1882,7 @@ void user_agent::export_card(const std::function<void(bool success, const std::v
 void user_agent::import_card(int size, int* card,
         const std::function<void(bool success, const std::shared_ptr<tgl_user>& user)>& callback)
 {
-    auto q = std::make_shared<query_import_card>(*this, callback);
+    auto q = make_query<query_import_card>(*this, callback);
     q->out_i32(CODE_contacts_import_card);
     q->out_i32(CODE_vector);
     q->out_i32(size);
@@ -1743,7 +1893,7 @@ void user_agent::import_card(int size, int* card,
 void user_agent::start_bot(const tgl_input_peer_t& bot, const tgl_peer_id_t& chat,
         const std::string& name, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_start_bot);
     q->out_i32(CODE_input_user);
     q->out_i32(bot.peer_id);
@@ -1763,7 +1913,7 @@ void user_agent::send_typing_status(const tgl_input_peer_t& id, tgl_typing_statu
         const std::function<void(bool success)>& callback)
 {
     if (id.peer_type != tgl_peer_type::enc_chat) {
-        auto q = std::make_shared<query_send_typing_status>(*this, callback);
+        auto q = make_query<query_send_typing_status>(*this, callback);
         q->out_i32(CODE_messages_set_typing);
         q->out_input_peer(id);
         switch (status) {
@@ -1814,7 +1964,7 @@ void user_agent::send_typing_status(const tgl_input_peer_t& id, tgl_typing_statu
 void user_agent::get_message(int64_t message_id,
         const std::function<void(bool success, const std::shared_ptr<tgl_message>&)>& callback)
 {
-    auto q = std::make_shared<query_get_messages>(*this, callback);
+    auto q = make_query<query_get_messages>(*this, callback);
     q->out_i32(CODE_messages_get_messages);
     q->out_i32(CODE_vector);
     q->out_i32(1);
@@ -1832,7 +1982,7 @@ void user_agent::export_chat_link(const tgl_peer_id_t& id, const std::function<v
         return;
     }
 
-    auto q = std::make_shared<query_export_chat_link>(*this, callback);
+    auto q = make_query<query_export_chat_link>(*this, callback);
     q->out_i32(CODE_messages_export_chat_invite);
     q->out_i32(id.peer_id);
 
@@ -1849,7 +1999,7 @@ void user_agent::import_chat_link(const std::string& link,
     }
     l++;
 
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_import_chat_invite);
     q->out_string(l, link.size() - (l - link_str));
 
@@ -1867,7 +2017,7 @@ void user_agent::export_channel_link(const tgl_input_peer_t& id,
         return;
     }
 
-    auto q = std::make_shared<query_export_chat_link>(*this, callback);
+    auto q = make_query<query_export_chat_link>(*this, callback);
     q->out_i32(CODE_channels_export_invite);
     q->out_i32(CODE_input_channel);
     q->out_i32(id.peer_id);
@@ -1877,7 +2027,7 @@ void user_agent::export_channel_link(const tgl_input_peer_t& id,
 
 void user_agent::update_password_settings(const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_get_and_set_password>(*this, callback);
+    auto q = make_query<query_get_and_set_password>(*this, callback);
     q->out_i32(CODE_account_get_password);
     q->execute(active_client());
 }
@@ -1899,7 +2049,7 @@ void user_agent::password_got(const std::string& current_salt, const std::string
         return;
     }
 
-    auto q = std::make_shared<query_check_password>(*this, callback);
+    auto q = make_query<query_check_password>(*this, callback);
     q->out_i32(CODE_auth_check_password);
 
     if (pwd && pwd_len && current_salt.size()) {
@@ -1918,7 +2068,7 @@ void user_agent::password_got(const std::string& current_salt, const std::string
 void user_agent::check_password(const std::function<void(bool success)>& callback)
 {
     std::weak_ptr<user_agent> weak_ua = shared_from_this();
-    auto q = std::make_shared<query_get_and_check_password>(*this, [weak_ua, callback](const tl_ds_account_password* DS_AP) {
+    auto q = make_query<query_get_and_check_password>(*this, [weak_ua, callback](const tl_ds_account_password* DS_AP) {
         auto ua = weak_ua.lock();
         if (!ua || !DS_AP) {
             if (ua) {
@@ -1980,7 +2130,7 @@ void user_agent::send_broadcast(const std::vector<tgl_input_peer_t>& peers, cons
         m_callback->new_messages({m});
     }
 
-    auto q = std::make_shared<query_send_messages>(*this, E, callback);
+    auto q = make_query<query_send_messages>(*this, E, callback);
     q->out_i32(CODE_messages_send_broadcast);
     q->out_i32(CODE_vector);
     q->out_i32(peers.size());
@@ -2014,7 +2164,7 @@ void user_agent::block_user(const tgl_input_peer_t& id, const std::function<void
         return;
     }
 
-    auto q = std::make_shared<query_block_or_unblock_user>(*this, callback);
+    auto q = make_query<query_block_or_unblock_user>(*this, callback);
     q->out_i32(CODE_contacts_block);
     q->out_i32(CODE_input_user);
     q->out_i32(id.peer_id);
@@ -2032,7 +2182,7 @@ void user_agent::unblock_user(const tgl_input_peer_t& id, const std::function<vo
         return;
     }
 
-    auto q = std::make_shared<query_block_or_unblock_user>(*this, callback);
+    auto q = make_query<query_block_or_unblock_user>(*this, callback);
     q->out_i32(CODE_contacts_unblock);
     q->out_i32(CODE_input_user);
     q->out_i32(id.peer_id);
@@ -2042,7 +2192,7 @@ void user_agent::unblock_user(const tgl_input_peer_t& id, const std::function<vo
 
 void user_agent::get_blocked_users(const std::function<void(std::vector<int32_t>)>& callback)
 {
-    auto q = std::make_shared<query_get_blocked_users>(*this, callback);
+    auto q = make_query<query_get_blocked_users>(*this, callback);
     q->out_i32(CODE_contacts_get_blocked);
     q->out_i32(0);
     q->out_i32(0);
@@ -2053,7 +2203,7 @@ void user_agent::update_notify_settings(const tgl_input_peer_t& peer_id,
         int32_t mute_until, const std::string& sound, bool show_previews, int32_t mask,
         const std::function<void(bool)>& callback)
 {
-    auto q = std::make_shared<query_update_notify_settings>(*this, callback);
+    auto q = make_query<query_update_notify_settings>(*this, callback);
     q->out_i32(CODE_account_update_notify_settings);
     q->out_i32(CODE_input_notify_peer);
     q->out_input_peer(peer_id);
@@ -2069,7 +2219,7 @@ void user_agent::update_notify_settings(const tgl_input_peer_t& peer_id,
 void user_agent::get_notify_settings(const tgl_input_peer_t &peer_id,
         const std::function<void(bool, int32_t mute_until)>& callback)
 {
-    auto q = std::make_shared<query_get_notify_settings>(*this, callback);
+    auto q = make_query<query_get_notify_settings>(*this, callback);
     q->out_i32(CODE_account_get_notify_settings);
     q->out_i32(CODE_input_notify_peer);
     q->out_input_peer(peer_id);
@@ -2078,7 +2228,7 @@ void user_agent::get_notify_settings(const tgl_input_peer_t &peer_id,
 
 void user_agent::get_terms_of_service(const std::function<void(bool success, const std::string& tos)>& callback)
 {
-    auto q = std::make_shared<query_get_tos>(*this, callback);
+    auto q = make_query<query_get_tos>(*this, callback);
     q->out_i32(CODE_help_get_terms_of_service);
     q->out_string("");
     q->execute(active_client());
@@ -2095,7 +2245,7 @@ void user_agent::register_device(int32_t token_type, const std::string& token,
     m_device_token_type = token_type;
     m_device_token = token;
 
-    auto q = std::make_shared<query_register_device>(*this, callback);
+    auto q = make_query<query_register_device>(*this, callback);
     q->out_i32(CODE_account_register_device);
     q->out_i32(token_type);
     q->out_std_string(token);
@@ -2110,7 +2260,7 @@ void user_agent::register_device(int32_t token_type, const std::string& token,
 void user_agent::unregister_device(int32_t token_type, const std::string& token,
         const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_unregister_device>(*this, callback);
+    auto q = make_query<query_unregister_device>(*this, callback);
     q->out_i32(CODE_account_unregister_device);
     q->out_i32(token_type);
     q->out_std_string(token);
@@ -2119,7 +2269,7 @@ void user_agent::unregister_device(int32_t token_type, const std::string& token,
 
 void user_agent::upgrade_group(const tgl_peer_id_t& id, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_messages>(*this, callback);
+    auto q = make_query<query_send_messages>(*this, callback);
     q->out_i32(CODE_messages_migrate_chat);
     q->out_i32(id.peer_id);
     q->execute(active_client());
@@ -2157,6 +2307,7 @@ void user_agent::set_client_logged_out(const std::shared_ptr<mtproto_client>& fr
         }
         client->set_logged_in(false);
     }
+    clear_media_clients();
     clear_all_locks();
 
     // Upon de-authorization, the event queue of the
@@ -2167,7 +2318,7 @@ void user_agent::set_client_logged_out(const std::shared_ptr<mtproto_client>& fr
 
 void user_agent::update_status(bool online, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_update_status>(*this, callback);
+    auto q = make_query<query_update_status>(*this, callback);
     q->out_i32(CODE_account_update_status);
     q->out_i32(online ? CODE_bool_false : CODE_bool_true);
     q->execute(active_client());
@@ -2257,7 +2408,7 @@ void user_agent::sign_up_code(const std::string& phone, const std::string& hash,
         return;
     }
 
-    auto q = std::make_shared<query_sign_in>(*this, [weak_ua, try_again](bool success, const std::shared_ptr<user>&) {
+    auto q = make_query<query_sign_in>(*this, [weak_ua, try_again](bool success, const std::shared_ptr<user>&) {
         auto ua = weak_ua.lock();
         if (!ua) {
             TGL_ERROR("the user agent has gone");
@@ -2394,14 +2545,14 @@ void user_agent::login()
 
 void user_agent::set_phone_number(const std::string& phone_number, const std::function<void(bool success)>& callback)
 {
-    auto q = std::make_shared<query_send_change_code>(*this, phone_number, callback);
+    auto q = make_query<query_send_change_code>(*this, phone_number, callback);
     q->execute(active_client());
 }
 
 
 void user_agent::get_privacy_rules(std::function<void(bool, const std::vector<std::pair<tgl_privacy_rule, const std::vector<int32_t>>>&)> callback)
 {
-    auto q = std::make_shared<query_get_privacy_rules>(*this, callback);
+    auto q = make_query<query_get_privacy_rules>(*this, callback);
     q->out_i32(CODE_account_get_privacy);
     q->out_i32(CODE_input_privacy_key_status_timestamp);
     q->execute(active_client());
@@ -2410,7 +2561,7 @@ void user_agent::get_privacy_rules(std::function<void(bool, const std::vector<st
 void user_agent::send_inline_query_to_bot(const tgl_input_peer_t& bot, const std::string& query,
         const std::function<void(bool success, const std::string& response)>& callback)
 {
-    auto q = std::make_shared<query_send_inline_query_to_bot>(*this, callback);
+    auto q = make_query<query_send_inline_query_to_bot>(*this, callback);
     q->out_i32(CODE_messages_get_inline_bot_results);
     q->out_input_peer(bot);
     q->out_std_string(query);
@@ -2484,7 +2635,7 @@ void user_agent::send_accept_encr_chat(const std::shared_ptr<secret_chat>& sc,
     check_crypto_result(TGLC_bn_mod_exp(r.get(), g_a.get(), b.get(), p, bn_ctx()->ctx));
     TGLC_bn_bn2bin(r.get(), buffer + (256 - TGLC_bn_num_bytes(r.get())));
 
-    auto q = std::make_shared<query_messages_accept_encryption>(*this, sc, callback);
+    auto q = make_query<query_messages_accept_encryption>(*this, sc, callback);
     q->out_i32(CODE_messages_accept_encryption);
     q->out_i32(CODE_input_encrypted_chat);
     q->out_i32(sc->id().peer_id);
@@ -2525,7 +2676,7 @@ void user_agent::send_create_encr_chat(const tgl_input_peer_t& user_id,
     sc->set_state(tgl_secret_chat_state::waiting);
     m_callback->secret_chat_update(sc);
 
-    auto q = std::make_shared<query_messages_request_encryption>(*this, sc, callback);
+    auto q = make_query<query_messages_request_encryption>(*this, sc, callback);
     q->out_i32(CODE_messages_request_encryption);
     q->out_i32(CODE_input_user);
     q->out_i32(user_id.peer_id);
@@ -2546,7 +2697,7 @@ void user_agent::discard_secret_chat(const tgl_input_peer_t& chat_id,
         return;
     }
 
-    auto q = std::make_shared<query_messages_discard_encryption>(*this, sc, callback);
+    auto q = make_query<query_messages_discard_encryption>(*this, sc, callback);
     q->out_i32(CODE_messages_discard_encryption);
     q->out_i32(sc->id().peer_id);
 
@@ -2565,7 +2716,7 @@ void user_agent::accept_encr_chat_request(const tgl_input_peer_t& chat_id,
     }
 
     std::weak_ptr<user_agent> weak_ua = shared_from_this();
-    auto q = std::make_shared<query_messages_get_dh_config>(*this, sc,
+    auto q = make_query<query_messages_get_dh_config>(*this, sc,
             [weak_ua](const std::shared_ptr<secret_chat>& sc,
                     std::array<unsigned char, 256>& random,
                     const std::function<void(bool, const std::shared_ptr<secret_chat>&)>& cb)
@@ -2599,7 +2750,7 @@ void user_agent::create_secret_chat(const tgl_input_peer_t& user_id, int32_t new
     }
 
     std::weak_ptr<user_agent> weak_ua = shared_from_this();
-    auto q = std::make_shared<query_messages_get_dh_config>(*this, sc,
+    auto q = make_query<query_messages_get_dh_config>(*this, sc,
             [weak_ua, user_id](const std::shared_ptr<secret_chat>& sc,
                     std::array<unsigned char, 256>& random,
                     const std::function<void(bool, const std::shared_ptr<secret_chat>&)>& cb)
@@ -2622,22 +2773,22 @@ void user_agent::create_secret_chat(const tgl_input_peer_t& user_id, int32_t new
 
 void user_agent::bytes_sent(size_t bytes)
 {
-    m_bytes_sent += bytes;
+    m_net_stats.bytes_sent += bytes;
 }
 
 void user_agent::bytes_received(size_t bytes)
 {
-    m_bytes_received += bytes;
+    m_net_stats.bytes_received += bytes;
 }
 
 tgl_net_stats user_agent::get_net_stats(bool reset_after_get)
 {
-    tgl_net_stats stats;
-    stats.bytes_sent = m_bytes_sent;
-    stats.bytes_received = m_bytes_received;
+    tgl_net_stats stats = m_net_stats;
+    stats.inflate_high_water_mark = m_inflate_arena.high_water_mark();
+    stats.inflate_buffer_reuses = m_inflate_arena.reuse_count();
     if (reset_after_get) {
-        m_bytes_sent = 0;
-        m_bytes_received = 0;
+        m_net_stats = tgl_net_stats();
+        m_inflate_arena.reset_reuse_count();
     }
     return stats;
 }
@@ -21,6 +21,10 @@
 #pragma once
 
 #include "chat.h"
+#include "crypto/crypto_bn.h"
+#include "deflate_packer.h"
+#include "inflate_arena.h"
+#include "query/active_query_table.h"
 #include "tgl/tgl_connection_status.h"
 #include "tgl/tgl_online_status.h"
 #include "tgl/tgl_peer_id.h"
@@ -36,6 +40,7 @@
 #include <set>
 #include <stdlib.h>
 #include <string.h>
+#include <unordered_set>
 #include <vector>
 
 class tgl_timer;
@@ -82,6 +87,9 @@ public:
     virtual std::shared_ptr<tgl_dc> active_dc() const override;
 
     virtual void set_dc_auth_key(int dc_id, const char* key, size_t key_length) override; 
+    virtual void add_validated_dh_prime(const std::string& fingerprint) override;
+    virtual std::string session_snapshot() const override;
+    virtual void resume_sessions(const std::string& snapshot) override;
     virtual void set_dc_option(bool is_v6, int id, const std::string& ip, int port) override;
     virtual void set_dc_logged_in(int dc_id) override { set_dc_logged_in(dc_id, true); }
     virtual void set_active_dc(int dc_id) override;
@@ -97,6 +105,10 @@ public:
     virtual bool test_mode() const override { return m_test_mode; }
     virtual void set_pfs_enabled(bool b) override { m_pfs_enabled = b; }
     virtual void set_ipv6_enabled(bool b) override { m_ipv6_enabled = b; }
+    virtual void set_transport(tgl_transport transport) override { m_transport = transport; }
+    virtual void set_dc_transport(int dc_id, tgl_transport transport) override { m_dc_transports[dc_id] = transport; }
+    virtual void set_compression_threshold(size_t bytes) override { m_compression_threshold = bytes; }
+    virtual void set_media_sessions_enabled(bool enabled) override;
 
     virtual void reset_authorization() override;
     virtual void add_rsa_key(const std::string& key) override;
@@ -267,6 +279,12 @@ public:
 
     bool pfs_enabled() const { return m_pfs_enabled; }
     bool ipv6_enabled() const { return m_ipv6_enabled; }
+    tgl_transport transport(int dc_id) const
+    {
+        auto it = m_dc_transports.find(dc_id);
+        return it != m_dc_transports.end() ? it->second : m_transport;
+    }
+    size_t compression_threshold() const { return m_compression_threshold; }
 
     const std::shared_ptr<tgl_update_callback>& callback() const { return m_callback; }
     const std::shared_ptr<tgl_connection_factory>& connection_factory() const { return m_connection_factory; }
@@ -281,9 +299,18 @@ public:
     const std::vector<std::shared_ptr<mtproto_client>>& clients() const { return m_clients; }
     std::shared_ptr<mtproto_client> active_client() const { return m_active_client; }
     std::shared_ptr<mtproto_client> client_at(int id) const;
+    // The client file transfers with DC id should use: its media client once the
+    // main client is logged in and has a bound temporary key, the main client
+    // until then.
+    std::shared_ptr<mtproto_client> media_client(int id);
+    // The media client of DC id if media_client() created one, null otherwise.
+    std::shared_ptr<mtproto_client> existing_media_client(int id) const;
     int temp_key_expire_time() const { return m_temp_key_expire_time; }
 
     const tgl_bn_context* bn_ctx() const { return m_bn_ctx.get(); }
+    // tglmp_check_DH_params() that only runs the primality tests for primes it
+    // has not validated before.
+    bool check_dh_params(TGLC_bn* p, int g);
 
     void set_seq(int32_t seq);
     int32_t seq() const { return m_seq; }
@@ -319,6 +346,9 @@ public:
 
     void bytes_sent(size_t bytes);
     void bytes_received(size_t bytes);
+    tgl_net_stats& net_stats() { return m_net_stats; }
+    inflate_arena& inflater() { return m_inflate_arena; }
+    deflate_packer& deflater() { return m_deflater; }
 
     void user_fetched(const std::shared_ptr<user>& u);
     void chat_fetched(const std::shared_ptr<chat>& c);
@@ -326,6 +356,7 @@ public:
 private:
     void state_lookup_timeout();
     std::shared_ptr<mtproto_client> allocate_client(int id);
+    void clear_media_clients();
     void sign_in();
     void signed_in();
     void export_all_auth();
@@ -372,13 +403,18 @@ private:
     int32_t m_app_id;
     int32_t m_temp_key_expire_time;
 
-    uint64_t m_bytes_sent;
-    uint64_t m_bytes_received;
+    tgl_net_stats m_net_stats;
+    inflate_arena m_inflate_arena;
+    deflate_packer m_deflater;
 
     bool m_is_started;
     bool m_test_mode;
     bool m_pfs_enabled;
     bool m_ipv6_enabled;
+    tgl_transport m_transport;
+    std::map<int, tgl_transport> m_dc_transports;
+    size_t m_compression_threshold;
+    bool m_media_sessions_enabled;
     bool m_diff_locked;
     bool m_password_locked;
     bool m_phone_number_input_locked;
@@ -404,10 +440,13 @@ private:
     std::unique_ptr<class updater> m_updater;
 
     std::vector<std::shared_ptr<mtproto_client>> m_clients;
+    std::vector<std::shared_ptr<mtproto_client>> m_media_clients;
     std::vector<std::shared_ptr<rsa_public_key>> m_rsa_keys;
     std::map<int32_t/*peer id*/, std::shared_ptr<secret_chat>> m_secret_chats;
-    std::map<int64_t/*msg_id*/, std::shared_ptr<query>> m_active_queries;
-    std::set<std::shared_ptr<query>> m_retry_queries;
+    active_query_table m_active_queries;
+    std::unordered_set<std::shared_ptr<query>> m_retry_queries;
+    // SHA-256 of the DH primes that passed the primality tests.
+    std::unordered_set<std::string> m_validated_dh_primes;
     std::set<std::weak_ptr<tgl_online_status_observer>, std::owner_less<std::weak_ptr<tgl_online_status_observer>>> m_online_status_observers;
 };
 